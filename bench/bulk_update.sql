@@ -0,0 +1,3 @@
+-- Update 1000 consecutive rows at once.
+\set id random(1, :rows - 1000)
+UPDATE :table SET n = n + 1 WHERE id BETWEEN :id AND :id + 999;
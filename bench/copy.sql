@@ -0,0 +1,3 @@
+-- Load 1000 rows with COPY. The file is created by run.sh and must be
+-- readable by the server.
+COPY :table (id) FROM ':copy_file';
@@ -0,0 +1,4 @@
+-- Delete a single row, every transaction deletes the next one. Once all the
+-- rows are deleted, the transactions delete nothing, so the table must have
+-- more rows than the run may delete.
+DELETE FROM :table WHERE id = (SELECT nextval(':table_seq'));
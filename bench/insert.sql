@@ -0,0 +1,2 @@
+-- Insert a single row.
+INSERT INTO :table (id) VALUES (nextval(':table_seq'));
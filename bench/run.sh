@@ -0,0 +1,124 @@
+#!/bin/sh
+#
+# temporal_tables/bench/run.sh
+#
+# Measure the overhead of the versioning triggers. Every scenario is run with
+# pgbench against a plain table and a versioned table with the same columns.
+# One JSON object per scenario and table is written to the output file:
+#
+#   {"scenario": "update", "variant": "versioned", "clients": 4,
+#    "transactions": 123456, "tps": 4115.2, "latency_avg_ms": 0.971,
+#    "latency_p50_ms": 0.912, "latency_p95_ms": 1.420, "latency_p99_ms": 2.011,
+#    "wal_bytes_per_transaction": 412.3}
+#
+# The connection is set up with the usual libpq environment variables. The
+# following variables control the run:
+#
+#   PGBENCH    pgbench executable (default: pgbench)
+#   PSQL       psql executable (default: psql)
+#   ROWS       the number of rows in every table (default: 100000)
+#   CLIENTS    the number of pgbench clients (default: 4)
+#   DURATION   the duration of every run in seconds (default: 30)
+#   SCENARIOS  the scenarios to run (default: all of them)
+#   OUTPUT     the output file (default: bench_results.json)
+#
+# The COPY scenario reads a file on the server side, so the server must run on
+# the same host and the user must be allowed to read server files. Requires
+# PostgreSQL 10 or higher.
+
+set -e
+
+PGBENCH=${PGBENCH:-pgbench}
+PSQL=${PSQL:-psql}
+ROWS=${ROWS:-100000}
+CLIENTS=${CLIENTS:-4}
+DURATION=${DURATION:-30}
+SCENARIOS=${SCENARIOS:-"insert update delete bulk_update copy wide savepoints partitioned"}
+OUTPUT=${OUTPUT:-bench_results.json}
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+psql_value() {
+	"$PSQL" -X -A -t -q -c "$1"
+}
+
+# The script of every scenario.
+scenario_script() {
+	case "$1" in
+		insert)			echo insert.sql ;;
+		update)			echo update.sql ;;
+		delete)			echo delete.sql ;;
+		bulk_update)	echo bulk_update.sql ;;
+		copy)			echo copy.sql ;;
+		wide)			echo update.sql ;;
+		savepoints)		echo savepoints.sql ;;
+		partitioned)	echo update.sql ;;
+		*)				echo "unknown scenario: $1" >&2; exit 1 ;;
+	esac
+}
+
+# Print the given percentile of the latencies in a pgbench log in milliseconds.
+percentile() {
+	awk '{ print $3 }' "$1" | sort -n | awk -v p="$2" '
+		{ latencies[NR] = $1 }
+		END {
+			if (NR == 0) { print 0; exit }
+			i = int(NR * p / 100 + 0.5)
+			if (i < 1) i = 1
+			if (i > NR) i = NR
+			printf "%.3f", latencies[i] / 1000
+		}'
+}
+
+echo "Setting up tables with $ROWS rows" >&2
+PGOPTIONS="$PGOPTIONS -c bench.rows=$ROWS" \
+	"$PSQL" -X -q -f "$BENCH_DIR/setup.sql" >/dev/null
+
+# The rows loaded by the COPY scenario.
+seq 1 1000 > "$WORK_DIR/copy.data"
+chmod a+rx "$WORK_DIR"
+chmod a+r "$WORK_DIR/copy.data"
+
+: > "$OUTPUT"
+
+for scenario in $SCENARIOS; do
+	script=$(scenario_script "$scenario")
+
+	for variant in plain versioned; do
+		table="bench.bench_${variant}_${scenario}"
+
+		echo "Running $scenario on $variant table" >&2
+
+		psql_value "CHECKPOINT" >/dev/null
+		wal_start=$(psql_value "SELECT pg_current_wal_lsn()")
+
+		rm -f "$WORK_DIR"/pgbench_log.*
+
+		"$PGBENCH" -n -c "$CLIENTS" -j "$CLIENTS" -T "$DURATION" \
+			-D table="$table" -D table_seq="${table}_seq" \
+			-D rows="$ROWS" -D copy_file="$WORK_DIR/copy.data" \
+			--log --log-prefix="$WORK_DIR/pgbench_log" \
+			-f "$BENCH_DIR/$script" > "$WORK_DIR/pgbench.out"
+
+		wal_bytes=$(psql_value "SELECT pg_wal_lsn_diff(pg_current_wal_lsn(), '$wal_start')")
+
+		cat "$WORK_DIR"/pgbench_log.* > "$WORK_DIR/latencies"
+
+		transactions=$(sed -n 's/^number of transactions actually processed: \([0-9]*\).*/\1/p' "$WORK_DIR/pgbench.out")
+		tps=$(sed -n 's/^tps = \([0-9.]*\).*/\1/p' "$WORK_DIR/pgbench.out" | tail -n 1)
+		latency_avg=$(sed -n 's/^latency average = \([0-9.]*\) ms.*/\1/p' "$WORK_DIR/pgbench.out")
+
+		printf '{"scenario": "%s", "variant": "%s", "clients": %s, "transactions": %s, "tps": %s, "latency_avg_ms": %s, "latency_p50_ms": %s, "latency_p95_ms": %s, "latency_p99_ms": %s, "wal_bytes_per_transaction": %s}\n' \
+			"$scenario" "$variant" "$CLIENTS" "$transactions" "$tps" \
+			"$latency_avg" \
+			"$(percentile "$WORK_DIR/latencies" 50)" \
+			"$(percentile "$WORK_DIR/latencies" 95)" \
+			"$(percentile "$WORK_DIR/latencies" 99)" \
+			"$(awk -v w="$wal_bytes" -v t="$transactions" 'BEGIN { printf "%.1f", t > 0 ? w / t : 0 }')" \
+			>> "$OUTPUT"
+	done
+done
+
+echo "Results are written to $OUTPUT" >&2
@@ -0,0 +1,46 @@
+-- Update a row in each of 20 nested savepoints to stress the stack of
+-- temporal contexts.
+\set id random(1, :rows)
+BEGIN;
+SAVEPOINT s1;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s2;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s3;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s4;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s5;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s6;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s7;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s8;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s9;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s10;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s11;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s12;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s13;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s14;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s15;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s16;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s17;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s18;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s19;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+SAVEPOINT s20;
+UPDATE :table SET n = n + 1 WHERE id = :id;
+RELEASE SAVEPOINT s1;
+COMMIT;
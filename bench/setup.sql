@@ -0,0 +1,97 @@
+-- temporal_tables/bench/setup.sql
+--
+-- Create the tables used by the benchmark scripts. Every scenario has a plain
+-- table "bench_plain_<scenario>" and a versioned table
+-- "bench_versioned_<scenario>" with the same columns, so that the scripts can
+-- run against both of them.
+--
+-- The number of rows in the tables is taken from the bench.rows setting, e.g.
+-- PGOPTIONS="-c bench.rows=100000" psql -f setup.sql.
+
+\set ON_ERROR_STOP on
+
+SET client_min_messages = warning;
+
+CREATE EXTENSION IF NOT EXISTS temporal_tables;
+
+DROP SCHEMA IF EXISTS bench CASCADE;
+CREATE SCHEMA bench;
+
+SET search_path = bench, public;
+
+CREATE FUNCTION bench_create(scenario text, ncolumns int, partitioned bool)
+RETURNS void AS $$
+DECLARE
+  columns text := '';
+  variant text;
+  name text;
+BEGIN
+  FOR i IN 1..ncolumns LOOP
+    columns := columns || format(', c%s text DEFAULT %L', i, 'value ' || i);
+  END LOOP;
+
+  FOREACH variant IN ARRAY ARRAY['plain', 'versioned'] LOOP
+    name := format('bench_%s_%s', variant, scenario);
+
+    EXECUTE format('CREATE TABLE %I (id bigint PRIMARY KEY, n bigint NOT NULL DEFAULT 0%s, sys_period tstzrange NOT NULL DEFAULT tstzrange(current_timestamp, NULL))',
+                   name, columns);
+
+    IF partitioned THEN
+      EXECUTE format('CREATE TABLE %I (LIKE %I) PARTITION BY RANGE (upper(sys_period))',
+                     name || '_history', name);
+
+      -- Monthly partitions from a year ago to a year ahead.
+      FOR i IN -12..12 LOOP
+        EXECUTE format('CREATE TABLE %I PARTITION OF %I FOR VALUES FROM (%L) TO (%L)',
+                       name || '_history_' || (i + 12),
+                       name || '_history',
+                       date_trunc('month', now()) + i * interval '1 month',
+                       date_trunc('month', now()) + (i + 1) * interval '1 month');
+      END LOOP;
+    ELSE
+      EXECUTE format('CREATE TABLE %I (LIKE %I)', name || '_history', name);
+    END IF;
+
+    IF variant = 'versioned' THEN
+      EXECUTE format('CREATE TRIGGER versioning_trigger BEFORE INSERT OR UPDATE OR DELETE ON %I FOR EACH ROW EXECUTE PROCEDURE versioning(%L, %L, true)',
+                     name, 'sys_period', 'bench.' || name || '_history');
+    END IF;
+  END LOOP;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT bench_create('insert', 0, false);
+SELECT bench_create('update', 0, false);
+SELECT bench_create('delete', 0, false);
+SELECT bench_create('bulk_update', 0, false);
+SELECT bench_create('copy', 0, false);
+SELECT bench_create('wide', 120, false);
+SELECT bench_create('savepoints', 0, false);
+SELECT bench_create('partitioned', 0, true);
+
+-- COPY loads the same rows over and over again.
+ALTER TABLE bench_plain_copy DROP CONSTRAINT bench_plain_copy_pkey;
+ALTER TABLE bench_versioned_copy DROP CONSTRAINT bench_versioned_copy_pkey;
+
+-- Fill the tables that are updated and deleted from. The versioning triggers
+-- are not fired as the rows are inserted before them.
+DO $$
+DECLARE
+  t text;
+BEGIN
+  FOREACH t IN ARRAY ARRAY['update', 'delete', 'bulk_update', 'wide', 'savepoints', 'partitioned'] LOOP
+    EXECUTE format('ALTER TABLE bench_versioned_%s DISABLE TRIGGER versioning_trigger', t);
+    EXECUTE format('INSERT INTO bench_plain_%s (id) SELECT generate_series(1, %s)', t, current_setting('bench.rows'));
+    EXECUTE format('INSERT INTO bench_versioned_%s (id) SELECT generate_series(1, %s)', t, current_setting('bench.rows'));
+    EXECUTE format('ALTER TABLE bench_versioned_%s ENABLE TRIGGER versioning_trigger', t);
+  END LOOP;
+END;
+$$;
+
+CREATE SEQUENCE bench_plain_delete_seq;
+CREATE SEQUENCE bench_versioned_delete_seq;
+
+CREATE SEQUENCE bench_plain_insert_seq;
+CREATE SEQUENCE bench_versioned_insert_seq;
+
+VACUUM ANALYZE;
@@ -0,0 +1,3 @@
+-- Update a single random row.
+\set id random(1, :rows)
+UPDATE :table SET n = n + 1 WHERE id = :id;
@@ -0,0 +1,1052 @@
+/* -------------------------------------------------------------------------
+ *
+ * capture.c
+ *
+ * Copyright (c) 2012-2023 Vladislav Arkhipov <vlad@arkhipov.ru>
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+
+#include <limits.h>
+
+#if PG_VERSION_NUM >= 120000
+#include "access/relation.h"
+#else
+#include "access/heapam.h"
+#endif
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#if PG_VERSION_NUM >= 100000
+#include "replication/logical.h"
+#include "replication/output_plugin.h"
+#include "replication/reorderbuffer.h"
+#endif
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/json.h"
+#if PG_VERSION_NUM >= 100000
+#include "utils/jsonb.h"
+#endif
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#if PG_VERSION_NUM >= 100000
+#include "utils/pg_lsn.h"
+#endif
+#include "utils/rel.h"
+#include "utils/resowner.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+
+#include "temporal_tables.h"
+
+PGDLLEXPORT void temporal_tables_capture_main(Datum main_arg);
+
+#if PG_VERSION_NUM >= 170000
+// The tuples of ReorderBufferChange are no longer wrapped into
+// ReorderBufferTupleBuf in PostgreSQL 17.
+#define change_tuple(tuple) (tuple)
+#else
+#define change_tuple(tuple) ((tuple) != NULL ? &(tuple)->tuple : NULL)
+#endif
+
+#if PG_VERSION_NUM >= 140000
+#define txn_commit_time(txn) ((txn)->xact_time.commit_time)
+#else
+#define txn_commit_time(txn) ((txn)->commit_time)
+#endif
+
+/* The line the output plugin writes after the rows of a transaction. */
+#define CAPTURE_COMMIT_LINE		"COMMIT"
+
+#if PG_VERSION_NUM >= 100000
+/* A system period lower bound of a row written by the decoded transaction. */
+typedef struct CapturedLower
+{
+	Oid				relid;
+	TimestampTz		lower;
+} CapturedLower;
+
+/* The state of the output plugin. */
+typedef struct CaptureState
+{
+	MemoryContext	change_context;		/* reset after every change */
+	MemoryContext	txn_context;		/* reset before every transaction */
+
+	/*
+	 * The lower bounds of the rows written by the decoded transaction or NULL
+	 * if it has written none yet. The old versions of these rows are not
+	 * archived, the same way the trigger does not archive the rows modified
+	 * in the current transaction.
+	 */
+	HTAB		   *lowers;
+
+	/*
+	 * The upper bound of the system period of the deleted rows taken from the
+	 * last logical message of the transaction, see log_captured_delete_time.
+	 */
+	bool			delete_time_set;
+	TimestampTz		delete_time;
+
+	/* true if a row of the decoded transaction was written out */
+	bool			emitted;
+} CaptureState;
+
+/* The database the capture worker connects to. */
+static char *capture_database = NULL;
+
+/* The logical replication slot the capture worker consumes. */
+static char *capture_slot = NULL;
+
+/* The time to sleep between capture rounds in ms. */
+static int capture_naptime = 1000;
+
+/* The maximum number of changes archived in a transaction. */
+static int capture_batch_size = 10000;
+
+static volatile sig_atomic_t got_sighup = false;
+
+static void capture_startup(LogicalDecodingContext *ctx,
+							OutputPluginOptions *opt,
+							bool is_init);
+static void capture_begin(LogicalDecodingContext *ctx,
+						  ReorderBufferTXN *txn);
+static void capture_change(LogicalDecodingContext *ctx,
+						   ReorderBufferTXN *txn,
+						   Relation relation,
+						   ReorderBufferChange *change);
+static void capture_message(LogicalDecodingContext *ctx,
+							ReorderBufferTXN *txn,
+							XLogRecPtr message_lsn,
+							bool transactional,
+							const char *prefix,
+							Size message_size,
+							const char *message);
+static void capture_commit(LogicalDecodingContext *ctx,
+						   ReorderBufferTXN *txn,
+						   XLogRecPtr commit_lsn);
+
+static bool captured_lower_written(CaptureState *state,
+								   Relation relation,
+								   TimestampTz lower,
+								   bool remember);
+static void write_captured_row(LogicalDecodingContext *ctx,
+							   Relation relation,
+							   HeapTuple tuple,
+							   TimestampTz upper);
+
+static void capture_sighup(SIGNAL_ARGS);
+static void capture_wait(long timeout);
+static char *get_capture_schema(void);
+static bool capture_changes(void);
+static void advance_capture_slot(XLogRecPtr lsn);
+static void archive_captured_line_or_quarantine(const char *schema,
+												XLogRecPtr lsn,
+												char *line);
+static void archive_captured_line(char *line);
+#endif
+
+/*
+ * Define the configuration parameters of the capture worker and register the
+ * worker if the library is being preloaded.
+ */
+void
+init_capture(void)
+{
+#if PG_VERSION_NUM >= 100000
+	BackgroundWorker	worker;
+
+	DefineCustomStringVariable("temporal_tables.capture_database",
+							   "Sets the database the capture worker connects to.",
+							   "An empty string disables the capture worker.",
+							   &capture_database,
+							   "",
+							   PGC_POSTMASTER,
+							   0,
+							   NULL,
+							   NULL,
+							   NULL);
+
+	DefineCustomStringVariable("temporal_tables.capture_slot",
+							   "Sets the logical replication slot the capture worker consumes.",
+							   "The slot is created if it does not exist.",
+							   &capture_slot,
+							   "temporal_tables",
+							   PGC_POSTMASTER,
+							   0,
+							   NULL,
+							   NULL,
+							   NULL);
+
+	DefineCustomIntVariable("temporal_tables.capture_naptime",
+							"Sets the time to sleep between capture rounds of the capture worker.",
+							NULL,
+							&capture_naptime,
+							1000,
+							1,
+							INT_MAX,
+							PGC_SIGHUP,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("temporal_tables.capture_batch_size",
+							"Sets the number of changes the capture worker archives in a transaction.",
+							NULL,
+							&capture_batch_size,
+							10000,
+							1,
+							INT_MAX,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	// The worker can be registered only while the library is being loaded
+	// via shared_preload_libraries.
+	if (!process_shared_preload_libraries_in_progress ||
+		capture_database == NULL || capture_database[0] == '\0')
+		return;
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+		BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = 10;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "temporal_tables");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN,
+			 "temporal_tables_capture_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "temporal_tables capture worker");
+#if PG_VERSION_NUM >= 110000
+	snprintf(worker.bgw_type, BGW_MAXLEN, "temporal_tables capture worker");
+#endif
+
+	RegisterBackgroundWorker(&worker);
+#endif
+}
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * The library is also the output plugin that the capture worker decodes its
+ * slot with. For every row of a relation whose history is captured that is
+ * updated or deleted by a committed transaction, the plugin writes the line
+ *
+ *		<relid> <upper> <row>
+ *
+ * where relid is the OID of the relation, upper is the upper bound of the
+ * system period of the history row as an int64 timestamp and row is a json
+ * object that maps the names of the attributes of the old row to the text
+ * representation of their values or null. The attributes are named so that
+ * the row can be archived after the columns of the relation change. The rows
+ * of a transaction are followed by the COMMIT line. Nothing is written for
+ * the transactions that archive no rows.
+ *
+ * The upper bound of an updated row is the lower bound of its new version,
+ * which the trigger has already adjusted if needed. The trigger writes the
+ * upper bound of the deleted rows as a logical message since the DELETE
+ * record has no new version.
+ */
+void
+_PG_output_plugin_init(OutputPluginCallbacks *cb)
+{
+	cb->startup_cb = capture_startup;
+	cb->begin_cb = capture_begin;
+	cb->change_cb = capture_change;
+	cb->message_cb = capture_message;
+	cb->commit_cb = capture_commit;
+}
+
+static void
+capture_startup(LogicalDecodingContext *ctx,
+				OutputPluginOptions *opt,
+				bool is_init)
+{
+	CaptureState   *state;
+	ListCell	   *lc;
+
+	foreach(lc, ctx->output_plugin_options)
+	{
+		DefElem	   *elem = (DefElem *) lfirst(lc);
+
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unrecognized option \"%s\" of output plugin \"temporal_tables\"",
+						elem->defname)));
+	}
+
+	state = (CaptureState *) MemoryContextAllocZero(ctx->context,
+													sizeof(CaptureState));
+
+	state->change_context = AllocSetContextCreate(ctx->context,
+												  "temporal_tables capture change",
+												  ALLOCSET_DEFAULT_MINSIZE,
+												  ALLOCSET_DEFAULT_INITSIZE,
+												  ALLOCSET_DEFAULT_MAXSIZE);
+	state->txn_context = AllocSetContextCreate(ctx->context,
+											   "temporal_tables capture transaction",
+											   ALLOCSET_DEFAULT_MINSIZE,
+											   ALLOCSET_DEFAULT_INITSIZE,
+											   ALLOCSET_DEFAULT_MAXSIZE);
+
+	ctx->output_plugin_private = state;
+
+	opt->output_type = OUTPUT_PLUGIN_TEXTUAL_OUTPUT;
+}
+
+static void
+capture_begin(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
+{
+	CaptureState   *state = (CaptureState *) ctx->output_plugin_private;
+
+	MemoryContextReset(state->txn_context);
+
+	state->lowers = NULL;
+	state->delete_time_set = false;
+	state->emitted = false;
+}
+
+static void
+capture_change(LogicalDecodingContext *ctx,
+			   ReorderBufferTXN *txn,
+			   Relation relation,
+			   ReorderBufferChange *change)
+{
+	CaptureState   *state = (CaptureState *) ctx->output_plugin_private;
+	MemoryContext	oldcontext;
+	HeapTuple		oldtuple;
+	HeapTuple		newtuple;
+	TimestampTz		old_lower;
+	TimestampTz		new_lower;
+
+	if (change->action != REORDER_BUFFER_CHANGE_INSERT &&
+		change->action != REORDER_BUFFER_CHANGE_UPDATE &&
+		change->action != REORDER_BUFFER_CHANGE_DELETE)
+		return;
+
+	if (!history_captured(relation))
+		return;
+
+	oldcontext = MemoryContextSwitchTo(state->change_context);
+
+	oldtuple = change_tuple(change->data.tp.oldtuple);
+	newtuple = change_tuple(change->data.tp.newtuple);
+
+	if (change->action == REORDER_BUFFER_CHANGE_INSERT)
+	{
+		if (newtuple != NULL &&
+			get_captured_lower(relation, newtuple, &new_lower))
+			captured_lower_written(state, relation, new_lower, true);
+	}
+	else if (relation->rd_rel->relreplident != REPLICA_IDENTITY_FULL ||
+			 oldtuple == NULL)
+	{
+		/* The trigger rejects the changes, but it may not have fired. */
+		ereport(WARNING,
+				(errmsg("history of a row of relation \"%s\" is not captured",
+						RelationGetRelationName(relation)),
+				 errdetail("The old row is not written to the WAL in full without REPLICA IDENTITY FULL.")));
+	}
+	else if (change->action == REORDER_BUFFER_CHANGE_UPDATE)
+	{
+		/*
+		 * The trigger keeps the system period of the rows modified in the
+		 * current transaction and of the unchanged ones it skips, so there is
+		 * nothing to archive if the new version does not start later.
+		 */
+		if (newtuple != NULL &&
+			get_captured_lower(relation, newtuple, &new_lower))
+			captured_lower_written(state, relation, new_lower, true);
+		else
+			new_lower = DT_NOBEGIN;
+
+		if (get_captured_lower(relation, oldtuple, &old_lower) &&
+			old_lower < new_lower &&
+			!captured_lower_written(state, relation, old_lower, false))
+			write_captured_row(ctx, relation, oldtuple, new_lower);
+	}
+	else
+	{
+		if (get_captured_lower(relation, oldtuple, &old_lower) &&
+			!captured_lower_written(state, relation, old_lower, false))
+			write_captured_row(ctx, relation, oldtuple,
+							   state->delete_time_set ?
+							   state->delete_time :
+							   txn_commit_time(txn));
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+	MemoryContextReset(state->change_context);
+}
+
+static void
+capture_message(LogicalDecodingContext *ctx,
+				ReorderBufferTXN *txn,
+				XLogRecPtr message_lsn,
+				bool transactional,
+				const char *prefix,
+				Size message_size,
+				const char *message)
+{
+	CaptureState   *state = (CaptureState *) ctx->output_plugin_private;
+
+	if (!transactional ||
+		strcmp(prefix, CAPTURE_MESSAGE_PREFIX) != 0 ||
+		message_size != sizeof(TimestampTz))
+		return;
+
+	memcpy(&state->delete_time, message, sizeof(TimestampTz));
+	state->delete_time_set = true;
+}
+
+static void
+capture_commit(LogicalDecodingContext *ctx,
+			   ReorderBufferTXN *txn,
+			   XLogRecPtr commit_lsn)
+{
+	CaptureState   *state = (CaptureState *) ctx->output_plugin_private;
+
+	if (!state->emitted)
+		return;
+
+	OutputPluginPrepareWrite(ctx, true);
+	appendStringInfoString(ctx->out, CAPTURE_COMMIT_LINE);
+	OutputPluginWrite(ctx, true);
+}
+
+/*
+ * Check whether a row of the relation with the lower bound was written by the
+ * decoded transaction. If remember is true, the lower bound is remembered as
+ * written.
+ */
+static bool
+captured_lower_written(CaptureState *state,
+					   Relation relation,
+					   TimestampTz lower,
+					   bool remember)
+{
+	CapturedLower	key;
+	bool			found;
+
+	if (state->lowers == NULL)
+	{
+		HASHCTL		ctl;
+
+		if (!remember)
+			return false;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(CapturedLower);
+		ctl.entrysize = sizeof(CapturedLower);
+		ctl.hcxt = state->txn_context;
+
+		state->lowers = hash_create("temporal_tables captured lower bounds",
+									64, &ctl,
+									HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	/* Zero the padding since the key is hashed as a blob. */
+	memset(&key, 0, sizeof(key));
+	key.relid = RelationGetRelid(relation);
+	key.lower = lower;
+
+	(void) hash_search(state->lowers, (void *) &key,
+					   remember ? HASH_ENTER : HASH_FIND, &found);
+
+	return found;
+}
+
+/*
+ * Write the line of the row archived with the upper bound.
+ */
+static void
+write_captured_row(LogicalDecodingContext *ctx,
+				   Relation relation,
+				   HeapTuple tuple,
+				   TimestampTz upper)
+{
+	CaptureState   *state = (CaptureState *) ctx->output_plugin_private;
+	TupleDesc		tupdesc = RelationGetDescr(relation);
+	bool			first = true;
+	int				i;
+
+	OutputPluginPrepareWrite(ctx, true);
+	appendStringInfo(ctx->out, "%u " INT64_FORMAT " {",
+					 RelationGetRelid(relation), (int64) upper);
+
+	for (i = 0; i < tupdesc->natts; ++i)
+	{
+		Form_pg_attribute	attr = TupleDescAttr(tupdesc, i);
+		Datum				value;
+		bool				isnull;
+
+		if (attr->attisdropped)
+			continue;
+
+		if (!first)
+			appendStringInfoString(ctx->out, ", ");
+
+		first = false;
+
+		escape_json(ctx->out, NameStr(attr->attname));
+		appendStringInfoString(ctx->out, ": ");
+
+		value = heap_getattr(tuple, i + 1, tupdesc, &isnull);
+
+		if (isnull)
+			appendStringInfoString(ctx->out, "null");
+		else
+		{
+			Oid		typoutput;
+			bool	typisvarlena;
+
+			getTypeOutputInfo(attr->atttypid, &typoutput, &typisvarlena);
+
+			escape_json(ctx->out, OidOutputFunctionCall(typoutput, value));
+		}
+	}
+
+	appendStringInfoChar(ctx->out, '}');
+	OutputPluginWrite(ctx, true);
+
+	state->emitted = true;
+}
+
+/*
+ * The entry point of the capture worker. The worker decodes the changes of
+ * its slot in the database it connects to and archives the captured rows,
+ * then sleeps for temporal_tables.capture_naptime if there are no more
+ * changes.
+ *
+ * A row that fails to be archived is stored in the
+ * temporal_tables_capture_failed table instead, see
+ * archive_captured_line_or_quarantine. Any other error stops the worker,
+ * which is restarted after a while and archives the rows of the failed
+ * transaction again.
+ */
+void
+temporal_tables_capture_main(Datum main_arg)
+{
+	pqsignal(SIGHUP, capture_sighup);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+#if PG_VERSION_NUM >= 110000
+	BackgroundWorkerInitializeConnection(capture_database, NULL, 0);
+#else
+	BackgroundWorkerInitializeConnection(capture_database, NULL);
+#endif
+
+	for (;;)
+	{
+		bool	more;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (got_sighup)
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		more = capture_changes();
+
+		if (!more)
+			capture_wait(capture_naptime);
+	}
+}
+
+static void
+capture_sighup(SIGNAL_ARGS)
+{
+	int		save_errno = errno;
+
+	got_sighup = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+/*
+ * Sleep until the timeout elapses or the latch is set. The worker exits if
+ * it was asked to or if the postmaster died.
+ */
+static void
+capture_wait(long timeout)
+{
+#if PG_VERSION_NUM >= 120000
+	(void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+					 timeout, PG_WAIT_EXTENSION);
+#else
+	int		rc;
+
+	rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+				   timeout, PG_WAIT_EXTENSION);
+
+	if (rc & WL_POSTMASTER_DEATH)
+		proc_exit(1);
+#endif
+
+	ResetLatch(MyLatch);
+
+	CHECK_FOR_INTERRUPTS();
+}
+
+/*
+ * Return the quoted schema of the extension or NULL if the extension is not
+ * installed in the current database. The caller must be connected to SPI.
+ */
+static char *
+get_capture_schema(void)
+{
+	int		ret;
+
+	if ((ret = SPI_execute("SELECT pg_catalog.quote_ident(n.nspname) "
+						   "FROM pg_catalog.pg_extension e "
+						   "JOIN pg_catalog.pg_namespace n ON n.oid = e.extnamespace "
+						   "WHERE e.extname = 'temporal_tables'",
+						   true, 1)) != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %d", ret);
+
+	if (SPI_processed == 0)
+		return NULL;
+
+	return SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+}
+
+/*
+ * Archive the rows captured since the last round in a single transaction,
+ * which also stores the position the slot is to be advanced to in the
+ * temporal_tables_capture table. The slot itself is advanced only at the
+ * start of the next round, so the rows are archived exactly once even if the
+ * transaction fails. Return true if the batch was full.
+ */
+static bool
+capture_changes(void)
+{
+	Oid				 argtypes[2] = { NAMEOID, LSNOID };
+	Datum			 args[2];
+	StringInfoData	 querybuf;
+	char			*schema;
+	XLogRecPtr		 flush_lsn;
+	XLogRecPtr		 confirmed_lsn = InvalidXLogRecPtr;
+	uint64			 nchanges;
+	uint64			 row;
+	bool			 isnull;
+	bool			 more;
+	MemoryContext	 row_context;
+	MemoryContext	 oldcontext;
+	int				 ret;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+
+	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect returned %d", ret);
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "capturing history");
+
+	schema = get_capture_schema();
+
+	/* Do not retain the WAL until the extension is installed. */
+	if (schema == NULL)
+	{
+		if ((ret = SPI_finish()) != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish returned %d", ret);
+
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+		pgstat_report_activity(STATE_IDLE, NULL);
+
+		return false;
+	}
+
+	args[0] = DirectFunctionCall1(namein, CStringGetDatum(capture_slot));
+
+	/*
+	 * Creating the slot waits for the running transactions to finish. The
+	 * current transaction has not written anything yet, so it may create the
+	 * slot.
+	 */
+	if ((ret = SPI_execute_with_args("SELECT pg_catalog.pg_create_logical_replication_slot($1, 'temporal_tables') "
+									 "WHERE NOT EXISTS (SELECT 1 FROM pg_catalog.pg_replication_slots "
+									 "WHERE slot_name = $1)",
+									 1, argtypes, args, NULL, false, 0)) != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute_with_args returned %d", ret);
+
+	if (SPI_processed != 0)
+		ereport(LOG,
+				(errmsg("capture worker created replication slot \"%s\"",
+						capture_slot)));
+
+	/* Advance the slot past the rows archived by the previous round. */
+	initStringInfo(&querybuf);
+
+	appendStringInfo(&querybuf,
+					 "SELECT confirmed_lsn FROM %s.temporal_tables_capture "
+					 "WHERE slot_name = $1",
+					 schema);
+
+	if ((ret = SPI_execute_with_args(querybuf.data, 1, argtypes, args, NULL,
+									 true, 1)) != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute_with_args returned %d", ret);
+
+	if (SPI_processed != 0)
+		advance_capture_slot(DatumGetLSN(SPI_getbinval(SPI_tuptable->vals[0],
+													   SPI_tuptable->tupdesc,
+													   1, &isnull)));
+
+	/*
+	 * The changes are decoded up to the end of the WAL flushed when the
+	 * decoding starts, so if the batch is not full, no transaction that has
+	 * committed before the current flush position is left.
+	 */
+	if ((ret = SPI_execute("SELECT pg_catalog.pg_current_wal_flush_lsn()",
+						   true, 1)) != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %d", ret);
+
+	flush_lsn = DatumGetLSN(SPI_getbinval(SPI_tuptable->vals[0],
+										  SPI_tuptable->tupdesc, 1, &isnull));
+
+	argtypes[1] = INT4OID;
+	args[1] = Int32GetDatum(capture_batch_size);
+
+	if ((ret = SPI_execute_with_args("SELECT lsn, data "
+									 "FROM pg_catalog.pg_logical_slot_peek_changes($1, NULL, $2)",
+									 2, argtypes, args, NULL, false, 0)) != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute_with_args returned %d", ret);
+
+	nchanges = SPI_processed;
+	more = nchanges >= (uint64) capture_batch_size;
+
+	/*
+	 * If there is nothing to archive, the slot can be advanced right away
+	 * since there is nothing to lose if the transaction fails.
+	 */
+	if (nchanges == 0)
+	{
+		advance_capture_slot(flush_lsn);
+
+		if ((ret = SPI_finish()) != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish returned %d", ret);
+
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+		pgstat_report_activity(STATE_IDLE, NULL);
+
+		return false;
+	}
+
+	row_context = AllocSetContextCreate(CurrentMemoryContext,
+										"temporal_tables capture row",
+										ALLOCSET_DEFAULT_MINSIZE,
+										ALLOCSET_DEFAULT_INITSIZE,
+										ALLOCSET_DEFAULT_MAXSIZE);
+
+	/* The archiving queries overwrite SPI_tuptable. */
+	{
+		SPITupleTable  *tuptable = SPI_tuptable;
+
+		for (row = 0; row < nchanges; ++row)
+		{
+			HeapTuple	tuple = tuptable->vals[row];
+			XLogRecPtr	lsn;
+			char	   *line;
+
+			CHECK_FOR_INTERRUPTS();
+
+			oldcontext = MemoryContextSwitchTo(row_context);
+
+			lsn = DatumGetLSN(SPI_getbinval(tuple, tuptable->tupdesc, 1,
+											&isnull));
+			line = TextDatumGetCString(SPI_getbinval(tuple, tuptable->tupdesc,
+													 2, &isnull));
+
+			if (strcmp(line, CAPTURE_COMMIT_LINE) == 0)
+				confirmed_lsn = lsn;
+			else
+				archive_captured_line_or_quarantine(schema, lsn, line);
+
+			MemoryContextSwitchTo(oldcontext);
+			MemoryContextReset(row_context);
+		}
+	}
+
+	MemoryContextDelete(row_context);
+
+	if (!more)
+		confirmed_lsn = Max(confirmed_lsn, flush_lsn);
+
+	/*
+	 * The query string build is
+	 * 		INSERT INTO <schema>.temporal_tables_capture AS c
+	 * 		VALUES ($1, $2)
+	 * 		ON CONFLICT (slot_name) DO UPDATE SET confirmed_lsn = $2
+	 */
+	resetStringInfo(&querybuf);
+
+	appendStringInfo(&querybuf,
+					 "INSERT INTO %s.temporal_tables_capture AS c "
+					 "VALUES ($1, $2) "
+					 "ON CONFLICT (slot_name) DO UPDATE SET confirmed_lsn = $2",
+					 schema);
+
+	argtypes[1] = LSNOID;
+	args[1] = LSNGetDatum(confirmed_lsn);
+
+	if ((ret = SPI_execute_with_args(querybuf.data, 2, argtypes, args, NULL,
+									 false, 0)) != SPI_OK_INSERT)
+		elog(ERROR, "SPI_execute_with_args returned %d", ret);
+
+	if ((ret = SPI_finish()) != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish returned %d", ret);
+
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	return more;
+}
+
+/*
+ * Advance the slot to the position unless it is there already. The caller
+ * must be connected to SPI.
+ */
+static void
+advance_capture_slot(XLogRecPtr lsn)
+{
+	Oid		argtypes[2] = { NAMEOID, LSNOID };
+	Datum	args[2];
+	bool	isnull;
+	int		ret;
+
+	args[0] = DirectFunctionCall1(namein, CStringGetDatum(capture_slot));
+	args[1] = LSNGetDatum(lsn);
+
+	if ((ret = SPI_execute_with_args("SELECT confirmed_flush_lsn "
+									 "FROM pg_catalog.pg_replication_slots "
+									 "WHERE slot_name = $1",
+									 1, argtypes, args, NULL, true, 1)) != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute_with_args returned %d", ret);
+
+	if (SPI_processed == 0 ||
+		DatumGetLSN(SPI_getbinval(SPI_tuptable->vals[0],
+								  SPI_tuptable->tupdesc, 1, &isnull)) >= lsn)
+		return;
+
+#if PG_VERSION_NUM >= 110000
+	ret = SPI_execute_with_args("SELECT pg_catalog.pg_replication_slot_advance($1, $2)",
+								2, argtypes, args, NULL, false, 0);
+#else
+	// There is no pg_replication_slot_advance() before PostgreSQL 11, so
+	// the changes are decoded and thrown away.
+	ret = SPI_execute_with_args("SELECT count(*) "
+								"FROM pg_catalog.pg_logical_slot_get_changes($1, $2, NULL)",
+								2, argtypes, args, NULL, false, 0);
+#endif
+
+	if (ret != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute_with_args returned %d", ret);
+}
+
+/*
+ * Archive the row of a line written by the output plugin in a subtransaction.
+ * If the row cannot be archived, say, since the definition of the relation
+ * has changed in an incompatible way, the subtransaction is rolled back and
+ * the line is stored in the temporal_tables_capture_failed table along with
+ * the error, so that neither a single row stops the worker nor the slot
+ * retains the WAL for ever. The caller must be connected to SPI.
+ */
+static void
+archive_captured_line_or_quarantine(const char *schema,
+									XLogRecPtr lsn,
+									char *line)
+{
+	MemoryContext	oldcontext = CurrentMemoryContext;
+	ResourceOwner	oldowner = CurrentResourceOwner;
+	char		   *line_copy;
+
+	/* The line is modified by the parser. */
+	line_copy = pstrdup(line);
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_TRY();
+	{
+		archive_captured_line(line);
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+	}
+	PG_CATCH();
+	{
+		ErrorData	   *edata;
+		StringInfoData	querybuf;
+		Oid				argtypes[4] = { NAMEOID, LSNOID, TEXTOID, TEXTOID };
+		Datum			args[4];
+		int				ret;
+
+		MemoryContextSwitchTo(oldcontext);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+
+		ereport(WARNING,
+				(errmsg("captured row at %X/%X is not archived: %s",
+						(uint32) (lsn >> 32), (uint32) lsn, edata->message),
+				 errdetail("The row is stored in the temporal_tables_capture_failed table.")));
+
+		/*
+		 * The query string build is
+		 * 		INSERT INTO <schema>.temporal_tables_capture_failed
+		 * 		(slot_name, lsn, line, error) VALUES ($1, $2, $3, $4)
+		 */
+		initStringInfo(&querybuf);
+
+		appendStringInfo(&querybuf,
+						 "INSERT INTO %s.temporal_tables_capture_failed "
+						 "(slot_name, lsn, line, error) VALUES ($1, $2, $3, $4)",
+						 schema);
+
+		args[0] = DirectFunctionCall1(namein, CStringGetDatum(capture_slot));
+		args[1] = LSNGetDatum(lsn);
+		args[2] = CStringGetTextDatum(line_copy);
+		args[3] = CStringGetTextDatum(edata->message);
+
+		if ((ret = SPI_execute_with_args(querybuf.data, 4, argtypes, args,
+										 NULL, false, 0)) != SPI_OK_INSERT)
+			elog(ERROR, "SPI_execute_with_args returned %d", ret);
+
+		pfree(querybuf.data);
+		FreeErrorData(edata);
+	}
+	PG_END_TRY();
+
+	pfree(line_copy);
+}
+
+/*
+ * Parse a line written by the output plugin and archive its row. The rows of
+ * the relations that have been dropped since are skipped. The row is built
+ * with the current definition of the relation: the attributes added since
+ * are nulls, and an attribute that the relation no longer has is an error.
+ */
+static void
+archive_captured_line(char *line)
+{
+	char		   *upper_text;
+	char		   *row_text;
+	Oid				relid;
+	TimestampTz		upper;
+	Relation		relation;
+	TupleDesc		tupdesc;
+	Datum		   *values;
+	bool		   *nulls;
+	Jsonb		   *jb;
+	JsonbIterator  *it;
+	JsonbValue		v;
+	JsonbIteratorToken r;
+	int				attnum = InvalidAttrNumber;
+	HeapTuple		tuple;
+
+	upper_text = strchr(line, ' ');
+	row_text = upper_text != NULL ? strchr(upper_text + 1, ' ') : NULL;
+
+	if (row_text == NULL)
+		elog(ERROR, "invalid captured row \"%s\"", line);
+
+	*upper_text++ = '\0';
+	*row_text++ = '\0';
+
+	relid = DatumGetObjectId(DirectFunctionCall1(oidin,
+												 CStringGetDatum(line)));
+	upper = DatumGetInt64(DirectFunctionCall1(int8in,
+											  CStringGetDatum(upper_text)));
+
+	relation = try_relation_open(relid, AccessShareLock);
+
+	if (relation == NULL)
+		return;
+
+	tupdesc = RelationGetDescr(relation);
+
+	values = palloc(tupdesc->natts * sizeof(Datum));
+	nulls = palloc(tupdesc->natts * sizeof(bool));
+
+	memset(nulls, true, tupdesc->natts * sizeof(bool));
+
+	jb = DatumGetJsonbP(DirectFunctionCall1(jsonb_in,
+											CStringGetDatum(row_text)));
+
+	it = JsonbIteratorInit(&jb->root);
+
+	while ((r = JsonbIteratorNext(&it, &v, true)) != WJB_DONE)
+	{
+		Form_pg_attribute	attr;
+		Oid					typinput;
+		Oid					typioparam;
+
+		if (r == WJB_KEY)
+		{
+			char   *attname = pnstrdup(v.val.string.val, v.val.string.len);
+
+			attnum = SPI_fnumber(tupdesc, attname);
+
+			if (attnum <= 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_UNDEFINED_COLUMN),
+						 errmsg("column \"%s\" of captured row of relation \"%s\" does not exist",
+								attname, RelationGetRelationName(relation))));
+
+			pfree(attname);
+			continue;
+		}
+
+		if (r != WJB_VALUE || v.type == jbvNull)
+			continue;
+
+		if (v.type != jbvString)
+			elog(ERROR, "invalid captured row \"%s\"", row_text);
+
+		attr = TupleDescAttr(tupdesc, attnum - 1);
+
+		getTypeInputInfo(attr->atttypid, &typinput, &typioparam);
+
+		values[attnum - 1] = OidInputFunctionCall(typinput,
+												  pnstrdup(v.val.string.val,
+														   v.val.string.len),
+												  typioparam,
+												  attr->atttypmod);
+		nulls[attnum - 1] = false;
+	}
+
+	tuple = heap_form_tuple(tupdesc, values, nulls);
+	tuple->t_tableOid = relid;
+
+	archive_captured_row(relation, tuple, upper);
+
+	heap_freetuple(tuple);
+	pfree(values);
+	pfree(nulls);
+
+	relation_close(relation, AccessShareLock);
+}
+#endif
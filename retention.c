@@ -0,0 +1,1235 @@
+/* -------------------------------------------------------------------------
+ *
+ * retention.c
+ *
+ * Copyright (c) 2012-2023 Vladislav Arkhipov <vlad@arkhipov.ru>
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+
+#include <limits.h>
+
+#if PG_VERSION_NUM >= 120000
+#include "access/relation.h"
+#else
+#include "access/heapam.h"
+#endif
+#include "access/xact.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
+#if PG_VERSION_NUM >= 140000
+#include "commands/defrem.h"
+#endif
+#include "executor/spi.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/resowner.h"
+#include "utils/snapmgr.h"
+#if PG_VERSION_NUM >= 140000
+#include "utils/syscache.h"
+#endif
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#if PG_VERSION_NUM >= 140000
+#include "partitioning/partbounds.h"
+#include "partitioning/partdesc.h"
+#include "utils/partcache.h"
+#endif
+
+#include "temporal_tables.h"
+
+PGDLLEXPORT Datum temporal_tables_prune(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum temporal_tables_tier(PG_FUNCTION_ARGS);
+PGDLLEXPORT void temporal_tables_retention_main(Datum main_arg);
+
+PG_FUNCTION_INFO_V1(temporal_tables_prune);
+PG_FUNCTION_INFO_V1(temporal_tables_tier);
+
+/* The number of columns returned by temporal_tables_prune(). */
+#define PRUNE_COLUMNS	3
+
+/* The number of columns returned by temporal_tables_tier(). */
+#define TIER_COLUMNS	2
+
+/* A row of the temporal_tables_retention table. */
+typedef struct RetentionPolicy
+{
+	Oid				 relid;
+	Interval		*retention;
+	int				 batch_size;
+	bool			 detach_partitions;
+} RetentionPolicy;
+
+#if PG_VERSION_NUM >= 100000
+/* The database the retention worker connects to. */
+static char *retention_database = NULL;
+
+/* The time to sleep between pruning rounds in seconds. */
+static int retention_naptime = 60;
+
+/* The time to sleep between deleting batches of history rows in ms. */
+static int retention_batch_delay = 10;
+
+static volatile sig_atomic_t got_sighup = false;
+
+static void retention_sighup(SIGNAL_ARGS);
+static void retention_wait(long timeout);
+static void prune_all(MemoryContext context);
+static void prune_relation_in_worker(RetentionPolicy *policy);
+static bool prune_relation_in_subtransaction(RetentionPolicy *policy,
+											 int64 *rows_pruned,
+											 int *partitions_pruned);
+
+static List *get_retention_policies(Oid relid, MemoryContext context);
+static TimestampTz retention_cutoff(RetentionPolicy *policy);
+static Relation open_pruned_history_relation(RetentionPolicy *policy,
+											 char **period_attname);
+static bool prune_step(RetentionPolicy *policy,
+					   TimestampTz cutoff,
+					   int64 *rows_pruned,
+					   int *partitions_pruned);
+static void finish_pruning(RetentionPolicy *policy, TimestampTz cutoff);
+
+#if PG_VERSION_NUM >= 140000
+static Oid find_expired_partition(Relation history_relation,
+								  TimestampTz cutoff);
+static void remove_history_partition(Oid history_relid,
+									 Oid partition_relid,
+									 bool detach);
+static Oid find_untiered_partition(Relation history_relation,
+								   TimestampTz cutoff,
+								   Oid amoid);
+static Oid move_history_partition(Oid history_relid,
+								  Oid partition_relid,
+								  const char *amname,
+								  int64 *rows_moved);
+#endif
+#endif
+
+/*
+ * Define the configuration parameters of the retention worker and register
+ * the worker if the library is being preloaded.
+ */
+void
+init_retention(void)
+{
+#if PG_VERSION_NUM >= 100000
+	BackgroundWorker	worker;
+
+	DefineCustomStringVariable("temporal_tables.retention_database",
+							   "Sets the database the retention worker connects to.",
+							   "The retention worker is disabled by default, i.e. if the database is an empty string.",
+							   &retention_database,
+							   "",
+							   PGC_POSTMASTER,
+							   0,
+							   NULL,
+							   NULL,
+							   NULL);
+
+	DefineCustomIntVariable("temporal_tables.retention_naptime",
+							"Sets the time to sleep between pruning rounds of the retention worker.",
+							NULL,
+							&retention_naptime,
+							60,
+							1,
+							INT_MAX / 1000,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("temporal_tables.retention_batch_delay",
+							"Sets the time to sleep between deleting batches of history rows.",
+							NULL,
+							&retention_batch_delay,
+							10,
+							0,
+							INT_MAX,
+							PGC_SIGHUP,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL);
+
+	/*
+	 * The worker can be registered only while the library is being loaded
+	 * via shared_preload_libraries.
+	 */
+	if (!process_shared_preload_libraries_in_progress ||
+		retention_database == NULL || retention_database[0] == '\0')
+		return;
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS |
+		BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = retention_naptime;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "temporal_tables");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN,
+			 "temporal_tables_retention_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "temporal_tables retention worker");
+#if PG_VERSION_NUM >= 110000
+	snprintf(worker.bgw_type, BGW_MAXLEN, "temporal_tables retention worker");
+#endif
+
+	RegisterBackgroundWorker(&worker);
+#endif
+}
+
+/*
+ * Prune the history of the specified relation or of all the relations that
+ * have a retention policy and return the number of the removed history rows
+ * and partitions.
+ *
+ * Unlike the retention worker, the function prunes the history in the
+ * current transaction and does not sleep between the batches. The history of
+ * every relation is pruned in a subtransaction, so an error of one relation
+ * is reported as a warning and the relation is left out of the result.
+ */
+Datum
+temporal_tables_prune(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 100000
+	ReturnSetInfo		*rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			 tupdesc;
+	Tuplestorestate		*tupstore;
+	MemoryContext		 oldcontext;
+	List				*policies;
+	ListCell			*lc;
+	int					 ret;
+
+	/* Check that the caller supports us returning a tuplestore. */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect returned %d", ret);
+
+	policies = get_retention_policies(PG_ARGISNULL(0) ? InvalidOid :
+									  PG_GETARG_OID(0),
+									  CurrentMemoryContext);
+
+	foreach(lc, policies)
+	{
+		RetentionPolicy	*policy = (RetentionPolicy *) lfirst(lc);
+		TimestampTz		 cutoff;
+		int64			 rows_pruned = 0;
+		int				 partitions_pruned = 0;
+		Datum			 values[PRUNE_COLUMNS];
+		bool			 nulls[PRUNE_COLUMNS];
+
+		if (!prune_relation_in_subtransaction(policy, &rows_pruned,
+											  &partitions_pruned))
+			continue;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = ObjectIdGetDatum(policy->relid);
+		values[1] = Int64GetDatum(rows_pruned);
+		values[2] = Int32GetDatum(partitions_pruned);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	if ((ret = SPI_finish()) != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish returned %d", ret);
+
+	return (Datum) 0;
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("temporal_tables_prune requires PostgreSQL 10 or later")));
+
+	PG_RETURN_NULL();			/* keep compiler quiet */
+#endif
+}
+
+/*
+ * Move the partitions of the history relation of the specified relation
+ * which rows ended before the threshold, i.e. older_than ago, to the table
+ * access method, e.g. a columnar one, and return the moved partitions and the
+ * number of their rows.
+ *
+ * The history relation must be partitioned by the upper bound of the system
+ * period. Every partition is copied into a new table of the access method
+ * that replaces it with the same name and bounds, in the current transaction,
+ * so the history relation is locked exclusively until it commits. The
+ * partitions that already have the access method are skipped.
+ */
+Datum
+temporal_tables_tier(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 140000
+	ReturnSetInfo		*rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			 tupdesc;
+	Tuplestorestate		*tupstore;
+	MemoryContext		 oldcontext;
+	Relation			 relation;
+	Oid					 history_relid;
+	char				*period_attname;
+	const char			*amname;
+	Oid					 amoid;
+	TimestampTz			 cutoff;
+	int					 ret;
+
+	/* Check that the caller supports us returning a tuplestore. */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	amname = NameStr(*PG_GETARG_NAME(2));
+	amoid = get_table_am_oid(amname, false);
+
+	cutoff = DatumGetTimestampTz(DirectFunctionCall2(timestamptz_mi_interval,
+													 TimestampTzGetDatum(GetCurrentTimestamp()),
+													 PG_GETARG_DATUM(1)));
+
+	relation = relation_open(PG_GETARG_OID(0), AccessShareLock);
+	history_relid = get_history_relation(relation, &period_attname);
+	relation_close(relation, AccessShareLock);
+
+	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect returned %d", ret);
+
+	/*
+	 * The partitions of the history relation change with every move, so it
+	 * is reopened for each one.
+	 */
+	for (;;)
+	{
+		Relation	history_relation;
+		Oid			partition_relid;
+		int64		rows_moved = 0;
+		Datum		values[TIER_COLUMNS];
+		bool		nulls[TIER_COLUMNS];
+
+		CHECK_FOR_INTERRUPTS();
+
+		history_relation = relation_open(history_relid, AccessShareLock);
+
+		if (!is_partitioned_by_upper(history_relation,
+									 SPI_fnumber(RelationGetDescr(history_relation),
+												 period_attname)))
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("history relation \"%s\" is not partitioned by the upper bound of the system period, so it cannot be tiered",
+							RelationGetRelationName(history_relation))));
+
+		partition_relid = find_untiered_partition(history_relation, cutoff,
+												  amoid);
+
+		/* ALTER TABLE fails if the history relation is open. */
+		relation_close(history_relation, NoLock);
+
+		if (!OidIsValid(partition_relid))
+			break;
+
+		partition_relid = move_history_partition(history_relid,
+												 partition_relid, amname,
+												 &rows_moved);
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = ObjectIdGetDatum(partition_relid);
+		values[1] = Int64GetDatum(rows_moved);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	if ((ret = SPI_finish()) != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish returned %d", ret);
+
+	return (Datum) 0;
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("temporal_tables_tier requires PostgreSQL 14 or later")));
+
+	PG_RETURN_NULL();			/* keep compiler quiet */
+#endif
+}
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * The entry point of the retention worker. The worker prunes the history of
+ * the relations that have a retention policy in the database it connects to,
+ * then sleeps for temporal_tables.retention_naptime.
+ */
+void
+temporal_tables_retention_main(Datum main_arg)
+{
+	MemoryContext	worker_context;
+
+	pqsignal(SIGHUP, retention_sighup);
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+#if PG_VERSION_NUM >= 110000
+	BackgroundWorkerInitializeConnection(retention_database, NULL, 0);
+#else
+	BackgroundWorkerInitializeConnection(retention_database, NULL);
+#endif
+
+	worker_context = AllocSetContextCreate(TopMemoryContext,
+										   "temporal_tables retention worker",
+										   ALLOCSET_DEFAULT_MINSIZE,
+										   ALLOCSET_DEFAULT_INITSIZE,
+										   ALLOCSET_DEFAULT_MAXSIZE);
+
+	for (;;)
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		if (got_sighup)
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		prune_all(worker_context);
+
+		MemoryContextReset(worker_context);
+
+		retention_wait(retention_naptime * 1000L);
+	}
+}
+
+static void
+retention_sighup(SIGNAL_ARGS)
+{
+	int		save_errno = errno;
+
+	got_sighup = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+/*
+ * Sleep until the timeout elapses or the latch is set. The worker exits if
+ * it was asked to or if the postmaster died.
+ */
+static void
+retention_wait(long timeout)
+{
+#if PG_VERSION_NUM >= 120000
+	(void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+					 timeout, PG_WAIT_EXTENSION);
+#else
+	int		rc;
+
+	rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+				   timeout, PG_WAIT_EXTENSION);
+
+	if (rc & WL_POSTMASTER_DEATH)
+		proc_exit(1);
+#endif
+
+	ResetLatch(MyLatch);
+
+	CHECK_FOR_INTERRUPTS();
+}
+
+/*
+ * Read the retention policies and prune the history of their relations. The
+ * policies are kept in the context until the next round. An error reading
+ * the policies is reported and the round is skipped.
+ */
+static void
+prune_all(MemoryContext context)
+{
+	MemoryContext	 oldcontext = CurrentMemoryContext;
+	List			*policies = NIL;
+	ListCell		*lc;
+
+	PG_TRY();
+	{
+		int		ret;
+
+		SetCurrentStatementStartTimestamp();
+		StartTransactionCommand();
+
+		if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+			elog(ERROR, "SPI_connect returned %d", ret);
+
+		PushActiveSnapshot(GetTransactionSnapshot());
+		pgstat_report_activity(STATE_RUNNING, "reading retention policies");
+
+		policies = get_retention_policies(InvalidOid, context);
+
+		if ((ret = SPI_finish()) != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish returned %d", ret);
+
+		PopActiveSnapshot();
+		CommitTransactionCommand();
+		pgstat_report_activity(STATE_IDLE, NULL);
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(oldcontext);
+
+		EmitErrorReport();
+		FlushErrorState();
+
+		AbortCurrentTransaction();
+		pgstat_report_activity(STATE_IDLE, NULL);
+
+		MemoryContextReset(context);
+		policies = NIL;
+	}
+	PG_END_TRY();
+
+	foreach(lc, policies)
+		prune_relation_in_worker((RetentionPolicy *) lfirst(lc));
+}
+
+/*
+ * Prune the history of the relation of the policy. Every batch of history
+ * rows or partition is removed in its own transaction, so the locks are held
+ * for a short time only and the dead rows of a batch can be vacuumed while
+ * the next one is being deleted.
+ *
+ * An error of one relation is reported, but it does not stop the worker.
+ */
+static void
+prune_relation_in_worker(RetentionPolicy *policy)
+{
+	MemoryContext	oldcontext = CurrentMemoryContext;
+	TimestampTz		cutoff;
+	int64			rows_pruned = 0;
+	int				partitions_pruned = 0;
+	bool			more = true;
+
+	cutoff = retention_cutoff(policy);
+
+	PG_TRY();
+	{
+		while (more)
+		{
+			int		ret;
+
+			SetCurrentStatementStartTimestamp();
+			StartTransactionCommand();
+
+			if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+				elog(ERROR, "SPI_connect returned %d", ret);
+
+			PushActiveSnapshot(GetTransactionSnapshot());
+			pgstat_report_activity(STATE_RUNNING, "pruning history");
+
+			more = prune_step(policy, cutoff, &rows_pruned,
+							  &partitions_pruned);
+
+			if (!more)
+				finish_pruning(policy, cutoff);
+
+			if ((ret = SPI_finish()) != SPI_OK_FINISH)
+				elog(ERROR, "SPI_finish returned %d", ret);
+
+			PopActiveSnapshot();
+			CommitTransactionCommand();
+			pgstat_report_activity(STATE_IDLE, NULL);
+
+			if (more && retention_batch_delay > 0)
+				retention_wait(retention_batch_delay);
+		}
+
+		if (rows_pruned != 0 || partitions_pruned != 0)
+			ereport(LOG,
+					(errmsg("retention worker pruned " INT64_FORMAT " history rows and %d partitions of relation with OID %u",
+							rows_pruned, partitions_pruned, policy->relid)));
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(oldcontext);
+
+		EmitErrorReport();
+		FlushErrorState();
+
+		AbortCurrentTransaction();
+		pgstat_report_activity(STATE_IDLE, NULL);
+	}
+	PG_END_TRY();
+}
+
+/*
+ * Prune the history of the relation of the policy in a subtransaction and
+ * return true if it succeeds. An error is reported as a warning and the
+ * changes made for the relation are rolled back. The caller must be connected
+ * to SPI.
+ */
+static bool
+prune_relation_in_subtransaction(RetentionPolicy *policy,
+								 int64 *rows_pruned,
+								 int *partitions_pruned)
+{
+	MemoryContext	oldcontext = CurrentMemoryContext;
+	ResourceOwner	oldowner = CurrentResourceOwner;
+	char		   *relname;
+	bool			result = true;
+
+	/* The relation has been dropped since the policy was read. */
+	if ((relname = get_rel_name(policy->relid)) == NULL)
+		return true;
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_TRY();
+	{
+		TimestampTz		cutoff;
+
+		cutoff = retention_cutoff(policy);
+
+		while (prune_step(policy, cutoff, rows_pruned, partitions_pruned))
+			CHECK_FOR_INTERRUPTS();
+
+		finish_pruning(policy, cutoff);
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+	}
+	PG_CATCH();
+	{
+		ErrorData	   *edata;
+
+		MemoryContextSwitchTo(oldcontext);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+
+		ereport(WARNING,
+				(errcode(edata->sqlerrcode),
+				 errmsg("history of relation \"%s\" is not pruned: %s",
+						relname, edata->message)));
+
+		FreeErrorData(edata);
+
+		result = false;
+	}
+	PG_END_TRY();
+
+	return result;
+}
+
+/*
+ * Read the retention policy of the relation or all the policies if relid is
+ * InvalidOid. The policies are allocated in the context. If the extension is
+ * not installed in the current database, or it is installed at a version
+ * that has no temporal_tables_retention table yet, there are no policies.
+ * The caller must be connected to SPI.
+ */
+static List *
+get_retention_policies(Oid relid, MemoryContext context)
+{
+	Oid				 argtypes[1] = { OIDOID };
+	Datum			 args[1];
+	StringInfoData	 querybuf;
+	List			*policies = NIL;
+	uint64			 row;
+	int				 ret;
+
+	/*
+	 * The table is in the schema of the extension, which is relocatable, and
+	 * it is created by the upgrade to 1.3.0, which may not have been run.
+	 */
+	if ((ret = SPI_execute("SELECT pg_catalog.quote_ident(n.nspname) "
+						   "FROM pg_catalog.pg_extension e "
+						   "JOIN pg_catalog.pg_namespace n ON n.oid = e.extnamespace "
+						   "WHERE e.extname = 'temporal_tables' "
+						   "AND pg_catalog.to_regclass(pg_catalog.quote_ident(n.nspname) "
+						   "OPERATOR(pg_catalog.||) '.temporal_tables_retention') IS NOT NULL",
+						   true, 1)) != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %d", ret);
+
+	if (SPI_processed == 0)
+		return NIL;
+
+	/*
+	 * The query string build is
+	 * 		SELECT relation, retention, batch_size, detach_partitions
+	 * 		FROM <schema>.temporal_tables_retention
+	 * 		WHERE $1 = 0 OR relation = $1
+	 */
+	initStringInfo(&querybuf);
+
+	appendStringInfo(&querybuf,
+					 "SELECT relation, retention, batch_size, detach_partitions "
+					 "FROM %s.temporal_tables_retention "
+					 "WHERE $1 = 0 OR relation = $1 ORDER BY relation",
+					 SPI_getvalue(SPI_tuptable->vals[0],
+								  SPI_tuptable->tupdesc, 1));
+
+	args[0] = ObjectIdGetDatum(relid);
+
+	if ((ret = SPI_execute_with_args(querybuf.data, 1, argtypes, args, NULL,
+									 true, 0)) != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute_with_args returned %d", ret);
+
+	for (row = 0; row < SPI_processed; ++row)
+	{
+		HeapTuple		 tuple = SPI_tuptable->vals[row];
+		TupleDesc		 tupdesc = SPI_tuptable->tupdesc;
+		RetentionPolicy	*policy;
+		MemoryContext	 oldcontext;
+		bool			 isnull;
+
+		oldcontext = MemoryContextSwitchTo(context);
+
+		policy = palloc(sizeof(RetentionPolicy));
+		policy->relid = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 1,
+													   &isnull));
+		policy->retention = DatumGetIntervalP(datumCopy(SPI_getbinval(tuple, tupdesc, 2,
+																	  &isnull),
+														false,
+														sizeof(Interval)));
+		policy->batch_size = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 3,
+														 &isnull));
+		policy->detach_partitions = DatumGetBool(SPI_getbinval(tuple, tupdesc,
+															   4, &isnull));
+
+		policies = lappend(policies, policy);
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	pfree(querybuf.data);
+
+	return policies;
+}
+
+/*
+ * Return the time before which the history rows of the policy expire.
+ */
+static TimestampTz
+retention_cutoff(RetentionPolicy *policy)
+{
+	return DatumGetTimestampTz(DirectFunctionCall2(timestamptz_mi_interval,
+												   TimestampTzGetDatum(GetCurrentTimestamp()),
+												   IntervalPGetDatum(policy->retention)));
+}
+
+/*
+ * Open the history relation of the relation of the policy with
+ * AccessShareLock. Return NULL if the relation has been dropped.
+ */
+static Relation
+open_pruned_history_relation(RetentionPolicy *policy, char **period_attname)
+{
+	Relation	relation;
+	Oid			history_relid;
+
+	relation = try_relation_open(policy->relid, AccessShareLock);
+
+	if (relation == NULL)
+		return NULL;
+
+	history_relid = get_history_relation(relation, period_attname);
+
+	relation_close(relation, AccessShareLock);
+
+	return relation_open(history_relid, AccessShareLock);
+}
+
+/*
+ * Remove a batch of the expired history rows or an expired partition of the
+ * history relation of the policy. Return true if there may be more expired
+ * rows to remove. The caller must be connected to SPI.
+ *
+ * If the history relation is partitioned by the upper bound of the system
+ * period, the partitions that have expired entirely are dropped or detached,
+ * one per call. Otherwise, up to batch_size history rows with the oldest
+ * upper bounds are deleted, so an index on the upper bound of the system
+ * period makes the batches cheap.
+ */
+static bool
+prune_step(RetentionPolicy *policy,
+		   TimestampTz cutoff,
+		   int64 *rows_pruned,
+		   int *partitions_pruned)
+{
+	Relation		 history_relation;
+	char			*period_attname;
+	char			*history_relation_name;
+	VersioningStats	*stats;
+	Oid				 argtypes[2] = { TIMESTAMPTZOID, INT4OID };
+	Datum			 args[2];
+	StringInfoData	 querybuf;
+	int				 ret;
+
+	history_relation = open_pruned_history_relation(policy, &period_attname);
+
+	/* The relation has been dropped since the policy was read. */
+	if (history_relation == NULL)
+		return false;
+
+	stats = get_versioning_stats(policy->relid);
+
+	if (history_relation->rd_rel->relkind == RELKIND_PARTITIONED_TABLE)
+	{
+#if PG_VERSION_NUM >= 140000
+		if (is_partitioned_by_upper(history_relation,
+									SPI_fnumber(RelationGetDescr(history_relation),
+												period_attname)))
+		{
+			Oid		partition_relid;
+
+			Oid		history_relid = RelationGetRelid(history_relation);
+
+			partition_relid = find_expired_partition(history_relation, cutoff);
+
+			/* ALTER TABLE fails if the history relation is open. */
+			relation_close(history_relation, NoLock);
+
+			if (OidIsValid(partition_relid))
+			{
+				remove_history_partition(history_relid, partition_relid,
+										 policy->detach_partitions);
+
+				(*partitions_pruned)++;
+				stats->counters[VERSIONING_STATS_PARTITIONS_PRUNED]++;
+			}
+
+			return OidIsValid(partition_relid);
+		}
+#endif
+
+		ereport(WARNING,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("history relation \"%s\" is not partitioned by the upper bound of the system period, so it is not pruned",
+						RelationGetRelationName(history_relation))));
+
+		relation_close(history_relation, NoLock);
+
+		return false;
+	}
+
+	history_relation_name =
+		quote_qualified_identifier(get_namespace_name(RelationGetNamespace(history_relation)),
+								   RelationGetRelationName(history_relation));
+
+	relation_close(history_relation, NoLock);
+
+	/*
+	 * The query string build is
+	 * 		DELETE FROM ONLY <history_relation> WHERE ctid = ANY (ARRAY(
+	 * 			SELECT ctid FROM ONLY <history_relation>
+	 * 			WHERE upper(<system_period>) < $1
+	 * 			ORDER BY upper(<system_period>) LIMIT $2))
+	 *
+	 * The children of the history relation, if any, have policies of their
+	 * own.
+	 */
+	initStringInfo(&querybuf);
+
+	appendStringInfo(&querybuf,
+					 "DELETE FROM ONLY %s WHERE ctid = ANY (ARRAY("
+					 "SELECT ctid FROM ONLY %s WHERE pg_catalog.upper(%s) < $1 "
+					 "ORDER BY pg_catalog.upper(%s) LIMIT $2))",
+					 history_relation_name, history_relation_name,
+					 quote_identifier(period_attname),
+					 quote_identifier(period_attname));
+
+	args[0] = TimestampTzGetDatum(cutoff);
+	args[1] = Int32GetDatum(policy->batch_size);
+
+	if ((ret = SPI_execute_with_args(querybuf.data, 2, argtypes, args, NULL,
+									 false, 0)) != SPI_OK_DELETE)
+		elog(ERROR, "SPI_execute_with_args returned %d", ret);
+
+	*rows_pruned += SPI_processed;
+	stats->counters[VERSIONING_STATS_ROWS_PRUNED] += SPI_processed;
+
+	pfree(querybuf.data);
+
+	return SPI_processed >= (uint64) policy->batch_size;
+}
+
+/*
+ * Record the time of the pruning and its lag: how long the oldest history row
+ * left has been past the retention. The caller must be connected to SPI.
+ */
+static void
+finish_pruning(RetentionPolicy *policy, TimestampTz cutoff)
+{
+	Relation		 history_relation;
+	char			*period_attname;
+	VersioningStats	*stats;
+	Oid				 argtypes[1] = { TIMESTAMPTZOID };
+	Datum			 args[1];
+	StringInfoData	 querybuf;
+	double			 lag = 0;
+	int				 ret;
+
+	history_relation = open_pruned_history_relation(policy, &period_attname);
+
+	if (history_relation == NULL)
+		return;
+
+	/*
+	 * The query string build is
+	 * 		SELECT upper(<system_period>) FROM ONLY <history_relation>
+	 * 		WHERE upper(<system_period>) < $1
+	 * 		ORDER BY upper(<system_period>) LIMIT 1
+	 *
+	 * As in prune_step, the children of the history relation have policies
+	 * of their own, unless it is partitioned.
+	 */
+	initStringInfo(&querybuf);
+
+	appendStringInfo(&querybuf,
+					 "SELECT pg_catalog.upper(%s) FROM %s%s "
+					 "WHERE pg_catalog.upper(%s) < $1 "
+					 "ORDER BY pg_catalog.upper(%s) LIMIT 1",
+					 quote_identifier(period_attname),
+					 history_relation->rd_rel->relkind == RELKIND_PARTITIONED_TABLE ?
+					 "" : "ONLY ",
+					 quote_qualified_identifier(get_namespace_name(RelationGetNamespace(history_relation)),
+												RelationGetRelationName(history_relation)),
+					 quote_identifier(period_attname),
+					 quote_identifier(period_attname));
+
+	relation_close(history_relation, NoLock);
+
+	args[0] = TimestampTzGetDatum(cutoff);
+
+	if ((ret = SPI_execute_with_args(querybuf.data, 1, argtypes, args, NULL,
+									 true, 1)) != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute_with_args returned %d", ret);
+
+	if (SPI_processed > 0)
+	{
+		bool		isnull;
+		TimestampTz	oldest;
+
+		oldest = DatumGetTimestampTz(SPI_getbinval(SPI_tuptable->vals[0],
+												   SPI_tuptable->tupdesc, 1,
+												   &isnull));
+
+		lag = (double) (cutoff - oldest) / USECS_PER_SEC;
+	}
+
+	stats = get_versioning_stats(policy->relid);
+	stats->last_prune = GetCurrentTimestamp();
+	stats->prune_lag = lag;
+
+	pfree(querybuf.data);
+}
+
+#if PG_VERSION_NUM >= 140000
+/*
+ * Return the first partition of the history relation which upper bound is
+ * less than or equal to the cutoff, so all its rows have expired, or
+ * InvalidOid if there is no such partition.
+ */
+static Oid
+find_expired_partition(Relation history_relation, TimestampTz cutoff)
+{
+	PartitionDesc		 partdesc;
+	PartitionBoundInfo	 boundinfo;
+	int					 i;
+
+	partdesc = RelationGetPartitionDesc(history_relation, true);
+	boundinfo = partdesc->boundinfo;
+
+	if (partdesc->nparts == 0)
+		return InvalidOid;
+
+	/*
+	 * The partition at indexes[i] covers the values from datums[i - 1] to
+	 * datums[i], and the bounds are sorted, so the search stops at the first
+	 * upper bound after the cutoff.
+	 */
+	for (i = 1; i < boundinfo->ndatums; ++i)
+	{
+		if (boundinfo->kind[i][0] != PARTITION_RANGE_DATUM_VALUE ||
+			DatumGetTimestampTz(boundinfo->datums[i][0]) > cutoff)
+			break;
+
+		if (boundinfo->indexes[i] >= 0)
+			return partdesc->oids[boundinfo->indexes[i]];
+	}
+
+	return InvalidOid;
+}
+
+/*
+ * Detach the partition from the history relation and drop it unless detach
+ * is true. The history relation must not be open, or ALTER TABLE fails. The
+ * caller must be connected to SPI.
+ */
+static void
+remove_history_partition(Oid history_relid,
+						 Oid partition_relid,
+						 bool detach)
+{
+	char	*history_relname;
+	char	*relname;
+	char	*partname;
+	char	*query;
+	int		 ret;
+
+	history_relname = get_rel_name(history_relid);
+	relname = get_rel_name(partition_relid);
+	partname = quote_qualified_identifier(get_namespace_name(get_rel_namespace(partition_relid)),
+										  relname);
+
+	query = psprintf("ALTER TABLE %s DETACH PARTITION %s",
+					 quote_qualified_identifier(get_namespace_name(get_rel_namespace(history_relid)),
+												history_relname),
+					 partname);
+
+	if ((ret = SPI_execute(query, false, 0)) != SPI_OK_UTILITY)
+		elog(ERROR, "SPI_execute returned %d", ret);
+
+	pfree(query);
+
+	if (!detach)
+	{
+		query = psprintf("DROP TABLE %s", partname);
+
+		if ((ret = SPI_execute(query, false, 0)) != SPI_OK_UTILITY)
+			elog(ERROR, "SPI_execute returned %d", ret);
+
+		pfree(query);
+	}
+
+	if (detach)
+		ereport(NOTICE,
+				(errmsg("detached partition \"%s\" of history relation \"%s\"",
+						relname, history_relname)));
+	else
+		ereport(NOTICE,
+				(errmsg("dropped partition \"%s\" of history relation \"%s\"",
+						relname, history_relname)));
+
+	pfree(history_relname);
+	pfree(relname);
+	pfree(partname);
+}
+
+/*
+ * Return the first leaf partition of the history relation which upper bound
+ * is less than or equal to the cutoff and which table access method is not
+ * the specified one, or InvalidOid if there is no such partition.
+ */
+static Oid
+find_untiered_partition(Relation history_relation,
+						TimestampTz cutoff,
+						Oid amoid)
+{
+	PartitionDesc		 partdesc;
+	PartitionBoundInfo	 boundinfo;
+	int					 i;
+
+	partdesc = RelationGetPartitionDesc(history_relation, true);
+	boundinfo = partdesc->boundinfo;
+
+	if (partdesc->nparts == 0)
+		return InvalidOid;
+
+	/* The bounds are searched the same way find_expired_partition does. */
+	for (i = 1; i < boundinfo->ndatums; ++i)
+	{
+		Oid				partition_relid;
+		HeapTuple		tuple;
+		Form_pg_class	classform;
+		bool			untiered;
+
+		if (boundinfo->kind[i][0] != PARTITION_RANGE_DATUM_VALUE ||
+			DatumGetTimestampTz(boundinfo->datums[i][0]) > cutoff)
+			break;
+
+		if (boundinfo->indexes[i] < 0 ||
+			!partdesc->is_leaf[boundinfo->indexes[i]])
+			continue;
+
+		partition_relid = partdesc->oids[boundinfo->indexes[i]];
+
+		tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(partition_relid));
+
+		if (!HeapTupleIsValid(tuple))
+			elog(ERROR, "cache lookup failed for relation %u", partition_relid);
+
+		classform = (Form_pg_class) GETSTRUCT(tuple);
+
+		/* Foreign tables have no access method and stay where they are. */
+		untiered = classform->relkind == RELKIND_RELATION &&
+			classform->relam != amoid;
+
+		ReleaseSysCache(tuple);
+
+		if (untiered)
+			return partition_relid;
+	}
+
+	return InvalidOid;
+}
+
+/*
+ * Replace the partition of the history relation with a copy of it that has
+ * the table access method and return the OID of the copy. The caller must be
+ * connected to SPI.
+ *
+ * The copy has the columns, defaults and constraints of the partition, and
+ * the indexes of the history relation are created on it when it is attached,
+ * but the storage parameters are not copied since they are specific to the
+ * access method.
+ */
+static Oid
+move_history_partition(Oid history_relid,
+					   Oid partition_relid,
+					   const char *amname,
+					   int64 *rows_moved)
+{
+	Oid				 argtypes[1] = { OIDOID };
+	Datum			 args[1];
+	Oid				 nspid;
+	char			*nspname;
+	char			*relname;
+	char			*partname;
+	char			*tmpname;
+	char			*history_relation_name;
+	char			*bound;
+	char			*query;
+	Oid				 copy_relid;
+	int				 ret;
+
+	nspid = get_rel_namespace(partition_relid);
+	nspname = get_namespace_name(nspid);
+	relname = get_rel_name(partition_relid);
+	partname = quote_qualified_identifier(nspname, relname);
+	tmpname = ChooseRelationName(relname, NULL, "tier", nspid, false);
+	history_relation_name =
+		quote_qualified_identifier(get_namespace_name(get_rel_namespace(history_relid)),
+								   get_rel_name(history_relid));
+
+	args[0] = ObjectIdGetDatum(partition_relid);
+
+	if ((ret = SPI_execute_with_args("SELECT pg_catalog.pg_get_expr(relpartbound, oid) "
+									 "FROM pg_catalog.pg_class WHERE oid = $1",
+									 1, argtypes, args, NULL,
+									 true, 1)) != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute_with_args returned %d", ret);
+
+	if (SPI_processed == 0)
+		elog(ERROR, "cache lookup failed for relation %u", partition_relid);
+
+	bound = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+
+	/*
+	 * The partition is detached first, so that no history rows are archived
+	 * into it while it is copied.
+	 */
+	query = psprintf("ALTER TABLE %s DETACH PARTITION %s",
+					 history_relation_name, partname);
+
+	if ((ret = SPI_execute(query, false, 0)) != SPI_OK_UTILITY)
+		elog(ERROR, "SPI_execute returned %d", ret);
+
+	query = psprintf("CREATE TABLE %s "
+					 "(LIKE %s INCLUDING DEFAULTS INCLUDING CONSTRAINTS) "
+					 "USING %s",
+					 quote_qualified_identifier(nspname, tmpname), partname,
+					 quote_identifier(amname));
+
+	if ((ret = SPI_execute(query, false, 0)) != SPI_OK_UTILITY)
+		elog(ERROR, "SPI_execute returned %d", ret);
+
+	query = psprintf("INSERT INTO %s SELECT * FROM %s",
+					 quote_qualified_identifier(nspname, tmpname), partname);
+
+	if ((ret = SPI_execute(query, false, 0)) != SPI_OK_INSERT)
+		elog(ERROR, "SPI_execute returned %d", ret);
+
+	*rows_moved = SPI_processed;
+
+	query = psprintf("DROP TABLE %s", partname);
+
+	if ((ret = SPI_execute(query, false, 0)) != SPI_OK_UTILITY)
+		elog(ERROR, "SPI_execute returned %d", ret);
+
+	query = psprintf("ALTER TABLE %s RENAME TO %s",
+					 quote_qualified_identifier(nspname, tmpname),
+					 quote_identifier(relname));
+
+	if ((ret = SPI_execute(query, false, 0)) != SPI_OK_UTILITY)
+		elog(ERROR, "SPI_execute returned %d", ret);
+
+	query = psprintf("ALTER TABLE %s ATTACH PARTITION %s %s",
+					 history_relation_name, partname, bound);
+
+	if ((ret = SPI_execute(query, false, 0)) != SPI_OK_UTILITY)
+		elog(ERROR, "SPI_execute returned %d", ret);
+
+	copy_relid = get_relname_relid(relname, nspid);
+
+	ereport(NOTICE,
+			(errmsg("moved partition \"%s\" of history relation \"%s\" to access method \"%s\"",
+					relname, get_rel_name(history_relid), amname)));
+
+	pfree(query);
+	pfree(relname);
+	pfree(partname);
+	pfree(tmpname);
+
+	return copy_relid;
+}
+#endif
+#endif
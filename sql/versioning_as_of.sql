@@ -0,0 +1,52 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE versioning_as_of (a bigint, "b b" text, sys_period tstzrange);
+
+CREATE TABLE versioning_as_of_history (a bigint, c text, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_as_of
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_as_of_history', false);
+
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+INSERT INTO versioning_as_of (a, "b b") VALUES (1, 'x'), (2, 'y');
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2002-01-01');
+
+UPDATE versioning_as_of SET a = 3 WHERE a = 1;
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2003-01-01');
+
+DELETE FROM versioning_as_of WHERE a = 2;
+
+COMMIT;
+
+-- Attributes that the history table does not have are nulls in the history rows.
+SELECT * FROM versioning_as_of(NULL::versioning_as_of, '2000-06-01') ORDER BY a;
+
+SELECT * FROM versioning_as_of(NULL::versioning_as_of, '2001-06-01') ORDER BY a;
+
+SELECT * FROM versioning_as_of(NULL::versioning_as_of, '2002-01-01') ORDER BY a;
+
+SELECT * FROM versioning_as_of(NULL::versioning_as_of, '2003-06-01') ORDER BY a;
+
+SELECT * FROM versioning_as_of(NULL::versioning_as_of, NULL) ORDER BY a;
+
+-- Errors.
+SELECT * FROM versioning_as_of(NULL::versioning_as_of_history, '2001-01-01');
+
+SELECT * FROM versioning_as_of(1, '2001-01-01');
+
+DROP TABLE versioning_as_of;
+DROP TABLE versioning_as_of_history;
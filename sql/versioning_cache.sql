@@ -0,0 +1,89 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE versioning_cache_a (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_cache_a_history (a bigint, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_cache_a
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_cache_a_history', false);
+
+CREATE TABLE versioning_cache_b (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_cache_b_history (a bigint, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_cache_b
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_cache_b_history', false);
+
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+INSERT INTO versioning_cache_a (a) VALUES (1);
+INSERT INTO versioning_cache_b (a) VALUES (1);
+
+COMMIT;
+
+-- Keep no cached data of the tables not used in the current transaction.
+SET temporal_tables.max_cache_size = 0;
+
+BEGIN;
+
+SELECT set_system_time('2002-01-01');
+
+UPDATE versioning_cache_a SET a = a + 1;
+
+COMMIT;
+
+-- The cached data of versioning_cache_a is evicted.
+BEGIN;
+
+SELECT set_system_time('2003-01-01');
+
+UPDATE versioning_cache_b SET a = a + 1;
+
+COMMIT;
+
+-- The cached data of versioning_cache_a is filled again and the one of
+-- versioning_cache_b is evicted.
+BEGIN;
+
+SELECT set_system_time('2004-01-01');
+
+UPDATE versioning_cache_a SET a = a + 1;
+
+COMMIT;
+
+-- Both tables are used in the same transaction, so nothing is evicted.
+BEGIN;
+
+SELECT set_system_time('2005-01-01');
+
+UPDATE versioning_cache_a SET a = a + 1;
+UPDATE versioning_cache_b SET a = a + 1;
+
+COMMIT;
+
+RESET temporal_tables.max_cache_size;
+
+BEGIN;
+
+SELECT set_system_time('2006-01-01');
+
+UPDATE versioning_cache_a SET a = a + 1;
+UPDATE versioning_cache_b SET a = a + 1;
+
+COMMIT;
+
+SELECT relname, cache_misses, cache_rebuilds, cache_evictions
+FROM temporal_tables_stats WHERE relname LIKE 'versioning_cache_%' ORDER BY relname;
+
+SELECT a, sys_period FROM versioning_cache_a_history ORDER BY sys_period;
+
+SELECT set_system_time(NULL);
+
+DROP TABLE versioning_cache_a;
+DROP TABLE versioning_cache_a_history;
+DROP TABLE versioning_cache_b;
+DROP TABLE versioning_cache_b_history;
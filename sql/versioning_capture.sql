@@ -0,0 +1,71 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE versioning_capture (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_capture_history (a bigint, sys_period tstzrange);
+
+-- An unknown capture engine.
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_capture
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_capture_history', false, 'capture=wal');
+
+INSERT INTO versioning_capture (a) VALUES (1);
+
+DROP TRIGGER versioning_trigger ON versioning_capture;
+
+-- The capture worker does not archive the rows in the delta format.
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_capture
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_capture_history', false, 'capture=logical', 'delta_column=a');
+
+INSERT INTO versioning_capture (a) VALUES (1);
+
+DROP TRIGGER versioning_trigger ON versioning_capture;
+
+-- Nor does it archive the rows along with the statement-level triggers.
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_capture
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_capture_history', false, 'capture=logical');
+
+CREATE TRIGGER versioning_update_trigger
+AFTER UPDATE ON versioning_capture
+REFERENCING OLD TABLE AS old_rows
+FOR EACH STATEMENT EXECUTE PROCEDURE versioning_statement('sys_period', 'versioning_capture_history', false);
+
+INSERT INTO versioning_capture (a) VALUES (1);
+
+DROP TRIGGER versioning_update_trigger ON versioning_capture;
+
+-- The old rows are written to the WAL in full only with REPLICA IDENTITY FULL.
+INSERT INTO versioning_capture (a) VALUES (1);
+
+DROP TRIGGER versioning_trigger ON versioning_capture;
+
+-- capture=trigger archives the rows in the trigger as usual.
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_capture
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_capture_history', false, 'capture=trigger');
+
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+INSERT INTO versioning_capture (a) VALUES (1);
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2002-01-01');
+
+UPDATE versioning_capture SET a = 2;
+
+COMMIT;
+
+SELECT a, sys_period FROM versioning_capture ORDER BY a;
+
+SELECT a, sys_period FROM versioning_capture_history ORDER BY a;
+
+DROP TABLE versioning_capture;
+
+DROP TABLE versioning_capture_history;
@@ -0,0 +1,100 @@
+SET TIME ZONE 'UTC';
+
+-- The capture worker works in the background, so wait for it to catch up.
+CREATE FUNCTION wait_for_capture(condition text)
+RETURNS boolean AS $$
+DECLARE
+  done boolean;
+BEGIN
+  FOR i IN 1 .. 3000 LOOP
+    EXECUTE condition INTO done;
+    IF done THEN
+      RETURN true;
+    END IF;
+    PERFORM pg_sleep(0.1);
+  END LOOP;
+  RETURN false;
+END;
+$$ LANGUAGE plpgsql;
+
+-- The worker creates its slot once the extension is installed.
+SELECT wait_for_capture($$SELECT EXISTS (SELECT 1 FROM pg_replication_slots WHERE slot_name = 'temporal_tables')$$);
+
+-- A slot of the test shows what the output plugin writes.
+SELECT 'init' FROM pg_create_logical_replication_slot('regression_slot', 'temporal_tables');
+
+CREATE TABLE versioning_capture_decoding (a bigint, b text, sys_period tstzrange);
+
+ALTER TABLE versioning_capture_decoding REPLICA IDENTITY FULL;
+
+CREATE TABLE versioning_capture_decoding_history (a bigint, b text, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_capture_decoding
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_capture_decoding_history', false, 'capture=logical');
+
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+INSERT INTO versioning_capture_decoding (a, b) VALUES (1, 'one'), (2, 'two'), (3, 'three');
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2002-01-01');
+
+UPDATE versioning_capture_decoding SET b = 'uno' WHERE a = 1;
+
+DELETE FROM versioning_capture_decoding WHERE a = 2;
+
+COMMIT;
+
+-- The trigger archives nothing itself.
+SELECT a, b, sys_period FROM versioning_capture_decoding ORDER BY a;
+
+SELECT count(*) FROM versioning_capture_decoding_history;
+
+-- The inserted rows are not written, the old rows are written with the
+-- upper bounds of their history rows.
+SELECT regexp_replace(data, '^' || 'versioning_capture_decoding'::regclass::oid || ' ', 'versioning_capture_decoding ') AS data
+FROM pg_logical_slot_get_changes('regression_slot', NULL, NULL);
+
+-- The worker archives the rows it decodes from its own slot.
+SELECT wait_for_capture($$SELECT count(*) = 2 FROM versioning_capture_decoding_history$$);
+
+SELECT a, b, sys_period FROM versioning_capture_decoding_history ORDER BY a;
+
+-- A row that is decoded with a column the table no longer has is quarantined.
+BEGIN;
+
+SELECT set_system_time('2003-01-01');
+
+UPDATE versioning_capture_decoding SET b = 'tres' WHERE a = 3;
+
+ALTER TABLE versioning_capture_decoding RENAME COLUMN b TO c;
+
+COMMIT;
+
+SELECT regexp_replace(data, '^' || 'versioning_capture_decoding'::regclass::oid || ' ', 'versioning_capture_decoding ') AS data
+FROM pg_logical_slot_get_changes('regression_slot', NULL, NULL);
+
+SELECT wait_for_capture($$SELECT count(*) = 1 FROM temporal_tables_capture_failed$$);
+
+SELECT slot_name,
+       regexp_replace(line, '^' || 'versioning_capture_decoding'::regclass::oid || ' ', 'versioning_capture_decoding ') AS line,
+       error
+FROM temporal_tables_capture_failed;
+
+SELECT a, b, sys_period FROM versioning_capture_decoding_history ORDER BY a;
+
+SELECT pg_drop_replication_slot('regression_slot');
+
+DROP TABLE versioning_capture_decoding;
+
+DROP TABLE versioning_capture_decoding_history;
+
+DROP FUNCTION wait_for_capture(text);
+
+DELETE FROM temporal_tables_capture_failed;
@@ -0,0 +1,60 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE create_history (a smallint, b bigint, c text, d integer PRIMARY KEY, e boolean, f timestamptz, sys_period tstzrange);
+
+SELECT create_history_table('create_history', key_index => true);
+
+-- The fixed-length columns come first, by descending alignment.
+SELECT attname, format_type(atttypid, atttypmod)
+FROM pg_attribute
+WHERE attrelid = 'create_history_history'::regclass AND attnum > 0
+ORDER BY attnum;
+
+SELECT 'fillfactor=100' = ANY(reloptions) FROM pg_class WHERE oid = 'create_history_history'::regclass;
+
+SELECT indexdef FROM pg_indexes WHERE tablename = 'create_history_history' ORDER BY indexname;
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON create_history
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'create_history_history', false);
+
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+INSERT INTO create_history (a, b, c, d, e, f) VALUES (1, 2, 'three', 4, true, '2000-01-01');
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2002-01-01');
+
+UPDATE create_history SET c = 'four' WHERE d = 4;
+
+COMMIT;
+
+SELECT set_system_time(NULL);
+
+SELECT * FROM create_history_history;
+
+-- The history relation can be named.
+SELECT create_history_table('create_history', 'create_history_log');
+
+-- Invalid system period.
+SELECT create_history_table('create_history', 'create_history_invalid', 'period');
+
+SELECT create_history_table('create_history', 'create_history_invalid', 'c');
+
+-- The key index requires a primary key.
+CREATE TABLE create_history_no_key (a bigint, sys_period tstzrange);
+
+SELECT create_history_table('create_history_no_key', key_index => true);
+
+DROP TABLE create_history;
+
+DROP TABLE create_history_history;
+
+DROP TABLE create_history_log;
+
+DROP TABLE create_history_no_key;
@@ -0,0 +1,65 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE versioning_current_period (a bigint, sys_period tstzrange NOT NULL DEFAULT versioning_current_period());
+
+CREATE TABLE versioning_current_period_history (a bigint, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE UPDATE OR DELETE ON versioning_current_period
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_current_period_history', false);
+
+-- Insert.
+BEGIN;
+
+INSERT INTO versioning_current_period (a) VALUES (1);
+
+SELECT a, lower(sys_period) = CURRENT_TIMESTAMP, upper_inf(sys_period) FROM versioning_current_period ORDER BY a;
+
+COMMIT;
+
+-- Insert with custom system time.
+BEGIN;
+
+SELECT set_system_time('2001-01-01'::timestamptz);
+
+SELECT versioning_current_period();
+
+INSERT INTO versioning_current_period (a) VALUES (2);
+
+COPY versioning_current_period (a) FROM stdin;
+3
+4
+\.
+
+SELECT a, sys_period FROM versioning_current_period WHERE a > 1 ORDER BY a;
+
+COMMIT;
+
+-- Update.
+BEGIN;
+
+SELECT set_system_time('2001-02-01');
+
+UPDATE versioning_current_period SET a = 5 WHERE a = 2;
+
+SELECT a, sys_period FROM versioning_current_period WHERE a > 1 ORDER BY a;
+
+SELECT a, sys_period FROM versioning_current_period_history ORDER BY a, sys_period;
+
+COMMIT;
+
+-- Delete.
+BEGIN;
+
+SELECT set_system_time('2001-03-01');
+
+DELETE FROM versioning_current_period WHERE a = 3;
+
+SELECT a, sys_period FROM versioning_current_period_history ORDER BY a, sys_period;
+
+COMMIT;
+
+SELECT set_system_time(NULL);
+
+DROP TABLE versioning_current_period;
+DROP TABLE versioning_current_period_history;
@@ -0,0 +1,95 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE versioning_deferred (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_deferred_history (a bigint, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_deferred
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_deferred_history', false);
+
+BEGIN;
+
+SELECT set_system_time('2000-01-01');
+
+INSERT INTO versioning_deferred (a) VALUES (1), (2), (10);
+
+COMMIT;
+
+SET temporal_tables.defer_history = on;
+
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+-- The history row is not inserted when the command finishes.
+UPDATE versioning_deferred SET a = 3 WHERE a = 1;
+
+SELECT pg_stat_get_xact_tuples_inserted(oid) FROM pg_class WHERE relname = 'versioning_deferred_history';
+
+-- The history rows of a rolled back subtransaction are never inserted.
+SAVEPOINT s;
+
+DELETE FROM versioning_deferred WHERE a = 2;
+
+ROLLBACK TO SAVEPOINT s;
+
+SELECT pg_stat_get_xact_tuples_inserted(oid) FROM pg_class WHERE relname = 'versioning_deferred_history';
+
+-- A query that reads the history table sees the deferred rows.
+SELECT a, sys_period FROM versioning_deferred_history ORDER BY a;
+
+SELECT pg_stat_get_xact_tuples_inserted(oid) FROM pg_class WHERE relname = 'versioning_deferred_history';
+
+UPDATE versioning_deferred SET a = 4 WHERE a = 2;
+
+SELECT pg_stat_get_xact_tuples_inserted(oid) FROM pg_class WHERE relname = 'versioning_deferred_history';
+
+-- So does a query in a function, which runs with a snapshot of its own.
+DO $$
+BEGIN
+  RAISE NOTICE 'history rows: %',
+    (SELECT count(*) FROM versioning_deferred_history);
+END
+$$;
+
+DELETE FROM versioning_deferred WHERE a = 10;
+
+-- The remaining rows are inserted when the transaction commits.
+COMMIT;
+
+SELECT a, sys_period FROM versioning_deferred_history ORDER BY a;
+
+-- The deferred rows of an aborted transaction are never inserted.
+BEGIN;
+
+SELECT set_system_time('2002-01-01');
+
+DELETE FROM versioning_deferred;
+
+ROLLBACK;
+
+SELECT count(*) FROM versioning_deferred_history;
+
+-- Utility statements that use the history table see the deferred rows too.
+BEGIN;
+
+SELECT set_system_time('2003-01-01');
+
+DELETE FROM versioning_deferred WHERE a = 3;
+
+COPY versioning_deferred_history (a) TO STDOUT;
+
+-- The rows deferred before TRUNCATE are not inserted after it.
+TRUNCATE versioning_deferred_history;
+
+DELETE FROM versioning_deferred WHERE a = 4;
+
+COMMIT;
+
+SELECT a FROM versioning_deferred_history ORDER BY a;
+
+RESET temporal_tables.defer_history;
+
+DROP TABLE versioning_deferred;
+DROP TABLE versioning_deferred_history;
@@ -0,0 +1,183 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE versioning_delta (id bigint PRIMARY KEY, a text, b text, c int, sys_period tstzrange);
+
+CREATE TABLE versioning_delta_history (id bigint, a text, b text, c int, sys_period tstzrange, delta jsonb);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_delta
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_delta_history', false,
+                                          'delta_column=delta');
+
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+INSERT INTO versioning_delta VALUES (1, 'a1', 'b1', 1), (2, 'a2', 'b2', 2), (3, 'a3', 'b3', 3);
+
+COMMIT;
+
+-- Only the changed attributes are archived.
+BEGIN;
+
+SELECT set_system_time('2002-01-01');
+
+UPDATE versioning_delta SET a = 'a1x' WHERE id = 1;
+
+COMMIT;
+
+-- The changes of the second update are added to the delta.
+BEGIN;
+
+SELECT set_system_time('2003-01-01');
+
+UPDATE versioning_delta SET b = NULL, c = 10 WHERE id = 1;
+UPDATE versioning_delta SET a = 'a1y' WHERE id = 1;
+
+COMMIT;
+
+-- The delta of a deleted row is converted into a full history row.
+BEGIN;
+
+SELECT set_system_time('2004-01-01');
+
+UPDATE versioning_delta SET a = 'a2x' WHERE id = 2;
+DELETE FROM versioning_delta WHERE id = 2;
+
+COMMIT;
+
+-- A row whose primary key changes is archived in full.
+BEGIN;
+
+SELECT set_system_time('2005-01-01');
+
+UPDATE versioning_delta SET id = 4 WHERE id = 3;
+
+COMMIT;
+
+SELECT * FROM versioning_delta ORDER BY id;
+
+SELECT * FROM versioning_delta_history ORDER BY id, sys_period;
+
+-- The versions are reconstructed from the newer ones.
+SELECT * FROM versioning_as_of(NULL::versioning_delta, '2001-06-01') ORDER BY id;
+
+SELECT * FROM versioning_as_of(NULL::versioning_delta, '2002-06-01') ORDER BY id;
+
+SELECT * FROM versioning_as_of(NULL::versioning_delta, '2003-06-01') ORDER BY id;
+
+SELECT * FROM versioning_as_of(NULL::versioning_delta, '2005-06-01') ORDER BY id;
+
+-- A column renamed after the rows were archived is not silently lost.
+ALTER TABLE versioning_delta RENAME COLUMN a TO x;
+
+SELECT * FROM versioning_as_of(NULL::versioning_delta, '2001-06-01') ORDER BY id;
+
+ALTER TABLE versioning_delta RENAME COLUMN x TO a;
+
+DROP TRIGGER versioning_trigger ON versioning_delta;
+
+-- Invalid delta columns.
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_delta
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_delta_history', false,
+                                          'delta_column=d');
+
+UPDATE versioning_delta SET a = 'a1z' WHERE id = 1;
+
+DROP TRIGGER versioning_trigger ON versioning_delta;
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_delta
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_delta_history', false,
+                                          'delta_column=a');
+
+UPDATE versioning_delta SET a = 'a1z' WHERE id = 1;
+
+DROP TRIGGER versioning_trigger ON versioning_delta;
+
+-- The versioned table must have a primary key.
+CREATE TABLE versioning_delta_nokey (id bigint, a text, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_delta_nokey
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_delta_history', false,
+                                          'delta_column=delta');
+
+INSERT INTO versioning_delta_nokey (id, a) VALUES (1, 'a1');
+
+UPDATE versioning_delta_nokey SET a = 'a1x';
+
+DROP TABLE versioning_delta_nokey;
+-- The old values are archived in the same format whatever the settings are.
+CREATE TABLE versioning_delta_style (id bigint PRIMARY KEY, d date, i interval, sys_period tstzrange);
+
+CREATE TABLE versioning_delta_style_history (id bigint, d date, i interval, sys_period tstzrange, delta jsonb);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_delta_style
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_delta_style_history', false,
+                                          'delta_column=delta');
+
+SET DateStyle = 'SQL, DMY';
+SET IntervalStyle = sql_standard;
+
+BEGIN;
+
+SELECT set_system_time('2006-01-01');
+
+INSERT INTO versioning_delta_style (id, d, i) VALUES (1, '2001-02-03', '1 day 2 hours');
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2007-01-01');
+
+UPDATE versioning_delta_style SET d = '2002-02-03', i = '3 days';
+
+COMMIT;
+
+SELECT delta FROM versioning_delta_style_history;
+
+SET DateStyle = 'SQL, MDY';
+RESET IntervalStyle;
+
+SELECT id, d, i FROM versioning_as_of(NULL::versioning_delta_style, '2006-06-01');
+
+RESET DateStyle;
+
+DROP TABLE versioning_delta_style;
+DROP TABLE versioning_delta_style_history;
+
+-- The delta history rows have nulls in the attributes that are not archived.
+CREATE TABLE versioning_delta_notnull (id bigint PRIMARY KEY, a text NOT NULL, sys_period tstzrange);
+
+CREATE TABLE versioning_delta_notnull_history (LIKE versioning_delta_notnull, delta jsonb);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_delta_notnull
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_delta_notnull_history', false,
+                                          'delta_column=delta');
+
+BEGIN;
+
+SELECT set_system_time('2006-01-01');
+
+INSERT INTO versioning_delta_notnull (id, a) VALUES (1, 'a1');
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2007-01-01');
+
+UPDATE versioning_delta_notnull SET a = 'a1x';
+
+COMMIT;
+
+DROP TABLE versioning_delta_notnull;
+DROP TABLE versioning_delta_notnull_history;
+
+DROP TABLE versioning_delta;
+DROP TABLE versioning_delta_history;
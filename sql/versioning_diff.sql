@@ -0,0 +1,112 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE versioning_diff (a bigint PRIMARY KEY, b text, sys_period tstzrange);
+
+CREATE TABLE versioning_diff_history (a bigint, b text, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_diff
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_diff_history', false);
+
+BEGIN;
+
+SELECT set_system_time('2000-01-01');
+
+INSERT INTO versioning_diff (a, b) VALUES (1, 'one'), (2, 'two'), (3, 'three');
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+UPDATE versioning_diff SET b = 'uno' WHERE a = 1;
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2002-01-01');
+
+DELETE FROM versioning_diff WHERE a = 3;
+
+INSERT INTO versioning_diff (a, b) VALUES (4, 'four');
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2003-01-01');
+
+UPDATE versioning_diff SET b = 'dos' WHERE a = 2;
+
+INSERT INTO versioning_diff (a, b) VALUES (5, 'five');
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2004-01-01');
+
+UPDATE versioning_diff SET b = 'deux' WHERE a = 2;
+
+DELETE FROM versioning_diff WHERE a = 5;
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2005-01-01');
+
+UPDATE versioning_diff SET b = b WHERE a = 4;
+
+COMMIT;
+
+SELECT set_system_time(NULL);
+
+SELECT operation, coalesce((old_row).a, (new_row).a) AS a,
+       (old_row).b AS old_b, (new_row).b AS new_b
+FROM temporal_diff(NULL::versioning_diff, '2000-06-01', '2003-06-01')
+ORDER BY a;
+
+SELECT operation, coalesce((old_row).a, (new_row).a) AS a,
+       (old_row).b AS old_b, (new_row).b AS new_b
+FROM temporal_diff(NULL::versioning_diff, '2003-06-01', '2004-06-01')
+ORDER BY a;
+
+-- A row inserted and deleted within the interval did not change anything.
+SELECT operation, coalesce((old_row).a, (new_row).a) AS a,
+       (old_row).b AS old_b, (new_row).b AS new_b
+FROM temporal_diff(NULL::versioning_diff, '2000-06-01', '2004-06-01')
+ORDER BY a;
+
+-- The versions are rows of the versioned relation.
+SELECT old_row, new_row
+FROM temporal_diff(NULL::versioning_diff, '2000-06-01', '2001-06-01');
+
+-- An update that changes nothing but the system period is no change.
+SELECT operation, coalesce((old_row).a, (new_row).a) AS a,
+       (old_row).b AS old_b, (new_row).b AS new_b
+FROM temporal_diff(NULL::versioning_diff, '2004-06-01', '2005-06-01')
+ORDER BY a;
+
+-- A null first point is the beginning of the history, a null second one is
+-- now.
+SELECT operation, coalesce((old_row).a, (new_row).a) AS a,
+       (old_row).b AS old_b, (new_row).b AS new_b
+FROM temporal_diff(NULL::versioning_diff, NULL, '2004-06-01')
+ORDER BY a;
+
+SELECT operation, coalesce((old_row).a, (new_row).a) AS a,
+       (old_row).b AS old_b, (new_row).b AS new_b
+FROM temporal_diff(NULL::versioning_diff, '2003-06-01', NULL)
+ORDER BY a;
+
+-- The versions are matched by the primary key.
+ALTER TABLE versioning_diff DROP CONSTRAINT versioning_diff_pkey;
+
+SELECT * FROM temporal_diff(NULL::versioning_diff, '2000-06-01', '2003-06-01');
+
+DROP TABLE versioning_diff;
+
+DROP TABLE versioning_diff_history;
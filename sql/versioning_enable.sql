@@ -0,0 +1,77 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE versioning_enable (a bigint PRIMARY KEY, b text);
+
+INSERT INTO versioning_enable VALUES (1, 'one'), (2, 'two');
+
+CREATE TABLE versioning_enable_history (a bigint, b text, sys_period tstzrange);
+
+-- The history relation is checked before the relation is changed.
+CREATE TABLE versioning_enable_bad_history (a bigint, b text);
+
+SELECT versioning_enable('versioning_enable', 'versioning_enable_bad_history');
+
+-- The columns of the history relation are checked as the trigger checks them.
+ALTER TABLE versioning_enable_bad_history ADD COLUMN sys_period tstzrange;
+
+ALTER TABLE versioning_enable_bad_history ALTER COLUMN b TYPE varchar;
+
+SELECT versioning_enable('versioning_enable', 'versioning_enable_bad_history');
+
+SELECT * FROM versioning_enable ORDER BY a;
+
+SELECT relfilenode AS filenode FROM pg_class WHERE oid = 'versioning_enable'::regclass \gset
+
+SELECT versioning_enable('versioning_enable', 'versioning_enable_history', '2000-01-01');
+
+-- The existing rows get the system period without the relation being rewritten.
+SELECT relfilenode = :filenode AS not_rewritten
+FROM pg_class
+WHERE oid = 'versioning_enable'::regclass;
+
+SELECT atthasmissing, atthasdef
+FROM pg_attribute
+WHERE attrelid = 'versioning_enable'::regclass AND attname = 'sys_period';
+
+SELECT tgname FROM pg_trigger WHERE tgrelid = 'versioning_enable'::regclass;
+
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+UPDATE versioning_enable SET b = 'uno' WHERE a = 1;
+
+INSERT INTO versioning_enable (a, b) VALUES (3, 'three');
+
+COMMIT;
+
+SELECT set_system_time(NULL);
+
+SELECT * FROM versioning_enable ORDER BY a;
+
+SELECT * FROM versioning_enable_history ORDER BY a, sys_period;
+
+SELECT versioning_enable('versioning_enable', 'versioning_enable_history');
+
+-- If the relation already has the system period column, the time applies to
+-- the rows that have no system period only.
+CREATE TABLE versioning_enable_existing (a bigint, sys_period tstzrange);
+
+INSERT INTO versioning_enable_existing
+VALUES (1, tstzrange('1999-01-01', NULL)), (2, NULL);
+
+CREATE TABLE versioning_enable_existing_history (a bigint, sys_period tstzrange);
+
+SELECT versioning_enable('versioning_enable_existing', 'versioning_enable_existing_history', '2000-01-01');
+
+SELECT * FROM versioning_enable_existing ORDER BY a;
+
+DROP TABLE versioning_enable;
+
+DROP TABLE versioning_enable_history;
+
+DROP TABLE versioning_enable_bad_history;
+
+DROP TABLE versioning_enable_existing;
+
+DROP TABLE versioning_enable_existing_history;
@@ -0,0 +1,130 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE versioning_partitioned (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_partitioned_history (a bigint, sys_period tstzrange)
+PARTITION BY RANGE (upper(sys_period));
+
+CREATE TABLE versioning_partitioned_history_2001 PARTITION OF versioning_partitioned_history
+FOR VALUES FROM ('2001-01-01') TO ('2002-01-01');
+
+-- The rows are inserted through the parent into the partition which columns
+-- are in a different order.
+CREATE TABLE versioning_partitioned_history_2002 (sys_period tstzrange, a bigint);
+ALTER TABLE versioning_partitioned_history ATTACH PARTITION versioning_partitioned_history_2002
+FOR VALUES FROM ('2002-01-01') TO ('2003-01-01');
+
+CREATE TABLE versioning_partitioned_history_default PARTITION OF versioning_partitioned_history
+DEFAULT;
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_partitioned
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_partitioned_history', false);
+
+-- Insert.
+BEGIN;
+
+SELECT set_system_time('2000-06-01');
+
+INSERT INTO versioning_partitioned (a) VALUES (1), (2);
+
+COMMIT;
+
+-- Update.
+BEGIN;
+
+SELECT set_system_time('2001-06-01');
+
+UPDATE versioning_partitioned SET a = 3 WHERE a = 1;
+
+COMMIT;
+
+-- Update, the row goes to the partition with a different layout.
+BEGIN;
+
+SELECT set_system_time('2002-06-01');
+
+UPDATE versioning_partitioned SET a = 4 WHERE a = 3;
+
+COMMIT;
+
+-- Delete, there is no partition for the row but the default one.
+BEGIN;
+
+SELECT set_system_time('2003-01-01');
+
+DELETE FROM versioning_partitioned WHERE a = 2;
+
+COMMIT;
+
+SELECT tableoid::regclass AS partition, a, sys_period FROM versioning_partitioned_history ORDER BY a;
+
+DROP TABLE versioning_partitioned;
+DROP TABLE versioning_partitioned_history;
+
+-- Create partitions automatically.
+CREATE TABLE versioning_partitioned_auto (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_partitioned_auto_history (a bigint, sys_period tstzrange)
+PARTITION BY RANGE (upper(sys_period));
+
+CREATE TABLE versioning_partitioned_auto_history_20010101 PARTITION OF versioning_partitioned_auto_history
+FOR VALUES FROM ('2001-01-01') TO ('2001-02-01');
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_partitioned_auto
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_partitioned_auto_history', false);
+
+SET temporal_tables.history_partition_interval = '1 month';
+
+-- Insert.
+BEGIN;
+
+SELECT set_system_time('2001-01-10');
+
+INSERT INTO versioning_partitioned_auto (a) VALUES (1);
+
+COMMIT;
+
+-- A partition is created since the row is close to the end of the last one.
+BEGIN;
+
+SELECT set_system_time('2001-01-20');
+
+UPDATE versioning_partitioned_auto SET a = 2 WHERE a = 1;
+
+COMMIT;
+
+-- Several partitions are created if the row is past the end of the last one.
+BEGIN;
+
+SELECT set_system_time('2001-03-15');
+
+UPDATE versioning_partitioned_auto SET a = 3 WHERE a = 2;
+
+COMMIT;
+
+SELECT tableoid::regclass AS partition, a, sys_period FROM versioning_partitioned_auto_history ORDER BY a;
+
+SELECT c.relname, pg_get_expr(c.relpartbound, c.oid)
+FROM pg_inherits i JOIN pg_class c ON c.oid = i.inhrelid
+WHERE i.inhparent = 'versioning_partitioned_auto_history'::regclass
+ORDER BY c.relname;
+
+-- The interval must be positive.
+SET temporal_tables.history_partition_interval = '0 days';
+
+BEGIN;
+
+SELECT set_system_time('2001-05-10');
+
+\set VERBOSITY terse
+UPDATE versioning_partitioned_auto SET a = 4 WHERE a = 3;
+\set VERBOSITY default
+
+ROLLBACK;
+
+RESET temporal_tables.history_partition_interval;
+
+DROP TABLE versioning_partitioned_auto;
+DROP TABLE versioning_partitioned_auto_history;
@@ -0,0 +1,44 @@
+CREATE TABLE versioning_prewarm (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_prewarm_history (a bigint, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_prewarm
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_prewarm_history', false);
+
+CREATE TABLE versioning_prewarm_broken (a bigint, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_prewarm_broken
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_prewarm_no_history', false);
+
+CREATE TABLE versioning_prewarm_plain (a bigint);
+
+-- Prewarm the listed relations.
+SELECT entries, elapsed >= interval '0' FROM temporal_tables_prewarm(ARRAY['versioning_prewarm', 'versioning_prewarm_plain']::regclass[]);
+
+-- Misconfigured triggers are skipped.
+SELECT entries FROM temporal_tables_prewarm(ARRAY['versioning_prewarm_broken', 'versioning_prewarm']::regclass[]);
+
+-- Prewarm all the relations.
+SET client_min_messages TO error;
+
+SELECT entries >= 1 FROM temporal_tables_prewarm();
+
+RESET client_min_messages;
+
+-- The prewarmed trigger works.
+BEGIN;
+
+INSERT INTO versioning_prewarm (a) VALUES (1);
+
+UPDATE versioning_prewarm SET a = 2;
+
+SELECT a, upper(sys_period) = CURRENT_TIMESTAMP FROM versioning_prewarm_history ORDER BY a, sys_period;
+
+COMMIT;
+
+DROP TABLE versioning_prewarm;
+DROP TABLE versioning_prewarm_history;
+DROP TABLE versioning_prewarm_broken;
+DROP TABLE versioning_prewarm_plain;
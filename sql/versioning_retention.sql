@@ -0,0 +1,144 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE versioning_retention (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_retention_history (a bigint, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_retention
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_retention_history', false);
+
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+INSERT INTO versioning_retention (a) VALUES (1), (2), (3);
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2002-01-01');
+
+UPDATE versioning_retention SET a = a + 10;
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2003-01-01');
+
+UPDATE versioning_retention SET a = a + 10 WHERE a = 11;
+
+COMMIT;
+
+SELECT set_system_time(NULL);
+
+UPDATE versioning_retention SET a = a + 100 WHERE a = 12;
+
+INSERT INTO temporal_tables_retention (relation, retention, batch_size)
+VALUES ('versioning_retention', '1 day', 3);
+
+-- The expired history rows are deleted in batches.
+SELECT relid::regclass, rows_pruned, partitions_pruned
+FROM temporal_tables_prune('versioning_retention');
+
+SELECT a, upper(sys_period) > now() - interval '1 day' AS kept
+FROM versioning_retention_history ORDER BY a;
+
+SELECT relname, rows_pruned, partitions_pruned, last_prune IS NOT NULL, prune_lag
+FROM temporal_tables_stats WHERE relid = 'versioning_retention'::regclass;
+
+-- Nothing is left to prune.
+SELECT relid::regclass, rows_pruned, partitions_pruned
+FROM temporal_tables_prune('versioning_retention');
+
+-- The expired partitions of a history table partitioned by the end of the
+-- system period are removed entirely.
+CREATE TABLE versioning_retention_parts (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_retention_parts_history (a bigint, sys_period tstzrange)
+PARTITION BY RANGE (upper(sys_period));
+
+CREATE TABLE versioning_retention_parts_2001 PARTITION OF versioning_retention_parts_history
+FOR VALUES FROM ('2001-01-01') TO ('2002-01-01');
+
+CREATE TABLE versioning_retention_parts_2002 PARTITION OF versioning_retention_parts_history
+FOR VALUES FROM ('2002-01-01') TO ('2003-01-01');
+
+CREATE TABLE versioning_retention_parts_default PARTITION OF versioning_retention_parts_history
+DEFAULT;
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_retention_parts
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_retention_parts_history', false);
+
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+INSERT INTO versioning_retention_parts (a) VALUES (1), (2);
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2001-06-01');
+
+UPDATE versioning_retention_parts SET a = a + 10 WHERE a = 1;
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2002-06-01');
+
+UPDATE versioning_retention_parts SET a = a + 10 WHERE a = 2;
+
+COMMIT;
+
+SELECT set_system_time(NULL);
+
+UPDATE versioning_retention_parts SET a = a + 100 WHERE a = 11;
+
+-- Only the first partition has expired entirely.
+INSERT INTO temporal_tables_retention (relation, retention)
+VALUES ('versioning_retention_parts', now() - '2002-07-01'::timestamptz);
+
+SELECT relid::regclass, rows_pruned, partitions_pruned
+FROM temporal_tables_prune('versioning_retention_parts');
+
+SELECT relname, partitions_pruned, prune_lag > 0 AS lagging
+FROM temporal_tables_stats WHERE relid = 'versioning_retention_parts'::regclass;
+
+-- Detach the partitions instead of dropping them.
+UPDATE temporal_tables_retention SET retention = '1 day', detach_partitions = true
+WHERE relation = 'versioning_retention_parts'::regclass;
+
+SELECT relid::regclass, rows_pruned, partitions_pruned
+FROM temporal_tables_prune('versioning_retention_parts');
+
+SELECT relname, partitions_pruned, prune_lag > 0 AS lagging
+FROM temporal_tables_stats WHERE relid = 'versioning_retention_parts'::regclass;
+
+SELECT tableoid::regclass, a FROM versioning_retention_parts_history ORDER BY a;
+
+SELECT a FROM versioning_retention_parts_2002 ORDER BY a;
+
+-- An error pruning one relation does not stop pruning the others.
+CREATE TABLE versioning_retention_unversioned (a bigint, sys_period tstzrange);
+
+INSERT INTO temporal_tables_retention (relation, retention)
+VALUES ('versioning_retention_unversioned', '1 day');
+
+SELECT relid::regclass, rows_pruned, partitions_pruned
+FROM temporal_tables_prune();
+
+DELETE FROM temporal_tables_retention;
+
+DROP TABLE versioning_retention;
+DROP TABLE versioning_retention_history;
+DROP TABLE versioning_retention_parts;
+DROP TABLE versioning_retention_parts_history;
+DROP TABLE versioning_retention_parts_2002;
+DROP TABLE versioning_retention_unversioned;
@@ -0,0 +1,104 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE versioning_skip (a bigint, b text, last_seen_at timestamptz, sys_period tstzrange);
+
+CREATE TABLE versioning_skip_history (LIKE versioning_skip);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_skip
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_skip_history', false,
+                                          'ignore_columns=last_seen_at');
+
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+INSERT INTO versioning_skip VALUES (1, 'x', '2001-01-01'), (2, 'y', '2001-01-01');
+
+COMMIT;
+
+-- Nothing changes.
+BEGIN;
+
+SELECT set_system_time('2002-01-01');
+
+UPDATE versioning_skip SET a = a, b = b;
+
+COMMIT;
+
+-- An ignored column changes.
+BEGIN;
+
+SELECT set_system_time('2003-01-01');
+
+UPDATE versioning_skip SET last_seen_at = '2003-01-01' WHERE a = 1;
+
+COMMIT;
+
+SELECT * FROM versioning_skip ORDER BY a;
+
+SELECT * FROM versioning_skip_history ORDER BY a, sys_period;
+
+-- A compared column changes.
+BEGIN;
+
+SELECT set_system_time('2004-01-01');
+
+UPDATE versioning_skip SET b = 'z' WHERE a = 1;
+
+COMMIT;
+
+-- A compared column becomes null.
+BEGIN;
+
+SELECT set_system_time('2005-01-01');
+
+UPDATE versioning_skip SET b = NULL WHERE a = 2;
+
+COMMIT;
+
+SELECT * FROM versioning_skip ORDER BY a;
+
+SELECT * FROM versioning_skip_history ORDER BY a, sys_period;
+
+DROP TRIGGER versioning_trigger ON versioning_skip;
+
+-- Invalid options.
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_skip
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_skip_history', false,
+                                          'skip_unchanged=maybe');
+
+UPDATE versioning_skip SET b = 'w' WHERE a = 1;
+
+DROP TRIGGER versioning_trigger ON versioning_skip;
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_skip
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_skip_history', false,
+                                          'ignore_columns=c');
+
+UPDATE versioning_skip SET b = 'w' WHERE a = 1;
+
+DROP TRIGGER versioning_trigger ON versioning_skip;
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_skip
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_skip_history', false,
+                                          'skip_unchanged');
+
+UPDATE versioning_skip SET b = 'w' WHERE a = 1;
+
+DROP TRIGGER versioning_trigger ON versioning_skip;
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_skip
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_skip_history', false,
+                                          'unchanged=true');
+
+UPDATE versioning_skip SET b = 'w' WHERE a = 1;
+
+DROP TRIGGER versioning_trigger ON versioning_skip;
+
+DROP TABLE versioning_skip;
+DROP TABLE versioning_skip_history;
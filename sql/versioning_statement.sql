@@ -0,0 +1,141 @@
+CREATE TABLE versioning_statement (a bigint, "b b" date, sys_period tstzrange);
+
+-- Insert some data before versioning is enabled.
+INSERT INTO versioning_statement (a, sys_period) VALUES (1, tstzrange('-infinity', NULL));
+INSERT INTO versioning_statement (a, sys_period) VALUES (2, tstzrange('2000-01-01', NULL));
+
+CREATE TABLE versioning_statement_history (a bigint, c date, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_statement
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_statement_history', false);
+
+-- A single trigger without a transition table archives both UPDATE and
+-- DELETE.
+CREATE TRIGGER versioning_statement_trigger
+AFTER UPDATE OR DELETE ON versioning_statement
+FOR EACH STATEMENT EXECUTE PROCEDURE versioning_statement('sys_period', 'versioning_statement_history', false);
+
+-- Insert.
+BEGIN;
+
+INSERT INTO versioning_statement (a) VALUES (3);
+
+SELECT a, "b b", lower(sys_period) = CURRENT_TIMESTAMP FROM versioning_statement ORDER BY a, sys_period;
+
+SELECT * FROM versioning_statement_history ORDER BY a, sys_period;
+
+COMMIT;
+
+-- Make sure that the next transaction's CURRENT_TIMESTAMP is different.
+SELECT pg_sleep(0.1);
+
+-- Update.
+BEGIN;
+
+UPDATE versioning_statement SET a = 4 WHERE a = 3;
+
+SELECT a, "b b", lower(sys_period) = CURRENT_TIMESTAMP FROM versioning_statement ORDER BY a, sys_period;
+
+SELECT a, c, upper(sys_period) = CURRENT_TIMESTAMP FROM versioning_statement_history ORDER BY a, sys_period;
+
+COMMIT;
+
+-- Make sure that the next transaction's CURRENT_TIMESTAMP is different.
+SELECT pg_sleep(0.1);
+
+-- Multiple updates.
+BEGIN;
+
+UPDATE versioning_statement SET a = 5 WHERE a = 4;
+UPDATE versioning_statement SET "b b" = '2012-01-01' WHERE a = 5;
+
+SELECT a, "b b", lower(sys_period) = CURRENT_TIMESTAMP FROM versioning_statement ORDER BY a, sys_period;
+
+SELECT a, c, upper(sys_period) = CURRENT_TIMESTAMP FROM versioning_statement_history ORDER BY a, sys_period;
+
+COMMIT;
+
+-- Make sure that the next transaction's CURRENT_TIMESTAMP is different.
+SELECT pg_sleep(0.1);
+
+-- Delete.
+BEGIN;
+
+DELETE FROM versioning_statement;
+
+SELECT * FROM versioning_statement;
+
+SELECT a, c, upper(sys_period) = CURRENT_TIMESTAMP FROM versioning_statement_history ORDER BY a, sys_period;
+
+END;
+
+-- The versioning trigger inserts history rows itself when the statement-level
+-- trigger is disabled.
+ALTER TABLE versioning_statement DISABLE TRIGGER versioning_statement_trigger;
+
+INSERT INTO versioning_statement (a) VALUES (6);
+
+-- Make sure that the next transaction's CURRENT_TIMESTAMP is different.
+SELECT pg_sleep(0.1);
+
+BEGIN;
+
+UPDATE versioning_statement SET a = 7 WHERE a = 6;
+
+SELECT a, c, upper(sys_period) = CURRENT_TIMESTAMP FROM versioning_statement_history ORDER BY a, sys_period;
+
+END;
+
+-- Rows of other transactions are archived even if their system periods start
+-- at the system time of the command.
+CREATE TABLE versioning_statement_same_time (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_statement_same_time_history (a bigint, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_statement_same_time
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_statement_same_time_history', true);
+
+CREATE TRIGGER versioning_update_trigger
+AFTER UPDATE ON versioning_statement_same_time
+REFERENCING OLD TABLE AS old_rows
+FOR EACH STATEMENT EXECUTE PROCEDURE versioning_statement('sys_period', 'versioning_statement_same_time_history', true);
+
+SET TIME ZONE 'UTC';
+
+BEGIN;
+
+SELECT set_system_time('2010-01-01');
+
+INSERT INTO versioning_statement_same_time (a) VALUES (1);
+
+COMMIT;
+
+BEGIN;
+
+UPDATE versioning_statement_same_time SET a = 2;
+
+-- The row inserted in this transaction is not archived.
+UPDATE versioning_statement_same_time SET a = 3;
+
+SELECT * FROM versioning_statement_same_time_history ORDER BY a;
+
+COMMIT;
+
+SELECT set_system_time(NULL);
+
+RESET TIME ZONE;
+
+DROP TABLE versioning_statement_same_time;
+DROP TABLE versioning_statement_same_time_history;
+
+-- Statement-level trigger must be fired AFTER the command.
+CREATE TRIGGER versioning_invalid_trigger
+BEFORE UPDATE ON versioning_statement
+FOR EACH STATEMENT EXECUTE PROCEDURE versioning_statement('sys_period', 'versioning_statement_history', false);
+
+UPDATE versioning_statement SET a = 8 WHERE a = 7;
+
+DROP TABLE versioning_statement;
+DROP TABLE versioning_statement_history;
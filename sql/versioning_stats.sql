@@ -0,0 +1,66 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE versioning_stats (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_stats_history (a bigint, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_stats
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_stats_history', false);
+
+-- Insert and update the inserted row.
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+INSERT INTO versioning_stats (a) VALUES (1), (2);
+
+UPDATE versioning_stats SET a = 3 WHERE a = 1;
+
+COMMIT;
+
+-- Update and delete.
+BEGIN;
+
+SELECT set_system_time('2001-02-01');
+
+UPDATE versioning_stats SET a = 4 WHERE a = 3;
+
+DELETE FROM versioning_stats WHERE a = 2;
+
+COMMIT;
+
+-- Change the history table.
+ALTER TABLE versioning_stats_history ADD COLUMN b text;
+
+BEGIN;
+
+SELECT set_system_time('2001-03-01');
+
+UPDATE versioning_stats SET a = 5 WHERE a = 4;
+
+COMMIT;
+
+-- Fail to adjust the system period.
+BEGIN;
+
+SELECT set_system_time('2000-01-01');
+
+\set VERBOSITY terse
+UPDATE versioning_stats SET a = 6 WHERE a = 5;
+\set VERBOSITY default
+
+ROLLBACK;
+
+SELECT relname, rows_stamped, history_rows, rows_skipped, adjustments, adjust_errors, cache_misses, cache_rebuilds, total_time = 0
+FROM temporal_tables_stats WHERE relid = 'versioning_stats'::regclass;
+
+-- Reset.
+SELECT temporal_tables_stats_reset();
+
+SELECT count(*) FROM temporal_tables_stats WHERE relid = 'versioning_stats'::regclass;
+
+SELECT set_system_time(NULL);
+
+DROP TABLE versioning_stats;
+DROP TABLE versioning_stats_history;
@@ -0,0 +1,63 @@
+CREATE TABLE versioning_subtransactions (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_subtransactions_history (a bigint, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_subtransactions
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_subtransactions_history', false);
+
+INSERT INTO versioning_subtransactions (a) SELECT generate_series(1, 3000);
+
+-- Make sure that the next transaction's CURRENT_TIMESTAMP is different.
+SELECT pg_sleep(0.1);
+
+-- History rows archived in a rolled back subtransaction are discarded.
+BEGIN;
+
+SAVEPOINT p1;
+
+DELETE FROM versioning_subtransactions WHERE a <= 1500;
+
+ROLLBACK TO SAVEPOINT p1;
+
+SELECT count(*) FROM versioning_subtransactions_history;
+
+SAVEPOINT p2;
+
+DELETE FROM versioning_subtransactions WHERE a <= 1500;
+
+RELEASE SAVEPOINT p2;
+
+SELECT count(*) FROM versioning_subtransactions_history;
+
+COMMIT;
+
+-- Make sure that the next transaction's CURRENT_TIMESTAMP is different.
+SELECT pg_sleep(0.1);
+
+-- History rows archived in an exception block that caught an error are
+-- discarded too.
+CREATE FUNCTION versioning_subtransactions_delete(bigint)
+RETURNS void AS $$
+BEGIN
+  BEGIN
+    DELETE FROM versioning_subtransactions WHERE a <= $1;
+    RAISE EXCEPTION 'rollback';
+  EXCEPTION WHEN raise_exception THEN
+    NULL;
+  END;
+  DELETE FROM versioning_subtransactions WHERE a <= $1 + 10;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT versioning_subtransactions_delete(2000);
+
+SELECT count(*) FROM versioning_subtransactions;
+
+SELECT count(*) FROM versioning_subtransactions_history;
+
+SELECT min(a), max(a) FROM versioning_subtransactions_history;
+
+DROP FUNCTION versioning_subtransactions_delete(bigint);
+DROP TABLE versioning_subtransactions;
+DROP TABLE versioning_subtransactions_history;
@@ -0,0 +1,121 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE versioning_clock (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_clock_history (a bigint, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_clock
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_clock_history', false);
+
+-- The rows become current after the following transactions start.
+BEGIN;
+
+SELECT set_system_time('2100-01-01');
+
+INSERT INTO versioning_clock (a) VALUES (1), (2);
+
+COMMIT;
+
+SELECT set_system_time(NULL);
+
+\set VERBOSITY terse
+UPDATE versioning_clock SET a = 3 WHERE a = 1;
+\set VERBOSITY default
+
+-- The monotonic clock moves past the start of the system period.
+SET temporal_tables.system_time_source = monotonic;
+
+UPDATE versioning_clock SET a = 3 WHERE a = 1;
+
+BEGIN;
+
+UPDATE versioning_clock SET a = 4 WHERE a = 3;
+
+-- The clock never goes back within the transaction.
+INSERT INTO versioning_clock (a) VALUES (5);
+
+COMMIT;
+
+SELECT a, sys_period FROM versioning_clock ORDER BY a;
+
+SELECT a, sys_period FROM versioning_clock_history ORDER BY a;
+
+SET temporal_tables.system_time_source = sundial;
+-- The option of the trigger overrides the parameter.
+DROP TRIGGER versioning_trigger ON versioning_clock;
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_clock
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_clock_history', false,
+                                          'system_time_source=statement');
+
+BEGIN;
+
+INSERT INTO versioning_clock (a) VALUES (6);
+
+SELECT lower(sys_period) > now() AS later FROM versioning_clock WHERE a = 6;
+
+COMMIT;
+
+DROP TRIGGER versioning_trigger ON versioning_clock;
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_clock
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_clock_history', false,
+                                          'system_time_source=clock');
+
+BEGIN;
+
+INSERT INTO versioning_clock (a) VALUES (7), (8);
+
+SELECT bool_and(lower(sys_period) > now()) AS later
+FROM versioning_clock WHERE a IN (7, 8);
+
+COMMIT;
+
+RESET temporal_tables.system_time_source;
+
+-- set_system_time() overrides the option.
+BEGIN;
+
+SELECT set_system_time('2200-01-01');
+
+DELETE FROM versioning_clock WHERE a = 7;
+
+COMMIT;
+
+SELECT set_system_time(NULL);
+
+SELECT upper(sys_period) FROM versioning_clock_history WHERE a = 7;
+
+DROP TRIGGER versioning_trigger ON versioning_clock;
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_clock
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_clock_history', false,
+                                          'system_time_source=sundial');
+
+INSERT INTO versioning_clock (a) VALUES (9);
+-- The statement-level trigger archives the rows with the system time the
+-- versioning trigger set the current rows to.
+DROP TRIGGER versioning_trigger ON versioning_clock;
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_clock
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_clock_history', false,
+                                          'system_time_source=clock');
+
+CREATE TRIGGER versioning_update_trigger
+AFTER UPDATE ON versioning_clock
+REFERENCING OLD TABLE AS old_rows
+FOR EACH STATEMENT EXECUTE PROCEDURE versioning_statement('sys_period', 'versioning_clock_history', false);
+
+UPDATE versioning_clock SET a = a + 10 WHERE a IN (6, 8);
+
+SELECT h.a, upper(h.sys_period) = lower(c.sys_period) AS adjacent
+FROM versioning_clock_history h JOIN versioning_clock c ON c.a = h.a + 10
+ORDER BY h.a;
+
+DROP TABLE versioning_clock;
+DROP TABLE versioning_clock_history;
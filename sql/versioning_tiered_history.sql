@@ -0,0 +1,85 @@
+SET TIME ZONE 'UTC';
+
+-- An access method that is not heap, as far as the trigger can tell.
+CREATE ACCESS METHOD versioning_tiered_am TYPE TABLE HANDLER heap_tableam_handler;
+
+CREATE TABLE versioning_tiered (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_tiered_history (a bigint, sys_period tstzrange)
+PARTITION BY RANGE (upper(sys_period));
+
+CREATE TABLE versioning_tiered_history_2001 PARTITION OF versioning_tiered_history
+FOR VALUES FROM ('2001-01-01') TO ('2002-01-01');
+
+CREATE TABLE versioning_tiered_history_2002 PARTITION OF versioning_tiered_history
+FOR VALUES FROM ('2002-01-01') TO ('2003-01-01') USING versioning_tiered_am;
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_tiered
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_tiered_history', false);
+
+BEGIN;
+
+SELECT set_system_time('2000-01-01');
+
+INSERT INTO versioning_tiered (a) VALUES (1), (2), (3);
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2001-06-01');
+
+UPDATE versioning_tiered SET a = 4 WHERE a = 1;
+
+COMMIT;
+
+-- The rows archived into the partition of the other access method are
+-- buffered until a query uses it.
+BEGIN;
+
+SELECT set_system_time('2002-06-01');
+
+UPDATE versioning_tiered SET a = 5 WHERE a = 2;
+
+DELETE FROM versioning_tiered WHERE a = 3;
+
+SELECT * FROM versioning_tiered_history ORDER BY a, sys_period;
+
+COMMIT;
+
+SELECT set_system_time(NULL);
+
+-- Only the heap partitions that ended before the threshold are moved.
+SELECT * FROM temporal_tables_tier('versioning_tiered', '1 year', 'versioning_tiered_am');
+
+SELECT * FROM temporal_tables_tier('versioning_tiered', '1 year', 'versioning_tiered_am');
+
+SELECT c.relname, a.amname, pg_get_expr(c.relpartbound, c.oid)
+FROM pg_class c
+JOIN pg_am a ON a.oid = c.relam
+WHERE c.relispartition AND c.relname LIKE 'versioning_tiered_history%'
+ORDER BY c.relname;
+
+SELECT * FROM versioning_tiered_history ORDER BY a, sys_period;
+
+-- The history relation must be partitioned.
+CREATE TABLE versioning_untiered (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_untiered_history (a bigint, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_untiered
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_untiered_history', false);
+
+SELECT * FROM temporal_tables_tier('versioning_untiered', '1 year', 'versioning_tiered_am');
+
+DROP TABLE versioning_tiered;
+
+DROP TABLE versioning_tiered_history;
+
+DROP TABLE versioning_untiered;
+
+DROP TABLE versioning_untiered_history;
+
+DROP ACCESS METHOD versioning_tiered_am;
@@ -0,0 +1,55 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE versioning_truncate (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_truncate_history (a bigint, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_truncate
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_truncate_history', false);
+
+CREATE TRIGGER versioning_truncate_trigger
+BEFORE TRUNCATE ON versioning_truncate
+FOR EACH STATEMENT EXECUTE PROCEDURE versioning_statement('sys_period', 'versioning_truncate_history', false);
+
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+INSERT INTO versioning_truncate (a) VALUES (1), (2);
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2002-01-01');
+
+UPDATE versioning_truncate SET a = 3 WHERE a = 2;
+
+COMMIT;
+
+-- TRUNCATE archives all the rows but the ones inserted in the same
+-- transaction.
+BEGIN;
+
+SELECT set_system_time('2003-01-01');
+
+INSERT INTO versioning_truncate (a) VALUES (4);
+TRUNCATE versioning_truncate;
+
+COMMIT;
+
+SELECT set_system_time(NULL);
+
+SELECT * FROM versioning_truncate;
+
+SELECT * FROM versioning_truncate_history ORDER BY a, sys_period;
+
+-- The rows are gone after TRUNCATE.
+CREATE TRIGGER versioning_invalid_trigger
+AFTER TRUNCATE ON versioning_truncate
+FOR EACH STATEMENT EXECUTE PROCEDURE versioning_statement('sys_period', 'versioning_truncate_history', false);
+
+TRUNCATE versioning_truncate;
+DROP TABLE versioning_truncate;
+DROP TABLE versioning_truncate_history;
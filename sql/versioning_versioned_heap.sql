@@ -0,0 +1,122 @@
+SET TIME ZONE 'UTC';
+
+CREATE TABLE versioning_heap (a bigint, b text, sys_period tstzrange)
+USING versioned_heap;
+
+CREATE TABLE versioning_heap_history (a bigint, b text, sys_period tstzrange);
+
+BEGIN;
+
+SELECT set_system_time('2000-01-01');
+
+INSERT INTO versioning_heap (a, b) VALUES (1, 'one'), (2, 'two'), (3, 'three');
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+UPDATE versioning_heap SET b = 'uno' WHERE a = 1;
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2002-01-01');
+
+DELETE FROM versioning_heap WHERE a = 3;
+
+COMMIT;
+
+SELECT set_system_time(NULL);
+
+SELECT * FROM versioning_heap ORDER BY a;
+
+SELECT * FROM versioning_heap_history ORDER BY a, sys_period;
+
+-- Indexes are built over the current rows like on a heap relation.
+CREATE INDEX ON versioning_heap (a);
+
+SET enable_seqscan = off;
+
+SELECT a, b FROM versioning_heap WHERE a = 2;
+
+RESET enable_seqscan;
+
+SELECT a, b FROM versioning_as_of(NULL::versioning_heap, '2000-06-01') ORDER BY a;
+
+-- A versioning trigger would archive the rows twice.
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_heap
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_heap_history', true);
+
+INSERT INTO versioning_heap (a, b) VALUES (4, 'four');
+
+DROP TRIGGER versioning_trigger ON versioning_heap;
+
+-- The history relation is looked up by name.
+CREATE TABLE versioning_heap_orphan (a bigint, sys_period tstzrange)
+USING versioned_heap;
+
+INSERT INTO versioning_heap_orphan (a) VALUES (1);
+
+-- The table of the README, with a nullable system period.
+CREATE TABLE employees
+(
+  name text NOT NULL PRIMARY KEY,
+  department text,
+  salary numeric(20, 2),
+  sys_period tstzrange
+) USING versioned_heap;
+
+CREATE TABLE employees_history (LIKE employees);
+
+BEGIN;
+
+SELECT set_system_time('2000-01-01');
+
+INSERT INTO employees (name, department, salary)
+VALUES ('Bernard Marx', 'Hatchery and Conditioning Centre', 10000);
+
+COPY employees (name, department, salary) FROM stdin;
+Lenina Crowne	Hatchery and Conditioning Centre	7000
+\.
+
+COMMIT;
+
+BEGIN;
+
+SELECT set_system_time('2001-01-01');
+
+UPDATE employees SET salary = 11200 WHERE name = 'Bernard Marx';
+
+COMMIT;
+
+SELECT set_system_time(NULL);
+
+SELECT * FROM employees ORDER BY name;
+
+SELECT * FROM employees_history ORDER BY name;
+
+-- The system period is set after the constraints are checked, so nothing may
+-- constrain it.
+CREATE TABLE versioning_heap_not_null (a bigint, sys_period tstzrange NOT NULL)
+USING versioned_heap;
+
+CREATE TABLE versioning_heap_check (a bigint, sys_period tstzrange CHECK (NOT isempty(sys_period)))
+USING versioned_heap;
+
+ALTER TABLE employees ALTER COLUMN sys_period SET NOT NULL;
+
+ALTER TABLE employees ADD CHECK (lower(sys_period) > '1999-01-01');
+
+DROP TABLE versioning_heap;
+
+DROP TABLE versioning_heap_history;
+
+DROP TABLE versioning_heap_orphan;
+
+DROP TABLE employees;
+
+DROP TABLE employees_history;
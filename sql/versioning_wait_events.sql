@@ -0,0 +1,28 @@
+CREATE TABLE versioning_wait_events (a bigint, sys_period tstzrange);
+
+CREATE TABLE versioning_wait_events_history (a bigint, sys_period tstzrange);
+
+CREATE TRIGGER versioning_trigger
+BEFORE INSERT OR UPDATE OR DELETE ON versioning_wait_events
+FOR EACH ROW EXECUTE PROCEDURE versioning('sys_period', 'versioning_wait_events_history', false);
+
+CREATE TRIGGER versioning_update_trigger
+AFTER UPDATE ON versioning_wait_events
+REFERENCING OLD TABLE AS old_rows
+FOR EACH STATEMENT EXECUTE PROCEDURE versioning_statement('sys_period', 'versioning_wait_events_history', false);
+
+INSERT INTO versioning_wait_events (a) VALUES (1), (2);
+
+-- The archive query of the statement trigger reports the first wait event.
+UPDATE versioning_wait_events SET a = a + 10;
+
+SELECT a FROM versioning_wait_events_history ORDER BY a;
+
+-- All the wait events are registered at once.
+SELECT type, name FROM pg_wait_events
+WHERE name LIKE 'TemporalTables%'
+ORDER BY name;
+
+DROP TABLE versioning_wait_events;
+
+DROP TABLE versioning_wait_events_history;
@@ -0,0 +1,613 @@
+/* -------------------------------------------------------------------------
+ *
+ * stats.c
+ *
+ * Copyright (c) 2012-2023 Vladislav Arkhipov <vlad@arkhipov.ru>
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+
+#include <limits.h>
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+
+#include "temporal_tables.h"
+
+PGDLLEXPORT Datum temporal_tables_stats(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum temporal_tables_stats_reset(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(temporal_tables_stats);
+PG_FUNCTION_INFO_V1(temporal_tables_stats_reset);
+
+/* The number of columns returned by temporal_tables_stats(). */
+#define STATS_COLUMNS	(VERSIONING_STATS_NUM_COUNTERS + 4)
+
+/* Hash key of the statistics of a relation. */
+typedef struct VersioningStatsKey
+{
+	Oid				 dbid;
+	Oid				 relid;
+} VersioningStatsKey;
+
+/*
+ * Statistics of a relation accumulated by all the backends. If the shared
+ * memory is not available, the same structure is used for the statistics of
+ * the current backend only and the mutex is not used.
+ */
+typedef struct SharedVersioningStats
+{
+	VersioningStatsKey key;				/* hash key (must be first) */
+	slock_t			 mutex;				/* protects the statistics */
+	VersioningStats	 stats;
+} SharedVersioningStats;
+
+/*
+ * Statistics of a relation accumulated by the current backend since they
+ * were added to the shared statistics for the last time. The entries are
+ * never removed, so the versioning triggers may keep pointers to them.
+ */
+typedef struct PendingVersioningStats
+{
+	Oid				 relid;				/* hash key (must be first) */
+	VersioningStats	 stats;
+} PendingVersioningStats;
+
+/* true if versioning triggers measure the time spent in them. */
+bool versioning_track_timing = false;
+
+/* The maximum number of relations in the shared statistics. */
+static int stats_max = 1000;
+
+#if PG_VERSION_NUM >= 90600
+/*
+ * The lock that protects the shared statistics hash table. Adding a value to
+ * the statistics requires a shared lock and the entry mutex, adding and
+ * removing entries requires an exclusive lock.
+ */
+typedef struct VersioningStatsState
+{
+	LWLock			*lock;
+} VersioningStatsState;
+
+static VersioningStatsState *stats_state = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#endif
+
+/* The shared statistics or NULL if the shared memory is not available. */
+static HTAB *shared_stats = NULL;
+
+/* The statistics of the current backend if there is no shared statistics. */
+static HTAB *local_stats = NULL;
+
+/* The statistics of the current backend that are not added yet. */
+static HTAB *pending_stats = NULL;
+
+#if PG_VERSION_NUM >= 90600
+static Size stats_shmem_size(void);
+#if PG_VERSION_NUM >= 150000
+static void stats_shmem_request(void);
+#endif
+static void stats_shmem_startup(void);
+#endif
+
+static void flush_pending_stats(void);
+static void add_stats(VersioningStats *dest, VersioningStats *src);
+static bool stats_are_zero(VersioningStats *stats);
+static void *stats_entry_alloc(Size size);
+
+/*
+ * Define the configuration parameters of the statistics and request the
+ * shared memory for them if the library is being preloaded.
+ */
+void
+init_versioning_stats(void)
+{
+	DefineCustomBoolVariable("temporal_tables.track_timing",
+							 "Collects timing statistics of versioning triggers.",
+							 NULL,
+							 &versioning_track_timing,
+							 false,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("temporal_tables.stats_max",
+							"Sets the maximum number of relations tracked by versioning statistics.",
+							NULL,
+							&stats_max,
+							1000,
+							100,
+							INT_MAX / 2,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+#if PG_VERSION_NUM >= 90600
+	// The statistics are shared by all the backends only if the library is
+	// loaded via shared_preload_libraries. Otherwise, every backend has its
+	// own statistics.
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = stats_shmem_request;
+#else
+	RequestAddinShmemSpace(stats_shmem_size());
+	RequestNamedLWLockTranche("temporal_tables", 1);
+#endif
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = stats_shmem_startup;
+#endif
+}
+
+#if PG_VERSION_NUM >= 90600
+static Size
+stats_shmem_size(void)
+{
+	return add_size(MAXALIGN(sizeof(VersioningStatsState)),
+					hash_estimate_size(stats_max,
+									   sizeof(SharedVersioningStats)));
+}
+
+#if PG_VERSION_NUM >= 150000
+static void
+stats_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(stats_shmem_size());
+	RequestNamedLWLockTranche("temporal_tables", 1);
+}
+#endif
+
+/*
+ * Allocate or attach to the shared statistics.
+ */
+static void
+stats_shmem_startup(void)
+{
+	HASHCTL		ctl;
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	stats_state = ShmemInitStruct("temporal_tables stats",
+								  sizeof(VersioningStatsState),
+								  &found);
+
+	if (!found)
+		stats_state->lock = &(GetNamedLWLockTranche("temporal_tables"))->lock;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(VersioningStatsKey);
+	ctl.entrysize = sizeof(SharedVersioningStats);
+
+	shared_stats = ShmemInitHash("temporal_tables stats hash",
+								 stats_max, stats_max,
+								 &ctl,
+								 HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+#endif
+
+/*
+ * Return the statistics of the relation accumulated by the current backend.
+ * The caller may increment the counters directly and keep the pointer for as
+ * long as it wants.
+ */
+VersioningStats *
+get_versioning_stats(Oid relid)
+{
+	PendingVersioningStats	*pending;
+	bool					 found;
+
+	if (pending_stats == NULL)
+	{
+		HASHCTL	ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.alloc = stats_entry_alloc;
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(PendingVersioningStats);
+#if PG_VERSION_NUM < 90500
+		ctl.hash = oid_hash;
+#endif
+
+		pending_stats = hash_create("Versioning Pending Stats Hash",
+									128,
+									&ctl,
+#if PG_VERSION_NUM < 90500
+									HASH_ALLOC | HASH_ELEM | HASH_FUNCTION
+#else
+									HASH_ALLOC | HASH_ELEM | HASH_BLOBS
+#endif
+								   );
+	}
+
+	pending = (PendingVersioningStats *) hash_search(pending_stats,
+													 (void *) &relid,
+													 HASH_ENTER,
+													 &found);
+
+	if (!found)
+		memset(&pending->stats, 0, sizeof(VersioningStats));
+
+	return &pending->stats;
+}
+
+/*
+ * Add the statistics accumulated by the current backend to the shared
+ * statistics when the transaction ends. The statistics of an aborted
+ * transaction are added too, as they include the errors.
+ */
+void
+versioning_stats_xact_callback(XactEvent event)
+{
+	if (event == XACT_EVENT_COMMIT ||
+		event == XACT_EVENT_ABORT ||
+		event == XACT_EVENT_PREPARE)
+		flush_pending_stats();
+}
+
+/*
+ * Add the pending statistics of the current backend to the shared statistics
+ * or to the statistics of the current backend if there is no shared memory.
+ *
+ * The function is called at the end of aborted transactions too, so it must
+ * not throw errors. If there is no room for a new relation, its statistics
+ * are lost.
+ */
+static void
+flush_pending_stats(void)
+{
+	HASH_SEQ_STATUS			 status;
+	PendingVersioningStats	*pending;
+	SharedVersioningStats	*entry;
+	VersioningStatsKey		 key;
+	bool					 found;
+
+	if (pending_stats == NULL)
+		return;
+
+	key.dbid = MyDatabaseId;
+
+#if PG_VERSION_NUM >= 90600
+	if (shared_stats != NULL)
+	{
+		bool	missing = false;
+
+		/* Add the statistics of the relations that are already tracked. */
+		LWLockAcquire(stats_state->lock, LW_SHARED);
+
+		hash_seq_init(&status, pending_stats);
+
+		while ((pending = (PendingVersioningStats *) hash_seq_search(&status)) != NULL)
+		{
+			if (stats_are_zero(&pending->stats))
+				continue;
+
+			key.relid = pending->relid;
+
+			entry = (SharedVersioningStats *) hash_search(shared_stats,
+														  (void *) &key,
+														  HASH_FIND,
+														  NULL);
+
+			if (entry == NULL)
+			{
+				missing = true;
+				continue;
+			}
+
+			SpinLockAcquire(&entry->mutex);
+			add_stats(&entry->stats, &pending->stats);
+			SpinLockRelease(&entry->mutex);
+
+			memset(&pending->stats, 0, sizeof(VersioningStats));
+		}
+
+		LWLockRelease(stats_state->lock);
+
+		if (!missing)
+			return;
+
+		/* Add entries for the new relations. */
+		LWLockAcquire(stats_state->lock, LW_EXCLUSIVE);
+
+		hash_seq_init(&status, pending_stats);
+
+		while ((pending = (PendingVersioningStats *) hash_seq_search(&status)) != NULL)
+		{
+			if (stats_are_zero(&pending->stats))
+				continue;
+
+			key.relid = pending->relid;
+
+			entry = (SharedVersioningStats *) hash_search(shared_stats,
+														  (void *) &key,
+														  HASH_ENTER_NULL,
+														  &found);
+
+			if (entry != NULL)
+			{
+				if (!found)
+				{
+					SpinLockInit(&entry->mutex);
+					memset(&entry->stats, 0, sizeof(VersioningStats));
+				}
+
+				add_stats(&entry->stats, &pending->stats);
+			}
+
+			memset(&pending->stats, 0, sizeof(VersioningStats));
+		}
+
+		LWLockRelease(stats_state->lock);
+
+		return;
+	}
+#endif
+
+	if (local_stats == NULL)
+	{
+		HASHCTL	ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.alloc = stats_entry_alloc;
+		ctl.keysize = sizeof(VersioningStatsKey);
+		ctl.entrysize = sizeof(SharedVersioningStats);
+#if PG_VERSION_NUM < 90500
+		ctl.hash = tag_hash;
+#endif
+
+		local_stats = hash_create("Versioning Local Stats Hash",
+								  128,
+								  &ctl,
+#if PG_VERSION_NUM < 90500
+								  HASH_ALLOC | HASH_ELEM | HASH_FUNCTION
+#else
+								  HASH_ALLOC | HASH_ELEM | HASH_BLOBS
+#endif
+								 );
+	}
+
+	hash_seq_init(&status, pending_stats);
+
+	while ((pending = (PendingVersioningStats *) hash_seq_search(&status)) != NULL)
+	{
+		if (stats_are_zero(&pending->stats))
+			continue;
+
+		key.relid = pending->relid;
+
+		entry = (SharedVersioningStats *) hash_search(local_stats,
+													  (void *) &key,
+													  HASH_ENTER_NULL,
+													  &found);
+
+		if (entry != NULL)
+		{
+			if (!found)
+				memset(&entry->stats, 0, sizeof(VersioningStats));
+
+			add_stats(&entry->stats, &pending->stats);
+		}
+
+		memset(&pending->stats, 0, sizeof(VersioningStats));
+	}
+}
+
+/*
+ * Return the versioning statistics of the relations of the current database.
+ * The statistics of the current backend are added to them first, so that
+ * they include the current transaction.
+ */
+Datum
+temporal_tables_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo		   *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc				tupdesc;
+	Tuplestorestate		   *tupstore;
+	MemoryContext			oldcontext;
+	HTAB				   *stats_hash;
+	HASH_SEQ_STATUS			status;
+	SharedVersioningStats  *entry;
+
+	/* Check that the caller supports us returning a tuplestore. */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	flush_pending_stats();
+
+	stats_hash = shared_stats != NULL ? shared_stats : local_stats;
+
+	if (stats_hash == NULL)
+		return (Datum) 0;
+
+#if PG_VERSION_NUM >= 90600
+	if (shared_stats != NULL)
+		LWLockAcquire(stats_state->lock, LW_SHARED);
+#endif
+
+	hash_seq_init(&status, stats_hash);
+
+	while ((entry = (SharedVersioningStats *) hash_seq_search(&status)) != NULL)
+	{
+		VersioningStats	stats;
+		Datum			values[STATS_COLUMNS];
+		bool			nulls[STATS_COLUMNS];
+		int				i;
+
+		if (entry->key.dbid != MyDatabaseId)
+			continue;
+
+		if (shared_stats != NULL)
+		{
+			SpinLockAcquire(&entry->mutex);
+			stats = entry->stats;
+			SpinLockRelease(&entry->mutex);
+		}
+		else
+			stats = entry->stats;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = ObjectIdGetDatum(entry->key.relid);
+
+		for (i = 0; i < VERSIONING_STATS_NUM_COUNTERS; ++i)
+			values[i + 1] = Int64GetDatum(stats.counters[i]);
+
+		values[i + 1] = Float8GetDatum(stats.total_time);
+
+		if (stats.last_prune == 0)
+		{
+			nulls[i + 2] = true;
+			nulls[i + 3] = true;
+		}
+		else
+		{
+			values[i + 2] = TimestampTzGetDatum(stats.last_prune);
+			values[i + 3] = Float8GetDatum(stats.prune_lag);
+		}
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+#if PG_VERSION_NUM >= 90600
+	if (shared_stats != NULL)
+		LWLockRelease(stats_state->lock);
+#endif
+
+	return (Datum) 0;
+}
+
+/*
+ * Discard the versioning statistics of the relations of the current
+ * database.
+ */
+Datum
+temporal_tables_stats_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS			 status;
+	PendingVersioningStats	*pending;
+	SharedVersioningStats	*entry;
+	HTAB					*stats_hash;
+
+	if (pending_stats != NULL)
+	{
+		hash_seq_init(&status, pending_stats);
+
+		while ((pending = (PendingVersioningStats *) hash_seq_search(&status)) != NULL)
+			memset(&pending->stats, 0, sizeof(VersioningStats));
+	}
+
+	stats_hash = shared_stats != NULL ? shared_stats : local_stats;
+
+	if (stats_hash == NULL)
+		PG_RETURN_VOID();
+
+#if PG_VERSION_NUM >= 90600
+	if (shared_stats != NULL)
+		LWLockAcquire(stats_state->lock, LW_EXCLUSIVE);
+#endif
+
+	hash_seq_init(&status, stats_hash);
+
+	while ((entry = (SharedVersioningStats *) hash_seq_search(&status)) != NULL)
+	{
+		if (entry->key.dbid == MyDatabaseId)
+			hash_search(stats_hash, (void *) &entry->key, HASH_REMOVE, NULL);
+	}
+
+#if PG_VERSION_NUM >= 90600
+	if (shared_stats != NULL)
+		LWLockRelease(stats_state->lock);
+#endif
+
+	PG_RETURN_VOID();
+}
+
+static void
+add_stats(VersioningStats *dest, VersioningStats *src)
+{
+	int		i;
+
+	for (i = 0; i < VERSIONING_STATS_NUM_COUNTERS; ++i)
+		dest->counters[i] += src->counters[i];
+
+	dest->total_time += src->total_time;
+
+	/* The lag is the one of the latest pruning. */
+	if (src->last_prune > dest->last_prune)
+	{
+		dest->last_prune = src->last_prune;
+		dest->prune_lag = src->prune_lag;
+	}
+}
+
+static bool
+stats_are_zero(VersioningStats *stats)
+{
+	int		i;
+
+	for (i = 0; i < VERSIONING_STATS_NUM_COUNTERS; ++i)
+	{
+		if (stats->counters[i] != 0)
+			return false;
+	}
+
+	return stats->total_time == 0 && stats->last_prune == 0;
+}
+
+static void *
+stats_entry_alloc(Size size)
+{
+	return MemoryContextAllocZero(TopMemoryContext, size);
+}
@@ -0,0 +1,203 @@
+/* temporal_tables/temporal_tables--1.2.2--1.3.0.sql */
+
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "ALTER EXTENSION temporal_tables UPDATE TO '1.3.0'" to load this file.\quit
+
+CREATE FUNCTION versioning_statement()
+RETURNS TRIGGER
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+REVOKE ALL ON FUNCTION versioning_statement() FROM PUBLIC;
+
+COMMENT ON FUNCTION versioning_statement() IS 'System-period temporal table statement-level trigger that archives the rows collected by the versioning trigger during the statement';
+
+CREATE FUNCTION versioning_truncate_period(xmin xid, period anyrange)
+RETURNS anyrange
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
+COMMENT ON FUNCTION versioning_truncate_period(xid, anyrange) IS 'System period of the history row of a row that is being truncated or NULL if the row is not archived. It is only called by versioning_statement';
+
+CREATE FUNCTION versioning_current_period()
+RETURNS tstzrange
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE;
+
+COMMENT ON FUNCTION versioning_current_period() IS 'System period of a row that becomes current now. It is intended to be the default value of the system period column';
+
+CREATE FUNCTION temporal_tables_prewarm(relations regclass[] DEFAULT NULL,
+                                        OUT entries integer,
+                                        OUT elapsed interval)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+COMMENT ON FUNCTION temporal_tables_prewarm(regclass[]) IS 'Fill the cached data of versioning triggers on the specified relations or on all the relations if NULL is passed';
+
+CREATE FUNCTION temporal_tables_stats(OUT relid oid,
+                                      OUT rows_stamped bigint,
+                                      OUT history_rows bigint,
+                                      OUT rows_skipped bigint,
+                                      OUT adjustments bigint,
+                                      OUT adjust_errors bigint,
+                                      OUT cache_misses bigint,
+                                      OUT cache_rebuilds bigint,
+                                      OUT cache_evictions bigint,
+                                      OUT rows_pruned bigint,
+                                      OUT partitions_pruned bigint,
+                                      OUT total_time double precision,
+                                      OUT last_prune timestamptz,
+                                      OUT prune_lag double precision)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION temporal_tables_stats_reset()
+RETURNS VOID
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+REVOKE ALL ON FUNCTION temporal_tables_stats_reset() FROM PUBLIC;
+
+COMMENT ON FUNCTION temporal_tables_stats_reset() IS 'Discard the versioning statistics of the current database';
+
+CREATE VIEW temporal_tables_stats AS
+  SELECT s.relid,
+         n.nspname AS schemaname,
+         c.relname,
+         s.rows_stamped,
+         s.history_rows,
+         s.rows_skipped,
+         s.adjustments,
+         s.adjust_errors,
+         s.cache_misses,
+         s.cache_rebuilds,
+         s.cache_evictions,
+         s.rows_pruned,
+         s.partitions_pruned,
+         s.total_time,
+         s.last_prune,
+         s.prune_lag
+  FROM temporal_tables_stats() s
+       JOIN pg_catalog.pg_class c ON c.oid = s.relid
+       JOIN pg_catalog.pg_namespace n ON n.oid = c.relnamespace;
+
+COMMENT ON VIEW temporal_tables_stats IS 'Versioning statistics of the relations of the current database';
+
+CREATE FUNCTION versioning_as_of(relation anyelement, system_time timestamptz)
+RETURNS SETOF anyelement
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE PARALLEL SAFE;
+
+COMMENT ON FUNCTION versioning_as_of(anyelement, timestamptz) IS 'Rows of the versioned relation which row type the first argument has that were current at the specified time';
+
+CREATE TABLE temporal_tables_retention (
+  relation regclass PRIMARY KEY,
+  retention interval NOT NULL CHECK (retention > interval '0'),
+  batch_size integer NOT NULL DEFAULT 1000 CHECK (batch_size > 0),
+  detach_partitions boolean NOT NULL DEFAULT false
+);
+
+SELECT pg_catalog.pg_extension_config_dump('temporal_tables_retention', '');
+
+COMMENT ON TABLE temporal_tables_retention IS 'Retention policies of the history of versioned relations';
+
+CREATE FUNCTION temporal_tables_prune(relation regclass DEFAULT NULL,
+                                      OUT relid oid,
+                                      OUT rows_pruned bigint,
+                                      OUT partitions_pruned integer)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+COMMENT ON FUNCTION temporal_tables_prune(regclass) IS 'Remove the history rows of the specified relation or of all the relations that are older than their retention policies';
+
+CREATE TABLE temporal_tables_capture (
+  slot_name name PRIMARY KEY,
+  confirmed_lsn pg_lsn NOT NULL
+);
+
+COMMENT ON TABLE temporal_tables_capture IS 'Positions up to which the capture worker has archived the history rows decoded from its replication slot';
+
+CREATE TABLE temporal_tables_capture_failed (
+  slot_name name NOT NULL,
+  lsn pg_lsn NOT NULL,
+  line text NOT NULL,
+  error text NOT NULL,
+  failed_at timestamptz NOT NULL DEFAULT now()
+);
+
+COMMENT ON TABLE temporal_tables_capture_failed IS 'Decoded history rows that the capture worker failed to archive';
+
+SELECT pg_catalog.pg_extension_config_dump('temporal_tables_capture_failed', '');
+
+CREATE FUNCTION create_history_table(relation regclass,
+                                     history_relation text DEFAULT NULL,
+                                     system_period name DEFAULT 'sys_period',
+                                     key_index boolean DEFAULT false,
+                                     partition_interval interval DEFAULT NULL)
+RETURNS regclass
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+COMMENT ON FUNCTION create_history_table(regclass, text, name, boolean, interval) IS 'Create a history relation for the versioned relation that is laid out and indexed for appending history rows';
+
+CREATE FUNCTION temporal_tables_tier(relation regclass,
+                                     older_than interval,
+                                     access_method name,
+                                     OUT partition regclass,
+                                     OUT rows_moved bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
+COMMENT ON FUNCTION temporal_tables_tier(regclass, interval, name) IS 'Move the partitions of the history of the specified relation that ended before the threshold to the table access method';
+
+CREATE FUNCTION temporal_diff(relation anyelement,
+                              t1 timestamptz,
+                              t2 timestamptz)
+RETURNS TABLE (operation text, old_row anyelement, new_row anyelement)
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE PARALLEL SAFE;
+
+COMMENT ON FUNCTION temporal_diff(anyelement, timestamptz, timestamptz) IS 'Rows of the versioned relation which row type the first argument has that changed between the two points in time, with their versions current at the first and at the second point';
+
+CREATE FUNCTION versioning_enable(relation regclass,
+                                  history_relation regclass,
+                                  since timestamptz DEFAULT NULL,
+                                  system_period name DEFAULT 'sys_period',
+                                  adjust boolean DEFAULT false)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+COMMENT ON FUNCTION versioning_enable(regclass, regclass, timestamptz, name, boolean) IS 'Add the system period column to the existing relation without rewriting it and create the versioning trigger archiving its rows into the history relation';
+
+-- Table access methods exist in PostgreSQL 12 and later only.
+DO $$
+BEGIN
+  IF current_setting('server_version_num')::integer >= 120000 THEN
+    CREATE FUNCTION versioned_heap_handler(internal)
+    RETURNS table_am_handler
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C;
+
+    CREATE ACCESS METHOD versioned_heap TYPE TABLE HANDLER versioned_heap_handler;
+
+    COMMENT ON ACCESS METHOD versioned_heap IS 'Heap table access method that versions the rows of the table into its history table';
+
+    CREATE FUNCTION versioned_heap_check_ddl()
+    RETURNS event_trigger
+    AS 'MODULE_PATHNAME'
+    LANGUAGE C;
+
+    CREATE EVENT TRIGGER versioned_heap_check_ddl
+    ON ddl_command_end
+    WHEN TAG IN ('CREATE TABLE', 'CREATE TABLE AS', 'SELECT INTO', 'ALTER TABLE')
+    EXECUTE PROCEDURE versioned_heap_check_ddl();
+
+    COMMENT ON EVENT TRIGGER versioned_heap_check_ddl IS 'Reject the constraints on the system period of the tables of the versioned_heap access method';
+  END IF;
+END
+$$;
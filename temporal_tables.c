@@ -9,8 +9,19 @@
 #include "postgres.h"
 #include "fmgr.h"
 
+#include "access/xact.h"
+#if PG_VERSION_NUM >= 140000
+#include "catalog/namespace.h"
+#include "catalog/pg_inherits.h"
+#endif
+#include "executor/executor.h"
 #include "nodes/pg_list.h"
+#if PG_VERSION_NUM >= 140000
+#include "tcop/utility.h"
+#endif
+#include "utils/guc.h"
 #include "utils/memutils.h"
+#include "utils/snapmgr.h"
 
 #include "temporal_tables.h"
 #include "utils/elog.h"
@@ -27,9 +38,45 @@ static void temporal_tables_subxact_callback(SubXactEvent event,
 											 SubTransactionId parentSubid,
 											 void *arg);
 
+#if PG_VERSION_NUM >= 140000
+static void temporal_tables_ExecutorStart(QueryDesc *queryDesc, int eflags);
+
+#if PG_VERSION_NUM >= 180000
+static void temporal_tables_ExecutorRun(QueryDesc *queryDesc,
+										ScanDirection direction,
+										uint64 count);
+#else
+static void temporal_tables_ExecutorRun(QueryDesc *queryDesc,
+										ScanDirection direction,
+										uint64 count, bool execute_once);
+#endif
+
+static void temporal_tables_ExecutorFinish(QueryDesc *queryDesc);
+
+static void temporal_tables_ProcessUtility(PlannedStmt *pstmt,
+										   const char *queryString,
+										   bool readOnlyTree,
+										   ProcessUtilityContext context,
+										   ParamListInfo params,
+										   QueryEnvironment *queryEnv,
+										   DestReceiver *dest,
+										   QueryCompletion *qc);
+
+static List *add_utility_relation(List *relids, RangeVar *relation);
+
+/* Saved hook values in case of unload */
+static ExecutorStart_hook_type prev_ExecutorStart = NULL;
+static ExecutorRun_hook_type prev_ExecutorRun = NULL;
+static ExecutorFinish_hook_type prev_ExecutorFinish = NULL;
+static ProcessUtility_hook_type prev_ProcessUtility = NULL;
+#endif
+
 /* TemporalContext stack */
 static List *temporal_contexts;
 
+/* Current nesting depth of ExecutorRun calls */
+static int executor_run_depth = 0;
+
 void
 _PG_init(void)
 {
@@ -58,6 +105,29 @@ _PG_init(void)
 	// stack.
 	RegisterXactCallback(temporal_tables_xact_callback, NULL);
 	RegisterSubXactCallback(temporal_tables_subxact_callback, NULL);
+
+#if PG_VERSION_NUM >= 140000
+	// Install the executor hooks that flush the buffered history rows
+	// before a query starts and when it finishes, and the utility hook that
+	// flushes them before a utility statement uses the history relation.
+	prev_ExecutorStart = ExecutorStart_hook;
+	ExecutorStart_hook = temporal_tables_ExecutorStart;
+	prev_ExecutorRun = ExecutorRun_hook;
+	ExecutorRun_hook = temporal_tables_ExecutorRun;
+	prev_ExecutorFinish = ExecutorFinish_hook;
+	ExecutorFinish_hook = temporal_tables_ExecutorFinish;
+	prev_ProcessUtility = ProcessUtility_hook;
+	ProcessUtility_hook = temporal_tables_ProcessUtility;
+#endif
+
+	init_versioning();
+	init_versioning_stats();
+	init_retention();
+	init_capture();
+
+#if PG_VERSION_NUM >= 150000
+	MarkGUCPrefixReserved("temporal_tables");
+#endif
 }
 
 static void
@@ -96,6 +166,9 @@ push_temporal_context(SubTransactionId subid)
 static void
 temporal_tables_xact_callback(XactEvent event, void *arg)
 {
+	history_buffers_xact_callback(event);
+	versioning_stats_xact_callback(event);
+
 	if (event == XACT_EVENT_COMMIT || event == XACT_EVENT_ABORT)
 	{
 		TemporalContext *ctx = linitial(temporal_contexts);
@@ -125,6 +198,8 @@ temporal_tables_subxact_callback(SubXactEvent event,
 								 SubTransactionId mySubid,
 								 SubTransactionId parentSubid, void *arg)
 {
+	history_buffers_subxact_callback(event, mySubid, parentSubid);
+
 	if (event == SUBXACT_EVENT_COMMIT_SUB ||
 		event == SUBXACT_EVENT_ABORT_SUB)
 	{
@@ -177,3 +252,205 @@ get_current_temporal_context(bool will_modify)
 
 	return push_temporal_context(subid);
 }
+
+#if PG_VERSION_NUM >= 140000
+/*
+ * ExecutorStart hook: flush the buffered history rows, so that the query
+ * sees them. If the history rows are deferred, and for the history relations
+ * that are not heap tables, only the rows of the history relations that the
+ * query uses are flushed.
+ *
+ * The snapshot of the query is already taken, and the flushed rows have its
+ * command ID, so they would be invisible to it. Hence the command counter is
+ * incremented and the query is started with a copy of its snapshot that has
+ * the new command ID.
+ */
+static void
+temporal_tables_ExecutorStart(QueryDesc *queryDesc, int eflags)
+{
+	bool		flushed;
+	bool		pushed = false;
+
+	flushed = flush_history_buffers_used_by(queryDesc->plannedstmt->relationOids);
+
+	if (!versioning_defer_history)
+		flushed |= flush_history_buffers(false);
+
+	if (flushed)
+	{
+		CommandCounterIncrement();
+
+		if (queryDesc->snapshot != InvalidSnapshot &&
+			IsMVCCSnapshot(queryDesc->snapshot))
+		{
+			PushCopiedSnapshot(queryDesc->snapshot);
+			UpdateActiveSnapshotCommandId();
+			queryDesc->snapshot = GetActiveSnapshot();
+			pushed = true;
+		}
+	}
+
+	if (prev_ExecutorStart)
+		prev_ExecutorStart(queryDesc, eflags);
+	else
+		standard_ExecutorStart(queryDesc, eflags);
+
+	/* The executor has registered the snapshot, so it outlives the stack. */
+	if (pushed)
+		PopActiveSnapshot();
+}
+
+/*
+ * ExecutorRun hook: track the nesting depth.
+ */
+static void
+#if PG_VERSION_NUM >= 180000
+temporal_tables_ExecutorRun(QueryDesc *queryDesc, ScanDirection direction,
+							uint64 count)
+#else
+temporal_tables_ExecutorRun(QueryDesc *queryDesc, ScanDirection direction,
+							uint64 count, bool execute_once)
+#endif
+{
+	executor_run_depth++;
+	PG_TRY();
+	{
+#if PG_VERSION_NUM >= 180000
+		if (prev_ExecutorRun)
+			prev_ExecutorRun(queryDesc, direction, count);
+		else
+			standard_ExecutorRun(queryDesc, direction, count);
+#else
+		if (prev_ExecutorRun)
+			prev_ExecutorRun(queryDesc, direction, count, execute_once);
+		else
+			standard_ExecutorRun(queryDesc, direction, count, execute_once);
+#endif
+	}
+	PG_FINALLY();
+	{
+		executor_run_depth--;
+	}
+	PG_END_TRY();
+}
+
+/*
+ * ExecutorFinish hook: flush the history rows buffered by the query before
+ * AFTER triggers are fired unless they are deferred until the transaction
+ * commits. The rows of the history relations that are not heap tables are
+ * always deferred.
+ */
+static void
+temporal_tables_ExecutorFinish(QueryDesc *queryDesc)
+{
+	if (!versioning_defer_history)
+		flush_history_buffers(false);
+
+	if (prev_ExecutorFinish)
+		prev_ExecutorFinish(queryDesc);
+	else
+		standard_ExecutorFinish(queryDesc);
+}
+
+/*
+ * ProcessUtility hook: flush the buffered history rows of the relations that
+ * the utility statement reads, empties, detaches or drops, since the
+ * statement is not run by the executor. Otherwise, COPY TO would miss the
+ * rows and the rows would be inserted after TRUNCATE or DETACH PARTITION.
+ * If COPY TO runs with a snapshot, it is replaced with a copy that sees the
+ * flushed rows, the same way as in temporal_tables_ExecutorStart.
+ */
+static void
+temporal_tables_ProcessUtility(PlannedStmt *pstmt,
+							   const char *queryString,
+							   bool readOnlyTree,
+							   ProcessUtilityContext context,
+							   ParamListInfo params,
+							   QueryEnvironment *queryEnv,
+							   DestReceiver *dest,
+							   QueryCompletion *qc)
+{
+	Node	   *parsetree = pstmt->utilityStmt;
+	List	   *relids = NIL;
+	ListCell   *lc;
+	bool		pushed = false;
+
+	if (history_rows_buffered())
+	{
+		switch (nodeTag(parsetree))
+		{
+			case T_CopyStmt:
+				relids = add_utility_relation(relids,
+											  ((CopyStmt *) parsetree)->relation);
+				break;
+			case T_TruncateStmt:
+				foreach(lc, ((TruncateStmt *) parsetree)->relations)
+					relids = add_utility_relation(relids, lfirst(lc));
+				break;
+			case T_AlterTableStmt:
+				relids = add_utility_relation(relids,
+											  ((AlterTableStmt *) parsetree)->relation);
+				break;
+			case T_DropStmt:
+				if (((DropStmt *) parsetree)->removeType == OBJECT_TABLE)
+					foreach(lc, ((DropStmt *) parsetree)->objects)
+						relids = add_utility_relation(relids,
+													  makeRangeVarFromNameList(lfirst(lc)));
+				break;
+			default:
+				break;
+		}
+	}
+
+	if (flush_history_buffers_used_by(relids))
+	{
+		CommandCounterIncrement();
+
+		if (IsA(parsetree, CopyStmt) && ActiveSnapshotSet())
+		{
+			PushCopiedSnapshot(GetActiveSnapshot());
+			UpdateActiveSnapshotCommandId();
+			pushed = true;
+		}
+	}
+
+	list_free(relids);
+
+	if (prev_ProcessUtility)
+		prev_ProcessUtility(pstmt, queryString, readOnlyTree, context, params,
+							queryEnv, dest, qc);
+	else
+		standard_ProcessUtility(pstmt, queryString, readOnlyTree, context,
+								params, queryEnv, dest, qc);
+
+	if (pushed)
+		PopActiveSnapshot();
+}
+
+/*
+ * Add the OIDs of the relation and of its partitions and inheritance children
+ * to the list. A relation that does not exist is left to the statement to
+ * report.
+ */
+static List *
+add_utility_relation(List *relids, RangeVar *relation)
+{
+	Oid		relid;
+
+	if (relation == NULL)
+		return relids;
+
+	relid = RangeVarGetRelid(relation, NoLock, true);
+
+	if (!OidIsValid(relid))
+		return relids;
+
+	return list_concat(relids, find_all_inheritors(relid, NoLock, NULL));
+}
+#endif
+
+bool
+executor_is_running(void)
+{
+	return executor_run_depth > 0;
+}
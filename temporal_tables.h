@@ -12,13 +12,29 @@
 #include "postgres.h"
 #include "fmgr.h"
 
+#include "access/htup.h"
 #include "access/xact.h"
+#include "commands/trigger.h"
+#include "nodes/pg_list.h"
+#include "utils/relcache.h"
 
 typedef enum SystemTimeMode
 {
 	/* use CURRENT_TIMESTAMP */
 	CurrentTransactionStartTimestamp,
 
+	/* use statement_timestamp() */
+	CurrentStatementStartTimestamp,
+
+	/* use clock_timestamp() */
+	ClockTimestamp,
+
+	/* use CURRENT_TIMESTAMP or, if the system period of a modified row starts
+	 * later, a moment after that start, so that the system period need not be
+	 * adjusted; the value never decreases within a transaction
+	 */
+	MonotonicTransactionTimestamp,
+
 	/* use the value stored in the system_time field of TemporalContext */
 	UserDefined
 } SystemTimeMode;
@@ -28,7 +44,11 @@ typedef struct TemporalContext
 	/* the subtransaction that this context was created in */
 	SubTransactionId	subid;
 
-	/* the current system time mode */
+	/* the current system time mode, either UserDefined or
+	 * CurrentTransactionStartTimestamp, which means that triggers use the
+	 * clock selected by their system_time_source option or by the
+	 * temporal_tables.system_time_source parameter
+	 */
 	SystemTimeMode		system_time_mode;
 
 	/* the system time that is used by triggers in the UserDefined mode */
@@ -41,4 +61,171 @@ typedef struct TemporalContext
  */
 TemporalContext *get_current_temporal_context(bool will_modify);
 
+/* Return true if the executor is running a query. The history rows inserted
+ * while the query is running can be buffered since they are flushed when the
+ * query finishes.
+ */
+bool executor_is_running(void);
+
+/* true if the buffered history rows are kept until the transaction commits
+ * instead of being inserted when the query finishes.
+ */
+extern bool versioning_defer_history;
+
+/* Define the configuration parameters of versioning triggers. */
+void init_versioning(void);
+
+/* Return the OID of the history relation of the versioned relation and the
+ * name of its system period attribute.
+ */
+Oid get_history_relation(Relation relation, char **period_attname);
+
+#if PG_VERSION_NUM >= 100000
+/* The prefix of the logical messages that carry the system time of the rows
+ * deleted from the relations whose history is captured by logical decoding.
+ */
+#define CAPTURE_MESSAGE_PREFIX "temporal_tables"
+
+/* Check whether the history of the relation is captured by logical decoding. */
+bool history_captured(Relation relation);
+
+/* Get the lower bound of the system period of a row of the relation whose
+ * history is captured. Return false if the row has no valid system period.
+ */
+bool get_captured_lower(Relation relation, HeapTuple tuple,
+						TimestampTz *lower);
+
+/* Insert a captured row of the relation into its history relation with the
+ * system period "[lower, upper)".
+ */
+void archive_captured_row(Relation relation, HeapTuple tuple,
+						  TimestampTz upper);
+#endif
+
+#if PG_VERSION_NUM >= 140000
+/* Check whether the history relation is range partitioned by the upper bound
+ * of its system period attribute.
+ */
+bool is_partitioned_by_upper(Relation history_relation, int period_attnum);
+#endif
+
+#if PG_VERSION_NUM >= 120000
+/* Check whether the relation uses the versioned_heap table access method. */
+bool is_versioned_heap(Relation relation);
+
+/* Version a row of a relation of the versioned_heap access method the way the
+ * versioning trigger would: return the row to be stored for INSERT and UPDATE
+ * and archive the old row for UPDATE and DELETE.
+ */
+HeapTuple versioned_heap_row(Relation relation, TriggerEvent event,
+							 HeapTuple oldtuple, HeapTuple newtuple);
+
+/* Return the number of the system period attribute of a relation of the
+ * versioned_heap access method.
+ */
+int versioned_heap_period_attnum(Relation relation);
+#endif
+
+/* Flush the history rows buffered in the current subtransaction. The rows of
+ * the history relations that are not heap tables are kept unless bulk is
+ * true. Return true if any rows were inserted, they become visible once the
+ * command counter is incremented.
+ */
+bool flush_history_buffers(bool bulk);
+
+/* Flush the history rows buffered in the current subtransaction for the
+ * history relations in the relids list. Return true if any rows were
+ * inserted.
+ */
+bool flush_history_buffers_used_by(List *relids);
+
+/* Check whether any history rows are buffered. */
+bool history_rows_buffered(void);
+
+/* Flush the buffered history rows before the transaction commits or discard
+ * them if it aborts.
+ */
+void history_buffers_xact_callback(XactEvent event);
+
+/* Discard the history rows buffered in the aborted subtransaction or pass
+ * them to the parent subtransaction if it commits.
+ */
+void history_buffers_subxact_callback(SubXactEvent event,
+									  SubTransactionId mySubid,
+									  SubTransactionId parentSubid);
+
+/* Counters of the versioning statistics of a relation. */
+typedef enum VersioningStatsCounter
+{
+	/* rows which system period was set on INSERT */
+	VERSIONING_STATS_ROWS_STAMPED,
+
+	/* rows inserted into the history relation */
+	VERSIONING_STATS_HISTORY_ROWS,
+
+	/* rows not archived since they were modified in the same transaction */
+	VERSIONING_STATS_ROWS_SKIPPED,
+
+	/* system periods adjusted and failed to be adjusted */
+	VERSIONING_STATS_ADJUSTMENTS,
+	VERSIONING_STATS_ADJUST_ERRORS,
+
+	/*
+	 * cached data of the relation created, rebuilt after a change and evicted
+	 * by the limit of the cache size
+	 */
+	VERSIONING_STATS_CACHE_MISSES,
+	VERSIONING_STATS_CACHE_REBUILDS,
+	VERSIONING_STATS_CACHE_EVICTIONS,
+
+	/* history rows and partitions removed by the retention policy */
+	VERSIONING_STATS_ROWS_PRUNED,
+	VERSIONING_STATS_PARTITIONS_PRUNED,
+
+	VERSIONING_STATS_NUM_COUNTERS
+} VersioningStatsCounter;
+
+typedef struct VersioningStats
+{
+	int64				counters[VERSIONING_STATS_NUM_COUNTERS];
+
+	/* the time spent in versioning triggers in milliseconds */
+	double				total_time;
+
+	/* the time the history was pruned for the last time or 0 if never, and
+	 * how long the oldest history row left then had been past the retention,
+	 * in seconds
+	 */
+	TimestampTz			last_prune;
+	double				prune_lag;
+} VersioningStats;
+
+/* true if versioning triggers measure the time spent in them */
+extern bool versioning_track_timing;
+
+/* Define the configuration parameters of the versioning statistics and
+ * request the shared memory for them.
+ */
+void init_versioning_stats(void);
+
+/* Get the versioning statistics of the relation accumulated by the current
+ * backend. The returned pointer stays valid until the backend exits.
+ */
+VersioningStats *get_versioning_stats(Oid relid);
+
+/* Add the versioning statistics accumulated by the current backend to the
+ * shared statistics when the transaction ends.
+ */
+void versioning_stats_xact_callback(XactEvent event);
+
+/* Define the configuration parameters of the retention worker and register
+ * it if the library is being preloaded.
+ */
+void init_retention(void);
+
+/* Define the configuration parameters of the capture worker and register it
+ * if the library is being preloaded.
+ */
+void init_capture(void);
+
 #endif
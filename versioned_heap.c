@@ -0,0 +1,727 @@
+/* -------------------------------------------------------------------------
+ *
+ * versioned_heap.c
+ *
+ * Copyright (c) 2012-2023 Vladislav Arkhipov <vlad@arkhipov.ru>
+ *
+ * -------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+
+#if PG_VERSION_NUM >= 120000
+#include "access/heapam.h"
+#include "access/sysattr.h"
+#include "access/tableam.h"
+#include "catalog/index.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_inherits.h"
+#include "commands/event_trigger.h"
+#include "executor/executor.h"
+#include "executor/spi.h"
+#include "optimizer/optimizer.h"
+#include "utils/datum.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/partcache.h"
+#include "utils/rel.h"
+#include "utils/snapmgr.h"
+#include "utils/syscache.h"
+#endif
+
+#include "temporal_tables.h"
+
+PGDLLEXPORT Datum versioned_heap_handler(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum versioned_heap_check_ddl(PG_FUNCTION_ARGS);
+
+PG_FUNCTION_INFO_V1(versioned_heap_handler);
+PG_FUNCTION_INFO_V1(versioned_heap_check_ddl);
+
+#if PG_VERSION_NUM >= 120000
+/*
+ * The callbacks of the versioned_heap access method: the ones of heap but
+ * for those that version the rows. The structure is filled on the first call
+ * of the handler.
+ */
+static TableAmRoutine versioned_heap_methods;
+static bool versioned_heap_methods_filled = false;
+
+static void versioned_heap_stamp(Relation relation,
+								 TupleTableSlot *slot,
+								 TriggerEvent event,
+								 HeapTuple oldtuple);
+static TM_Result versioned_heap_lock(Relation relation,
+									 ItemPointer tid,
+									 Snapshot snapshot,
+									 CommandId cid,
+									 LockTupleMode lockmode,
+									 bool wait,
+									 TM_FailureData *tmfd,
+									 TupleTableSlot **oldslot);
+static LockTupleMode versioned_heap_update_lock_mode(Relation relation,
+													 ItemPointer otid,
+													 TupleTableSlot *slot);
+static void versioned_heap_check_period(Relation relation);
+static Relation versioned_heap_open_as_heap(Relation relation);
+static void versioned_heap_close_as_heap(Relation heap_relation);
+
+static void versioned_heap_tuple_insert(Relation relation,
+										TupleTableSlot *slot,
+										CommandId cid,
+										int options,
+										struct BulkInsertStateData *bistate);
+static void versioned_heap_tuple_insert_speculative(Relation relation,
+													TupleTableSlot *slot,
+													CommandId cid,
+													int options,
+													struct BulkInsertStateData *bistate,
+													uint32 specToken);
+static void versioned_heap_multi_insert(Relation relation,
+										TupleTableSlot **slots,
+										int nslots,
+										CommandId cid,
+										int options,
+										struct BulkInsertStateData *bistate);
+static TM_Result versioned_heap_tuple_delete(Relation relation,
+											 ItemPointer tid,
+											 CommandId cid,
+											 Snapshot snapshot,
+											 Snapshot crosscheck,
+											 bool wait,
+											 TM_FailureData *tmfd,
+											 bool changingPart);
+#if PG_VERSION_NUM >= 160000
+static TM_Result versioned_heap_tuple_update(Relation relation,
+											 ItemPointer otid,
+											 TupleTableSlot *slot,
+											 CommandId cid,
+											 Snapshot snapshot,
+											 Snapshot crosscheck,
+											 bool wait,
+											 TM_FailureData *tmfd,
+											 LockTupleMode *lockmode,
+											 TU_UpdateIndexes *update_indexes);
+#else
+static TM_Result versioned_heap_tuple_update(Relation relation,
+											 ItemPointer otid,
+											 TupleTableSlot *slot,
+											 CommandId cid,
+											 Snapshot snapshot,
+											 Snapshot crosscheck,
+											 bool wait,
+											 TM_FailureData *tmfd,
+											 LockTupleMode *lockmode,
+											 bool *update_indexes);
+#endif
+static double versioned_heap_index_build_range_scan(Relation relation,
+													Relation index_relation,
+													IndexInfo *index_info,
+													bool allow_sync,
+													bool anyvisible,
+													bool progress,
+													BlockNumber start_blockno,
+													BlockNumber numblocks,
+													IndexBuildCallback callback,
+													void *callback_state,
+													TableScanDesc scan);
+static void versioned_heap_index_validate_scan(Relation relation,
+											   Relation index_relation,
+											   IndexInfo *index_info,
+											   Snapshot snapshot,
+											   ValidateIndexState *state);
+#if PG_VERSION_NUM >= 140000
+static Oid versioned_heap_relation_toast_am(Relation relation);
+#endif
+#endif
+
+/*
+ * The handler of the versioned_heap table access method. The rows are stored
+ * the same way heap stores them, but the access method maintains their system
+ * period and archives their old versions into the history relation instead of
+ * a versioning trigger, see versioned_heap_row.
+ */
+Datum
+versioned_heap_handler(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+	if (!versioned_heap_methods_filled)
+	{
+		versioned_heap_methods = *GetHeapamTableAmRoutine();
+
+		versioned_heap_methods.tuple_insert = versioned_heap_tuple_insert;
+		versioned_heap_methods.tuple_insert_speculative =
+			versioned_heap_tuple_insert_speculative;
+		versioned_heap_methods.multi_insert = versioned_heap_multi_insert;
+		versioned_heap_methods.tuple_delete = versioned_heap_tuple_delete;
+		versioned_heap_methods.tuple_update = versioned_heap_tuple_update;
+		versioned_heap_methods.index_build_range_scan =
+			versioned_heap_index_build_range_scan;
+		versioned_heap_methods.index_validate_scan =
+			versioned_heap_index_validate_scan;
+#if PG_VERSION_NUM >= 140000
+		versioned_heap_methods.relation_toast_am =
+			versioned_heap_relation_toast_am;
+#endif
+
+		versioned_heap_methods_filled = true;
+	}
+
+	PG_RETURN_POINTER(&versioned_heap_methods);
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("versioned_heap access method requires PostgreSQL 12 or later")));
+
+	PG_RETURN_NULL();			/* keep compiler quiet */
+#endif
+}
+
+/*
+ * The event trigger that checks the relations that a CREATE TABLE or ALTER
+ * TABLE command leaves of the versioned_heap access method, see
+ * versioned_heap_check_period. The partitions of a partitioned relation are
+ * checked too, since the partitioned one inherits its constraints to them.
+ */
+Datum
+versioned_heap_check_ddl(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 120000
+	uint64		i;
+	int			ret;
+
+	if (!CALLED_AS_EVENT_TRIGGER(fcinfo))
+		elog(ERROR, "not fired by event trigger manager");
+
+	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect returned %d", ret);
+
+	if ((ret = SPI_execute("SELECT DISTINCT objid "
+						   "FROM pg_catalog.pg_event_trigger_ddl_commands() "
+						   "WHERE classid OPERATOR(pg_catalog.=) 'pg_catalog.pg_class'::pg_catalog.regclass",
+						   true, 0)) != SPI_OK_SELECT)
+		elog(ERROR, "SPI_execute returned %d", ret);
+
+	for (i = 0; i < SPI_processed; ++i)
+	{
+		bool		isnull;
+		Oid			relid;
+		List	   *relids;
+		ListCell   *lc;
+
+		relid = DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[i],
+											   SPI_tuptable->tupdesc, 1,
+											   &isnull));
+
+		/* The relation may have been dropped by the command. */
+		if (!SearchSysCacheExists1(RELOID, ObjectIdGetDatum(relid)))
+			continue;
+
+		relids = find_all_inheritors(relid, AccessShareLock, NULL);
+
+		foreach(lc, relids)
+		{
+			Relation	relation;
+
+			relation = try_relation_open(lfirst_oid(lc), AccessShareLock);
+
+			if (relation == NULL)
+				continue;
+
+			if (is_versioned_heap(relation))
+				versioned_heap_check_period(relation);
+
+			relation_close(relation, AccessShareLock);
+		}
+	}
+
+	if ((ret = SPI_finish()) != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish returned %d", ret);
+#endif
+
+	PG_RETURN_VOID();
+}
+
+#if PG_VERSION_NUM >= 120000
+bool
+is_versioned_heap(Relation relation)
+{
+	return versioned_heap_methods_filled &&
+		relation->rd_tableam == &versioned_heap_methods;
+}
+
+/*
+ * Store the row to be inserted into the slot instead of the new row of INSERT
+ * or UPDATE, archiving the old row of UPDATE.
+ */
+static void
+versioned_heap_stamp(Relation relation,
+					 TupleTableSlot *slot,
+					 TriggerEvent event,
+					 HeapTuple oldtuple)
+{
+	HeapTuple	newtuple;
+	HeapTuple	result;
+
+	newtuple = ExecFetchSlotHeapTuple(slot, true, NULL);
+
+	result = versioned_heap_row(relation, event, oldtuple, newtuple);
+
+	/* The slot keeps its tuple if the system period is left alone. */
+	if (result != newtuple)
+		ExecForceStoreHeapTuple(result, slot, true);
+}
+
+/*
+ * Lock the row that is about to be updated or deleted and fetch it into a new
+ * slot, the same way the trigger manager does before it fires BEFORE ROW
+ * triggers, so that the row cannot be changed concurrently once its old
+ * version is archived. The row is locked in the mode that heap would take
+ * for the update or delete, so that an update that leaves the key columns
+ * alone does not block the foreign keys that refer to the row. If the row
+ * cannot be locked, the result is returned the way heap would return it for
+ * the update or delete.
+ */
+static TM_Result
+versioned_heap_lock(Relation relation,
+					ItemPointer tid,
+					Snapshot snapshot,
+					CommandId cid,
+					LockTupleMode lockmode,
+					bool wait,
+					TM_FailureData *tmfd,
+					TupleTableSlot **oldslot)
+{
+	TM_Result	result;
+
+	*oldslot = table_slot_create(relation, NULL);
+
+	result = GetHeapamTableAmRoutine()->tuple_lock(relation, tid, snapshot,
+												   *oldslot, cid, lockmode,
+												   wait ? LockWaitBlock : LockWaitError,
+												   0, tmfd);
+
+	if (result != TM_Ok)
+	{
+		ExecDropSingleTupleTableSlot(*oldslot);
+		*oldslot = NULL;
+	}
+
+	return result;
+}
+
+/*
+ * Return the lock mode of the update of the row with the new version in the
+ * slot the way heap_update() determines it: LockTupleExclusive if any of the
+ * columns that a unique index that can be referenced by a foreign key covers
+ * is modified, LockTupleNoKeyExclusive otherwise.
+ *
+ * The row at otid is the one that is about to be updated, whichever version
+ * of it is visible, and the columns of a row version never change. The
+ * system period is stamped after the row is locked, so it always counts as
+ * modified.
+ */
+static LockTupleMode
+versioned_heap_update_lock_mode(Relation relation,
+								ItemPointer otid,
+								TupleTableSlot *slot)
+{
+	Bitmapset	   *key_attrs;
+	TupleDesc		tupdesc = RelationGetDescr(relation);
+	TupleTableSlot *oldslot;
+	AttrNumber		period_attnum;
+	LockTupleMode	lockmode = LockTupleNoKeyExclusive;
+	int				attidx = -1;
+
+	key_attrs = RelationGetIndexAttrBitmap(relation, INDEX_ATTR_BITMAP_KEY);
+
+	if (bms_is_empty(key_attrs))
+		return LockTupleNoKeyExclusive;
+
+	period_attnum = versioned_heap_period_attnum(relation);
+
+	if (bms_is_member(period_attnum - FirstLowInvalidHeapAttributeNumber,
+					  key_attrs))
+	{
+		bms_free(key_attrs);
+		return LockTupleExclusive;
+	}
+
+	oldslot = table_slot_create(relation, NULL);
+
+	if (!GetHeapamTableAmRoutine()->tuple_fetch_row_version(relation, otid,
+															SnapshotAny,
+															oldslot))
+		lockmode = LockTupleExclusive;
+
+	while (lockmode != LockTupleExclusive &&
+		   (attidx = bms_next_member(key_attrs, attidx)) >= 0)
+	{
+		AttrNumber			attnum = attidx + FirstLowInvalidHeapAttributeNumber;
+		Form_pg_attribute	attr;
+		Datum				oldvalue;
+		Datum				newvalue;
+		bool				oldisnull;
+		bool				newisnull;
+
+		/* System attributes are not expected, but heap treats them so. */
+		if (attnum <= 0)
+		{
+			lockmode = LockTupleExclusive;
+			break;
+		}
+
+		attr = TupleDescAttr(tupdesc, attnum - 1);
+
+		oldvalue = slot_getattr(oldslot, attnum, &oldisnull);
+		newvalue = slot_getattr(slot, attnum, &newisnull);
+
+		if (oldisnull != newisnull ||
+			(!oldisnull &&
+			 !datumIsEqual(oldvalue, newvalue, attr->attbyval, attr->attlen)))
+			lockmode = LockTupleExclusive;
+	}
+
+	ExecDropSingleTupleTableSlot(oldslot);
+	bms_free(key_attrs);
+
+	return lockmode;
+}
+
+static void
+versioned_heap_tuple_insert(Relation relation,
+							TupleTableSlot *slot,
+							CommandId cid,
+							int options,
+							struct BulkInsertStateData *bistate)
+{
+	versioned_heap_stamp(relation, slot, TRIGGER_EVENT_INSERT, NULL);
+
+	GetHeapamTableAmRoutine()->tuple_insert(relation, slot, cid, options,
+											bistate);
+}
+
+static void
+versioned_heap_tuple_insert_speculative(Relation relation,
+										TupleTableSlot *slot,
+										CommandId cid,
+										int options,
+										struct BulkInsertStateData *bistate,
+										uint32 specToken)
+{
+	versioned_heap_stamp(relation, slot, TRIGGER_EVENT_INSERT, NULL);
+
+	GetHeapamTableAmRoutine()->tuple_insert_speculative(relation, slot, cid,
+														options, bistate,
+														specToken);
+}
+
+static void
+versioned_heap_multi_insert(Relation relation,
+							TupleTableSlot **slots,
+							int nslots,
+							CommandId cid,
+							int options,
+							struct BulkInsertStateData *bistate)
+{
+	int		i;
+
+	for (i = 0; i < nslots; ++i)
+		versioned_heap_stamp(relation, slots[i], TRIGGER_EVENT_INSERT, NULL);
+
+	GetHeapamTableAmRoutine()->multi_insert(relation, slots, nslots, cid,
+											options, bistate);
+}
+
+static TM_Result
+versioned_heap_tuple_delete(Relation relation,
+							ItemPointer tid,
+							CommandId cid,
+							Snapshot snapshot,
+							Snapshot crosscheck,
+							bool wait,
+							TM_FailureData *tmfd,
+							bool changingPart)
+{
+	TupleTableSlot *oldslot;
+	TM_Result		result;
+
+	result = versioned_heap_lock(relation, tid, snapshot, cid,
+								 LockTupleExclusive, wait, tmfd, &oldslot);
+
+	if (result != TM_Ok)
+		return result;
+
+	(void) versioned_heap_row(relation, TRIGGER_EVENT_DELETE,
+							  ExecFetchSlotHeapTuple(oldslot, false, NULL),
+							  NULL);
+
+	ExecDropSingleTupleTableSlot(oldslot);
+
+	return GetHeapamTableAmRoutine()->tuple_delete(relation, tid, cid,
+												   snapshot, crosscheck, wait,
+												   tmfd, changingPart);
+}
+
+static TM_Result
+versioned_heap_tuple_update(Relation relation,
+							ItemPointer otid,
+							TupleTableSlot *slot,
+							CommandId cid,
+							Snapshot snapshot,
+							Snapshot crosscheck,
+							bool wait,
+							TM_FailureData *tmfd,
+							LockTupleMode *lockmode,
+#if PG_VERSION_NUM >= 160000
+							TU_UpdateIndexes *update_indexes)
+#else
+							bool *update_indexes)
+#endif
+{
+	TupleTableSlot *oldslot;
+	LockTupleMode	mode;
+	TM_Result		result;
+
+	mode = versioned_heap_update_lock_mode(relation, otid, slot);
+
+	result = versioned_heap_lock(relation, otid, snapshot, cid, mode, wait,
+								 tmfd, &oldslot);
+
+	if (result != TM_Ok)
+	{
+		*lockmode = mode;
+#if PG_VERSION_NUM >= 160000
+		*update_indexes = TU_None;
+#else
+		*update_indexes = false;
+#endif
+		return result;
+	}
+
+	versioned_heap_stamp(relation, slot, TRIGGER_EVENT_UPDATE,
+						 ExecFetchSlotHeapTuple(oldslot, false, NULL));
+
+	ExecDropSingleTupleTableSlot(oldslot);
+
+	return GetHeapamTableAmRoutine()->tuple_update(relation, otid, slot, cid,
+												   snapshot, crosscheck, wait,
+												   tmfd, lockmode,
+												   update_indexes);
+}
+
+/*
+ * Build an index the way heap does. heap_getnext(), which heap uses to scan
+ * the relation, refuses to scan the relations of other access methods, so
+ * heap scans a copy of the relation descriptor that has the heap access
+ * method, see versioned_heap_open_as_heap. A scan that the caller has begun,
+ * e.g. for a parallel build, is moved over to the copy.
+ */
+static double
+versioned_heap_index_build_range_scan(Relation relation,
+									  Relation index_relation,
+									  IndexInfo *index_info,
+									  bool allow_sync,
+									  bool anyvisible,
+									  bool progress,
+									  BlockNumber start_blockno,
+									  BlockNumber numblocks,
+									  IndexBuildCallback callback,
+									  void *callback_state,
+									  TableScanDesc scan)
+{
+	Relation	heap_relation;
+	double		result;
+
+	heap_relation = versioned_heap_open_as_heap(relation);
+
+	/* heap ends the scan, which releases the reference to the copy. */
+	if (scan != NULL)
+	{
+		RelationIncrementReferenceCount(heap_relation);
+		scan->rs_rd = heap_relation;
+		RelationDecrementReferenceCount(relation);
+	}
+
+	PG_TRY();
+	{
+		result = GetHeapamTableAmRoutine()->index_build_range_scan(heap_relation,
+																   index_relation,
+																   index_info,
+																   allow_sync,
+																   anyvisible,
+																   progress,
+																   start_blockno,
+																   numblocks,
+																   callback,
+																   callback_state,
+																   scan);
+	}
+	PG_CATCH();
+	{
+		/* The copy is released along with the resource owner. */
+		RelationCloseSmgr(heap_relation);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	versioned_heap_close_as_heap(heap_relation);
+
+	return result;
+}
+
+/*
+ * Validate an index built concurrently the way heap does, see
+ * versioned_heap_index_build_range_scan.
+ */
+static void
+versioned_heap_index_validate_scan(Relation relation,
+								   Relation index_relation,
+								   IndexInfo *index_info,
+								   Snapshot snapshot,
+								   ValidateIndexState *state)
+{
+	Relation	heap_relation;
+
+	heap_relation = versioned_heap_open_as_heap(relation);
+
+	PG_TRY();
+	{
+		GetHeapamTableAmRoutine()->index_validate_scan(heap_relation,
+													   index_relation,
+													   index_info, snapshot,
+													   state);
+	}
+	PG_CATCH();
+	{
+		RelationCloseSmgr(heap_relation);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	versioned_heap_close_as_heap(heap_relation);
+}
+
+/*
+ * Check that nothing constrains the system period of the relation of the
+ * versioned_heap access method. The executor checks the constraints and
+ * routes the row to its partition before it passes the row to the access
+ * method, which sets the system period only then, so a NOT NULL or CHECK
+ * constraint, or a partition bound, would see the system period that the
+ * command specified instead of the one that is stored.
+ */
+static void
+versioned_heap_check_period(Relation relation)
+{
+	TupleDesc	tupdesc = RelationGetDescr(relation);
+	AttrNumber	period_attnum;
+	Bitmapset  *attrs = NULL;
+	int			i;
+
+	/* See versioned_heap_trigger(). */
+	period_attnum = get_attnum(RelationGetRelid(relation), "sys_period");
+
+	if (period_attnum == InvalidAttrNumber)
+		return;
+
+	if (TupleDescAttr(tupdesc, period_attnum - 1)->attnotnull)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TABLE_DEFINITION),
+				 errmsg("system period column \"sys_period\" of relation \"%s\" of the versioned_heap access method must not be NOT NULL",
+						RelationGetRelationName(relation)),
+				 errdetail("The access method sets the system period after the constraints are checked.")));
+
+	for (i = 0; tupdesc->constr != NULL && i < tupdesc->constr->num_check; ++i)
+		pull_varattnos(stringToNode(tupdesc->constr->check[i].ccbin), 1,
+					   &attrs);
+
+	if (relation->rd_rel->relispartition)
+		pull_varattnos((Node *) RelationGetPartitionQual(relation), 1, &attrs);
+
+	if (bms_is_member(period_attnum - FirstLowInvalidHeapAttributeNumber,
+					  attrs))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_TABLE_DEFINITION),
+				 errmsg("system period column \"sys_period\" of relation \"%s\" of the versioned_heap access method must not be constrained",
+						RelationGetRelationName(relation)),
+				 errdetail("The access method sets the system period after the constraints are checked and the row is routed to its partition.")));
+
+	bms_free(attrs);
+}
+
+/*
+ * Return a copy of the relation descriptor that has the heap access method,
+ * so that heap can scan the relation without the relcache entry being
+ * changed. The copy has its own copies of the catalog row and the options
+ * and a pin on the row type, so that it stays valid if the relcache entry is
+ * rebuilt meanwhile, and it opens the storage on its own.
+ *
+ * The copy is allocated in the transaction context, as the resource owner
+ * may still refer to it until the end of the transaction if the scan fails.
+ */
+static Relation
+versioned_heap_open_as_heap(Relation relation)
+{
+	MemoryContext	oldcontext;
+	Relation		heap_relation;
+
+	oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+
+	heap_relation = palloc(sizeof(RelationData));
+	memcpy(heap_relation, relation, sizeof(RelationData));
+
+	heap_relation->rd_tableam = GetHeapamTableAmRoutine();
+	heap_relation->rd_smgr = NULL;
+
+	heap_relation->rd_rel = palloc(CLASS_TUPLE_SIZE);
+	memcpy(heap_relation->rd_rel, relation->rd_rel, CLASS_TUPLE_SIZE);
+
+	if (relation->rd_options != NULL)
+	{
+		heap_relation->rd_options = palloc(VARSIZE(relation->rd_options));
+		memcpy(heap_relation->rd_options, relation->rd_options,
+			   VARSIZE(relation->rd_options));
+	}
+
+#if PG_VERSION_NUM >= 150000
+	/* The statistics entry, if any, belongs to the relcache entry. */
+	if (heap_relation->pgstat_info == NULL)
+		heap_relation->pgstat_enabled = false;
+#endif
+
+	MemoryContextSwitchTo(oldcontext);
+
+	IncrTupleDescRefCount(heap_relation->rd_att);
+
+	return heap_relation;
+}
+
+/*
+ * Release a copy made by versioned_heap_open_as_heap after a successful
+ * scan.
+ */
+static void
+versioned_heap_close_as_heap(Relation heap_relation)
+{
+	RelationCloseSmgr(heap_relation);
+
+	DecrTupleDescRefCount(heap_relation->rd_att);
+
+	if (heap_relation->rd_options != NULL)
+		pfree(heap_relation->rd_options);
+
+	pfree(heap_relation->rd_rel);
+	pfree(heap_relation);
+}
+
+#if PG_VERSION_NUM >= 140000
+/*
+ * The TOAST table is a plain heap table, as its rows are not versioned.
+ */
+static Oid
+versioned_heap_relation_toast_am(Relation relation)
+{
+	return HEAP_TABLE_AM_OID;
+}
+#endif
+#endif
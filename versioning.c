@@ -14,26 +14,92 @@
 #if PG_VERSION_NUM >= 120000
 #include "access/relation.h"
 #include "access/table.h"
+#include "access/tableam.h"
 #endif
+#include "access/genam.h"
 #if PG_VERSION_NUM >= 90300
 #include "access/htup_details.h"
 #endif
+#include "access/sysattr.h"
+#if PG_VERSION_NUM >= 140000
+#include "access/tupconvert.h"
+#endif
 #include "access/xact.h"
+#include "access/xlog.h"
 #include "catalog/namespace.h"
+#if PG_VERSION_NUM >= 140000
+#include "catalog/partition.h"
+#endif
+#if PG_VERSION_NUM >= 120000
+#include "catalog/pg_am.h"
+#endif
+#include "catalog/pg_class.h"
+#include "catalog/pg_trigger.h"
 #include "catalog/pg_type.h"
 #include "commands/trigger.h"
+#include "executor/executor.h"
 #include "executor/spi.h"
+#include "funcapi.h"
+#include "lib/ilist.h"
+#include "miscadmin.h"
+#include "nodes/makefuncs.h"
+#if PG_VERSION_NUM >= 140000
+#include "nodes/primnodes.h"
+#include "partitioning/partbounds.h"
+#include "partitioning/partdesc.h"
+#endif
+#include "parser/scansup.h"
+#if PG_VERSION_NUM >= 90600 && PG_VERSION_NUM < 140000
+#include "pgstat.h"
+#endif
+#include "portability/instr_time.h"
+#if PG_VERSION_NUM >= 100000
+#include "replication/message.h"
+#endif
+#include "storage/lmgr.h"
+#include "storage/proc.h"
+#include "utils/acl.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/datum.h"
+#if PG_VERSION_NUM >= 110000
+#include "utils/format_type.h"
+#endif
+#if PG_VERSION_NUM >= 140000
+#include "utils/fmgroids.h"
+#endif
 #include "utils/guc.h"
+#include "utils/inval.h"
+#if PG_VERSION_NUM >= 100000
+#include "utils/json.h"
+#include "utils/jsonb.h"
+#endif
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
+#if PG_VERSION_NUM >= 140000
+#include "utils/partcache.h"
+#endif
+#include "utils/plancache.h"
 #include "utils/rangetypes.h"
 #if PG_VERSION_NUM >= 100000
 #include "utils/regproc.h"
 #endif
 #include "utils/rel.h"
+#include "utils/resowner.h"
+#include "utils/ruleutils.h"
 #include "utils/syscache.h"
 #include "utils/timestamp.h"
+#include "utils/tuplestore.h"
+#if PG_VERSION_NUM >= 100000
+#include "utils/varlena.h"
+#endif
+#if PG_VERSION_NUM >= 140000
+#include "utils/wait_event.h"
+#endif
+
+#if defined(ENABLE_DTRACE) && defined(__linux__)
+#include <sys/sdt.h>
+#endif
 
 #include "temporal_tables.h"
 
@@ -45,6 +111,7 @@
 // https://github.com/postgres/postgres/commit/4bd1994650fddf49e717e35f1930d62208845974#diff-350265f4962fd3fb1c5c2d8667d79700
 #define DatumGetRangeTypeP DatumGetRangeType
 #define RangeTypePGetDatum RangeTypeGetDatum
+#define DatumGetJsonbP DatumGetJsonb
 #endif
 
 #if PG_VERSION_NUM >= 130001
@@ -53,11 +120,70 @@
 #define heap_openrv table_openrv
 #endif
 
+#if PG_VERSION_NUM >= 170000
+// PGPROC.lxid was moved into PGPROC.vxid in PostgreSQL 17.
+#define MyLocalTransactionId (MyProc->vxid.lxid)
+#else
+#define MyLocalTransactionId (MyProc->lxid)
+#endif
+
+#if defined(ENABLE_DTRACE) && defined(__linux__)
+// USDT probes of the temporal_tables provider. Unlike the probes of the
+// server they need no probes.d, SystemTap's <sys/sdt.h> defines them inline.
+#define TEMPORAL_TABLES_TRIGGER_START(relid, event) \
+	DTRACE_PROBE2(temporal_tables, trigger__start, relid, event)
+#define TEMPORAL_TABLES_TRIGGER_DONE(relid, event) \
+	DTRACE_PROBE2(temporal_tables, trigger__done, relid, event)
+#define TEMPORAL_TABLES_HISTORY_INSERT_START(relid, history_relid) \
+	DTRACE_PROBE2(temporal_tables, history__insert__start, relid, history_relid)
+#define TEMPORAL_TABLES_HISTORY_INSERT_DONE(relid, history_relid) \
+	DTRACE_PROBE2(temporal_tables, history__insert__done, relid, history_relid)
+#else
+#define TEMPORAL_TABLES_TRIGGER_START(relid, event) do {} while (0)
+#define TEMPORAL_TABLES_TRIGGER_DONE(relid, event) do {} while (0)
+#define TEMPORAL_TABLES_HISTORY_INSERT_START(relid, history_relid) do {} while (0)
+#define TEMPORAL_TABLES_HISTORY_INSERT_DONE(relid, history_relid) do {} while (0)
+#endif
+
+// The storage parameters of the history relations create_history_table
+// creates: the rows are only appended, so the pages are filled up, and the
+// vacuums the inserts trigger freeze them.
+#if PG_VERSION_NUM >= 130000
+#define HISTORY_RELOPTIONS "fillfactor = 100, autovacuum_freeze_min_age = 0, " \
+	"autovacuum_vacuum_insert_threshold = 100000, " \
+	"autovacuum_vacuum_insert_scale_factor = 0"
+#else
+#define HISTORY_RELOPTIONS "fillfactor = 100, autovacuum_freeze_min_age = 0"
+#endif
+
+#if PG_VERSION_NUM >= 170000
+// https://github.com/postgres/postgres/commit/a86c61c9eefaba70e5d4f8d9d6791891a9f8e741
+#define OverrideSearchPath SearchPathMatcher
+#define GetOverrideSearchPath GetSearchPathMatcher
+#define OverrideSearchPathMatchesCurrent SearchPathMatchesCurrentEnvironment
+#endif
+
 PGDLLEXPORT Datum versioning(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum versioning_statement(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum versioning_truncate_period(PG_FUNCTION_ARGS);
 PGDLLEXPORT Datum set_system_time(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum temporal_tables_prewarm(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum versioning_current_period(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum versioning_as_of(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum temporal_diff(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum create_history_table(PG_FUNCTION_ARGS);
+PGDLLEXPORT Datum versioning_enable(PG_FUNCTION_ARGS);
 
 PG_FUNCTION_INFO_V1(versioning);
+PG_FUNCTION_INFO_V1(versioning_statement);
+PG_FUNCTION_INFO_V1(versioning_truncate_period);
 PG_FUNCTION_INFO_V1(set_system_time);
+PG_FUNCTION_INFO_V1(versioning_current_period);
+PG_FUNCTION_INFO_V1(temporal_tables_prewarm);
+PG_FUNCTION_INFO_V1(versioning_as_of);
+PG_FUNCTION_INFO_V1(temporal_diff);
+PG_FUNCTION_INFO_V1(create_history_table);
+PG_FUNCTION_INFO_V1(versioning_enable);
 
 /* Warning if system period was adjusted. */
 #define ERRCODE_WARNING_SYSTEM_PERIOD_ADJUSTED MAKE_SQLSTATE('0', '1', 'X', '0', '1')
@@ -67,13 +193,19 @@ typedef struct VersioningHashEntry
 {
 	Oid 		 relid;					/* hash key (must be first) */
 	Oid 		 history_relid;			/* OID of the history relation */
-	TupleDesc	 tupdesc;				/* tuple descriptor of the versioned relation */
-	TupleDesc	 history_tupdesc;		/* tuple descriptor of the history relation */
+
+	/*
+	 * false if the versioned relation or the history relation has changed
+	 * since the cached data was filled. It is reset by the relcache
+	 * invalidation callback, the cached data is freed on the next use.
+	 */
+	bool		 valid;
 
 	/*
 	 * The number of items in attnums or -1 if this cached data is invalid.
-	 * If attnums is not zero then tupdesc, history_tupdesc, attnums and
-	 * insert_history_plan contains not null values.
+	 * If attnums is not zero then attnums, history_attnums,
+	 * insert_history_query and insert_history_argtypes contains not null
+	 * values.
 	 */
 	int			 natts;
 
@@ -83,26 +215,422 @@ typedef struct VersioningHashEntry
 	 */
 	int			*attnums;
 
-	/* Cached plan of INSERT command into the history relation. */
+	/*
+	 * history_attnums[N] is a number of the attribute in the history relation
+	 * that has the same name as the attribute attnums[N].
+	 */
+	int			*history_attnums;
+
+	/*
+	 * Numbers of the system period attribute in the versioned relation and
+	 * in the history relation.
+	 */
+	int			 period_attnum;
+	int			 history_period_attnum;
+
+	/*
+	 * true if the history relation has the same physical layout as the
+	 * versioned relation and every attribute of one relation is in the other,
+	 * so that the attributes need not be mapped.
+	 */
+	bool		 identical_layout;
+
+	/*
+	 * true if every attribute of the history relation that is not in attnums
+	 * would be set to null by INSERT command, so the row can be inserted
+	 * directly into the history relation without executing the command.
+	 */
+	bool		 direct_insert;
+
+#if PG_VERSION_NUM >= 140000
+	/*
+	 * true if the history relation is range partitioned by the upper bound of
+	 * the system period only, so the partition of a history row depends on
+	 * the upper bound only.
+	 */
+	bool		 partitioned_by_upper;
+
+	/*
+	 * If partition_cached is true, partition_relid is the leaf partition of
+	 * the history rows that have the partition_upper upper bound or
+	 * InvalidOid if there is no such partition. partition_direct is true if
+	 * the partition has the same attributes as the history relation, so the
+	 * rows may be inserted into it directly.
+	 */
+	bool		 partition_cached;
+	TimestampTz	 partition_upper;
+	Oid			 partition_relid;
+	bool		 partition_direct;
+#endif
+
+	/*
+	 * INSERT command into the history relation and the types of its
+	 * parameters. The command is prepared on its first use only, the plan is
+	 * NULL until then.
+	 */
+	char		*insert_history_query;
+	Oid			*insert_history_argtypes;
 	SPIPlanPtr	 insert_history_plan;
+
+	/*
+	 * The jsonb attribute of the history relation that the delta history rows
+	 * are archived into, the numbers of the primary key attributes of the
+	 * versioned relation and INSERT command of the delta history rows. They
+	 * are filled on the first use only, see prepare_delta_plan.
+	 */
+	char		*delta_attname;
+	int			 nkey_attrs;
+	int			*key_attnums;
+	SPIPlanPtr	 insert_delta_plan;
+
+	/*
+	 * The space taken by the cached data and by the kept plans, see
+	 * charge_cached_chunk and update_plan_space.
+	 */
+	Size		 space;
+	Size		 plan_space;
+
+	/*
+	 * The value of versioning_cache_clock and the local transaction when the
+	 * entry was used for the last time, and the node of the entry in
+	 * versioning_cache_lru. The entries used longest ago are evicted first,
+	 * the ones used in the current transaction never.
+	 */
+	uint64		 last_used;
+	LocalTransactionId last_used_lxid;
+	dlist_node	 lru_node;
 } VersioningHashEntry;
 
+/* Cached resolved arguments of a versioning trigger. */
+typedef struct VersioningTriggerEntry
+{
+	Oid				 tgoid;				/* hash key (must be first), see versioned_heap_cache */
+	bool			 valid;				/* false if the entry must be refilled */
+	Oid				 relid;				/* OID of the versioned relation */
+	int				 period_attnum;		/* number of the system period attribute */
+	TypeCacheEntry	*typcache;			/* typcache entry of the system period type */
+
+	/*
+	 * The "adjust" argument is parsed only when it is needed for the first
+	 * time, so an invalid value does not break triggers that never adjust
+	 * system periods.
+	 */
+	bool			 adjust_parsed;
+	bool			 adjust;
+
+	/*
+	 * OID of the history relation or InvalidOid if it is not resolved yet. If
+	 * the history relation name is not schema-qualified, history_search_path
+	 * contains the search path that was used to resolve it.
+	 */
+	Oid				 history_relid;
+	OverrideSearchPath *history_search_path;
+
+	/*
+	 * The history relation that was locked with locked_lockmode in the
+	 * subtransaction identified by locked_lxid and locked_subid. The lock is
+	 * held until the end of the transaction, so it is not acquired again for
+	 * every row.
+	 */
+	Oid				 locked_history_relid;
+	LOCKMODE		 locked_lockmode;
+	LocalTransactionId locked_lxid;
+	SubTransactionId locked_subid;
+
+	/*
+	 * tgenabled value of the statement-level trigger that archives the rows of
+	 * UPDATE (DELETE) command or '\0' if there is no such trigger.
+	 */
+	char			 update_statement_tgenabled;
+	char			 delete_statement_tgenabled;
+
+	/*
+	 * true if UPDATE that changes no attribute but the system period and the
+	 * ignored ones neither archives the row nor changes its system period.
+	 * compare_attnums contains the numbers of the ncompare_attrs attributes
+	 * that are compared and compare_typcaches the typcache entries of their
+	 * types.
+	 */
+	bool			 skip_unchanged;
+	int				 ncompare_attrs;
+	int				*compare_attnums;
+	TypeCacheEntry **compare_typcaches;
+
+	/*
+	 * The jsonb attribute of the history relation that stores the changed
+	 * attributes of the rows archived in the delta format or NULL if the
+	 * rows are archived in full.
+	 */
+	char			*delta_attname;
+
+	/*
+	 * The clock that the system time is taken from or -1 if the trigger has
+	 * no system_time_source option.
+	 */
+	int				 system_time_source;
+
+	/*
+	 * true if the trigger only maintains the system period and the history
+	 * rows are archived by the capture worker from the WAL, see capture.c.
+	 */
+	bool			 capture_logical;
+
+	/* Statistics of the versioned relation of the current backend. */
+	VersioningStats	*stats;
+
+	/*
+	 * The implicit trigger of a relation of the versioned_heap access method,
+	 * allocated in versioning_cache_context, or NULL, see
+	 * versioned_heap_trigger.
+	 */
+	Trigger			*trigger;
+
+	/*
+	 * The hash table of the entry, the space taken by the entry and its
+	 * resolved arguments, and the uses of the entry the same way as in
+	 * VersioningHashEntry, see versioning_trigger_lru.
+	 */
+	HTAB			*cache;
+	Size			 space;
+	uint64			 last_used;
+	LocalTransactionId last_used_lxid;
+	dlist_node		 lru_node;
+} VersioningTriggerEntry;
+
+#if PG_VERSION_NUM >= 140000
+/* Limits of the history rows buffered for a single history relation. */
+#define MAX_BUFFERED_HISTORY_ROWS	1000
+#define MAX_BUFFERED_HISTORY_BYTES	(64 * 1024)
+
+/*
+ * Limits of the history rows buffered for a history relation of another
+ * table access method than heap. Such access methods, e.g. columnar ones,
+ * store the rows inserted at once together, so the batches are larger.
+ */
+#define MAX_BUFFERED_BULK_HISTORY_ROWS	10000
+#define MAX_BUFFERED_BULK_HISTORY_BYTES	(8 * 1024 * 1024)
+
+/*
+ * History rows that are inserted into the history relation at once by
+ * table_multi_insert(). All the rows of the buffer were archived in the same
+ * subtransaction, so the buffer may be flushed only when it is the current
+ * one.
+ */
+typedef struct HistoryBuffer
+{
+	Oid					 history_relid;
+	SubTransactionId	 subid;
+
+	/*
+	 * A copy of the tuple descriptor of the history relation which the slots
+	 * are created with. It is used to check that the history relation has not
+	 * changed when the buffer is flushed.
+	 */
+	TupleDesc			 tupdesc;
+
+	/*
+	 * true if the history relation is not a heap table. The rows of such a
+	 * buffer are kept until the transaction commits or a query uses the
+	 * history relation, as if they were deferred, to make the batches larger.
+	 */
+	bool				 bulk;
+
+	/*
+	 * true if the history relation has been invalidated since the buffer was
+	 * last flushed, so it may have been dropped, see
+	 * versioning_relcache_callback.
+	 */
+	bool				 stale;
+
+	int					 nrows;
+	Size				 nbytes;
+	int					 maxrows;
+	Size				 maxbytes;
+
+	/*
+	 * The array has maxrows elements. The first nslots slots are created, the
+	 * first nrows slots are filled.
+	 */
+	int					 nslots;
+	TupleTableSlot	   **slots;
+} HistoryBuffer;
+
+/*
+ * The list of HistoryBuffers and the memory context they are allocated in.
+ * The context is a child of TopTransactionContext.
+ */
+static List			*history_buffers = NIL;
+static MemoryContext history_buffers_context = NULL;
+#endif
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * History rows that the row-level versioning trigger collects for the
+ * statement-level trigger of the same event, which inserts them at once. The
+ * row-level trigger knows which rows were modified in the current transaction
+ * and the system time it stamped the new rows with, the transition table
+ * does not. The rows are collected and inserted in the same subtransaction.
+ */
+typedef struct StatementHistoryRows
+{
+	Oid					 relid;
+	TriggerEvent		 event;		/* UPDATE or DELETE */
+	SubTransactionId	 subid;
+	TupleDesc			 tupdesc;	/* a copy of the versioned relation's */
+	Tuplestorestate		*rows;		/* with the system periods of history rows */
+} StatementHistoryRows;
+
+/*
+ * The list of StatementHistoryRows and the memory context they are allocated
+ * in. The context is a child of TopTransactionContext.
+ */
+static List			*statement_history_rows = NIL;
+static MemoryContext statement_history_rows_context = NULL;
+
+/*
+ * The versioned relation being truncated and the cached data of its trigger
+ * while versioning_statement archives its rows, see archive_truncated_rows.
+ */
+static Relation		 truncated_relation = NULL;
+static VersioningTriggerEntry *truncated_entry = NULL;
+#endif
+
+/*
+ * The last built "[lower, )" range of the current_period_typid type. As the
+ * system time rarely changes within a transaction, the same range is used
+ * for the current rows over and over again.
+ */
+static RangeType	*current_period = NULL;
+static Oid			 current_period_typid = InvalidOid;
+static TimestampTz	 current_period_lower;
+
 /* true if datetimes are integer based. */
 static bool integer_datetimes;
 
 /* true if integer_datetimes value was looked up. */
 static bool integer_datetimes_set = false;
 
+/*
+ * The memory context of both hash tables below and of everything their
+ * entries point to, except the kept plans, which belong to the plan cache.
+ */
+static MemoryContext versioning_cache_context = NULL;
+
 /* Contains cached data for OID of versioned relation. */
 static HTAB *versioning_cache = NULL;
 
+/*
+ * The total space of the cached data of versioned relations, the limit of
+ * it in kilobytes or -1 if there is no limit, and the counter that orders
+ * the uses of the cached data.
+ */
+static Size	 versioning_cache_space = 0;
+static int	 versioning_max_cache_size = -1;
+static uint64 versioning_cache_clock = 0;
+
+/*
+ * The entries of the cached data of versioned relations and of the resolved
+ * trigger arguments in the order of their uses, the most recent first, so
+ * that the entry to evict is found at the tail of either list.
+ */
+static dlist_head versioning_cache_lru = DLIST_STATIC_INIT(versioning_cache_lru);
+static dlist_head versioning_trigger_lru = DLIST_STATIC_INIT(versioning_trigger_lru);
+
+/* Contains resolved trigger arguments for OID of versioning trigger. */
+static HTAB *versioning_trigger_cache = NULL;
+
+#if PG_VERSION_NUM >= 120000
+/*
+ * Contains resolved arguments of the implicit trigger of a relation of the
+ * versioned_heap access method for OID of the relation, see
+ * versioned_heap_trigger.
+ */
+static HTAB *versioned_heap_cache = NULL;
+
+/*
+ * The memory context that versioned_heap_row versions a row in. It is reset
+ * after every row, the way the trigger manager resets the per-tuple memory
+ * context that a trigger is called in. A nested call, e.g. from a trigger on
+ * the history relation, uses a context of its own.
+ */
+static MemoryContext versioned_heap_row_context = NULL;
+static bool versioned_heap_row_context_used = false;
+#endif
+
+/*
+ * The interval covered by the partitions of a history relation that are
+ * created automatically or an empty string if they are not created.
+ */
+static char *history_partition_interval = NULL;
+
+/* true if the buffered history rows are kept until the transaction commits */
+bool versioning_defer_history = false;
+
+/* The clock of the triggers that have no system_time_source option. */
+static int system_time_source = CurrentTransactionStartTimestamp;
+
+static const struct config_enum_entry system_time_source_options[] = {
+	{"transaction", CurrentTransactionStartTimestamp, false},
+	{"statement", CurrentStatementStartTimestamp, false},
+	{"clock", ClockTimestamp, false},
+	{"monotonic", MonotonicTransactionTimestamp, false},
+	{NULL, 0, false}
+};
+
+/*
+ * The minimum duration of a trigger call in milliseconds that is logged or
+ * -1 if the calls are not logged.
+ */
+static int log_min_duration = -1;
+
+/*
+ * The wait events reported while the triggers wait on inserting history rows
+ * or on building their cached data from the catalogs.
+ */
+typedef enum VersioningWaitEvent
+{
+	VERSIONING_WAIT_HISTORY_INSERT,
+	VERSIONING_WAIT_HISTORY_FLUSH,
+	VERSIONING_WAIT_CACHE_FILL,
+
+	VERSIONING_NUM_WAIT_EVENTS
+} VersioningWaitEvent;
+
+#if PG_VERSION_NUM >= 170000
+static const char *const wait_event_names[VERSIONING_NUM_WAIT_EVENTS] = {
+	"TemporalTablesHistoryInsert",
+	"TemporalTablesHistoryFlush",
+	"TemporalTablesCacheFill"
+};
+
+/* The custom wait events or 0 if they are not allocated yet. */
+static uint32 wait_event_infos[VERSIONING_NUM_WAIT_EVENTS];
+#endif
+
+/*
+ * The last value of the MonotonicTransactionTimestamp clock and the local
+ * transaction it was taken in.
+ */
+static TimestampTz monotonic_system_time;
+static LocalTransactionId monotonic_system_time_lxid = InvalidLocalTransactionId;
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * The upper bound of the system period of the rows deleted from the
+ * relations whose history is captured that was last written to the WAL and
+ * the subtransaction it was written in.
+ */
+static TimestampTz captured_delete_time;
+static LocalTransactionId captured_delete_lxid = InvalidLocalTransactionId;
+static SubTransactionId captured_delete_subid = InvalidSubTransactionId;
+#endif
+
 static bool parse_adjust_argument(const char *arg);
 
 /*
  * Local function prototypes.
  */
-static TypeCacheEntry *get_period_typcache(FunctionCallInfo fcinfo,
-										   Form_pg_attribute attr,
+static TypeCacheEntry *get_period_typcache(Form_pg_attribute attr,
 										   Relation relation);
 
 static void check_attr_type(Form_pg_attribute attr,
@@ -116,11 +644,214 @@ static void fill_versioning_hash_entry(VersioningHashEntry *hash_entry,
 									   TupleDesc tupdesc,
 									   const char *period_attname);
 
+static void fill_versioning_trigger_entry(VersioningTriggerEntry *entry,
+										  Relation relation,
+										  Trigger *trigger);
+
+static void parse_trigger_option(const char *option,
+								 bool *skip_unchanged,
+								 List **ignore_columns,
+								 char **delta_attname,
+								 int *system_time_source,
+								 bool *capture_logical);
+
+static void fill_compare_attrs(VersioningTriggerEntry *entry,
+							   Relation relation,
+							   List *ignore_columns);
+
+static bool values_equal(Form_pg_attribute attr,
+						 TypeCacheEntry *typcache,
+						 Datum value1,
+						 Datum value2);
+
+static bool row_unchanged(VersioningTriggerEntry *entry,
+						  HeapTuple oldtuple,
+						  HeapTuple newtuple,
+						  TupleDesc tupdesc);
+
+#if PG_VERSION_NUM >= 100000
+static bool versions_equal(TupleDesc tupdesc,
+						   int period_attnum,
+						   int natts,
+						   int *attnums,
+						   Datum *old_values,
+						   bool *old_nulls,
+						   Datum *new_values,
+						   bool *new_nulls);
+#endif
+
+static HeapTuple keep_system_period(TriggerData *trigdata,
+									VersioningTriggerEntry *entry);
+
+static char find_statement_trigger(Relation relation, bool for_update);
+
+static bool statement_trigger_fires(char tgenabled);
+
+static void resolve_history_relid(VersioningTriggerEntry *entry,
+								  const char *history_relation_name);
+
+static Relation open_history_relation(VersioningTriggerEntry *entry,
+									  const char *history_relation_name,
+									  LOCKMODE lockmode);
+
+static bool has_identical_layout(TupleDesc tupdesc,
+								 TupleDesc history_tupdesc,
+								 int *attnums,
+								 int *history_attnums,
+								 int natts);
+
+static void prepare_history_plan(VersioningHashEntry *hash_entry);
+
+static void execute_history_plan(HeapTuple tuple,
+								 TupleDesc tupdesc,
+								 VersioningHashEntry *hash_entry,
+								 Datum period);
+
+#if PG_VERSION_NUM >= 140000
+static bool can_insert_history_row_directly(VersioningHashEntry *hash_entry,
+											Relation history_relation);
+
+static void insert_history_row_directly(HeapTuple tuple,
+										TupleDesc tupdesc,
+										VersioningHashEntry *hash_entry,
+										Datum period,
+										Relation history_relation);
+
+static Relation open_history_partition(VersioningHashEntry *hash_entry,
+									   Relation *history_relation,
+									   TypeCacheEntry *typcache,
+									   Datum period);
+
+static void find_history_partition(VersioningHashEntry *hash_entry,
+								   Relation *history_relation,
+								   TimestampTz upper);
+
+static void create_history_partitions(Relation *history_relation,
+									  TimestampTz upper);
+
+static void create_history_partition(Oid history_relid,
+									 TimestampTz from,
+									 TimestampTz to,
+									 const char *options);
+
+static char *get_reloptions_clause(Oid relid);
+
+static void fill_history_slot(TupleTableSlot *slot,
+							  HeapTuple tuple,
+							  TupleDesc tupdesc,
+							  VersioningHashEntry *hash_entry,
+							  Datum period);
+
+static void buffer_history_row(HeapTuple tuple,
+							   TupleDesc tupdesc,
+							   VersioningHashEntry *hash_entry,
+							   Datum period,
+							   Relation history_relation);
+
+static bool flush_history_buffer(HistoryBuffer *buffer);
+
+static void discard_history_buffer(HistoryBuffer *buffer);
+#endif
+
+static VersioningHashEntry *get_versioning_hash_entry(Relation relation,
+													  Relation history_relation,
+													  const char *period_attname);
+
 static void insert_history_row(HeapTuple tuple,
+							   Datum period,
 							   Relation relation,
+							   VersioningTriggerEntry *entry,
 							   const char *history_relation_argument,
 							   const char *period_attname);
 
+static void free_versioning_hash_entry(VersioningHashEntry *hash_entry);
+
+static void evict_versioning_hash_entries(void);
+static void evict_trigger_entry(VersioningTriggerEntry *entry);
+static void touch_trigger_entry(VersioningTriggerEntry *entry);
+static void update_trigger_entry_space(VersioningTriggerEntry *entry);
+
+static void charge_cached_chunk(VersioningHashEntry *hash_entry,
+								void *pointer);
+
+static void free_cached_chunk(VersioningHashEntry *hash_entry,
+							  void *pointer);
+
+static void update_plan_space(VersioningHashEntry *hash_entry);
+
+#if PG_VERSION_NUM >= 100000
+static int *order_history_attrs(TupleDesc tupdesc, int *natts);
+#endif
+
+static void free_delta_plan(VersioningHashEntry *hash_entry);
+
+#if PG_VERSION_NUM >= 100000
+static int *get_key_attnums(Relation relation, int *nkey_attrs);
+
+static int find_common_attr(VersioningHashEntry *hash_entry, int attnum);
+
+static bool is_key_attr(int nkey_attrs, int *key_attnums, int attnum);
+
+static void prepare_delta_plan(VersioningHashEntry *hash_entry,
+							   Relation relation,
+							   Relation history_relation,
+							   const char *delta_attname);
+
+static bool key_changed(VersioningHashEntry *hash_entry,
+						HeapTuple oldtuple,
+						HeapTuple newtuple,
+						TupleDesc tupdesc);
+
+static int begin_delta_text_format(void);
+
+static Datum build_delta(VersioningHashEntry *hash_entry,
+						 HeapTuple oldtuple,
+						 HeapTuple newtuple,
+						 TupleDesc tupdesc,
+						 int *nchanged);
+
+static void insert_delta_history_row(HeapTuple oldtuple,
+									 HeapTuple newtuple,
+									 Datum period,
+									 Relation relation,
+									 VersioningTriggerEntry *entry,
+									 const char *history_relation_argument,
+									 const char *period_attname);
+
+static void update_delta_history_row(HeapTuple oldtuple,
+									 HeapTuple newtuple,
+									 Relation relation,
+									 VersioningTriggerEntry *entry,
+									 const char *history_relation_argument,
+									 const char *period_attname);
+#endif
+
+#if PG_VERSION_NUM >= 100000
+static void collect_statement_history_row(Relation relation,
+										  TriggerEvent event,
+										  HeapTuple tuple,
+										  int period_attnum,
+										  RangeType *period);
+
+static StatementHistoryRows *take_statement_history_rows(Relation relation,
+														 TriggerEvent event);
+
+static void free_statement_history_rows(StatementHistoryRows *rows);
+
+static void discard_statement_history_rows(SubTransactionId subid);
+
+static void archive_truncated_rows(Relation relation,
+								   Relation history_relation,
+								   VersioningTriggerEntry *entry,
+								   VersioningHashEntry *hash_entry,
+								   Trigger *trigger);
+
+static char *build_archive_query(Relation relation,
+								 Relation history_relation,
+								 VersioningHashEntry *hash_entry,
+								 const char *source);
+#endif
+
 static void deserialize_system_period(HeapTuple tuple,
 									  Relation relation,
 									  int period_attnum,
@@ -129,13 +860,17 @@ static void deserialize_system_period(HeapTuple tuple,
 									  RangeBound *lower,
 									  RangeBound *upper);
 
+static RangeType *get_current_period(TypeCacheEntry *typcache,
+									 TimestampTz lower);
+
 static void lookup_integer_datetimes();
 
-static TimestampTz get_system_time();
+static TimestampTz get_system_time(int clock, RangeBound *lower);
+static int trigger_clock(VersioningTriggerEntry *entry);
 
 static TimestampTz next_timestamp(TimestampTz timestamp);
 
-static void adjust_system_period(TypeCacheEntry *typcache,
+static void adjust_system_period(VersioningTriggerEntry *entry,
 								 RangeBound *lower,
 								 RangeBound *upper,
 								 const char *adjust_argument,
@@ -143,37 +878,179 @@ static void adjust_system_period(TypeCacheEntry *typcache,
 
 static bool modified_in_current_transaction(HeapTuple tuple);
 
+static void add_trigger_time(TriggerData *trigdata,
+							 VersioningTriggerEntry *entry,
+							 instr_time start_time);
+
+static void report_wait_start(VersioningWaitEvent event);
+static void report_wait_end(void);
+
+#if PG_VERSION_NUM >= 100000
+static void log_captured_delete_time(TimestampTz upper);
+#endif
+
 static HeapTuple modify_tuple(Relation rel, HeapTuple tuple,
 	                          int period_attnum, RangeType *range);
 
+static bool overwrite_system_period(TriggerData *trigdata,
+									int period_attnum,
+									RangeType *range);
+
 static Datum versioning_insert(TriggerData *trigdata,
-							   TypeCacheEntry *typcache,
-							   int period_attnum);
+							   VersioningTriggerEntry *entry);
 
 static Datum versioning_update(TriggerData *trigdata,
-							   TypeCacheEntry *typcache,
-							   int period_attnum,
+							   VersioningTriggerEntry *entry,
 							   const char *period_attname,
 							   const char *history_relation_argument,
 							   const char *adjust_argument);
 
 static Datum versioning_delete(TriggerData *trigdata,
-							   TypeCacheEntry *typcache,
-							   int period_attnum,
+							   VersioningTriggerEntry *entry,
 							   const char *period_attname,
 							   const char *history_relation_argument,
 							   const char *adjust_argument);
 
+static MemoryContext get_versioning_cache_context(void);
 static void init_versioning_hash_table();
+static void init_versioning_trigger_hash_table();
 static void *hash_entry_alloc(Size size);
 
 static VersioningHashEntry *lookup_versioning_hash_entry(Oid relid,
 														 bool *found);
 
+static VersioningTriggerEntry *lookup_versioning_trigger_entry(Oid tgoid);
+static VersioningTriggerEntry *get_versioning_trigger_entry(Relation relation,
+															Trigger *trigger);
+static HTAB *create_trigger_hash_table(const char *name);
+static VersioningTriggerEntry *enter_trigger_entry(HTAB *cache, Oid key);
+static void invalidate_trigger_entries(HTAB *cache, Oid relid);
+static void reset_trigger_entries(HTAB *cache, int cacheid);
+
+static void versioning_relcache_callback(Datum arg, Oid relid);
+static void versioning_syscache_callback(Datum arg, int cacheid,
+										 uint32 hashvalue);
+
+static bool is_versioning_function(Oid foid);
+
+static List *find_versioned_relations(void);
+
+static void prewarm_versioning_trigger(Relation relation, Trigger *trigger);
+
+static int prewarm_versioning_triggers(Oid relid);
+
+static Trigger *find_versioning_trigger(Relation relation);
+
+#if PG_VERSION_NUM >= 100000
+static VersioningTriggerEntry *lookup_row_versioning_trigger(Relation relation,
+															 Trigger **trigger);
+#endif
+
+#if PG_VERSION_NUM >= 120000
+static VersioningTriggerEntry *enter_versioned_heap_entry(Relation relation);
+static Trigger *versioned_heap_trigger(Relation relation);
+static void free_versioned_heap_trigger(Trigger *trigger);
+#endif
+
+static void scan_as_of(const char *query,
+					   TimestampTz system_time,
+					   int natts,
+					   int *attnums,
+					   Tuplestorestate *tupstore,
+					   TupleDesc tupdesc);
+
+#if PG_VERSION_NUM >= 100000
+static void scan_delta_as_of(Relation relation,
+							 Relation history_relation,
+							 VersioningHashEntry *hash_entry,
+							 VersioningTriggerEntry *entry,
+							 int natts,
+							 int *attnums,
+							 int *history_attnums,
+							 const char *period_attname,
+							 TimestampTz system_time,
+							 Tuplestorestate *tupstore,
+							 TupleDesc tupdesc);
+
+static void apply_delta(Datum delta,
+						Relation relation,
+						TupleDesc tupdesc,
+						Datum *values,
+						bool *nulls);
+#endif
+
 /*
- * This trigger maintains the logic of versioned tables.
- *
- * Versioned table contains the current active rows. Archived rows are located
+ * Define the configuration parameters of versioning triggers.
+ */
+void
+init_versioning(void)
+{
+	DefineCustomStringVariable("temporal_tables.history_partition_interval",
+							   "Sets the interval covered by the automatically created partitions of history relations.",
+							   "An empty string disables the creation of partitions.",
+							   &history_partition_interval,
+							   "",
+							   PGC_SUSET,
+							   0,
+							   NULL,
+							   NULL,
+							   NULL);
+
+	DefineCustomBoolVariable("temporal_tables.defer_history",
+							 "Defers inserting history rows until the transaction commits.",
+							 NULL,
+							 &versioning_defer_history,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomEnumVariable("temporal_tables.system_time_source",
+							 "Sets the clock that versioning triggers take the system time from.",
+							 "The system_time_source option of a trigger overrides it, set_system_time() overrides both.",
+							 &system_time_source,
+							 CurrentTransactionStartTimestamp,
+							 system_time_source_options,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("temporal_tables.log_min_duration",
+							"Sets the minimum execution time above which versioning trigger calls are logged.",
+							"Zero logs all the calls, -1 turns this feature off.",
+							&log_min_duration,
+							-1,
+							-1,
+							INT_MAX,
+							PGC_SUSET,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("temporal_tables.max_cache_size",
+							"Sets the maximum size of the cached data of versioned relations in a session.",
+							"The data of the relations used longest ago is evicted when the size is exceeded. "
+							"-1 means no limit, 0 keeps no data of the relations not used in the current transaction.",
+							&versioning_max_cache_size,
+							-1,
+							-1,
+							MAX_KILOBYTES,
+							PGC_USERSET,
+							GUC_UNIT_KB,
+							NULL,
+							NULL,
+							NULL);
+}
+
+/*
+ * This trigger maintains the logic of versioned tables.
+ *
+ * Versioned table contains the current active rows. Archived rows are located
  * into the other table called the history table. When you insert, update or
  * delete rows in the versioned table, the current trigger automatically
  * inserts a copy of the old row into the corresponding history table.
@@ -206,11 +1083,15 @@ versioning(PG_FUNCTION_ARGS)
 	Trigger			   *trigger;
 	char			  **args;
 	Relation			relation;
-	TupleDesc			tupdesc;
-	char			   *period_attname;
-	int					period_attnum;
-	Form_pg_attribute	period_attr;
-	TypeCacheEntry 	   *typcache;
+	VersioningTriggerEntry *entry;
+	bool				track_timing;
+	instr_time			start_time;
+	Datum				result;
+
+	track_timing = versioning_track_timing || log_min_duration >= 0;
+
+	if (track_timing)
+		INSTR_TIME_SET_CURRENT(start_time);
 
 	trigdata = (TriggerData *) fcinfo->context;
 
@@ -236,11 +1117,162 @@ versioning(PG_FUNCTION_ARGS)
 
 	trigger = trigdata->tg_trigger;
 
+	/*
+	 * Check number of arguments. The arguments that follow the first three
+	 * are options, see parse_trigger_option.
+	 */
+	if (trigger->tgnargs < 3)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("wrong number of parameters for function \"versioning\""),
+				 errdetail("expected at least 3 parameters but got %d",
+						   trigger->tgnargs)));
+
+	args = trigger->tgargs;
+
+	relation = trigdata->tg_relation;
+
+	/*
+	 * Look up the resolved trigger arguments. They are resolved only once per
+	 * trigger and are kept until the versioned relation or the type of the
+	 * system period attribute changes.
+	 */
+	entry = lookup_versioning_trigger_entry(trigger->tgoid);
+
+	if (!entry->valid)
+		fill_versioning_trigger_entry(entry, relation, trigger);
+
+#if PG_VERSION_NUM >= 100000
+	/*
+	 * The capture worker needs the old rows in full, which are written to
+	 * the WAL only with REPLICA IDENTITY FULL and wal_level=logical.
+	 */
+	if (entry->capture_logical)
+	{
+		if (relation->rd_rel->relreplident != REPLICA_IDENTITY_FULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("relation \"%s\" must have REPLICA IDENTITY FULL to capture its history by logical decoding",
+							RelationGetRelationName(relation))));
+
+		if (!XLogLogicalInfoActive())
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("capturing the history by logical decoding requires wal_level \"logical\"")));
+	}
+#endif
+
+	TEMPORAL_TABLES_TRIGGER_START(RelationGetRelid(relation),
+								  trigdata->tg_event & TRIGGER_EVENT_OPMASK);
+
+	if (TRIGGER_FIRED_BY_INSERT(trigdata->tg_event))
+		result = versioning_insert(trigdata, entry);
+	else if (TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event))
+		result = versioning_update(trigdata, entry, args[0], args[1], args[2]);
+	else
+		/* otherwise this is ON DELETE trigger */
+		result = versioning_delete(trigdata, entry, args[0], args[1], args[2]);
+
+	TEMPORAL_TABLES_TRIGGER_DONE(RelationGetRelid(relation),
+								 trigdata->tg_event & TRIGGER_EVENT_OPMASK);
+
+	if (track_timing)
+		add_trigger_time(trigdata, entry, start_time);
+
+	return result;
+}
+
+/*
+ * This trigger archives all the rows affected by UPDATE or DELETE command at
+ * once by a single INSERT.
+ *
+ * It is created along with the versioning trigger, which keeps maintaining
+ * the system period of the rows but no longer inserts the history rows one by
+ * one: it collects them for this trigger instead, see
+ * collect_statement_history_row. The collected rows already have the system
+ * periods of the history rows and leave out the rows modified earlier in the
+ * same transaction, which a transition table cannot tell, so the trigger
+ * needs no transition table and ignores one if it is given. The trigger has
+ * the same arguments as the versioning trigger:
+ *
+ * CREATE TRIGGER <trigger_name>
+ * AFTER UPDATE OR DELETE ON <versioned_table>
+ * FOR EACH STATEMENT EXECUTE PROCEDURE
+ *   versioning_statement(<system_period_column_name>, <history_relation>, <adjust>).
+ *
+ * TRUNCATE does not fire row-level triggers, so the same function fired
+ * before TRUNCATE archives all the rows of the versioned relation, which are
+ * still there at that time:
+ *
+ * CREATE TRIGGER <trigger_name>
+ * BEFORE TRUNCATE ON <versioned_table>
+ * FOR EACH STATEMENT EXECUTE PROCEDURE
+ *   versioning_statement(<system_period_column_name>, <history_relation>, <adjust>).
+ */
+Datum
+versioning_statement(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 100000
+	TriggerData		   *trigdata;
+	Trigger			   *trigger;
+	char			  **args;
+	Relation			relation;
+	VersioningTriggerEntry *entry;
+	Relation			history_relation;
+	VersioningHashEntry *hash_entry;
+	bool				truncate;
+	StatementHistoryRows *rows;
+	EphemeralNamedRelation enr;
+	char			   *query;
+	int					ret;
+	bool				track_timing;
+	instr_time			start_time;
+
+	track_timing = versioning_track_timing || log_min_duration >= 0;
+
+	if (track_timing)
+		INSTR_TIME_SET_CURRENT(start_time);
+
+	trigdata = (TriggerData *) fcinfo->context;
+
+	/* Check that the trigger function was called in expected context. */
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+				 errmsg("function \"versioning_statement\" was not called by trigger manager")));
+
+	truncate = TRIGGER_FIRED_BY_TRUNCATE(trigdata->tg_event);
+
+	/* Check proper event. */
+	if (truncate)
+	{
+		if (!TRIGGER_FIRED_BEFORE(trigdata->tg_event))
+			ereport(ERROR,
+					(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+					 errmsg("function \"versioning_statement\" must be fired BEFORE TRUNCATE")));
+	}
+	else
+	{
+		if (!TRIGGER_FIRED_AFTER(trigdata->tg_event) ||
+			!TRIGGER_FIRED_FOR_STATEMENT(trigdata->tg_event))
+			ereport(ERROR,
+					(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+					 errmsg("function \"versioning_statement\" must be fired AFTER STATEMENT")));
+
+		if (!TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event) &&
+			!TRIGGER_FIRED_BY_DELETE(trigdata->tg_event))
+			ereport(ERROR,
+					(errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+					 errmsg("function \"versioning_statement\" must be fired for UPDATE, DELETE or TRUNCATE")));
+	}
+
+	trigger = trigdata->tg_trigger;
+
 	/* Check number of arguments. */
 	if (trigger->tgnargs != 3)
 		ereport(ERROR,
 				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("wrong number of parameters for function \"versioning\""),
+				 errmsg("wrong number of parameters for function \"versioning_statement\""),
 				 errdetail("expected 3 parameters but got %d",
 						   trigger->tgnargs)));
 
@@ -248,52 +1280,189 @@ versioning(PG_FUNCTION_ARGS)
 
 	relation = trigdata->tg_relation;
 
-	tupdesc = RelationGetDescr(relation);
+	/*
+	 * A command on a parent fires the statement-level triggers of the parent
+	 * only, so the rows that the versioning triggers of its partitions and
+	 * inheritance children collect would never be inserted. TRUNCATE of the
+	 * parent would not archive the rows of the children either.
+	 */
+	if (relation->rd_rel->relhassubclass)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function \"versioning_statement\" cannot be used on relation \"%s\" because it has partitions or inheritance children",
+						RelationGetRelationName(relation))));
 
-	period_attname = args[0];
+	entry = lookup_versioning_trigger_entry(trigger->tgoid);
 
-	/* Check that system period attribute exists in the versioned relation. */
-	period_attnum = SPI_fnumber(tupdesc, period_attname);
+	if (!entry->valid)
+		fill_versioning_trigger_entry(entry, relation, trigger);
 
-	if (period_attnum == SPI_ERROR_NOATTRIBUTE)
+	TEMPORAL_TABLES_TRIGGER_START(RelationGetRelid(relation),
+								  trigdata->tg_event & TRIGGER_EVENT_OPMASK);
+
+	history_relation = open_history_relation(entry, args[1], RowExclusiveLock);
+
+	hash_entry = get_versioning_hash_entry(relation, history_relation,
+										   args[0]);
+
+	/*
+	 * The rows to be truncated are still in the relation and are archived
+	 * straight from it, the ones that were updated or deleted have been
+	 * collected by the row-level trigger.
+	 */
+	if (truncate)
+	{
+		if (!entry->adjust_parsed)
+		{
+			entry->adjust = parse_adjust_argument(args[2]);
+			entry->adjust_parsed = true;
+		}
+
+		if (hash_entry->natts != 0)
+			archive_truncated_rows(relation, history_relation, entry,
+								   hash_entry, trigger);
+
+		rows = NULL;
+	}
+	else
+		rows = take_statement_history_rows(relation,
+										   trigdata->tg_event & TRIGGER_EVENT_OPMASK);
+
+	if (rows != NULL && hash_entry->natts != 0 &&
+		tuplestore_tuple_count(rows->rows) > 0)
+	{
+		/* The collected rows are read as a named tuplestore. */
+		enr = palloc(sizeof(EphemeralNamedRelationData));
+		enr->md.name = "temporal_tables_history_rows";
+		enr->md.reliddesc = InvalidOid;
+		enr->md.tupdesc = rows->tupdesc;
+		enr->md.enrtype = ENR_NAMED_TUPLESTORE;
+		enr->md.enrtuples = tuplestore_tuple_count(rows->rows);
+		enr->reldata = rows->rows;
+
+		query = build_archive_query(relation, history_relation, hash_entry,
+									enr->md.name);
+
+		if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+			elog(ERROR, "SPI_connect returned %d", ret);
+
+		if ((ret = SPI_register_relation(enr)) != SPI_OK_REL_REGISTER)
+			elog(ERROR, "SPI_register_relation returned %d", ret);
+
+		TEMPORAL_TABLES_HISTORY_INSERT_START(RelationGetRelid(relation),
+											 RelationGetRelid(history_relation));
+		report_wait_start(VERSIONING_WAIT_HISTORY_INSERT);
+
+		if ((ret = SPI_execute(query, false, 0)) != SPI_OK_INSERT)
+			elog(ERROR, "SPI_execute returned %d", ret);
+
+		report_wait_end();
+		TEMPORAL_TABLES_HISTORY_INSERT_DONE(RelationGetRelid(relation),
+											RelationGetRelid(history_relation));
+
+		entry->stats->counters[VERSIONING_STATS_HISTORY_ROWS] += SPI_processed;
+
+		if ((ret = SPI_finish()) != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish returned %d", ret);
+
+		pfree(enr);
+		pfree(query);
+	}
+
+	if (rows != NULL)
+		free_statement_history_rows(rows);
+
+	relation_close(history_relation, NoLock);
+
+	TEMPORAL_TABLES_TRIGGER_DONE(RelationGetRelid(relation),
+								 trigdata->tg_event & TRIGGER_EVENT_OPMASK);
+
+	if (track_timing)
+		add_trigger_time(trigdata, entry, start_time);
+
+	return PointerGetDatum(NULL);
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("function \"versioning_statement\" requires PostgreSQL 10 or higher")));
+
+	PG_RETURN_NULL();
+#endif
+}
+
+/*
+ * Return the system period of the history row of a row that is being
+ * truncated, given its xmin and its system period, or NULL if the row was
+ * inserted or updated in the current transaction and is not archived. The
+ * function is only called by the command that versioning_statement runs
+ * before TRUNCATE, see archive_truncated_rows.
+ */
+Datum
+versioning_truncate_period(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 100000
+	VersioningTriggerEntry *entry = truncated_entry;
+	Relation	 relation = truncated_relation;
+	const char	*period_attname;
+	RangeType	*system_period;
+	RangeBound	 lower;
+	RangeBound	 upper;
+	bool		 empty;
+
+	if (entry == NULL)
 		ereport(ERROR,
-				(errcode(ERRCODE_UNDEFINED_COLUMN),
-				 errmsg("column \"%s\" of relation \"%s\" does not exist",
-						period_attname,
-						RelationGetRelationName(relation))));
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("function \"versioning_truncate_period\" can only be called by function \"versioning_statement\"")));
 
-	period_attr = TupleDescAttr(tupdesc, period_attnum - 1);
+	period_attname = NameStr(TupleDescAttr(RelationGetDescr(relation),
+										   entry->period_attnum - 1)->attname);
 
-	/* Check that system period attribute is not dropped. */
-	if (period_attr->attisdropped)
+	if (PG_ARGISNULL(1))
 		ereport(ERROR,
-				(errcode(ERRCODE_UNDEFINED_COLUMN),
-				 errmsg("column \"%s\" of relation \"%s\" does not exist",
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				 errmsg("system period column \"%s\" of relation \"%s\" must not be null",
 						period_attname,
 						RelationGetRelationName(relation))));
 
-	/* Check that system period attribute is not an array. */
-	if (period_attr->attndims != 0)
+	/* Ignore tuples modified in this transaction. */
+	if (TransactionIdIsCurrentTransactionId(PG_GETARG_TRANSACTIONID(0)))
+	{
+		entry->stats->counters[VERSIONING_STATS_ROWS_SKIPPED]++;
+		PG_RETURN_NULL();
+	}
+
+	system_period = DatumGetRangeTypeP(PG_GETARG_DATUM(1));
+
+	range_deserialize(entry->typcache, system_period, &lower, &upper, &empty);
+
+	if (empty || !upper.infinite)
 		ereport(ERROR,
-				(errcode(ERRCODE_DATATYPE_MISMATCH),
-				 errmsg("system period column \"%s\" of relation \"%s\" is not a range but an array",
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("system period column \"%s\" of relation \"%s\" contains invalid value",
 						period_attname,
-						RelationGetRelationName(relation))));
+						RelationGetRelationName(relation)),
+				 errdetail("valid ranges must be non-empty and unbounded on the high side")));
 
-	/* Locate the typcache entry for the type of system period attribute. */
-	typcache = get_period_typcache(fcinfo, period_attr, relation);
+	upper.val = TimestampTzGetDatum(get_system_time(trigger_clock(entry),
+													&lower));
+	upper.infinite = false;
+	upper.inclusive = false;
 
-	if (TRIGGER_FIRED_BY_INSERT(trigdata->tg_event))
-		return versioning_insert(trigdata, typcache, period_attnum);
-	else if (TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event))
-		return versioning_update(trigdata, typcache,
-								 period_attnum, period_attname,
-								 args[1], args[2]);
-	else
-		/* otherwise this is ON DELETE trigger */
-		return versioning_delete(trigdata, typcache,
-								 period_attnum, period_attname,
-								 args[1], args[2]);
+	/* The "adjust" argument has been parsed by versioning_statement. */
+	adjust_system_period(entry, &lower, &upper, NULL, relation);
+
+#if PG_VERSION_NUM >= 160000
+	PG_RETURN_POINTER(make_range(entry->typcache, &lower, &upper, false, NULL));
+#else
+	PG_RETURN_POINTER(make_range(entry->typcache, &lower, &upper, false));
+#endif
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("function \"versioning_truncate_period\" requires PostgreSQL 10 or higher")));
+
+	PG_RETURN_NULL();
+#endif
 }
 
 /*
@@ -320,813 +1489,6674 @@ set_system_time(PG_FUNCTION_ARGS)
 }
 
 /*
- * Get the value that should be used as the system time by versioned
- * triggers.
+ * Return the system period "[system_time, )" of a row that becomes current
+ * now. It is intended to be the default value of the system period column,
+ * so that the versioning trigger need not be fired on INSERT:
+ *
+ * CREATE TABLE <versioned_table> (
+ *   ...,
+ *   <system_period_column_name> tstzrange NOT NULL DEFAULT versioning_current_period()
+ * );
+ *
+ * CREATE TRIGGER <trigger_name>
+ * BEFORE UPDATE OR DELETE ON <versioned_table>
+ * FOR EACH ROW EXECUTE PROCEDURE
+ *   versioning(<system_period_column_name>, <history_relation>, <adjust>).
+ *
+ * The system time is taken from the source set by system_time_source
+ * parameter, the options of the trigger are not known here. The function is
+ * volatile since the clock source changes the result within a statement.
  */
-static TimestampTz
-get_system_time()
+Datum
+versioning_current_period(PG_FUNCTION_ARGS)
 {
-	TemporalContext *ctx = get_current_temporal_context(false);
+	TypeCacheEntry	*typcache;
+	RangeType		*range;
+	RangeType		*result;
 
-	switch (ctx->system_time_mode)
-	{
-		case CurrentTransactionStartTimestamp:
-			return GetCurrentTransactionStartTimestamp();
-		case UserDefined:
-			return ctx->system_time;
-	}
+	typcache = lookup_type_cache(TSTZRANGEOID, TYPECACHE_RANGE_INFO);
 
-	Assert(false);
+	range = get_current_period(typcache,
+							   get_system_time(system_time_source, NULL));
 
-	/* will never get here */
-	return 0;
+	/* The cached range must not be returned as it may be freed. */
+	result = palloc(VARSIZE(range));
+	memcpy(result, range, VARSIZE(range));
+
+	PG_RETURN_POINTER(result);
 }
 
 /*
- * Parse argument value as boolean. The valid values are "true" for true,
- * "false" for false.
+ * Fill the cached data of the versioning triggers on the specified relations,
+ * or on all the relations of the current database if NULL is passed, so that
+ * the first command that fires the triggers does not have to look up the
+ * catalogs and to prepare INSERT command into the history relation. Relations
+ * that the current user is not allowed to read are skipped.
  *
- * If the string parses okay, return the parsed value, else throw an error.
+ * Return the number of the warmed triggers and the time it took.
  */
-static bool
-parse_adjust_argument(const char *arg)
+Datum
+temporal_tables_prewarm(PG_FUNCTION_ARGS)
 {
-	if (pg_strcasecmp(arg, "true") == 0)
-		return true;
+	TupleDesc	 result_tupdesc;
+	TimestampTz	 start_time;
+	List		*relids = NIL;
+	ListCell	*lc;
+	int			 entries = 0;
+	Datum		 values[2];
+	bool		 nulls[2] = { false, false };
 
-	if (pg_strcasecmp(arg, "false") == 0)
-		return false;
+	if (get_call_result_type(fcinfo, NULL, &result_tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
 
-	ereport(ERROR,
-			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-			 errmsg("invalid value \"%s\" for \"adjust\" parameter",
-					arg),
-			 errdetail("valid values are: \"true\", \"false\"")));
+	start_time = GetCurrentTimestamp();
 
-	return false;
+	if (PG_ARGISNULL(0))
+		relids = find_versioned_relations();
+	else
+	{
+		ArrayType  *array = PG_GETARG_ARRAYTYPE_P(0);
+		Datum	   *elems;
+		bool	   *elem_nulls;
+		int			nelems;
+		int			i;
+
+		deconstruct_array(array, REGCLASSOID, sizeof(Oid), true, 'i',
+						  &elems, &elem_nulls, &nelems);
+
+		for (i = 0; i < nelems; ++i)
+		{
+			if (!elem_nulls[i])
+				relids = list_append_unique_oid(relids,
+												DatumGetObjectId(elems[i]));
+		}
+	}
+
+	foreach(lc, relids)
+		entries += prewarm_versioning_triggers(lfirst_oid(lc));
+
+	values[0] = Int32GetDatum(entries);
+	values[1] = DirectFunctionCall2(timestamp_mi,
+									TimestampTzGetDatum(GetCurrentTimestamp()),
+									TimestampTzGetDatum(start_time));
+
+	result_tupdesc = BlessTupleDesc(result_tupdesc);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(result_tupdesc, values,
+													  nulls)));
 }
 
 /*
- * Locate the typcache entry for the system period attribute. If the specified
- * attribute is not a range of timestamp with timezone, an error is thrown.
+ * Return the rows of a versioned relation that were current at the specified
+ * time. The rows are looked up both in the versioned relation and in its
+ * history relation, the attributes of the history rows that are not in the
+ * history relation are nulls.
+ *
+ * The first argument is a null value of the row type of the versioned
+ * relation, e.g. NULL::employees, which determines the returned row type.
+ *
+ * The conditions on the system period of the history rows are boundable, so
+ * that a B-tree index on the upper bound of the system period or a GiST index
+ * on the system period can be used.
  */
-static TypeCacheEntry *
-get_period_typcache(FunctionCallInfo fcinfo,
-					Form_pg_attribute attr,
-					Relation relation)
+Datum
+versioning_as_of(PG_FUNCTION_ARGS)
 {
-	Oid 			 typoid;
-	HeapTuple 		 type_tuple;
-	Form_pg_type 	 type;
-	TypeCacheEntry	*typcache;
-
-	typoid = attr->atttypid;
+	ReturnSetInfo		*rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			 tupdesc;
+	Tuplestorestate		*tupstore;
+	MemoryContext		 oldcontext;
+	Oid					 relid;
+	TimestampTz			 system_time;
+	Relation			 relation;
+	Trigger				*trigger;
+	VersioningTriggerEntry *entry;
+	Relation			 history_relation;
+	VersioningHashEntry	*hash_entry;
+	int					 natts;
+	int					*attnums;
+	int					*history_attnums;
+	StringInfoData		 querybuf;
+	char				*period_attname;
+	int					 ret;
+	int					 i;
 
-	/* Search syscache for attribute type. */
-	type_tuple = SearchSysCache1(TYPEOID, ObjectIdGetDatum(typoid));
+	/* Check that the caller supports us returning a tuplestore. */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
 
-	if (!HeapTupleIsValid(type_tuple))
-		elog(ERROR, "cache lookup failed for type %u", typoid);
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
 
-	type = (Form_pg_type) GETSTRUCT(type_tuple);
+	relid = get_typ_typrelid(get_fn_expr_argtype(fcinfo->flinfo, 0));
 
-	/* Check that type is a range. */
-	if (type->typtype != TYPTYPE_RANGE)
+	if (!OidIsValid(relid))
 		ereport(ERROR,
 				(errcode(ERRCODE_DATATYPE_MISMATCH),
-				 errmsg("system period column \"%s\" of relation \"%s\" is not a range but type %s",
-						NameStr(attr->attname),
-						RelationGetRelationName(relation),
-						format_type_be(typoid))));
+				 errmsg("first argument of versioning_as_of must be a row type of a relation")));
 
-	/* Get cached information about the range type. */
-	typcache = range_get_typcache(fcinfo, typoid);
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
 
-	/* Check that this is a range of timestamp with timezone. */
-	if (typcache->rngelemtype->type_id != TIMESTAMPTZOID)
-		ereport(ERROR,
-				(errcode(ERRCODE_DATATYPE_MISMATCH),
-				 errmsg("system period column \"%s\" of relation \"%s\" is not a range of timestamp with timezone but of type %s",
-						NameStr(attr->attname),
-						RelationGetRelationName(relation),
-						format_type_be(typcache->rngelemtype->type_id))));
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
 
-	ReleaseSysCache(type_tuple);
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
 
-	return typcache;
-}
+	MemoryContextSwitchTo(oldcontext);
 
-/*
- * Check that the type of an attribute in the versioned table is the same as in
- * the history table.
- */
-static void
-check_attr_type(Form_pg_attribute attr,
-				Form_pg_attribute history_attr,
-				Relation relation,
-				Relation history_relation)
-{
-	if (attr->atttypid != history_attr->atttypid ||
-		attr->attndims != history_attr->attndims ||
-		attr->atttypmod != history_attr->atttypmod)
-		ereport(ERROR,
-				(errcode(ERRCODE_DATATYPE_MISMATCH),
-				 errmsg("column \"%s\" of relation \"%s\" is of type %s but column \"%s\" of history relation \"%s\" is of type %s",
-						NameStr(attr->attname),
-						RelationGetRelationName(relation),
-						format_type_with_typemod(attr->atttypid,
-												 attr->atttypmod),
-						NameStr(history_attr->attname),
-						RelationGetRelationName(history_relation),
-						format_type_with_typemod(history_attr->atttypid,
-												 history_attr->atttypmod))));
-}
+	if (PG_ARGISNULL(1))
+		return (Datum) 0;
 
-/*
- * Fill a newly created hash entry with the cached data.
- *
- * Note that hash entry must be zeroed and natts value of the entry must be
- * set to -1 prior to the call of this function.
- */
-static void
-fill_versioning_hash_entry(VersioningHashEntry *hash_entry,
-						   Relation relation,
-						   Relation history_relation,
-						   TupleDesc tupdesc,
-						   const char *period_attname)
-{
-	TupleDesc		 history_tupdesc;
-	MemoryContext	 oldcontext;
-	int				 attnums_size;
-	int				*attnums;
-	StringInfoData	 querybuf;
-	char			*nspname;
-	char			*relname;
-	int				*history_attnums;
-	int				 natts;
-	int				 i;
-	int				 ret;
+	system_time = PG_GETARG_TIMESTAMPTZ(1);
 
-	history_tupdesc = RelationGetDescr(history_relation);
+	relation = relation_open(relid, AccessShareLock);
 
-	/* Check that the history relation contains the system period attribute. */
-	if (SPI_fnumber(history_tupdesc, period_attname) < 0)
-		ereport(ERROR,
-				(errmsg("history relation \"%s\" does not contain system period column \"%s\"",
-						RelationGetRelationName(history_relation),
-						period_attname),
-				 errhint("history relation must contain system period column with the same name and data type as the versioned one")));
+	trigger = find_versioning_trigger(relation);
+
+	entry = get_versioning_trigger_entry(relation, trigger);
+
+	history_relation = open_history_relation(entry, trigger->tgargs[1],
+											 AccessShareLock);
+
+	hash_entry = get_versioning_hash_entry(relation, history_relation,
+										   trigger->tgargs[0]);
 
 	/*
-	 * Allocate versioned relation attributes array. attnums[N] contains the
-	 * number of the attribute in the versioned relation.
+	 * Copy the attribute mapping since the cached data may be rebuilt while
+	 * the queries are running.
 	 */
-	attnums_size = Min(tupdesc->natts, history_tupdesc->natts);
-	attnums = palloc(attnums_size * sizeof(int));
+	natts = hash_entry->natts;
+	attnums = palloc(natts * sizeof(int));
+	history_attnums = palloc(natts * sizeof(int));
+	memcpy(attnums, hash_entry->attnums, natts * sizeof(int));
+	memcpy(history_attnums, hash_entry->history_attnums, natts * sizeof(int));
+
+	period_attname = quote_identifier(trigger->tgargs[0]);
+
+	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect returned %d", ret);
 
 	/*
 	 * The query string build is
-	 * 		INSERT INTO <history_relation> (<attr1>, <attr2>, ...)
-	 * 		VALUES ($1, $2, ...)
+	 * 		SELECT <attr1>, <attr2>, ... FROM <relation>
+	 * 		WHERE <system_period> @> $1
 	 */
 	initStringInfo(&querybuf);
 
-	nspname = get_namespace_name(RelationGetNamespace(history_relation));
-	relname = RelationGetRelationName(history_relation);
+	appendStringInfoString(&querybuf, "SELECT ");
 
-	appendStringInfo(&querybuf,
-					 "INSERT INTO %s.%s (",
-					 quote_identifier(nspname),
-					 quote_identifier(relname));
+	for (i = 0; i < natts; ++i)
+		appendStringInfo(&querybuf, "%s%s", i == 0 ? "" : ", ",
+						 quote_identifier(NameStr(TupleDescAttr(RelationGetDescr(relation),
+																attnums[i] - 1)->attname)));
 
-	/*
-	 * Allocate history relation attributes array. history_attnums[N] is a
-	 * number of the attribute in the history relation that has the same name
-	 * as the attribute with the number attnums[N] in the versioned relation.
-	 */
-	history_attnums = palloc(attnums_size * sizeof(int));
+	appendStringInfo(&querybuf, " FROM %s WHERE %s OPERATOR(pg_catalog.@>) $1",
+					 quote_qualified_identifier(get_namespace_name(RelationGetNamespace(relation)),
+												RelationGetRelationName(relation)),
+					 period_attname);
 
-	/* Fill in common attributes array. */
-	natts = 0;
-	for (i = 0; i < tupdesc->natts; ++i)
+	scan_as_of(querybuf.data, system_time, natts, attnums, tupstore, tupdesc);
+
+#if PG_VERSION_NUM >= 100000
+	/* The delta history rows are reconstructed from the newer versions. */
+	if (entry->delta_attname != NULL)
+		scan_delta_as_of(relation, history_relation, hash_entry, entry, natts,
+						 attnums, history_attnums, period_attname,
+						 system_time, tupstore, tupdesc);
+	else
+#endif
 	{
-		Form_pg_attribute	 attr;
-		Form_pg_attribute	 history_attr;
-		int					 history_attnum;
-		char				*attname;
+		/*
+		 * The query string build is
+		 * 		SELECT <attr1>, <attr2>, ... FROM <history_relation>
+		 * 		WHERE <system_period> @> $1 AND upper(<system_period>) > $1
+		 *
+		 * The second condition is redundant since the system period of a
+		 * history row is always bounded, but it can use an index on the upper
+		 * bound.
+		 */
+		resetStringInfo(&querybuf);
 
-		attr = TupleDescAttr(tupdesc, i);
+		appendStringInfoString(&querybuf, "SELECT ");
 
-		if (attr->attisdropped)
-			continue;
+		for (i = 0; i < natts; ++i)
+			appendStringInfo(&querybuf, "%s%s", i == 0 ? "" : ", ",
+							 quote_identifier(NameStr(TupleDescAttr(RelationGetDescr(history_relation),
+																	history_attnums[i] - 1)->attname)));
+
+		appendStringInfo(&querybuf, " FROM %s WHERE %s OPERATOR(pg_catalog.@>) $1 "
+						 "AND pg_catalog.upper(%s) > $1",
+						 quote_qualified_identifier(get_namespace_name(RelationGetNamespace(history_relation)),
+													RelationGetRelationName(history_relation)),
+						 period_attname, period_attname);
+
+		scan_as_of(querybuf.data, system_time, natts, attnums, tupstore,
+				   tupdesc);
+	}
 
-		attname = NameStr(attr->attname);
+	if ((ret = SPI_finish()) != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish returned %d", ret);
 
-		history_attnum = SPI_fnumber(history_tupdesc, attname);
+	/* Close the relations but keep the locks. */
+	relation_close(history_relation, NoLock);
+	relation_close(relation, NoLock);
 
-		if (history_attnum < 0)
-			continue;
+	return (Datum) 0;
+}
 
-		history_attr = TupleDescAttr(history_tupdesc, history_attnum - 1);
+/*
+ * Return the changes of the versioned relation which row type the first
+ * argument has between the two points in time: a row for every primary key
+ * which version current at t1 differs from the one current at t2, with the
+ * operation that turns the former into the latter and both versions.
+ *
+ * Only the row versions that start or end within (t1, t2] are scanned, so
+ * that indexes on the bounds of the system period can be used:
+ *	- the old versions are the history rows that start before the interval
+ *	  and end within it;
+ *	- the new versions are the rows and the history rows that start within the
+ *	  interval and end after it.
+ * Hence a row that is both inserted and deleted within the interval is not
+ * returned at all, and neither is a row which versions differ in the system
+ * period only, e.g. since it was updated to the same values.
+ *
+ * A null t1 is the beginning of the history, so every row current at t2 is
+ * inserted, and a null t2 is now.
+ */
+Datum
+temporal_diff(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 100000
+	ReturnSetInfo		*rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc			 tupdesc;
+	TupleDesc			 rowdesc;
+	Tuplestorestate		*tupstore;
+	MemoryContext		 oldcontext;
+	Oid					 relid;
+	Oid					 argtypes[2] = { TIMESTAMPTZOID, TIMESTAMPTZOID };
+	Datum				 args[2];
+	Relation			 relation;
+	Trigger				*trigger;
+	VersioningTriggerEntry *entry;
+	Relation			 history_relation;
+	VersioningHashEntry	*hash_entry;
+	int					 natts;
+	int					*attnums;
+	int					 nkey_attrs;
+	int					*key_attnums;
+	int					*key_indexes;
+	StringInfoData		 querybuf;
+	char				*period_attname;
+	char				*history_name;
+	Portal				 portal;
+	Datum				*old_values;
+	bool				*old_nulls;
+	Datum				*new_values;
+	bool				*new_nulls;
+	uint64				 row;
+	int					 ret;
+	int					 i;
 
-		check_attr_type(attr, history_attr, relation, history_relation);
+	/* Check that the caller supports us returning a tuplestore. */
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
 
-		attnums[natts] = attr->attnum;
-		history_attnums[natts] = history_attnum;
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
 
-		if (natts != 0)
-			appendStringInfo(&querybuf, ", ");
+	relid = get_typ_typrelid(get_fn_expr_argtype(fcinfo->flinfo, 0));
 
-		appendStringInfo(&querybuf, "%s", quote_identifier(attname));
+	if (!OidIsValid(relid))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("first argument of temporal_diff must be a row type of a relation")));
 
-		natts++;
-	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
 
-	/*
-	 * If there are common attributes, then prepare and set the plan and
-	 * related information.
-	 */
-	if (natts != 0)
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	if (PG_ARGISNULL(1))
 	{
-		Oid			*argtypes;
-		SPIPlanPtr	 plan;
+		TimestampTz	t1;
 
-		appendStringInfo(&querybuf, ") VALUES (");
+		TIMESTAMP_NOBEGIN(t1);
+		args[0] = TimestampTzGetDatum(t1);
+	}
+	else
+		args[0] = PG_GETARG_DATUM(1);
 
-		argtypes = palloc(sizeof(Oid) * natts);
-		for (i = 0; i < natts; ++i)
-		{
-			if (i != 0)
-				appendStringInfo(&querybuf, ", ");
+	if (PG_ARGISNULL(2))
+	{
+		TimestampTz	t2;
 
-			appendStringInfo(&querybuf, "$%d", i + 1);
+		TIMESTAMP_NOEND(t2);
+		args[1] = TimestampTzGetDatum(t2);
+	}
+	else
+		args[1] = PG_GETARG_DATUM(2);
 
-			argtypes[i] = SPI_gettypeid(history_tupdesc, history_attnums[i]);
-		}
+	relation = relation_open(relid, AccessShareLock);
 
-		appendStringInfo(&querybuf, ")");
+	trigger = find_versioning_trigger(relation);
 
-		/* Prepare and save the plan. */
-		plan = SPI_prepare(querybuf.data, natts, argtypes);
+	entry = get_versioning_trigger_entry(relation, trigger);
 
-		if (plan == NULL)
-			elog(ERROR, "SPI_prepare returned %d for %s",
-				 SPI_result, NameStr(querybuf));
+	/* An old version of a delta history row is only known from newer ones. */
+	if (entry->delta_attname != NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("temporal_diff does not support delta history rows of relation \"%s\"",
+						RelationGetRelationName(relation))));
 
-		if ((ret = SPI_keepplan(plan)) != 0)
-			elog(ERROR, "SPI_keepplan returned %d", ret);
+	history_relation = open_history_relation(entry, trigger->tgargs[1],
+											 AccessShareLock);
 
-		hash_entry->insert_history_plan = plan;
+	hash_entry = get_versioning_hash_entry(relation, history_relation,
+										   trigger->tgargs[0]);
 
-		pfree(argtypes);
+	/*
+	 * Copy the attribute mapping since the cached data may be rebuilt while
+	 * the query is running.
+	 */
+	natts = hash_entry->natts;
+	attnums = palloc(natts * sizeof(int));
+	memcpy(attnums, hash_entry->attnums, natts * sizeof(int));
 
-		/* Copy the constructed attribute list into TopMemoryContext. */
-		oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+	/* The versions of a row are matched by the primary key. */
+	key_attnums = get_key_attnums(relation, &nkey_attrs);
 
-		hash_entry->history_relid = RelationGetRelid(history_relation);
-		hash_entry->tupdesc = CreateTupleDescCopyConstr(tupdesc);
-		hash_entry->history_tupdesc = CreateTupleDescCopyConstr(history_tupdesc);
+	if (key_attnums == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("relation \"%s\" must have a primary key to compute its changes",
+						RelationGetRelationName(relation))));
 
-		hash_entry->attnums = palloc(natts * sizeof(int));
-		memcpy(hash_entry->attnums, attnums, natts * sizeof(int));
+	key_indexes = palloc(nkey_attrs * sizeof(int));
 
-		MemoryContextSwitchTo(oldcontext);
+	for (i = 0; i < nkey_attrs; ++i)
+	{
+		key_indexes[i] = find_common_attr(hash_entry, key_attnums[i]);
+
+		if (key_indexes[i] < 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_COLUMN_DEFINITION),
+					 errmsg("primary key column \"%s\" of relation \"%s\" is not in history relation \"%s\"",
+							NameStr(TupleDescAttr(RelationGetDescr(relation),
+												  key_attnums[i] - 1)->attname),
+							RelationGetRelationName(relation),
+							RelationGetRelationName(history_relation))));
 	}
 
+	period_attname = quote_identifier(trigger->tgargs[0]);
+	history_name = quote_qualified_identifier(get_namespace_name(RelationGetNamespace(history_relation)),
+											  RelationGetRelationName(history_relation));
+
 	/*
-	 * Now when the cached data structure is filled we can set natts to mark
-	 * the entry valid.
+	 * The common attributes have the same names in both relations. The query
+	 * string build is
+	 * 		SELECT o.<attr1>, ..., n.<attr1>, ...
+	 * 		FROM (SELECT <attr1>, ... FROM <history_relation>
+	 * 			  WHERE upper(<system_period>) > $1
+	 * 				AND upper(<system_period>) <= $2
+	 * 				AND lower(<system_period>) <= $1) o
+	 * 		FULL JOIN (SELECT <attr1>, ... FROM <relation>
+	 * 				   WHERE lower(<system_period>) > $1
+	 * 					 AND lower(<system_period>) <= $2
+	 * 				   UNION ALL
+	 * 				   SELECT <attr1>, ... FROM <history_relation>
+	 * 				   WHERE lower(<system_period>) > $1
+	 * 					 AND lower(<system_period>) <= $2
+	 * 					 AND upper(<system_period>) > $2) n
+	 * 		ON o.<key1> = n.<key1> AND ...
 	 */
-	hash_entry->natts = natts;
+	initStringInfo(&querybuf);
 
-	pfree(attnums);
-	pfree(history_attnums);
-}
+	appendStringInfoString(&querybuf, "SELECT ");
 
-/*
- * Insert a row into the history relation.
- *
- *		tuple: a row to insert
- *		relation: versioned relation
- *		history_relation_name: qualified name of the history relation
- */
-static void
-insert_history_row(HeapTuple tuple,
-				   Relation relation,
-				   const char *history_relation_name,
-				   const char *period_attname)
-{
-	RangeVar			*relrv;
-	Relation			 history_relation;
-	VersioningHashEntry	*hash_entry;
-	bool				 found;
-	TupleDesc			 tupdesc;
-	int					 ret;
-	int					 natts;
+	for (i = 0; i < 2 * natts; ++i)
+		appendStringInfo(&querybuf, "%s%s.%s", i == 0 ? "" : ", ",
+						 i < natts ? "o" : "n",
+						 quote_identifier(NameStr(TupleDescAttr(RelationGetDescr(relation),
+																attnums[i % natts] - 1)->attname)));
 
-	/* Open the history relation and obtain AccessShareLock on it. */
-#if PG_VERSION_NUM >= 160000
-	relrv = makeRangeVarFromNameList(stringToQualifiedNameList(history_relation_name, NULL));
-#else
-	relrv = makeRangeVarFromNameList(stringToQualifiedNameList(history_relation_name));
-#endif
+	appendStringInfoString(&querybuf, " FROM (SELECT ");
 
-	history_relation = heap_openrv(relrv, AccessShareLock);
+	for (i = 0; i < natts; ++i)
+		appendStringInfo(&querybuf, "%s%s", i == 0 ? "" : ", ",
+						 quote_identifier(NameStr(TupleDescAttr(RelationGetDescr(relation),
+																attnums[i] - 1)->attname)));
 
-	/* Look up the cached data for the versioned relation OID. */
-	hash_entry = lookup_versioning_hash_entry(RelationGetRelid(relation),
-											  &found);
+	appendStringInfo(&querybuf, " FROM %s WHERE pg_catalog.upper(%s) > $1 AND pg_catalog.upper(%s) <= $2 AND pg_catalog.lower(%s) <= $1) o FULL JOIN (SELECT ",
+					 history_name, period_attname, period_attname,
+					 period_attname);
 
-	tupdesc = RelationGetDescr(relation);
+	for (i = 0; i < natts; ++i)
+		appendStringInfo(&querybuf, "%s%s", i == 0 ? "" : ", ",
+						 quote_identifier(NameStr(TupleDescAttr(RelationGetDescr(relation),
+																attnums[i] - 1)->attname)));
 
-	if (found)
+	appendStringInfo(&querybuf, " FROM %s WHERE pg_catalog.lower(%s) > $1 AND pg_catalog.lower(%s) <= $2 UNION ALL SELECT ",
+					 quote_qualified_identifier(get_namespace_name(RelationGetNamespace(relation)),
+												RelationGetRelationName(relation)),
+					 period_attname, period_attname);
+
+	for (i = 0; i < natts; ++i)
+		appendStringInfo(&querybuf, "%s%s", i == 0 ? "" : ", ",
+						 quote_identifier(NameStr(TupleDescAttr(RelationGetDescr(relation),
+																attnums[i] - 1)->attname)));
+
+	appendStringInfo(&querybuf, " FROM %s WHERE pg_catalog.lower(%s) > $1 AND pg_catalog.lower(%s) <= $2 AND pg_catalog.upper(%s) > $2) n ON ",
+					 history_name, period_attname, period_attname,
+					 period_attname);
+
+	for (i = 0; i < nkey_attrs; ++i)
 	{
-		TupleDesc history_tupdesc;
+		const char *attname = quote_identifier(NameStr(TupleDescAttr(RelationGetDescr(relation),
+																	 key_attnums[i] - 1)->attname));
 
-		history_tupdesc = RelationGetDescr(history_relation);
+		appendStringInfo(&querybuf, "%so.%s = n.%s", i == 0 ? "" : " AND ",
+						 attname, attname);
+	}
 
-		/*
-		 * Check that the cached data is still valid.
-		 *
-		 * If natts is -1, then fill_versioning_hash_entry failed and the
-		 * cached data is invalid.
-		 *
-		 * If the trigger definition changes, then the cached history relation
-		 * OID may differs compared to the current one.
-		 *
-		 * Then check that the structure of the versioned table and the history
-		 * table is intact by comparing the cached TupleDesc with the current
-		 * one.
-		 */
-		if (hash_entry->natts == -1 ||
-			RelationGetRelid(history_relation) != hash_entry->history_relid ||
-			!equalTupleDescs(tupdesc, hash_entry->tupdesc) ||
-			!equalTupleDescs(history_tupdesc, hash_entry->history_tupdesc))
+	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect returned %d", ret);
+
+	portal = SPI_cursor_open_with_args(NULL, querybuf.data, 2, argtypes, args,
+									   NULL, true, 0);
+
+	/* The versions are returned as rows of the versioned relation. */
+	rowdesc = RelationGetDescr(relation);
+
+	old_values = palloc(rowdesc->natts * sizeof(Datum));
+	old_nulls = palloc(rowdesc->natts * sizeof(bool));
+	new_values = palloc(rowdesc->natts * sizeof(Datum));
+	new_nulls = palloc(rowdesc->natts * sizeof(bool));
+
+	for (;;)
+	{
+		SPI_cursor_fetch(portal, true, 1000);
+
+		if (SPI_processed == 0)
+			break;
+
+		for (row = 0; row < SPI_processed; ++row)
 		{
-			/* Mark the entry invalid. */
-			hash_entry->natts = -1;
-		
-			/* If the cached data structure is invalid, free it's fields. */
-			if (hash_entry->tupdesc != NULL)
+			HeapTuple	tuple = SPI_tuptable->vals[row];
+			HeapTuple	old_tuple = NULL;
+			HeapTuple	new_tuple = NULL;
+			bool		has_old;
+			bool		has_new;
+			Datum		values[3];
+			bool		nulls[3];
+
+			memset(old_nulls, true, rowdesc->natts * sizeof(bool));
+			memset(new_nulls, true, rowdesc->natts * sizeof(bool));
+
+			for (i = 0; i < natts; ++i)
 			{
-				FreeTupleDesc(hash_entry->tupdesc);
-				hash_entry->tupdesc = NULL;
+				old_values[attnums[i] - 1] = SPI_getbinval(tuple,
+														   SPI_tuptable->tupdesc,
+														   i + 1,
+														   &old_nulls[attnums[i] - 1]);
+				new_values[attnums[i] - 1] = SPI_getbinval(tuple,
+														   SPI_tuptable->tupdesc,
+														   natts + i + 1,
+														   &new_nulls[attnums[i] - 1]);
 			}
 
-			if (hash_entry->history_tupdesc != NULL)
+			/* A missing version has nulls even in its primary key. */
+			has_old = !old_nulls[key_attnums[0] - 1];
+			has_new = !new_nulls[key_attnums[0] - 1];
+
+			if (has_old && has_new &&
+				versions_equal(rowdesc, entry->period_attnum, natts, attnums,
+							   old_values, old_nulls, new_values, new_nulls))
+				continue;
+
+			values[0] = CStringGetTextDatum(!has_old ? "INSERT" :
+											!has_new ? "DELETE" : "UPDATE");
+			nulls[0] = false;
+
+			if (has_old)
 			{
-				FreeTupleDesc(hash_entry->history_tupdesc);
-				hash_entry->history_tupdesc = NULL;
+				old_tuple = heap_form_tuple(rowdesc, old_values, old_nulls);
+				values[1] = HeapTupleGetDatum(old_tuple);
 			}
+			nulls[1] = !has_old;
 
-			if (hash_entry->attnums != NULL)
+			if (has_new)
 			{
-				pfree(hash_entry->attnums);
-				hash_entry->attnums = NULL;
+				new_tuple = heap_form_tuple(rowdesc, new_values, new_nulls);
+				values[2] = HeapTupleGetDatum(new_tuple);
 			}
-			
-			if (hash_entry->insert_history_plan != NULL)
-			{
-				if ((ret = SPI_freeplan(hash_entry->insert_history_plan)) != 0)
-					elog(ERROR, "SPI_freeplan returned %d", ret);
+			nulls[2] = !has_new;
 
-				hash_entry->insert_history_plan = NULL;
-			}
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
 
-			/* Make to refill the cached data entry. */
-			found = false;
+			if (old_tuple != NULL)
+				heap_freetuple(old_tuple);
+			if (new_tuple != NULL)
+				heap_freetuple(new_tuple);
 		}
+
+		SPI_freetuptable(SPI_tuptable);
 	}
 
-	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
-		elog(ERROR, "SPI_connect returned %d", ret);
+	SPI_cursor_close(portal);
 
-	/*
-	 * If there is no cached data or it is invalid, fill the cached data
-	 * structure.
-	 */
-	if (!found)
-	{
-		fill_versioning_hash_entry(hash_entry, relation, history_relation,
-								   tupdesc, period_attname);
-	}
+	if ((ret = SPI_finish()) != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish returned %d", ret);
 
-	natts = hash_entry->natts;
+	/* Close the relations but keep the locks. */
+	relation_close(history_relation, NoLock);
+	relation_close(relation, NoLock);
 
-	/* Execute the plan. */
-	if (natts != 0)
-	{
-		Datum		*values;
-		char		*nulls;
-		int			*attnums;
-		SPIPlanPtr	 plan;
-		int			 i;
+	return (Datum) 0;
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("temporal_diff requires PostgreSQL 10 or later")));
+
+	PG_RETURN_NULL();			/* keep compiler quiet */
+#endif
+}
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * Check whether two versions of a row of the relation have the same values of
+ * the common attributes but the system period, see values_equal.
+ */
+static bool
+versions_equal(TupleDesc tupdesc,
+			   int period_attnum,
+			   int natts,
+			   int *attnums,
+			   Datum *old_values,
+			   bool *old_nulls,
+			   Datum *new_values,
+			   bool *new_nulls)
+{
+	int		i;
 
-		values = palloc(natts * sizeof(Datum));
-		nulls = palloc(natts * sizeof(char));
+	for (i = 0; i < natts; ++i)
+	{
+		int		index = attnums[i] - 1;
 
-		attnums = hash_entry->attnums;
-		plan = hash_entry->insert_history_plan;
+		if (attnums[i] == period_attnum)
+			continue;
 
-		for (i = 0; i < natts; ++i)
+		if (old_nulls[index] || new_nulls[index])
 		{
-			bool isnull;
+			if (old_nulls[index] != new_nulls[index])
+				return false;
 
-			values[i] = SPI_getbinval(tuple, tupdesc, attnums[i], &isnull);
-			nulls[i] = isnull ? 'n' : ' ';
+			continue;
 		}
 
-		if ((ret = SPI_execp(plan, values, nulls, 0)) != SPI_OK_INSERT)
-			elog(ERROR, "SPI_execp returned %d", ret);
-
-		pfree(values);
-		pfree(nulls);
+		if (!values_equal(TupleDescAttr(tupdesc, index), NULL,
+						  old_values[index], new_values[index]))
+			return false;
 	}
 
-	/* Close the history relation. */
-	relation_close(history_relation, AccessShareLock);
-
-	if ((ret = SPI_finish()) != SPI_OK_FINISH)
-		elog(ERROR, "SPI_finish returned %d", ret);
+	return true;
 }
+#endif
 
 /*
- * Deconstruct a range value of the system period attribute.
+ * Create a history relation for the versioned relation that is laid out for
+ * appending rows and return its OID:
  *
- * If the value is null or is bounded on it's high side, an error is thrown.
+ *	- the columns of the versioned relation, with their types and collations
+ *	  but without constraints, are ordered to minimize the alignment padding,
+ *	  see order_history_attrs;
+ *	- the pages are filled up and frozen by the vacuums the inserts trigger,
+ *	  see HISTORY_RELOPTIONS;
+ *	- there is a BRIN index on the upper bound of the system period and, if
+ *	  key_index is true, a btree index on the primary key columns and the
+ *	  system period;
+ *	- if partition_interval is not null, the relation is partitioned by range
+ *	  of the upper bound of the system period and the first partition covers
+ *	  the interval from the start of the current day in UTC.
+ *
+ * The history relation is named "<versioned_relation>_history" and is created
+ * in the schema of the versioned relation unless its name is specified.
  */
-static void
-deserialize_system_period(HeapTuple tuple,
-						  Relation relation,
-						  int period_attnum,
-						  const char *period_attname,
-						  TypeCacheEntry *typcache,
-						  RangeBound *lower,
-						  RangeBound *upper)
+Datum
+create_history_table(PG_FUNCTION_ARGS)
 {
-	bool		 isnull;
-	Datum		 datum;
-	RangeType	*system_period;
-	bool		 empty;
+#if PG_VERSION_NUM >= 100000
+	Relation		 relation;
+	TupleDesc		 tupdesc;
+	const char		*period_attname;
+	int				 period_attnum;
+	Form_pg_attribute period_attr;
+	char			*nspname;
+	char			*relname;
+	char			*history_relation_name;
+	int				*attnums;
+	int				 natts;
+	bool			 partitioned;
+	StringInfoData	 querybuf;
+	Oid				 history_relid;
+	int				 ret;
+	int				 i;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
 
-	datum = SPI_getbinval(tuple, RelationGetDescr(relation), period_attnum,
-						  &isnull);
+	period_attname = PG_ARGISNULL(2) ? "sys_period" :
+		NameStr(*PG_GETARG_NAME(2));
+	partitioned = !PG_ARGISNULL(4);
 
-	if (isnull)
+#if PG_VERSION_NUM < 140000
+	if (partitioned)
 		ereport(ERROR,
-				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
-				 errmsg("system period column \"%s\" of relation \"%s\" must not be null",
-						period_attname,
-						RelationGetRelationName(relation))));
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("partitioned history relations require PostgreSQL 14 or later")));
+#endif
 
-	system_period = DatumGetRangeTypeP(datum);
+	relation = relation_open(PG_GETARG_OID(0), AccessShareLock);
+	tupdesc = RelationGetDescr(relation);
 
-	range_deserialize(typcache, system_period, lower, upper, &empty);
+	/* The system period attribute is checked the same way the trigger does. */
+	period_attnum = SPI_fnumber(tupdesc, period_attname);
 
-	if (empty || !upper->infinite)
+	if (period_attnum == SPI_ERROR_NOATTRIBUTE ||
+		(period_attnum > 0 &&
+		 TupleDescAttr(tupdesc, period_attnum - 1)->attisdropped))
 		ereport(ERROR,
-				(errcode(ERRCODE_DATA_EXCEPTION),
-				 errmsg("system period column \"%s\" of relation \"%s\" contains invalid value",
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("column \"%s\" of relation \"%s\" does not exist",
 						period_attname,
-						RelationGetRelationName(relation)),
-				 errdetail("valid ranges must be non-empty and unbounded on the high side")));
-}
-
-/*
- * Look up "integer_datetimes" configuration option.
- */
-static void
-lookup_integer_datetimes()
-{
-	const char	*value;
-
-	value = GetConfigOption("integer_datetimes", false, true);
+						RelationGetRelationName(relation))));
 
-	integer_datetimes = (strcmp(value, "on") == 0);
+	if (period_attnum <= 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("system period column \"%s\" of relation \"%s\" must not be a system column",
+						period_attname,
+						RelationGetRelationName(relation))));
 
-	integer_datetimes_set = true;
-}
+	period_attr = TupleDescAttr(tupdesc, period_attnum - 1);
 
-/*
- * Add a minimal time interval to the specified timestamp. The returned value
- * is always not equal to this timestamp.
- */
-static TimestampTz
-next_timestamp(TimestampTz timestamp)
-{
-	if (!integer_datetimes_set)
-		lookup_integer_datetimes();
+	(void) get_period_typcache(period_attr, relation);
 
-	/* If Timestamp is int64, add 1 microsecond. */
-	if (integer_datetimes)
-		return (TimestampTz) ((int64) timestamp + 1);
+	/* Resolve the name of the history relation. */
+	if (PG_ARGISNULL(1))
+	{
+		nspname = get_namespace_name(RelationGetNamespace(relation));
+		relname = psprintf("%s_history", RelationGetRelationName(relation));
+	}
 	else
 	{
-		float8	ts;
-		float8	next;
+		RangeVar   *relrv;
 
-		/*
-		 * If Timestamp is double, try adding 1 microsecond. If microsecond
-		 * precision is not available for this value, return the next
-		 * representable floating-point number.
-		 */
-		ts = (float8) timestamp;
-		next = ts + 1E-06;
-		if (next != ts)
-			return (TimestampTz) next;
+#if PG_VERSION_NUM >= 160000
+		relrv = makeRangeVarFromNameList(stringToQualifiedNameList(text_to_cstring(PG_GETARG_TEXT_PP(1)), NULL));
+#else
+		relrv = makeRangeVarFromNameList(stringToQualifiedNameList(text_to_cstring(PG_GETARG_TEXT_PP(1))));
+#endif
 
-		return (TimestampTz) nextafter(ts, DBL_MAX);
+		nspname = relrv->schemaname != NULL ? relrv->schemaname :
+			get_namespace_name(RelationGetNamespace(relation));
+		relname = relrv->relname;
 	}
-}
 
-/*
- * Check that the upper bound is greater than the lower bound. If it is not
- * the case and adjust argument of the trigger is set to false, an exception
- * is thrown. If adjust argument is set to true, then the upper bound is set
- * to the lower bound plus delta.
- */
-static void
-adjust_system_period(TypeCacheEntry *typcache,
-					 RangeBound *lower,
-					 RangeBound *upper,
-					 const char *adjust_argument,
-					 Relation relation)
-{
-	if (range_cmp_bounds(typcache, lower, upper) >= 0)
-	{
-		TimestampTz next_ts;
+	/* The relation is looked up by the name, so truncate it the way CREATE does. */
+	truncate_identifier(relname, strlen(relname), true);
 
-		if (!parse_adjust_argument(adjust_argument))
-			ereport(ERROR,
-					(errcode(ERRCODE_DATA_EXCEPTION),
-					 errmsg("system period value of relation \"%s\" cannot be set to a valid period because a row that is attempted to modify was also modified by another transaction",
-							RelationGetRelationName(relation)),
-					 errdetail("the start time of system period is %s but the start time of the current transaction is %s",
-							   lower->infinite ? "-infinity" : timestamptz_to_str(DatumGetTimestampTz(lower->val)),
-							   timestamptz_to_str(DatumGetTimestampTz(upper->val))),
-					 errhint("retry the statement or set \"adjust\" parameter of \"versioning\" function to true")));
+	history_relation_name = quote_qualified_identifier(nspname, relname);
 
-		ereport(WARNING,
-				(errcode(ERRCODE_WARNING_SYSTEM_PERIOD_ADJUSTED),
-				 errmsg("system period value of relation \"%s\" was adjusted",
-						RelationGetRelationName(relation))));
+	/*
+	 * The query string build is
+	 * 		CREATE TABLE <history_relation> (<column> <type> [COLLATE <collation>], ...)
+	 * 		{WITH (<options>) | PARTITION BY RANGE (upper(<period>))}
+	 */
+	attnums = order_history_attrs(tupdesc, &natts);
 
-		next_ts = next_timestamp(DatumGetTimestampTz(lower->val));
+	initStringInfo(&querybuf);
 
-		upper->val = TimestampTzGetDatum(next_ts);
+	appendStringInfo(&querybuf, "CREATE TABLE %s (", history_relation_name);
+
+	for (i = 0; i < natts; ++i)
+	{
+		Form_pg_attribute	attr = TupleDescAttr(tupdesc, attnums[i] - 1);
+
+		appendStringInfo(&querybuf, "%s%s %s", i == 0 ? "" : ", ",
+						 quote_identifier(NameStr(attr->attname)),
+						 format_type_with_typemod(attr->atttypid,
+												  attr->atttypmod));
+
+		if (OidIsValid(attr->attcollation) &&
+			attr->attcollation != get_typcollation(attr->atttypid))
+			appendStringInfo(&querybuf, " COLLATE %s",
+							 generate_collation_name(attr->attcollation));
 	}
-}
 
-/*
- * Check if the tuple was inserted or updated in the current transaction.
- */
-static bool
-modified_in_current_transaction(HeapTuple tuple)
-{
-	TransactionId	 oldxmin;
+	appendStringInfoChar(&querybuf, ')');
 
-	oldxmin = HeapTupleHeaderGetXmin(tuple->t_data);
-	return TransactionIdIsCurrentTransactionId(oldxmin);
-}
+	/* A partitioned relation has no storage, so its partitions get the options. */
+	if (partitioned)
+		appendStringInfo(&querybuf, " PARTITION BY RANGE (upper(%s))",
+						 quote_identifier(period_attname));
+	else
+		appendStringInfoString(&querybuf, " WITH (" HISTORY_RELOPTIONS ")");
 
-/*
- * Tuple modification wrapper around SPI_modifytuple for PG<10
- * and heap_modify_tuple_by_cols for PG 10
- */
-static HeapTuple
-modify_tuple(Relation rel, HeapTuple tuple, int period_attnum, RangeType *range)
-{
-	int			 colnum[1] = { period_attnum };
-	Datum		 values[1] = { RangeTypePGetDatum(range) };
-#if PG_VERSION_NUM >= 100000
-	bool		 nulls[1] = { false };
-	return heap_modify_tuple_by_cols(tuple, RelationGetDescr(rel), 1, colnum, values, nulls);
-#else
-	char		 nulls[1] = { ' ' };
-	return SPI_modifytuple(rel, tuple, 1, colnum, values, nulls);
-#endif
-}
+	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect returned %d", ret);
 
+	if ((ret = SPI_execute(querybuf.data, false, 0)) != SPI_OK_UTILITY)
+		elog(ERROR, "SPI_execute returned %d", ret);
 
-/*
- * Set system period attribute value of the current row to
- * "[system_time, )".
- */
-static Datum
-versioning_insert(TriggerData *trigdata,
-				  TypeCacheEntry *typcache,
-				  int period_attnum)
-{
-	RangeBound	 lower;
-	RangeBound	 upper;
-	RangeType	*range;
+	history_relid = RangeVarGetRelid(makeRangeVar(nspname, relname, -1),
+									 NoLock, false);
 
-	/* Construct a period for the current row. */
-	lower.val = TimestampTzGetDatum(get_system_time());
-	lower.infinite = false;
-	lower.inclusive = true;
-	lower.lower = true;
+	/* The history rows are looked up by the end of their system period. */
+	resetStringInfo(&querybuf);
 
-	upper.infinite = true;
-	upper.inclusive = false;
-	upper.lower = false;
+	appendStringInfo(&querybuf, "CREATE INDEX ON %s USING brin (upper(%s))",
+					 history_relation_name, quote_identifier(period_attname));
 
-#if PG_VERSION_NUM >= 160000
-	range = make_range(typcache, &lower, &upper, false, NULL);
-#else
-	range = make_range(typcache, &lower, &upper, false);
-#endif
+	if ((ret = SPI_execute(querybuf.data, false, 0)) != SPI_OK_UTILITY)
+		elog(ERROR, "SPI_execute returned %d", ret);
 
-	return PointerGetDatum(modify_tuple(trigdata->tg_relation, trigdata->tg_trigtuple, period_attnum, range));
-}
+	if (!PG_ARGISNULL(3) && PG_GETARG_BOOL(3))
+	{
+		Bitmapset  *keyattrs;
+		int			attnum;
 
-/*
- * Set system period attribute value of the current row to
- * "[system_time, )", insert the original row into the history table
- * with the system period attribute value "[lower, system_time)".
- *
- * If lower is greater than or equals to system_time, adjust argument
- * determines whether timestamps adjustment are made or transaction should
- * fail.
- *
- * When a transaction makes multiple changes to a row, a history row is
- * generated only once.
- */
-static Datum
-versioning_update(TriggerData *trigdata,
-				  TypeCacheEntry *typcache,
-				  int period_attnum,
-				  const char *period_attname,
-				  const char *history_relation_argument,
-				  const char *adjust_argument)
-{
-	HeapTuple		 tuple;
-	Relation		 relation;
-	RangeBound		 lower;
-	RangeBound		 upper;
-	RangeType		*range;
-	HeapTuple		 history_tuple;
+		keyattrs = RelationGetIndexAttrBitmap(relation,
+											  INDEX_ATTR_BITMAP_PRIMARY_KEY);
 
-	tuple = trigdata->tg_trigtuple;
+		if (bms_is_empty(keyattrs))
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("relation \"%s\" must have a primary key to create the key index of its history relation",
+							RelationGetRelationName(relation))));
 
-	/* Ignore tuples modified in this transaction. */
-	if (modified_in_current_transaction(tuple))
-		return PointerGetDatum(trigdata->tg_newtuple);
+		resetStringInfo(&querybuf);
 
-	relation = trigdata->tg_relation;
+		appendStringInfo(&querybuf, "CREATE INDEX ON %s (",
+						 history_relation_name);
 
-	deserialize_system_period(tuple, relation, period_attnum, period_attname,
-							  typcache, &lower, &upper);
+		attnum = -1;
+		while ((attnum = bms_next_member(keyattrs, attnum)) >= 0)
+			appendStringInfo(&querybuf, "%s, ",
+							 quote_identifier(NameStr(TupleDescAttr(tupdesc,
+																	attnum + FirstLowInvalidHeapAttributeNumber - 1)->attname)));
 
-	/* Construct a period for the history row. */
-	upper.val = TimestampTzGetDatum(get_system_time());
-	upper.infinite = false;
-	upper.inclusive = false;
+		appendStringInfo(&querybuf, "%s)", quote_identifier(period_attname));
 
-	/* Adjust if needed. */
-	adjust_system_period(typcache, &lower, &upper, adjust_argument, relation);
+		if ((ret = SPI_execute(querybuf.data, false, 0)) != SPI_OK_UTILITY)
+			elog(ERROR, "SPI_execute returned %d", ret);
 
-#if PG_VERSION_NUM >= 160000
-	range = make_range(typcache, &lower, &upper, false, NULL);
-#else
-	range = make_range(typcache, &lower, &upper, false);
-#endif
+		bms_free(keyattrs);
+	}
 
-	history_tuple = modify_tuple(relation, tuple, period_attnum, range);
+#if PG_VERSION_NUM >= 140000
+	if (partitioned)
+	{
+		TimestampTz	from;
+		TimestampTz	to;
 
-	insert_history_row(history_tuple, relation, history_relation_argument,
-					   period_attname);
+		from = GetCurrentTransactionStartTimestamp();
+		from -= from % USECS_PER_DAY;
 
-	/* Construct a period for the current row. */
-	lower.val = upper.val;
-	lower.infinite = false;
-	lower.inclusive = true;
+		to = DatumGetTimestampTz(DirectFunctionCall2(timestamptz_pl_interval,
+													 TimestampTzGetDatum(from),
+													 PointerGetDatum(PG_GETARG_INTERVAL_P(4))));
 
-	upper.infinite = true;
-	upper.inclusive = false;
+		if (to <= from)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("\"partition_interval\" must be positive")));
 
-#if PG_VERSION_NUM >= 160000
-	range = make_range(typcache, &lower, &upper, false, NULL);
-#else
-	range = make_range(typcache, &lower, &upper, false);
+		/* The partitions created by the trigger copy the options. */
+		create_history_partition(history_relid, from, to,
+								 "WITH (" HISTORY_RELOPTIONS ")");
+	}
 #endif
 
-	return PointerGetDatum(modify_tuple(relation, trigdata->tg_newtuple, period_attnum, range));
+	if ((ret = SPI_finish()) != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish returned %d", ret);
+
+	relation_close(relation, AccessShareLock);
+
+	pfree(querybuf.data);
+
+	PG_RETURN_OID(history_relid);
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("create_history_table requires PostgreSQL 10 or later")));
+
+	PG_RETURN_NULL();			/* keep compiler quiet */
+#endif
+}
+
+/*
+ * Put the existing relation under versioning into the history relation:
+ *
+ *	- the system period column is added unless the relation already has it,
+ *	  the existing rows become current since the specified time or, if it is
+ *	  null, since the current system time;
+ *	- if the relation already has the column and the time is specified, the
+ *	  rows that have a null system period become current since then, the
+ *	  others are left alone;
+ *	- a versioning trigger is created on the relation.
+ *
+ * The column is added with a constant default, which is stored in the
+ * catalog instead of the existing rows, so the relation is not rewritten. The
+ * default is dropped then, since the trigger sets the system period of new
+ * rows. Everything is done in the current transaction and the history
+ * relation is validated the same way the trigger validates it before the
+ * transaction can commit, so either the relation is versioned or nothing is
+ * changed.
+ */
+Datum
+versioning_enable(PG_FUNCTION_ARGS)
+{
+#if PG_VERSION_NUM >= 110000
+	Oid				 relid;
+	Oid				 history_relid;
+	TimestampTz		 since;
+	const char		*period_attname;
+	bool			 adjust;
+	Relation		 relation;
+	Relation		 history_relation;
+	Trigger			*trigger;
+	int				 period_attnum;
+	int				 history_period_attnum;
+	Oid				 period_typoid = InvalidOid;
+	bool			 since_given;
+	char			*relation_name;
+	char			*history_relation_name;
+	char			*nspname;
+	StringInfoData	 querybuf;
+	int				 ret;
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
+		PG_RETURN_VOID();
+
+	relid = PG_GETARG_OID(0);
+	history_relid = PG_GETARG_OID(1);
+	since_given = !PG_ARGISNULL(2);
+	since = !since_given ? get_system_time(system_time_source, NULL) :
+		PG_GETARG_TIMESTAMPTZ(2);
+	period_attname = PG_ARGISNULL(3) ? "sys_period" :
+		NameStr(*PG_GETARG_NAME(3));
+	adjust = PG_ARGISNULL(4) ? false : PG_GETARG_BOOL(4);
+
+	/* ALTER TABLE locks the relation exclusively, the lock is not upgraded. */
+	relation = relation_open(relid, AccessExclusiveLock);
+
+	if (lookup_row_versioning_trigger(relation, &trigger) != NULL
+#if PG_VERSION_NUM >= 120000
+		|| is_versioned_heap(relation)
+#endif
+		)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("relation \"%s\" is already versioned",
+						RelationGetRelationName(relation))));
+
+	history_relation = relation_open(history_relid, AccessShareLock);
+
+	/* Check the system period columns before the relation is changed. */
+	history_period_attnum = SPI_fnumber(RelationGetDescr(history_relation),
+										period_attname);
+
+	if (history_period_attnum <= 0)
+		ereport(ERROR,
+				(errmsg("history relation \"%s\" does not contain system period column \"%s\"",
+						RelationGetRelationName(history_relation),
+						period_attname),
+				 errhint("history relation must contain system period column with the same name and data type as the versioned one")));
+
+	(void) get_period_typcache(TupleDescAttr(RelationGetDescr(history_relation),
+											 history_period_attnum - 1),
+							   history_relation);
+
+	period_attnum = SPI_fnumber(RelationGetDescr(relation), period_attname);
+
+	if (period_attnum > 0)
+	{
+		TypeCacheEntry *typcache;
+
+		typcache = get_period_typcache(TupleDescAttr(RelationGetDescr(relation),
+													 period_attnum - 1),
+									   relation);
+		period_typoid = typcache->type_id;
+	}
+
+	relation_name = quote_qualified_identifier(get_namespace_name(RelationGetNamespace(relation)),
+											   RelationGetRelationName(relation));
+	history_relation_name = quote_qualified_identifier(get_namespace_name(RelationGetNamespace(history_relation)),
+													   RelationGetRelationName(history_relation));
+
+	/* The trigger function is in the same schema as this one. */
+	nspname = get_namespace_name(get_func_namespace(fcinfo->flinfo->fn_oid));
+
+	/* ALTER TABLE refuses to change a relation that is open. */
+	relation_close(history_relation, NoLock);
+	relation_close(relation, NoLock);
+
+	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect returned %d", ret);
+
+	initStringInfo(&querybuf);
+
+	if (period_attnum <= 0)
+	{
+		appendStringInfo(&querybuf, "ALTER TABLE %s ADD COLUMN %s pg_catalog.tstzrange DEFAULT pg_catalog.tstzrange(%s::pg_catalog.timestamptz, NULL)",
+						 relation_name, quote_identifier(period_attname),
+						 quote_literal_cstr(DatumGetCString(DirectFunctionCall1(timestamptz_out,
+																				TimestampTzGetDatum(since)))));
+
+		if ((ret = SPI_execute(querybuf.data, false, 0)) != SPI_OK_UTILITY)
+			elog(ERROR, "SPI_execute returned %d", ret);
+
+		resetStringInfo(&querybuf);
+
+		appendStringInfo(&querybuf, "ALTER TABLE %s ALTER COLUMN %s DROP DEFAULT",
+						 relation_name, quote_identifier(period_attname));
+
+		if ((ret = SPI_execute(querybuf.data, false, 0)) != SPI_OK_UTILITY)
+			elog(ERROR, "SPI_execute returned %d", ret);
+
+		resetStringInfo(&querybuf);
+	}
+	else if (since_given)
+	{
+		Oid		argtypes[1] = { TIMESTAMPTZOID };
+		Datum	args[1];
+
+		/*
+		 * The rows are updated before the trigger is created, so their old
+		 * versions are not archived. The query string build is
+		 * 		UPDATE <relation> SET <system_period> = <range_type>($1, NULL)
+		 * 		WHERE <system_period> IS NULL
+		 */
+		appendStringInfo(&querybuf, "UPDATE %s SET %s = %s($1, NULL) WHERE %s IS NULL",
+						 relation_name, quote_identifier(period_attname),
+						 format_type_be_qualified(period_typoid),
+						 quote_identifier(period_attname));
+
+		args[0] = TimestampTzGetDatum(since);
+
+		if ((ret = SPI_execute_with_args(querybuf.data, 1, argtypes, args,
+										 NULL, false, 0)) != SPI_OK_UPDATE)
+			elog(ERROR, "SPI_execute_with_args returned %d", ret);
+
+		resetStringInfo(&querybuf);
+	}
+
+	appendStringInfo(&querybuf, "CREATE TRIGGER versioning_trigger BEFORE INSERT OR UPDATE OR DELETE ON %s FOR EACH ROW EXECUTE PROCEDURE %s(%s, %s, %s)",
+					 relation_name,
+					 quote_qualified_identifier(nspname, "versioning"),
+					 quote_literal_cstr(period_attname),
+					 quote_literal_cstr(history_relation_name),
+					 adjust ? "true" : "false");
+
+	if ((ret = SPI_execute(querybuf.data, false, 0)) != SPI_OK_UTILITY)
+		elog(ERROR, "SPI_execute returned %d", ret);
+
+	if ((ret = SPI_finish()) != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish returned %d", ret);
+
+	/*
+	 * Fill the cached data of the trigger, which checks that the columns of
+	 * the history relation match the ones of the relation.
+	 */
+	relation = relation_open(relid, NoLock);
+	history_relation = relation_open(history_relid, NoLock);
+
+	(void) get_versioning_hash_entry(relation, history_relation,
+									 period_attname);
+
+	relation_close(history_relation, NoLock);
+	relation_close(relation, NoLock);
+
+	pfree(querybuf.data);
+
+	PG_RETURN_VOID();
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("versioning_enable requires PostgreSQL 11 or later")));
+
+	PG_RETURN_VOID();			/* keep compiler quiet */
+#endif
+}
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * Return the numbers of the attributes of the relation in the order that
+ * minimizes the alignment padding of its rows: the fixed-length attributes by
+ * descending alignment, then the variable-length ones. The attributes of the
+ * same kind keep their order.
+ */
+static int *
+order_history_attrs(TupleDesc tupdesc, int *natts)
+{
+	static const char	aligns[] = { 'd', 'i', 's', 'c' };
+	int				   *attnums;
+	int					n = 0;
+	int					pass;
+	int					i;
+
+	attnums = palloc(tupdesc->natts * sizeof(int));
+
+	/* The last pass takes the variable-length attributes of any alignment. */
+	for (pass = 0; pass <= lengthof(aligns); ++pass)
+	{
+		for (i = 0; i < tupdesc->natts; ++i)
+		{
+			Form_pg_attribute	attr = TupleDescAttr(tupdesc, i);
+
+			if (attr->attisdropped)
+				continue;
+
+			if (pass < lengthof(aligns) ?
+				attr->attlen > 0 && attr->attalign == aligns[pass] :
+				attr->attlen < 0)
+				attnums[n++] = attr->attnum;
+		}
+	}
+
+	*natts = n;
+
+	return attnums;
+}
+#endif
+
+/*
+ * Get the value that should be used as the system time by versioned
+ * triggers. Unless set_system_time() has set the system time, it is taken
+ * from the clock, a SystemTimeMode value. lower is the lower bound of the
+ * system period of the modified row or NULL if no row is modified, it is
+ * only used by MonotonicTransactionTimestamp.
+ */
+static TimestampTz
+get_system_time(int clock, RangeBound *lower)
+{
+	TemporalContext *ctx = get_current_temporal_context(false);
+
+	if (ctx->system_time_mode == UserDefined)
+		return ctx->system_time;
+
+	switch ((SystemTimeMode) clock)
+	{
+		case CurrentTransactionStartTimestamp:
+			return GetCurrentTransactionStartTimestamp();
+		case CurrentStatementStartTimestamp:
+			return GetCurrentStatementStartTimestamp();
+		case ClockTimestamp:
+			return GetCurrentTimestamp();
+		case MonotonicTransactionTimestamp:
+			if (monotonic_system_time_lxid != MyLocalTransactionId)
+			{
+				monotonic_system_time = GetCurrentTransactionStartTimestamp();
+				monotonic_system_time_lxid = MyLocalTransactionId;
+			}
+
+			if (lower != NULL && !lower->infinite &&
+				DatumGetTimestampTz(lower->val) >= monotonic_system_time)
+				monotonic_system_time =
+					next_timestamp(DatumGetTimestampTz(lower->val));
+
+			return monotonic_system_time;
+		case UserDefined:
+			break;
+	}
+
+	Assert(false);
+
+	/* will never get here */
+	return 0;
+}
+
+/*
+ * Return the clock of the versioning trigger.
+ */
+static int
+trigger_clock(VersioningTriggerEntry *entry)
+{
+	if (entry->system_time_source >= 0)
+		return entry->system_time_source;
+
+	return system_time_source;
+}
+
+/*
+ * Parse argument value as boolean. The valid values are "true" for true,
+ * "false" for false.
+ *
+ * If the string parses okay, return the parsed value, else throw an error.
+ */
+static bool
+parse_adjust_argument(const char *arg)
+{
+	if (pg_strcasecmp(arg, "true") == 0)
+		return true;
+
+	if (pg_strcasecmp(arg, "false") == 0)
+		return false;
+
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			 errmsg("invalid value \"%s\" for \"adjust\" parameter",
+					arg),
+			 errdetail("valid values are: \"true\", \"false\"")));
+
+	return false;
+}
+
+/*
+ * Locate the typcache entry for the system period attribute. If the specified
+ * attribute is not a range of timestamp with timezone, an error is thrown.
+ */
+static TypeCacheEntry *
+get_period_typcache(Form_pg_attribute attr,
+					Relation relation)
+{
+	Oid 			 typoid;
+	HeapTuple 		 type_tuple;
+	Form_pg_type 	 type;
+	TypeCacheEntry	*typcache;
+
+	typoid = attr->atttypid;
+
+	/* Search syscache for attribute type. */
+	type_tuple = SearchSysCache1(TYPEOID, ObjectIdGetDatum(typoid));
+
+	if (!HeapTupleIsValid(type_tuple))
+		elog(ERROR, "cache lookup failed for type %u", typoid);
+
+	type = (Form_pg_type) GETSTRUCT(type_tuple);
+
+	/* Check that type is a range. */
+	if (type->typtype != TYPTYPE_RANGE)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("system period column \"%s\" of relation \"%s\" is not a range but type %s",
+						NameStr(attr->attname),
+						RelationGetRelationName(relation),
+						format_type_be(typoid))));
+
+	/*
+	 * Get cached information about the range type. Typcache entries are never
+	 * freed, so the caller can keep the pointer for as long as it wants.
+	 */
+	typcache = lookup_type_cache(typoid, TYPECACHE_RANGE_INFO);
+
+	/* Check that this is a range of timestamp with timezone. */
+	if (typcache->rngelemtype->type_id != TIMESTAMPTZOID)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("system period column \"%s\" of relation \"%s\" is not a range of timestamp with timezone but of type %s",
+						NameStr(attr->attname),
+						RelationGetRelationName(relation),
+						format_type_be(typcache->rngelemtype->type_id))));
+
+	ReleaseSysCache(type_tuple);
+
+	return typcache;
+}
+
+/*
+ * Resolve the arguments of a versioning trigger and store them in the trigger
+ * cache entry. If an argument is invalid, an error is thrown and the entry is
+ * left invalid.
+ */
+static void
+fill_versioning_trigger_entry(VersioningTriggerEntry *entry,
+							  Relation relation,
+							  Trigger *trigger)
+{
+	const char		   *period_attname = trigger->tgargs[0];
+	TupleDesc			tupdesc;
+	int					period_attnum;
+	Form_pg_attribute	period_attr;
+	TypeCacheEntry	   *typcache;
+	bool				skip_unchanged = false;
+	List			   *ignore_columns = NIL;
+	char			   *delta_attname = NULL;
+	int					clock = -1;
+	bool				capture_logical = false;
+	int					i;
+
+	tupdesc = RelationGetDescr(relation);
+
+	/* Check that system period attribute exists in the versioned relation. */
+	period_attnum = SPI_fnumber(tupdesc, period_attname);
+
+	if (period_attnum == SPI_ERROR_NOATTRIBUTE)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("column \"%s\" of relation \"%s\" does not exist",
+						period_attname,
+						RelationGetRelationName(relation))));
+
+	period_attr = TupleDescAttr(tupdesc, period_attnum - 1);
+
+	/* Check that system period attribute is not dropped. */
+	if (period_attr->attisdropped)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("column \"%s\" of relation \"%s\" does not exist",
+						period_attname,
+						RelationGetRelationName(relation))));
+
+	/* Check that system period attribute is not an array. */
+	if (period_attr->attndims != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("system period column \"%s\" of relation \"%s\" is not a range but an array",
+						period_attname,
+						RelationGetRelationName(relation))));
+
+	/* Locate the typcache entry for the type of system period attribute. */
+	typcache = get_period_typcache(period_attr, relation);
+
+	for (i = 3; i < trigger->tgnargs; ++i)
+		parse_trigger_option(trigger->tgargs[i], &skip_unchanged,
+							 &ignore_columns, &delta_attname, &clock,
+							 &capture_logical);
+
+	/*
+	 * The capture worker archives every row as a whole and only once, so
+	 * neither the delta format nor the statement-level triggers can be used
+	 * along with it.
+	 */
+	if (capture_logical && delta_attname != NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("\"capture\" option cannot be combined with \"delta_column\" option")));
+
+	if (capture_logical &&
+		(find_statement_trigger(relation, true) != '\0' ||
+		 find_statement_trigger(relation, false) != '\0'))
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("relation \"%s\" has statement-level versioning triggers",
+						RelationGetRelationName(relation)),
+				 errhint("Drop the statement-level triggers to capture the history by logical decoding.")));
+
+	/* The history relation is resolved when it is needed for the first time. */
+	if (entry->history_search_path != NULL)
+	{
+		list_free(entry->history_search_path->schemas);
+		pfree(entry->history_search_path);
+		entry->history_search_path = NULL;
+	}
+
+	entry->relid = RelationGetRelid(relation);
+	entry->period_attnum = period_attnum;
+	entry->typcache = typcache;
+	entry->adjust_parsed = false;
+	entry->history_relid = InvalidOid;
+	entry->update_statement_tgenabled = find_statement_trigger(relation, true);
+	entry->delete_statement_tgenabled = find_statement_trigger(relation, false);
+	entry->stats = get_versioning_stats(entry->relid);
+
+	entry->skip_unchanged = skip_unchanged;
+	entry->system_time_source = clock;
+	entry->capture_logical = capture_logical;
+
+	if (skip_unchanged)
+		fill_compare_attrs(entry, relation, ignore_columns);
+
+	if (entry->delta_attname != NULL)
+	{
+		pfree(entry->delta_attname);
+		entry->delta_attname = NULL;
+	}
+
+	if (delta_attname != NULL)
+		entry->delta_attname = MemoryContextStrdup(versioning_cache_context,
+												   delta_attname);
+
+	update_trigger_entry_space(entry);
+
+	/* Now when the entry is filled we can mark it valid. */
+	entry->valid = true;
+}
+
+/*
+ * Parse an option of a versioning trigger. An option is an argument that
+ * follows the first three ones and has the form "<name>=<value>":
+ *
+ *	skip_unchanged=<boolean>
+ *		do not archive a row if UPDATE does not change it;
+ *	ignore_columns=<column>[,<column>...]
+ *		do not compare the listed columns, implies skip_unchanged=true;
+ *	delta_column=<column>
+ *		archive the rows in the delta format, see insert_delta_history_row;
+ *	system_time_source=<clock>
+ *		take the system time from the clock instead of the one selected by
+ *		temporal_tables.system_time_source;
+ *	capture=trigger|logical
+ *		archive the rows in the trigger or leave them to the capture worker.
+ */
+static void
+parse_trigger_option(const char *option,
+					 bool *skip_unchanged,
+					 List **ignore_columns,
+					 char **delta_attname,
+					 int *system_time_source,
+					 bool *capture_logical)
+{
+	const char *value;
+	size_t		namelen;
+
+	value = strchr(option, '=');
+
+	if (value == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid option \"%s\" of function \"versioning\"",
+						option),
+				 errhint("options must have the form \"name=value\"")));
+
+	namelen = value - option;
+	value++;
+
+	if (namelen == strlen("skip_unchanged") &&
+		pg_strncasecmp(option, "skip_unchanged", namelen) == 0)
+	{
+		if (!parse_bool(value, skip_unchanged))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("invalid value \"%s\" for \"skip_unchanged\" option",
+							value)));
+	}
+	else if (namelen == strlen("ignore_columns") &&
+			 pg_strncasecmp(option, "ignore_columns", namelen) == 0)
+	{
+		List   *names;
+
+		/* SplitIdentifierString modifies the string. */
+		if (!SplitIdentifierString(pstrdup(value), ',', &names))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("invalid value \"%s\" for \"ignore_columns\" option",
+							value)));
+
+		*ignore_columns = list_concat(*ignore_columns, names);
+		*skip_unchanged = true;
+	}
+	else if (namelen == strlen("delta_column") &&
+			 pg_strncasecmp(option, "delta_column", namelen) == 0)
+	{
+#if PG_VERSION_NUM >= 100000
+		if (*value == '\0')
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("invalid value \"%s\" for \"delta_column\" option",
+							value)));
+
+		*delta_attname = pstrdup(value);
+#else
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("\"delta_column\" option requires PostgreSQL 10 or later")));
+#endif
+	}
+	else if (namelen == strlen("system_time_source") &&
+			 pg_strncasecmp(option, "system_time_source", namelen) == 0)
+	{
+		const struct config_enum_entry *clock;
+
+		for (clock = system_time_source_options; clock->name != NULL; ++clock)
+		{
+			if (pg_strcasecmp(value, clock->name) == 0)
+				break;
+		}
+
+		if (clock->name == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("invalid value \"%s\" for \"system_time_source\" option",
+							value),
+					 errhint("Available values: transaction, statement, clock, monotonic.")));
+
+		*system_time_source = clock->val;
+	}
+	else if (namelen == strlen("capture") &&
+			 pg_strncasecmp(option, "capture", namelen) == 0)
+	{
+#if PG_VERSION_NUM >= 100000
+		if (pg_strcasecmp(value, "trigger") == 0)
+			*capture_logical = false;
+		else if (pg_strcasecmp(value, "logical") == 0)
+			*capture_logical = true;
+		else
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("invalid value \"%s\" for \"capture\" option",
+							value),
+					 errhint("Available values: trigger, logical.")));
+#else
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("\"capture\" option requires PostgreSQL 10 or later")));
+#endif
+	}
+	else
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unrecognized option \"%.*s\" of function \"versioning\"",
+						(int) namelen, option)));
+}
+
+/*
+ * Fill the list of the attributes compared by row_unchanged. These are
+ * all the attributes of the versioned relation but the system period and
+ * the ignored ones.
+ */
+static void
+fill_compare_attrs(VersioningTriggerEntry *entry,
+				   Relation relation,
+				   List *ignore_columns)
+{
+	TupleDesc	 tupdesc = RelationGetDescr(relation);
+	bool		*ignored;
+	ListCell	*lc;
+	int			 i;
+
+	ignored = palloc0(tupdesc->natts * sizeof(bool));
+
+	foreach(lc, ignore_columns)
+	{
+		char   *name = lfirst(lc);
+		int		attnum = SPI_fnumber(tupdesc, name);
+
+		if (attnum <= 0 || TupleDescAttr(tupdesc, attnum - 1)->attisdropped)
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_COLUMN),
+					 errmsg("column \"%s\" of relation \"%s\" does not exist",
+							name,
+							RelationGetRelationName(relation))));
+
+		ignored[attnum - 1] = true;
+	}
+
+	if (entry->compare_attnums != NULL)
+	{
+		pfree(entry->compare_attnums);
+		entry->compare_attnums = NULL;
+	}
+
+	if (entry->compare_typcaches != NULL)
+	{
+		pfree(entry->compare_typcaches);
+		entry->compare_typcaches = NULL;
+	}
+
+	entry->ncompare_attrs = 0;
+	entry->compare_attnums = MemoryContextAlloc(versioning_cache_context,
+												tupdesc->natts * sizeof(int));
+	entry->compare_typcaches = MemoryContextAlloc(versioning_cache_context,
+												  tupdesc->natts * sizeof(TypeCacheEntry *));
+
+	for (i = 0; i < tupdesc->natts; ++i)
+	{
+		Form_pg_attribute	attr = TupleDescAttr(tupdesc, i);
+
+		if (attr->attisdropped || ignored[i] ||
+			attr->attnum == entry->period_attnum)
+			continue;
+
+		entry->compare_attnums[entry->ncompare_attrs] = attr->attnum;
+		entry->compare_typcaches[entry->ncompare_attrs] =
+			lookup_type_cache(attr->atttypid, TYPECACHE_EQ_OPR_FINFO);
+		entry->ncompare_attrs++;
+	}
+
+	pfree(ignored);
+}
+
+/*
+ * Find a statement-level versioning trigger that archives the rows of UPDATE
+ * (if for_update is true) or DELETE command on the relation. Return its
+ * tgenabled value or '\0' if there is no such trigger.
+ */
+static char
+find_statement_trigger(Relation relation, bool for_update)
+{
+#if PG_VERSION_NUM >= 100000
+	TriggerDesc	   *trigdesc;
+	int				i;
+
+	trigdesc = relation->trigdesc;
+
+	if (trigdesc == NULL)
+		return '\0';
+
+	for (i = 0; i < trigdesc->numtriggers; ++i)
+	{
+		Trigger	   *trigger;
+		FmgrInfo	flinfo;
+
+		trigger = &trigdesc->triggers[i];
+
+		if (TRIGGER_FOR_ROW(trigger->tgtype) ||
+			!TRIGGER_FOR_AFTER(trigger->tgtype))
+			continue;
+
+		if (for_update ? !TRIGGER_FOR_UPDATE(trigger->tgtype)
+					   : !TRIGGER_FOR_DELETE(trigger->tgtype))
+			continue;
+
+		/* Check that the trigger executes our function. */
+		fmgr_info(trigger->tgfoid, &flinfo);
+
+		if (flinfo.fn_addr == versioning_statement)
+			return trigger->tgenabled;
+	}
+#endif
+
+	return '\0';
+}
+
+/*
+ * Check whether a statement-level trigger with the specified tgenabled value
+ * fires in the current session.
+ */
+static bool
+statement_trigger_fires(char tgenabled)
+{
+	if (tgenabled == '\0' || tgenabled == TRIGGER_DISABLED)
+		return false;
+
+	if (SessionReplicationRole == SESSION_REPLICATION_ROLE_REPLICA)
+		return tgenabled == TRIGGER_FIRES_ALWAYS ||
+			   tgenabled == TRIGGER_FIRES_ON_REPLICA;
+
+	return tgenabled == TRIGGER_FIRES_ALWAYS ||
+		   tgenabled == TRIGGER_FIRES_ON_ORIGIN;
+}
+
+/*
+ * Resolve the history relation name to OID and remember it in the trigger
+ * cache entry. If the relation does not exist, an error is thrown.
+ */
+static void
+resolve_history_relid(VersioningTriggerEntry *entry,
+					  const char *history_relation_name)
+{
+	RangeVar	*relrv;
+	Oid			 relid;
+
+#if PG_VERSION_NUM >= 160000
+	relrv = makeRangeVarFromNameList(stringToQualifiedNameList(history_relation_name, NULL));
+#else
+	relrv = makeRangeVarFromNameList(stringToQualifiedNameList(history_relation_name));
+#endif
+
+	relid = RangeVarGetRelid(relrv, NoLock, false);
+
+	if (entry->history_search_path != NULL)
+	{
+		list_free(entry->history_search_path->schemas);
+		pfree(entry->history_search_path);
+		entry->history_search_path = NULL;
+	}
+
+	/*
+	 * If the name is not schema-qualified, the resolved OID depends on the
+	 * search path, so we have to keep it to detect its changes.
+	 */
+	if (relrv->schemaname == NULL)
+		entry->history_search_path = GetOverrideSearchPath(versioning_cache_context);
+
+	entry->history_relid = relid;
+}
+
+/*
+ * Open the history relation of a versioning trigger with the specified lock.
+ *
+ * The relation is opened by the cached OID. The OID is resolved again if the
+ * cached one was invalidated while we were waiting for the lock. The lock is
+ * held until the end of the transaction, so the caller must close the
+ * relation with NoLock.
+ */
+static Relation
+open_history_relation(VersioningTriggerEntry *entry,
+					  const char *history_relation_name,
+					  LOCKMODE lockmode)
+{
+	Oid		relid;
+
+	for (;;)
+	{
+		if (!OidIsValid(entry->history_relid) ||
+#if PG_VERSION_NUM >= 90300
+			(entry->history_search_path != NULL &&
+			 !OverrideSearchPathMatchesCurrent(entry->history_search_path)))
+#else
+			entry->history_search_path != NULL)
+#endif
+			resolve_history_relid(entry, history_relation_name);
+
+		relid = entry->history_relid;
+
+		/*
+		 * If the relation has been already locked in the current
+		 * subtransaction, the lock is still held, and nobody could have
+		 * changed the relation since then.
+		 */
+		if (relid == entry->locked_history_relid &&
+			lockmode == entry->locked_lockmode &&
+			entry->locked_lxid == MyLocalTransactionId &&
+			entry->locked_subid == GetCurrentSubTransactionId())
+			break;
+
+		/* Locking the relation also processes pending invalidations. */
+		LockRelationOid(relid, lockmode);
+
+		if (entry->history_relid == relid)
+		{
+			entry->locked_history_relid = relid;
+			entry->locked_lockmode = lockmode;
+			entry->locked_lxid = MyLocalTransactionId;
+			entry->locked_subid = GetCurrentSubTransactionId();
+			break;
+		}
+
+		UnlockRelationOid(relid, lockmode);
+	}
+
+	return heap_open(relid, NoLock);
+}
+
+/*
+ * Check that the type of an attribute in the versioned table is the same as in
+ * the history table.
+ */
+static void
+check_attr_type(Form_pg_attribute attr,
+				Form_pg_attribute history_attr,
+				Relation relation,
+				Relation history_relation)
+{
+	if (attr->atttypid != history_attr->atttypid ||
+		attr->attndims != history_attr->attndims ||
+		attr->atttypmod != history_attr->atttypmod)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("column \"%s\" of relation \"%s\" is of type %s but column \"%s\" of history relation \"%s\" is of type %s",
+						NameStr(attr->attname),
+						RelationGetRelationName(relation),
+						format_type_with_typemod(attr->atttypid,
+												 attr->atttypmod),
+						NameStr(history_attr->attname),
+						RelationGetRelationName(history_relation),
+						format_type_with_typemod(history_attr->atttypid,
+												 history_attr->atttypmod))));
+}
+
+/*
+ * Fill a newly created hash entry with the cached data.
+ *
+ * Note that hash entry must be zeroed and natts value of the entry must be
+ * set to -1 prior to the call of this function.
+ */
+static void
+fill_versioning_hash_entry(VersioningHashEntry *hash_entry,
+						   Relation relation,
+						   Relation history_relation,
+						   TupleDesc tupdesc,
+						   const char *period_attname)
+{
+	TupleDesc		 history_tupdesc;
+	MemoryContext	 oldcontext;
+	int				 attnums_size;
+	int				*attnums;
+	StringInfoData	 querybuf;
+	char			*nspname;
+	char			*relname;
+	int				*history_attnums;
+	int				 natts;
+	int				 i;
+
+	history_tupdesc = RelationGetDescr(history_relation);
+
+	/* Check that the history relation contains the system period attribute. */
+	if (SPI_fnumber(history_tupdesc, period_attname) < 0)
+		ereport(ERROR,
+				(errmsg("history relation \"%s\" does not contain system period column \"%s\"",
+						RelationGetRelationName(history_relation),
+						period_attname),
+				 errhint("history relation must contain system period column with the same name and data type as the versioned one")));
+
+	/*
+	 * Allocate versioned relation attributes array. attnums[N] contains the
+	 * number of the attribute in the versioned relation.
+	 */
+	attnums_size = Min(tupdesc->natts, history_tupdesc->natts);
+	attnums = palloc(attnums_size * sizeof(int));
+
+	/*
+	 * The query string build is
+	 * 		INSERT INTO <history_relation> (<attr1>, <attr2>, ...)
+	 * 		VALUES ($1, $2, ...)
+	 */
+	initStringInfo(&querybuf);
+
+	nspname = get_namespace_name(RelationGetNamespace(history_relation));
+	relname = RelationGetRelationName(history_relation);
+
+	appendStringInfo(&querybuf,
+					 "INSERT INTO %s.%s (",
+					 quote_identifier(nspname),
+					 quote_identifier(relname));
+
+	/*
+	 * Allocate history relation attributes array. history_attnums[N] is a
+	 * number of the attribute in the history relation that has the same name
+	 * as the attribute with the number attnums[N] in the versioned relation.
+	 */
+	history_attnums = palloc(attnums_size * sizeof(int));
+
+	/* Fill in common attributes array. */
+	natts = 0;
+	for (i = 0; i < tupdesc->natts; ++i)
+	{
+		Form_pg_attribute	 attr;
+		Form_pg_attribute	 history_attr;
+		int					 history_attnum;
+		char				*attname;
+
+		attr = TupleDescAttr(tupdesc, i);
+
+		if (attr->attisdropped)
+			continue;
+
+		attname = NameStr(attr->attname);
+
+		history_attnum = SPI_fnumber(history_tupdesc, attname);
+
+		if (history_attnum < 0)
+			continue;
+
+		history_attr = TupleDescAttr(history_tupdesc, history_attnum - 1);
+
+		check_attr_type(attr, history_attr, relation, history_relation);
+
+		attnums[natts] = attr->attnum;
+		history_attnums[natts] = history_attnum;
+
+		if (natts != 0)
+			appendStringInfo(&querybuf, ", ");
+
+		appendStringInfo(&querybuf, "%s", quote_identifier(attname));
+
+		natts++;
+	}
+
+	/*
+	 * If there are common attributes, then prepare and set the plan and
+	 * related information.
+	 */
+	if (natts != 0)
+	{
+		Oid			*argtypes;
+
+		appendStringInfo(&querybuf, ") VALUES (");
+
+		argtypes = palloc(sizeof(Oid) * natts);
+		for (i = 0; i < natts; ++i)
+		{
+			if (i != 0)
+				appendStringInfo(&querybuf, ", ");
+
+			appendStringInfo(&querybuf, "$%d", i + 1);
+
+			argtypes[i] = SPI_gettypeid(history_tupdesc, history_attnums[i]);
+		}
+
+		appendStringInfo(&querybuf, ")");
+
+		/*
+		 * Copy the constructed attribute list and the command into the cache
+		 * memory context. The plan is prepared only when it is used for the
+		 * first time, since the row is usually inserted directly.
+		 */
+		oldcontext = MemoryContextSwitchTo(versioning_cache_context);
+
+		hash_entry->insert_history_plan = NULL;
+		hash_entry->insert_history_query = pstrdup(querybuf.data);
+		hash_entry->insert_history_argtypes = palloc(natts * sizeof(Oid));
+		memcpy(hash_entry->insert_history_argtypes, argtypes,
+			   natts * sizeof(Oid));
+
+		hash_entry->history_relid = RelationGetRelid(history_relation);
+
+		hash_entry->attnums = palloc(natts * sizeof(int));
+		memcpy(hash_entry->attnums, attnums, natts * sizeof(int));
+
+		hash_entry->history_attnums = palloc(natts * sizeof(int));
+		memcpy(hash_entry->history_attnums, history_attnums, natts * sizeof(int));
+
+		MemoryContextSwitchTo(oldcontext);
+
+		charge_cached_chunk(hash_entry, hash_entry->insert_history_query);
+		charge_cached_chunk(hash_entry, hash_entry->insert_history_argtypes);
+		charge_cached_chunk(hash_entry, hash_entry->attnums);
+		charge_cached_chunk(hash_entry, hash_entry->history_attnums);
+
+		hash_entry->period_attnum = SPI_fnumber(tupdesc, period_attname);
+		hash_entry->history_period_attnum = SPI_fnumber(history_tupdesc,
+														period_attname);
+
+		hash_entry->identical_layout =
+			has_identical_layout(tupdesc, history_tupdesc, attnums,
+								 history_attnums, natts);
+
+		pfree(argtypes);
+
+		/*
+		 * Check whether INSERT command would compute anything for the history
+		 * attributes by itself. If so, the row cannot be inserted directly.
+		 */
+#if PG_VERSION_NUM >= 140000
+		hash_entry->direct_insert = true;
+
+		for (i = 0; i < history_tupdesc->natts; ++i)
+		{
+			Form_pg_attribute	history_attr;
+			bool				common;
+			int					j;
+
+			history_attr = TupleDescAttr(history_tupdesc, i);
+
+			if (history_attr->attisdropped)
+				continue;
+
+			if (history_attr->attidentity || history_attr->attgenerated)
+			{
+				hash_entry->direct_insert = false;
+				break;
+			}
+
+			if (!history_attr->atthasdef)
+				continue;
+
+			common = false;
+			for (j = 0; j < natts; ++j)
+			{
+				if (history_attnums[j] == history_attr->attnum)
+				{
+					common = true;
+					break;
+				}
+			}
+
+			if (!common)
+			{
+				hash_entry->direct_insert = false;
+				break;
+			}
+		}
+
+		hash_entry->partitioned_by_upper =
+			is_partitioned_by_upper(history_relation,
+									hash_entry->history_period_attnum);
+		hash_entry->partition_cached = false;
+#else
+		hash_entry->direct_insert = false;
+#endif
+	}
+
+	/*
+	 * Now when the cached data structure is filled we can set natts to mark
+	 * the entry valid.
+	 */
+	hash_entry->natts = natts;
+
+	pfree(attnums);
+	pfree(history_attnums);
+}
+
+/*
+ * Look up the cached data for the versioned relation and the history relation.
+ * If there is no cached data or it is invalid, fill it.
+ */
+static VersioningHashEntry *
+get_versioning_hash_entry(Relation relation,
+						  Relation history_relation,
+						  const char *period_attname)
+{
+	VersioningHashEntry	*hash_entry;
+	bool				 found;
+	TupleDesc			 tupdesc;
+	VersioningStats		*stats;
+
+	/* Look up the cached data for the versioned relation OID. */
+	hash_entry = lookup_versioning_hash_entry(RelationGetRelid(relation),
+											  &found);
+
+	tupdesc = RelationGetDescr(relation);
+
+	if (found)
+	{
+		/*
+		 * Check that the cached data is still valid.
+		 *
+		 * If natts is -1, then fill_versioning_hash_entry failed and the
+		 * cached data is invalid.
+		 *
+		 * If the trigger definition changes, then the cached history relation
+		 * OID may differs compared to the current one.
+		 *
+		 * If the structure of the versioned table or the history table
+		 * changes, then the relcache invalidation callback resets valid.
+		 */
+		if (!hash_entry->valid ||
+			hash_entry->natts == -1 ||
+			RelationGetRelid(history_relation) != hash_entry->history_relid)
+		{
+			/* If the cached data structure is invalid, free it's fields. */
+			free_versioning_hash_entry(hash_entry);
+
+			/* Make to refill the cached data entry. */
+			found = false;
+
+			stats = get_versioning_stats(RelationGetRelid(relation));
+			stats->counters[VERSIONING_STATS_CACHE_REBUILDS]++;
+		}
+	}
+	else
+	{
+		stats = get_versioning_stats(RelationGetRelid(relation));
+		stats->counters[VERSIONING_STATS_CACHE_MISSES]++;
+	}
+
+	/*
+	 * If there is no cached data or it is invalid, fill the cached data
+	 * structure. It does not need SPI, the plan is prepared by
+	 * execute_history_plan when it is needed.
+	 */
+	if (!found)
+	{
+		/*
+		 * Mark the entry valid before filling it, so that an invalidation
+		 * that arrives while it is being filled is not lost.
+		 */
+		hash_entry->valid = true;
+
+		/* The cached data is built from the catalogs of both relations. */
+		report_wait_start(VERSIONING_WAIT_CACHE_FILL);
+
+		fill_versioning_hash_entry(hash_entry, relation, history_relation,
+								   tupdesc, period_attname);
+
+		report_wait_end();
+	}
+
+	hash_entry->last_used = ++versioning_cache_clock;
+	hash_entry->last_used_lxid = MyLocalTransactionId;
+	dlist_move_head(&versioning_cache_lru, &hash_entry->lru_node);
+
+	if (versioning_max_cache_size >= 0)
+	{
+		update_plan_space(hash_entry);
+		evict_versioning_hash_entries();
+	}
+
+	return hash_entry;
+}
+
+/*
+ * Free the cached data of the versioned relation and mark it invalid.
+ */
+static void
+free_versioning_hash_entry(VersioningHashEntry *hash_entry)
+{
+	int		ret;
+
+	/* Mark the entry invalid. */
+	hash_entry->natts = -1;
+
+	if (hash_entry->attnums != NULL)
+	{
+		free_cached_chunk(hash_entry, hash_entry->attnums);
+		hash_entry->attnums = NULL;
+	}
+
+	if (hash_entry->history_attnums != NULL)
+	{
+		free_cached_chunk(hash_entry, hash_entry->history_attnums);
+		hash_entry->history_attnums = NULL;
+	}
+
+	if (hash_entry->insert_history_query != NULL)
+	{
+		free_cached_chunk(hash_entry, hash_entry->insert_history_query);
+		hash_entry->insert_history_query = NULL;
+	}
+
+	if (hash_entry->insert_history_argtypes != NULL)
+	{
+		free_cached_chunk(hash_entry, hash_entry->insert_history_argtypes);
+		hash_entry->insert_history_argtypes = NULL;
+	}
+
+	if (hash_entry->insert_history_plan != NULL)
+	{
+		if ((ret = SPI_freeplan(hash_entry->insert_history_plan)) != 0)
+			elog(ERROR, "SPI_freeplan returned %d", ret);
+
+		hash_entry->insert_history_plan = NULL;
+	}
+
+	free_delta_plan(hash_entry);
+
+	update_plan_space(hash_entry);
+}
+
+/*
+ * Evict the cached data of the versioned relations and the resolved trigger
+ * arguments used longest ago until their space does not exceed
+ * temporal_tables.max_cache_size. The entries used in the current
+ * transaction are kept, since the callers may still refer to them.
+ *
+ * The entries are kept in the order of their uses, so the coldest one is at
+ * the tail of one of the lists, and if it is used in the current transaction
+ * so are all the others of its list.
+ */
+static void
+evict_versioning_hash_entries(void)
+{
+	Size	max_space = (Size) versioning_max_cache_size * 1024;
+
+	while (versioning_cache_space > max_space)
+	{
+		VersioningHashEntry		*hash_entry = NULL;
+		VersioningTriggerEntry	*entry = NULL;
+		VersioningStats			*stats;
+		Oid						 relid;
+
+		if (!dlist_is_empty(&versioning_cache_lru))
+		{
+			hash_entry = dlist_tail_element(VersioningHashEntry, lru_node,
+											&versioning_cache_lru);
+
+			if (hash_entry->last_used_lxid == MyLocalTransactionId)
+				hash_entry = NULL;
+		}
+
+		if (!dlist_is_empty(&versioning_trigger_lru))
+		{
+			entry = dlist_tail_element(VersioningTriggerEntry, lru_node,
+									   &versioning_trigger_lru);
+
+			if (entry->last_used_lxid == MyLocalTransactionId)
+				entry = NULL;
+		}
+
+		if (entry != NULL &&
+			(hash_entry == NULL || entry->last_used < hash_entry->last_used))
+		{
+			evict_trigger_entry(entry);
+			continue;
+		}
+
+		if (hash_entry == NULL)
+			break;
+
+		relid = hash_entry->relid;
+
+		free_versioning_hash_entry(hash_entry);
+
+		dlist_delete(&hash_entry->lru_node);
+		hash_search(versioning_cache, (void *) &relid, HASH_REMOVE, NULL);
+
+		stats = get_versioning_stats(relid);
+		stats->counters[VERSIONING_STATS_CACHE_EVICTIONS]++;
+	}
+}
+
+/*
+ * Free the resolved arguments of the trigger entry and remove it from its
+ * hash table.
+ */
+static void
+evict_trigger_entry(VersioningTriggerEntry *entry)
+{
+	Oid		key = entry->tgoid;
+
+	if (entry->history_search_path != NULL)
+	{
+		list_free(entry->history_search_path->schemas);
+		pfree(entry->history_search_path);
+	}
+
+	if (entry->compare_attnums != NULL)
+		pfree(entry->compare_attnums);
+
+	if (entry->compare_typcaches != NULL)
+		pfree(entry->compare_typcaches);
+
+	if (entry->delta_attname != NULL)
+		pfree(entry->delta_attname);
+
+#if PG_VERSION_NUM >= 120000
+	if (entry->trigger != NULL)
+		free_versioned_heap_trigger(entry->trigger);
+#endif
+
+	versioning_cache_space -= entry->space;
+
+	dlist_delete(&entry->lru_node);
+	hash_search(entry->cache, (void *) &key, HASH_REMOVE, NULL);
+}
+
+/*
+ * Record the use of the trigger entry and evict the cached data used longest
+ * ago if there is too much of it.
+ */
+static void
+touch_trigger_entry(VersioningTriggerEntry *entry)
+{
+	entry->last_used = ++versioning_cache_clock;
+	entry->last_used_lxid = MyLocalTransactionId;
+	dlist_move_head(&versioning_trigger_lru, &entry->lru_node);
+
+	if (versioning_max_cache_size >= 0)
+		evict_versioning_hash_entries();
+}
+
+/*
+ * Recompute the space taken by the trigger entry and its resolved arguments.
+ * The search path is small and not counted.
+ */
+static void
+update_trigger_entry_space(VersioningTriggerEntry *entry)
+{
+	Size	space = sizeof(VersioningTriggerEntry);
+
+	if (entry->compare_attnums != NULL)
+		space += GetMemoryChunkSpace(entry->compare_attnums);
+
+	if (entry->compare_typcaches != NULL)
+		space += GetMemoryChunkSpace(entry->compare_typcaches);
+
+	if (entry->delta_attname != NULL)
+		space += GetMemoryChunkSpace(entry->delta_attname);
+
+	if (entry->trigger != NULL)
+		space += GetMemoryChunkSpace(entry->trigger) +
+			GetMemoryChunkSpace(entry->trigger->tgargs) +
+			GetMemoryChunkSpace(entry->trigger->tgargs[1]);
+
+	versioning_cache_space += space - entry->space;
+	entry->space = space;
+}
+
+/*
+ * Add the space of a chunk allocated in the cache memory context to the space
+ * of the cached data.
+ */
+static void
+charge_cached_chunk(VersioningHashEntry *hash_entry, void *pointer)
+{
+	Size	size = GetMemoryChunkSpace(pointer);
+
+	hash_entry->space += size;
+	versioning_cache_space += size;
+}
+
+/*
+ * Free a chunk of the cached data charged by charge_cached_chunk.
+ */
+static void
+free_cached_chunk(VersioningHashEntry *hash_entry, void *pointer)
+{
+	Size	size = GetMemoryChunkSpace(pointer);
+
+	hash_entry->space -= size;
+	versioning_cache_space -= size;
+
+	pfree(pointer);
+}
+
+/*
+ * Recompute the space taken by the kept plans of the cached data. The plan
+ * cache builds the generic plan on one of the executions, so the space grows
+ * after the plan is prepared. It is only known since PostgreSQL 13.
+ */
+static void
+update_plan_space(VersioningHashEntry *hash_entry)
+{
+#if PG_VERSION_NUM >= 130000
+	SPIPlanPtr	plans[2];
+	Size		space = 0;
+	int			i;
+
+	plans[0] = hash_entry->insert_history_plan;
+	plans[1] = hash_entry->insert_delta_plan;
+
+	for (i = 0; i < lengthof(plans); ++i)
+	{
+		ListCell   *lc;
+
+		if (plans[i] == NULL)
+			continue;
+
+		foreach(lc, SPI_plan_get_plan_sources(plans[i]))
+		{
+			CachedPlanSource *plansource = (CachedPlanSource *) lfirst(lc);
+
+			space += MemoryContextMemAllocated(plansource->context, true);
+
+			if (plansource->gplan != NULL)
+				space += MemoryContextMemAllocated(plansource->gplan->context,
+												   true);
+		}
+	}
+
+	versioning_cache_space += space - hash_entry->plan_space;
+	hash_entry->plan_space = space;
+#endif
+}
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * Build INSERT command that archives all the rows of the source relation,
+ * which has the row type of the versioned relation and the system periods of
+ * the history rows, into the history relation.
+ */
+static char *
+build_archive_query(Relation relation,
+					Relation history_relation,
+					VersioningHashEntry *hash_entry,
+					const char *source)
+{
+	TupleDesc		 tupdesc;
+	StringInfoData	 querybuf;
+	StringInfoData	 selectbuf;
+	int				 i;
+
+	tupdesc = RelationGetDescr(relation);
+
+	/*
+	 * The query string build is
+	 * 		INSERT INTO <history_relation> (<attr1>, <attr2>, ...)
+	 * 		SELECT <attr1>, <attr2>, ... FROM <source>
+	 */
+	initStringInfo(&querybuf);
+	initStringInfo(&selectbuf);
+
+	appendStringInfo(&querybuf,
+					 "INSERT INTO %s.%s (",
+					 quote_identifier(get_namespace_name(RelationGetNamespace(history_relation))),
+					 quote_identifier(RelationGetRelationName(history_relation)));
+
+	for (i = 0; i < hash_entry->natts; ++i)
+	{
+		int			 attnum;
+		const char	*attname;
+
+		attnum = hash_entry->attnums[i];
+		attname = quote_identifier(NameStr(TupleDescAttr(tupdesc, attnum - 1)->attname));
+
+		if (i != 0)
+		{
+			appendStringInfo(&querybuf, ", ");
+			appendStringInfo(&selectbuf, ", ");
+		}
+
+		appendStringInfo(&querybuf, "%s", attname);
+		appendStringInfo(&selectbuf, "%s", attname);
+	}
+
+	appendStringInfo(&querybuf, ") SELECT %s FROM %s",
+					 selectbuf.data, quote_identifier(source));
+
+	pfree(selectbuf.data);
+
+	return querybuf.data;
+}
+
+/*
+ * Collect the row of the versioned relation with the system period of its
+ * history row for the statement-level trigger of the event.
+ */
+static void
+collect_statement_history_row(Relation relation,
+							  TriggerEvent event,
+							  HeapTuple tuple,
+							  int period_attnum,
+							  RangeType *period)
+{
+	SubTransactionId	 subid;
+	StatementHistoryRows *rows;
+	HeapTuple			 history_tuple;
+	ListCell			*lc;
+	MemoryContext		 oldcxt;
+	ResourceOwner		 oldowner;
+
+	subid = GetCurrentSubTransactionId();
+
+	if (statement_history_rows_context == NULL)
+		statement_history_rows_context =
+			AllocSetContextCreate(TopTransactionContext,
+								  "temporal_tables statement history rows",
+								  ALLOCSET_DEFAULT_SIZES);
+
+	rows = NULL;
+
+	foreach(lc, statement_history_rows)
+	{
+		StatementHistoryRows *r = lfirst(lc);
+
+		if (r->relid == RelationGetRelid(relation) && r->event == event &&
+			r->subid == subid)
+		{
+			rows = r;
+			break;
+		}
+	}
+
+	history_tuple = modify_tuple(relation, tuple, period_attnum, period);
+
+	oldcxt = MemoryContextSwitchTo(statement_history_rows_context);
+
+	/*
+	 * The temporary files of the tuplestore belong to the top transaction, so
+	 * that the tuplestore can be freed whenever the rows are no longer needed.
+	 */
+	oldowner = CurrentResourceOwner;
+	CurrentResourceOwner = TopTransactionResourceOwner;
+
+	if (rows == NULL)
+	{
+		rows = palloc(sizeof(StatementHistoryRows));
+		rows->relid = RelationGetRelid(relation);
+		rows->event = event;
+		rows->subid = subid;
+		rows->tupdesc = CreateTupleDescCopy(RelationGetDescr(relation));
+		rows->rows = tuplestore_begin_heap(false, false, work_mem);
+
+		statement_history_rows = lappend(statement_history_rows, rows);
+	}
+
+	tuplestore_puttuple(rows->rows, history_tuple);
+
+	CurrentResourceOwner = oldowner;
+	MemoryContextSwitchTo(oldcxt);
+
+	heap_freetuple(history_tuple);
+}
+
+/*
+ * Remove the rows collected in the current subtransaction for the
+ * statement-level trigger of the event from the list and return them or NULL
+ * if there are no such rows.
+ */
+static StatementHistoryRows *
+take_statement_history_rows(Relation relation, TriggerEvent event)
+{
+	SubTransactionId	subid;
+	ListCell		   *lc;
+
+	subid = GetCurrentSubTransactionId();
+
+	foreach(lc, statement_history_rows)
+	{
+		StatementHistoryRows *rows = lfirst(lc);
+
+		if (rows->relid == RelationGetRelid(relation) &&
+			rows->event == event && rows->subid == subid)
+		{
+			statement_history_rows = list_delete_ptr(statement_history_rows,
+													 rows);
+			return rows;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+free_statement_history_rows(StatementHistoryRows *rows)
+{
+	tuplestore_end(rows->rows);
+	FreeTupleDesc(rows->tupdesc);
+	pfree(rows);
+}
+
+/*
+ * Free the collected rows of the subtransaction or, if subid is
+ * InvalidSubTransactionId, all of them. The rows that a statement-level
+ * trigger has not taken in the subtransaction they were collected in will
+ * never be taken.
+ */
+static void
+discard_statement_history_rows(SubTransactionId subid)
+{
+	List	   *kept = NIL;
+	ListCell   *lc;
+
+	foreach(lc, statement_history_rows)
+	{
+		StatementHistoryRows *rows = lfirst(lc);
+
+		if (subid == InvalidSubTransactionId || rows->subid == subid)
+			free_statement_history_rows(rows);
+		else
+			kept = lappend(kept, rows);
+	}
+
+	list_free(statement_history_rows);
+	statement_history_rows = kept;
+
+	if (statement_history_rows == NIL && statement_history_rows_context != NULL)
+	{
+		MemoryContextDelete(statement_history_rows_context);
+		statement_history_rows_context = NULL;
+	}
+}
+
+/*
+ * Archive the rows of the relation to be truncated with a single command
+ *
+ * 		INSERT INTO <history_relation> (<attr1>, <attr2>, ..., <period>)
+ * 		SELECT <attr1>, <attr2>, ..., <period> FROM (
+ * 			SELECT <attr1>, <attr2>, ...,
+ * 				<schema>.versioning_truncate_period(xmin, <period>) AS <period>
+ * 			FROM ONLY <relation> OFFSET 0) r
+ * 		WHERE <period> IS NOT NULL
+ *
+ * so that the rows are not collected into a tuplestore first. The function
+ * returns the system period of the history row or NULL for the rows inserted
+ * or updated in the current transaction, which are not archived. OFFSET 0
+ * keeps the function from being evaluated again in the WHERE clause.
+ */
+static void
+archive_truncated_rows(Relation relation,
+					   Relation history_relation,
+					   VersioningTriggerEntry *entry,
+					   VersioningHashEntry *hash_entry,
+					   Trigger *trigger)
+{
+	TupleDesc		 tupdesc;
+	StringInfoData	 querybuf;
+	StringInfoData	 columnbuf;
+	StringInfoData	 selectbuf;
+	const char		*period_attname;
+	const char		*function_schema;
+	int				 i;
+	int				 ret;
+
+	tupdesc = RelationGetDescr(relation);
+
+	period_attname = quote_identifier(NameStr(TupleDescAttr(tupdesc, entry->period_attnum - 1)->attname));
+
+	/* The extension is relocatable, so look for the function in its schema. */
+	function_schema = quote_identifier(get_namespace_name(get_func_namespace(trigger->tgfoid)));
+
+	initStringInfo(&querybuf);
+	initStringInfo(&columnbuf);
+	initStringInfo(&selectbuf);
+
+	for (i = 0; i < hash_entry->natts; ++i)
+	{
+		int			 attnum;
+		const char	*attname;
+
+		attnum = hash_entry->attnums[i];
+		attname = quote_identifier(NameStr(TupleDescAttr(tupdesc, attnum - 1)->attname));
+
+		if (i != 0)
+		{
+			appendStringInfo(&columnbuf, ", ");
+			appendStringInfo(&selectbuf, ", ");
+		}
+
+		appendStringInfo(&columnbuf, "%s", attname);
+
+		if (attnum == entry->period_attnum)
+			appendStringInfo(&selectbuf,
+							 "%s.versioning_truncate_period(xmin, %s) AS %s",
+							 function_schema, attname, attname);
+		else
+			appendStringInfo(&selectbuf, "%s", attname);
+	}
+
+	appendStringInfo(&querybuf,
+					 "INSERT INTO %s.%s (%s) SELECT %s FROM (SELECT %s FROM ONLY %s.%s OFFSET 0) r WHERE %s IS NOT NULL",
+					 quote_identifier(get_namespace_name(RelationGetNamespace(history_relation))),
+					 quote_identifier(RelationGetRelationName(history_relation)),
+					 columnbuf.data, columnbuf.data, selectbuf.data,
+					 quote_identifier(get_namespace_name(RelationGetNamespace(relation))),
+					 quote_identifier(RelationGetRelationName(relation)),
+					 period_attname);
+
+	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect returned %d", ret);
+
+	truncated_relation = relation;
+	truncated_entry = entry;
+
+	PG_TRY();
+	{
+		TEMPORAL_TABLES_HISTORY_INSERT_START(RelationGetRelid(relation),
+											 RelationGetRelid(history_relation));
+		report_wait_start(VERSIONING_WAIT_HISTORY_INSERT);
+
+		if ((ret = SPI_execute(querybuf.data, false, 0)) != SPI_OK_INSERT)
+			elog(ERROR, "SPI_execute returned %d", ret);
+
+		report_wait_end();
+		TEMPORAL_TABLES_HISTORY_INSERT_DONE(RelationGetRelid(relation),
+											RelationGetRelid(history_relation));
+	}
+	PG_CATCH();
+	{
+		truncated_relation = NULL;
+		truncated_entry = NULL;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	truncated_relation = NULL;
+	truncated_entry = NULL;
+
+	entry->stats->counters[VERSIONING_STATS_HISTORY_ROWS] += SPI_processed;
+
+	if ((ret = SPI_finish()) != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish returned %d", ret);
+
+	pfree(querybuf.data);
+	pfree(columnbuf.data);
+	pfree(selectbuf.data);
+}
+#endif
+
+/*
+ * Insert a row into the history relation.
+ *
+ *		tuple: a row of the versioned relation to insert
+ *		period: the system period value of the history row
+ *		relation: versioned relation
+ *		entry: resolved arguments of the versioning trigger
+ *		history_relation_name: qualified name of the history relation
+ */
+static void
+insert_history_row(HeapTuple tuple,
+				   Datum period,
+				   Relation relation,
+				   VersioningTriggerEntry *entry,
+				   const char *history_relation_name,
+				   const char *period_attname)
+{
+	Relation			 history_relation;
+	VersioningHashEntry	*hash_entry;
+	TupleDesc			 tupdesc;
+#if PG_VERSION_NUM >= 140000
+	Relation			 target_relation;
+#endif
+
+	/*
+	 * Open the history relation and obtain RowExclusiveLock on it since we may
+	 * insert the row into it directly.
+	 */
+	history_relation = open_history_relation(entry, history_relation_name,
+											 RowExclusiveLock);
+
+	hash_entry = get_versioning_hash_entry(relation, history_relation,
+										   period_attname);
+
+	tupdesc = RelationGetDescr(relation);
+
+	if (hash_entry->natts != 0)
+	{
+		entry->stats->counters[VERSIONING_STATS_HISTORY_ROWS]++;
+
+		TEMPORAL_TABLES_HISTORY_INSERT_START(RelationGetRelid(relation),
+											 hash_entry->history_relid);
+
+#if PG_VERSION_NUM >= 140000
+		/*
+		 * Insert the row directly if INSERT command would do nothing else.
+		 * If the history relation is partitioned, the row is inserted into
+		 * its partition. If the executor is running a query, buffer the row
+		 * until the query finishes, or until the transaction commits if the
+		 * history rows are deferred or the history relation is not a heap
+		 * table.
+		 */
+		target_relation = NULL;
+
+		if (can_insert_history_row_directly(hash_entry, history_relation))
+		{
+			if (hash_entry->partitioned_by_upper)
+				target_relation = open_history_partition(hash_entry,
+														 &history_relation,
+														 entry->typcache,
+														 period);
+			else
+				target_relation = history_relation;
+		}
+
+		if (target_relation != NULL)
+		{
+			if (executor_is_running() || versioning_defer_history ||
+				target_relation->rd_rel->relam != HEAP_TABLE_AM_OID)
+				buffer_history_row(tuple, tupdesc, hash_entry, period,
+								   target_relation);
+			else
+				insert_history_row_directly(tuple, tupdesc, hash_entry,
+											period, target_relation);
+
+			if (target_relation != history_relation)
+				relation_close(target_relation, NoLock);
+		}
+		else
+#endif
+			execute_history_plan(tuple, tupdesc, hash_entry, period);
+
+		TEMPORAL_TABLES_HISTORY_INSERT_DONE(RelationGetRelid(relation),
+											hash_entry->history_relid);
+	}
+
+	/* Close the history relation but keep the lock. */
+	relation_close(history_relation, NoLock);
+}
+
+/*
+ * Check whether the history relation has the same physical layout as the
+ * versioned relation and all their attributes are common, so that a row of
+ * the versioned relation can be stored as is into the history relation.
+ */
+static bool
+has_identical_layout(TupleDesc tupdesc,
+					 TupleDesc history_tupdesc,
+					 int *attnums,
+					 int *history_attnums,
+					 int natts)
+{
+	int		nattrs;
+	int		i;
+
+	if (tupdesc->natts != history_tupdesc->natts)
+		return false;
+
+	for (i = 0; i < natts; ++i)
+	{
+		if (attnums[i] != history_attnums[i])
+			return false;
+	}
+
+	nattrs = 0;
+	for (i = 0; i < tupdesc->natts; ++i)
+	{
+		Form_pg_attribute	attr = TupleDescAttr(tupdesc, i);
+		Form_pg_attribute	history_attr = TupleDescAttr(history_tupdesc, i);
+
+		if (attr->attisdropped != history_attr->attisdropped)
+			return false;
+
+		if (attr->attisdropped)
+			continue;
+
+		if (attr->atttypid != history_attr->atttypid ||
+			attr->attlen != history_attr->attlen ||
+			attr->attbyval != history_attr->attbyval ||
+			attr->attalign != history_attr->attalign)
+			return false;
+
+		nattrs++;
+	}
+
+	/* Every attribute that is not dropped must be common. */
+	return nattrs == natts;
+}
+
+/*
+ * Prepare INSERT command into the history relation and keep its plan in the
+ * cached data. The caller must be connected to SPI.
+ */
+static void
+prepare_history_plan(VersioningHashEntry *hash_entry)
+{
+	SPIPlanPtr	 plan;
+	int			 ret;
+
+	plan = SPI_prepare(hash_entry->insert_history_query, hash_entry->natts,
+					   hash_entry->insert_history_argtypes);
+
+	if (plan == NULL)
+		elog(ERROR, "SPI_prepare returned %d for %s",
+			 SPI_result, hash_entry->insert_history_query);
+
+	if ((ret = SPI_keepplan(plan)) != 0)
+		elog(ERROR, "SPI_keepplan returned %d", ret);
+
+	hash_entry->insert_history_plan = plan;
+}
+
+/*
+ * Insert a row into the history relation by executing the cached INSERT plan.
+ */
+static void
+execute_history_plan(HeapTuple tuple,
+					 TupleDesc tupdesc,
+					 VersioningHashEntry *hash_entry,
+					 Datum period)
+{
+	Datum		*tuple_values;
+	bool		*tuple_isnull;
+	Datum		*values;
+	char		*nulls;
+	int			*attnums;
+	SPIPlanPtr	 plan;
+	int			 natts;
+	int			 ret;
+	int			 i;
+
+	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect returned %d", ret);
+
+	natts = hash_entry->natts;
+
+	/* Deform the row once and pick the common attributes. */
+	tuple_values = palloc(tupdesc->natts * sizeof(Datum));
+	tuple_isnull = palloc(tupdesc->natts * sizeof(bool));
+
+	heap_deform_tuple(tuple, tupdesc, tuple_values, tuple_isnull);
+
+	tuple_values[hash_entry->period_attnum - 1] = period;
+	tuple_isnull[hash_entry->period_attnum - 1] = false;
+
+	values = palloc(natts * sizeof(Datum));
+	nulls = palloc(natts * sizeof(char));
+
+	attnums = hash_entry->attnums;
+
+	/* Prepare and save the plan on its first use. */
+	if (hash_entry->insert_history_plan == NULL)
+		prepare_history_plan(hash_entry);
+
+	plan = hash_entry->insert_history_plan;
+
+	for (i = 0; i < natts; ++i)
+	{
+		values[i] = tuple_values[attnums[i] - 1];
+		nulls[i] = tuple_isnull[attnums[i] - 1] ? 'n' : ' ';
+	}
+
+	report_wait_start(VERSIONING_WAIT_HISTORY_INSERT);
+
+	if ((ret = SPI_execp(plan, values, nulls, 0)) != SPI_OK_INSERT)
+		elog(ERROR, "SPI_execp returned %d", ret);
+
+	report_wait_end();
+
+	if ((ret = SPI_finish()) != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish returned %d", ret);
+}
+
+/*
+ * Free the cached INSERT command of the delta history rows.
+ */
+static void
+free_delta_plan(VersioningHashEntry *hash_entry)
+{
+	int		ret;
+
+	if (hash_entry->delta_attname != NULL)
+	{
+		free_cached_chunk(hash_entry, hash_entry->delta_attname);
+		hash_entry->delta_attname = NULL;
+	}
+
+	if (hash_entry->key_attnums != NULL)
+	{
+		free_cached_chunk(hash_entry, hash_entry->key_attnums);
+		hash_entry->key_attnums = NULL;
+	}
+
+	hash_entry->nkey_attrs = 0;
+
+	if (hash_entry->insert_delta_plan != NULL)
+	{
+		if ((ret = SPI_freeplan(hash_entry->insert_delta_plan)) != 0)
+			elog(ERROR, "SPI_freeplan returned %d", ret);
+
+		hash_entry->insert_delta_plan = NULL;
+	}
+}
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * Return the numbers of the primary key attributes of the relation or NULL if
+ * the relation has no primary key.
+ */
+static int *
+get_key_attnums(Relation relation, int *nkey_attrs)
+{
+	Bitmapset	*keyattrs;
+	int			*key_attnums;
+	int			 attnum;
+	int			 n;
+
+	keyattrs = RelationGetIndexAttrBitmap(relation,
+										  INDEX_ATTR_BITMAP_PRIMARY_KEY);
+
+	if (bms_is_empty(keyattrs))
+	{
+		*nkey_attrs = 0;
+		return NULL;
+	}
+
+	key_attnums = palloc(bms_num_members(keyattrs) * sizeof(int));
+
+	n = 0;
+	attnum = -1;
+	while ((attnum = bms_next_member(keyattrs, attnum)) >= 0)
+		key_attnums[n++] = attnum + FirstLowInvalidHeapAttributeNumber;
+
+	bms_free(keyattrs);
+
+	*nkey_attrs = n;
+
+	return key_attnums;
+}
+
+/*
+ * Return the index of the attribute in the common attributes or -1 if the
+ * attribute is not in the history relation.
+ */
+static int
+find_common_attr(VersioningHashEntry *hash_entry, int attnum)
+{
+	int		i;
+
+	for (i = 0; i < hash_entry->natts; ++i)
+	{
+		if (hash_entry->attnums[i] == attnum)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Check whether the attribute is a primary key attribute.
+ */
+static bool
+is_key_attr(int nkey_attrs, int *key_attnums, int attnum)
+{
+	int		i;
+
+	for (i = 0; i < nkey_attrs; ++i)
+	{
+		if (key_attnums[i] == attnum)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Prepare INSERT command of the delta history rows and keep it in the cached
+ * data unless it is already prepared for the delta attribute. The caller must
+ * be connected to SPI.
+ *
+ * The command build is
+ * 		INSERT INTO <history_relation> (<key1>, ..., <system_period>, <delta>)
+ * 		VALUES ($1, ..., $N + 1, $N + 2)
+ */
+static void
+prepare_delta_plan(VersioningHashEntry *hash_entry,
+				   Relation relation,
+				   Relation history_relation,
+				   const char *delta_attname)
+{
+	TupleDesc		 history_tupdesc;
+	int				 delta_attnum;
+	int				*key_attnums;
+	int				 nkey_attrs;
+	Oid				*argtypes;
+	StringInfoData	 querybuf;
+	SPIPlanPtr		 plan;
+	MemoryContext	 oldcontext;
+	int				 ret;
+	int				 i;
+
+	if (hash_entry->delta_attname != NULL &&
+		strcmp(hash_entry->delta_attname, delta_attname) == 0)
+		return;
+
+	free_delta_plan(hash_entry);
+
+	history_tupdesc = RelationGetDescr(history_relation);
+
+	delta_attnum = SPI_fnumber(history_tupdesc, delta_attname);
+
+	if (delta_attnum <= 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("column \"%s\" of relation \"%s\" does not exist",
+						delta_attname,
+						RelationGetRelationName(history_relation))));
+
+	if (TupleDescAttr(history_tupdesc, delta_attnum - 1)->atttypid != JSONBOID)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("column \"%s\" of relation \"%s\" must be of type jsonb",
+						delta_attname,
+						RelationGetRelationName(history_relation))));
+
+	for (i = 0; i < hash_entry->natts; ++i)
+	{
+		if (hash_entry->history_attnums[i] == delta_attnum)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_COLUMN_DEFINITION),
+					 errmsg("column \"%s\" of relation \"%s\" must not be a column of relation \"%s\"",
+							delta_attname,
+							RelationGetRelationName(history_relation),
+							RelationGetRelationName(relation))));
+	}
+
+	key_attnums = get_key_attnums(relation, &nkey_attrs);
+
+	if (key_attnums == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("relation \"%s\" must have a primary key to archive rows in the delta format",
+						RelationGetRelationName(relation))));
+
+	/* The delta history rows have nulls in the other attributes. */
+	for (i = 0; i < hash_entry->natts; ++i)
+	{
+		Form_pg_attribute	history_attr;
+
+		if (hash_entry->attnums[i] == hash_entry->period_attnum ||
+			is_key_attr(nkey_attrs, key_attnums, hash_entry->attnums[i]))
+			continue;
+
+		history_attr = TupleDescAttr(history_tupdesc,
+									 hash_entry->history_attnums[i] - 1);
+
+		if (history_attr->attnotnull)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_COLUMN_DEFINITION),
+					 errmsg("column \"%s\" of relation \"%s\" must allow nulls to archive rows in the delta format",
+							NameStr(history_attr->attname),
+							RelationGetRelationName(history_relation))));
+	}
+
+	argtypes = palloc((nkey_attrs + 2) * sizeof(Oid));
+
+	initStringInfo(&querybuf);
+
+	appendStringInfo(&querybuf, "INSERT INTO %s (",
+					 quote_qualified_identifier(get_namespace_name(RelationGetNamespace(history_relation)),
+												RelationGetRelationName(history_relation)));
+
+	for (i = 0; i < nkey_attrs; ++i)
+	{
+		int		index = find_common_attr(hash_entry, key_attnums[i]);
+
+		if (index < 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_COLUMN_DEFINITION),
+					 errmsg("primary key column \"%s\" of relation \"%s\" is not in history relation \"%s\"",
+							NameStr(TupleDescAttr(RelationGetDescr(relation),
+												  key_attnums[i] - 1)->attname),
+							RelationGetRelationName(relation),
+							RelationGetRelationName(history_relation))));
+
+		appendStringInfo(&querybuf, "%s, ",
+						 quote_identifier(NameStr(TupleDescAttr(history_tupdesc,
+																hash_entry->history_attnums[index] - 1)->attname)));
+
+		argtypes[i] = SPI_gettypeid(history_tupdesc,
+									hash_entry->history_attnums[index]);
+	}
+
+	appendStringInfo(&querybuf, "%s, %s) VALUES (",
+					 quote_identifier(NameStr(TupleDescAttr(history_tupdesc,
+															hash_entry->history_period_attnum - 1)->attname)),
+					 quote_identifier(delta_attname));
+
+	argtypes[nkey_attrs] = SPI_gettypeid(history_tupdesc,
+										 hash_entry->history_period_attnum);
+	argtypes[nkey_attrs + 1] = JSONBOID;
+
+	for (i = 0; i < nkey_attrs + 2; ++i)
+		appendStringInfo(&querybuf, "%s$%d", i == 0 ? "" : ", ", i + 1);
+
+	appendStringInfoString(&querybuf, ")");
+
+	plan = SPI_prepare(querybuf.data, nkey_attrs + 2, argtypes);
+
+	if (plan == NULL)
+		elog(ERROR, "SPI_prepare returned %d for %s", SPI_result, querybuf.data);
+
+	if ((ret = SPI_keepplan(plan)) != 0)
+		elog(ERROR, "SPI_keepplan returned %d", ret);
+
+	oldcontext = MemoryContextSwitchTo(versioning_cache_context);
+
+	hash_entry->key_attnums = palloc(nkey_attrs * sizeof(int));
+	memcpy(hash_entry->key_attnums, key_attnums, nkey_attrs * sizeof(int));
+	hash_entry->nkey_attrs = nkey_attrs;
+	hash_entry->insert_delta_plan = plan;
+	hash_entry->delta_attname = pstrdup(delta_attname);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	charge_cached_chunk(hash_entry, hash_entry->key_attnums);
+	charge_cached_chunk(hash_entry, hash_entry->delta_attname);
+
+	pfree(key_attnums);
+	pfree(argtypes);
+	pfree(querybuf.data);
+}
+
+/*
+ * Check whether UPDATE changes a primary key attribute of the row.
+ */
+static bool
+key_changed(VersioningHashEntry *hash_entry,
+			HeapTuple oldtuple,
+			HeapTuple newtuple,
+			TupleDesc tupdesc)
+{
+	int		i;
+
+	for (i = 0; i < hash_entry->nkey_attrs; ++i)
+	{
+		int		attnum = hash_entry->key_attnums[i];
+		Datum	oldvalue;
+		Datum	newvalue;
+		bool	oldisnull;
+		bool	newisnull;
+
+		oldvalue = heap_getattr(oldtuple, attnum, tupdesc, &oldisnull);
+		newvalue = heap_getattr(newtuple, attnum, tupdesc, &newisnull);
+
+		if (oldisnull || newisnull)
+		{
+			if (oldisnull != newisnull)
+				return true;
+
+			continue;
+		}
+
+		if (!datumIsEqual(oldvalue, newvalue,
+						  TupleDescAttr(tupdesc, attnum - 1)->attbyval,
+						  TupleDescAttr(tupdesc, attnum - 1)->attlen))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Fix the settings that the text representation of the old values in the
+ * deltas depends on, so that the values are read back the same whatever the
+ * settings of the sessions that write and read them: the dates are in ISO
+ * format, intervals in the postgres style and floats have all their digits.
+ * The caller restores the settings with AtEOXact_GUC(true, nestlevel) where
+ * nestlevel is the returned value.
+ */
+static int
+begin_delta_text_format(void)
+{
+	int		nestlevel = NewGUCNestLevel();
+
+	(void) set_config_option("datestyle", "ISO",
+							 PGC_USERSET, PGC_S_SESSION,
+							 GUC_ACTION_SAVE, true, 0, false);
+	(void) set_config_option("intervalstyle", "postgres",
+							 PGC_USERSET, PGC_S_SESSION,
+							 GUC_ACTION_SAVE, true, 0, false);
+	(void) set_config_option("extra_float_digits", "3",
+							 PGC_USERSET, PGC_S_SESSION,
+							 GUC_ACTION_SAVE, true, 0, false);
+
+	return nestlevel;
+}
+
+/*
+ * Build the delta of the row: a jsonb object that maps the name of every
+ * common attribute that UPDATE changes, except the primary key and the system
+ * period, to the text representation of its old value or null, see
+ * begin_delta_text_format. An attribute is changed unless its old and new
+ * values are binary equal, so that the delta keeps, say, the scale of a
+ * numeric value.
+ */
+static Datum
+build_delta(VersioningHashEntry *hash_entry,
+			HeapTuple oldtuple,
+			HeapTuple newtuple,
+			TupleDesc tupdesc,
+			int *nchanged)
+{
+	StringInfoData	 buf;
+	Datum			 delta;
+	int				 nestlevel;
+	int				 i;
+
+	initStringInfo(&buf);
+
+	appendStringInfoChar(&buf, '{');
+
+	*nchanged = 0;
+
+	nestlevel = begin_delta_text_format();
+
+	for (i = 0; i < hash_entry->natts; ++i)
+	{
+		int					attnum = hash_entry->attnums[i];
+		Form_pg_attribute	attr = TupleDescAttr(tupdesc, attnum - 1);
+		Datum				oldvalue;
+		Datum				newvalue;
+		bool				oldisnull;
+		bool				newisnull;
+
+		if (attnum == hash_entry->period_attnum ||
+			is_key_attr(hash_entry->nkey_attrs, hash_entry->key_attnums,
+						attnum))
+			continue;
+
+		oldvalue = heap_getattr(oldtuple, attnum, tupdesc, &oldisnull);
+		newvalue = heap_getattr(newtuple, attnum, tupdesc, &newisnull);
+
+		if (oldisnull && newisnull)
+			continue;
+
+		if (!oldisnull && !newisnull &&
+			datumIsEqual(oldvalue, newvalue, attr->attbyval, attr->attlen))
+			continue;
+
+		if ((*nchanged)++ != 0)
+			appendStringInfoString(&buf, ", ");
+
+		escape_json(&buf, NameStr(attr->attname));
+		appendStringInfoString(&buf, ": ");
+
+		if (oldisnull)
+			appendStringInfoString(&buf, "null");
+		else
+		{
+			Oid		typoutput;
+			bool	typisvarlena;
+
+			getTypeOutputInfo(attr->atttypid, &typoutput, &typisvarlena);
+
+			escape_json(&buf, OidOutputFunctionCall(typoutput, oldvalue));
+		}
+	}
+
+	AtEOXact_GUC(true, nestlevel);
+
+	appendStringInfoChar(&buf, '}');
+
+	delta = DirectFunctionCall1(jsonb_in, CStringGetDatum(buf.data));
+
+	pfree(buf.data);
+
+	return delta;
+}
+
+/*
+ * Insert a delta history row of the updated row into the history relation.
+ *
+ * The delta history row stores only the primary key, the system period and,
+ * in the delta attribute, the old values of the attributes that UPDATE
+ * changes. The other attributes of the row are archived by the newer version
+ * of the row. If UPDATE changes the primary key, the row is archived in full.
+ */
+static void
+insert_delta_history_row(HeapTuple oldtuple,
+						 HeapTuple newtuple,
+						 Datum period,
+						 Relation relation,
+						 VersioningTriggerEntry *entry,
+						 const char *history_relation_name,
+						 const char *period_attname)
+{
+	Relation			 history_relation;
+	VersioningHashEntry	*hash_entry;
+	TupleDesc			 tupdesc;
+	Datum				*values;
+	char				*nulls;
+	int					 nkey_attrs;
+	int					 nchanged;
+	int					 ret;
+	int					 i;
+
+	history_relation = open_history_relation(entry, history_relation_name,
+											 RowExclusiveLock);
+
+	hash_entry = get_versioning_hash_entry(relation, history_relation,
+										   period_attname);
+
+	tupdesc = RelationGetDescr(relation);
+
+	if (hash_entry->natts == 0)
+	{
+		relation_close(history_relation, NoLock);
+		return;
+	}
+
+	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect returned %d", ret);
+
+	prepare_delta_plan(hash_entry, relation, history_relation,
+					   entry->delta_attname);
+
+	if (key_changed(hash_entry, oldtuple, newtuple, tupdesc))
+	{
+		if ((ret = SPI_finish()) != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish returned %d", ret);
+
+		relation_close(history_relation, NoLock);
+
+		insert_history_row(oldtuple, period, relation, entry,
+						   history_relation_name, period_attname);
+		return;
+	}
+
+	entry->stats->counters[VERSIONING_STATS_HISTORY_ROWS]++;
+
+	nkey_attrs = hash_entry->nkey_attrs;
+
+	values = palloc((nkey_attrs + 2) * sizeof(Datum));
+	nulls = palloc((nkey_attrs + 2) * sizeof(char));
+
+	for (i = 0; i < nkey_attrs; ++i)
+	{
+		bool	isnull;
+
+		values[i] = heap_getattr(oldtuple, hash_entry->key_attnums[i],
+								 tupdesc, &isnull);
+		nulls[i] = isnull ? 'n' : ' ';
+	}
+
+	values[nkey_attrs] = period;
+	nulls[nkey_attrs] = ' ';
+
+	values[nkey_attrs + 1] = build_delta(hash_entry, oldtuple, newtuple,
+										 tupdesc, &nchanged);
+	nulls[nkey_attrs + 1] = ' ';
+
+	if ((ret = SPI_execp(hash_entry->insert_delta_plan, values, nulls, 0)) != SPI_OK_INSERT)
+		elog(ERROR, "SPI_execp returned %d", ret);
+
+	if ((ret = SPI_finish()) != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish returned %d", ret);
+
+	/* Close the history relation but keep the lock. */
+	relation_close(history_relation, NoLock);
+}
+
+/*
+ * Update the delta history row archived in the current transaction when the
+ * transaction modifies the row again.
+ *
+ * If UPDATE changes none of the primary key attributes, the old values of
+ * the attributes it changes are added to the delta unless the delta already
+ * has them. Otherwise, the newer version of the row no longer archives the
+ * other attributes, so the delta history row is converted into a full one:
+ * the attributes that are not in the delta are set to their old values and
+ * the delta is set to null. newtuple is NULL for DELETE.
+ *
+ * The delta history row is found by the primary key and the upper bound of
+ * its system period, which is the lower bound of the system period of the
+ * row.
+ */
+static void
+update_delta_history_row(HeapTuple oldtuple,
+						 HeapTuple newtuple,
+						 Relation relation,
+						 VersioningTriggerEntry *entry,
+						 const char *history_relation_name,
+						 const char *period_attname)
+{
+	Relation			 history_relation;
+	VersioningHashEntry	*hash_entry;
+	TupleDesc			 tupdesc;
+	TupleDesc			 history_tupdesc;
+	StringInfoData		 querybuf;
+	const char			*delta_attname;
+	Oid					*argtypes;
+	Datum				*values;
+	char				*nulls;
+	bool				 isnull;
+	int					 nargs;
+	int					 nestlevel;
+	int					 ret;
+	int					 i;
+
+	history_relation = open_history_relation(entry, history_relation_name,
+											 RowExclusiveLock);
+
+	hash_entry = get_versioning_hash_entry(relation, history_relation,
+										   period_attname);
+
+	tupdesc = RelationGetDescr(relation);
+	history_tupdesc = RelationGetDescr(history_relation);
+
+	if (hash_entry->natts == 0)
+	{
+		relation_close(history_relation, NoLock);
+		return;
+	}
+
+	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect returned %d", ret);
+
+	prepare_delta_plan(hash_entry, relation, history_relation,
+					   entry->delta_attname);
+
+	delta_attname = quote_identifier(hash_entry->delta_attname);
+
+	argtypes = palloc((hash_entry->natts + hash_entry->nkey_attrs + 2) * sizeof(Oid));
+	values = palloc((hash_entry->natts + hash_entry->nkey_attrs + 2) * sizeof(Datum));
+	nulls = palloc((hash_entry->natts + hash_entry->nkey_attrs + 2) * sizeof(char));
+
+	nargs = 0;
+
+	initStringInfo(&querybuf);
+
+	appendStringInfo(&querybuf, "UPDATE %s SET ",
+					 quote_qualified_identifier(get_namespace_name(RelationGetNamespace(history_relation)),
+												RelationGetRelationName(history_relation)));
+
+	if (newtuple != NULL &&
+		!key_changed(hash_entry, oldtuple, newtuple, tupdesc))
+	{
+		int		nchanged;
+
+		argtypes[nargs] = JSONBOID;
+		values[nargs] = build_delta(hash_entry, oldtuple, newtuple, tupdesc,
+									&nchanged);
+		nulls[nargs++] = ' ';
+
+		/* The delta already has everything if nothing changes. */
+		if (nchanged == 0)
+		{
+			if ((ret = SPI_finish()) != SPI_OK_FINISH)
+				elog(ERROR, "SPI_finish returned %d", ret);
+
+			relation_close(history_relation, NoLock);
+			return;
+		}
+
+		appendStringInfo(&querybuf, "%s = $1 || %s",
+						 delta_attname, delta_attname);
+	}
+	else
+	{
+		for (i = 0; i < hash_entry->natts; ++i)
+		{
+			int					attnum = hash_entry->attnums[i];
+			char			   *attname;
+			Form_pg_attribute	history_attr;
+
+			if (attnum == hash_entry->period_attnum ||
+				is_key_attr(hash_entry->nkey_attrs, hash_entry->key_attnums,
+							attnum))
+				continue;
+
+			history_attr = TupleDescAttr(history_tupdesc,
+										 hash_entry->history_attnums[i] - 1);
+			attname = quote_literal_cstr(NameStr(history_attr->attname));
+
+			argtypes[nargs] = history_attr->atttypid;
+			values[nargs] = heap_getattr(oldtuple, attnum, tupdesc, &isnull);
+			nulls[nargs++] = isnull ? 'n' : ' ';
+
+			appendStringInfo(&querybuf,
+							 "%s = CASE WHEN %s ? %s THEN (%s ->> %s)::%s ELSE $%d END, ",
+							 quote_identifier(NameStr(history_attr->attname)),
+							 delta_attname, attname, delta_attname, attname,
+							 format_type_with_typemod(history_attr->atttypid,
+													  history_attr->atttypmod),
+							 nargs);
+		}
+
+		appendStringInfo(&querybuf, "%s = NULL", delta_attname);
+	}
+
+	appendStringInfoString(&querybuf, " WHERE ");
+
+	for (i = 0; i < hash_entry->nkey_attrs; ++i)
+	{
+		int		attnum = hash_entry->key_attnums[i];
+		int		history_attnum;
+
+		history_attnum = hash_entry->history_attnums[find_common_attr(hash_entry,
+																	  attnum)];
+
+		argtypes[nargs] = SPI_gettypeid(history_tupdesc, history_attnum);
+		values[nargs] = heap_getattr(oldtuple, attnum, tupdesc, &isnull);
+		nulls[nargs++] = isnull ? 'n' : ' ';
+
+		appendStringInfo(&querybuf, "%s = $%d AND ",
+						 quote_identifier(NameStr(TupleDescAttr(history_tupdesc,
+																history_attnum - 1)->attname)),
+						 nargs);
+	}
+
+	argtypes[nargs] = SPI_gettypeid(history_tupdesc,
+									hash_entry->history_period_attnum);
+	values[nargs] = heap_getattr(oldtuple, hash_entry->period_attnum,
+								 tupdesc, &isnull);
+	nulls[nargs++] = isnull ? 'n' : ' ';
+
+	appendStringInfo(&querybuf,
+					 "pg_catalog.upper(%s) = pg_catalog.lower($%d) AND %s IS NOT NULL",
+					 quote_identifier(period_attname), nargs, delta_attname);
+
+	/* The old values in the delta are cast from their text representation. */
+	nestlevel = begin_delta_text_format();
+
+	if ((ret = SPI_execute_with_args(querybuf.data, nargs, argtypes, values,
+									 nulls, false, 0)) != SPI_OK_UPDATE)
+		elog(ERROR, "SPI_execute_with_args returned %d", ret);
+
+	AtEOXact_GUC(true, nestlevel);
+
+	if ((ret = SPI_finish()) != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish returned %d", ret);
+
+	/* Close the history relation but keep the lock. */
+	relation_close(history_relation, NoLock);
+}
+#endif
+
+#if PG_VERSION_NUM >= 140000
+/*
+ * Check whether a row can be inserted into the history relation directly.
+ *
+ * It is possible only if INSERT command would do nothing but insert the row
+ * and its index entries, i.e. the history relation is a plain table without
+ * triggers, rules and row level security, and the current user is allowed
+ * to insert into it. Otherwise, the cached INSERT plan is used, which also
+ * reports permission errors.
+ */
+static bool
+can_insert_history_row_directly(VersioningHashEntry *hash_entry,
+								Relation history_relation)
+{
+	if (!hash_entry->direct_insert)
+		return false;
+
+	if ((history_relation->rd_rel->relkind != RELKIND_RELATION &&
+		 !hash_entry->partitioned_by_upper) ||
+		history_relation->rd_rel->relispartition ||
+		history_relation->rd_rel->relrowsecurity ||
+		history_relation->trigdesc != NULL ||
+		history_relation->rd_rules != NULL)
+		return false;
+
+	if (pg_class_aclcheck(RelationGetRelid(history_relation), GetUserId(),
+						  ACL_INSERT) != ACLCHECK_OK)
+		return false;
+
+	return true;
+}
+
+/*
+ * Check whether the history relation is range partitioned by the upper bound
+ * of its system period attribute, i.e. by "upper(<system_period>)".
+ */
+bool
+is_partitioned_by_upper(Relation history_relation, int period_attnum)
+{
+	PartitionKey	 key;
+	FuncExpr		*expr;
+	Var				*var;
+
+	if (history_relation->rd_rel->relkind != RELKIND_PARTITIONED_TABLE)
+		return false;
+
+	key = RelationGetPartitionKey(history_relation);
+
+	if (key->strategy != PARTITION_STRATEGY_RANGE ||
+		key->partnatts != 1 ||
+		key->partattrs[0] != 0 ||
+		key->parttypid[0] != TIMESTAMPTZOID)
+		return false;
+
+	expr = (FuncExpr *) linitial(key->partexprs);
+
+	if (!IsA(expr, FuncExpr) ||
+		expr->funcid != F_UPPER_ANYRANGE ||
+		list_length(expr->args) != 1)
+		return false;
+
+	var = (Var *) linitial(expr->args);
+
+	return IsA(var, Var) && var->varattno == period_attnum;
+}
+
+/*
+ * Open the leaf partition of the history relation that a history row with the
+ * specified system period belongs to. Return NULL if there is no such
+ * partition or the row cannot be inserted into it directly, in which case the
+ * row must be inserted through the history relation.
+ *
+ * The history relation may be reopened, see create_history_partitions().
+ */
+static Relation
+open_history_partition(VersioningHashEntry *hash_entry,
+					   Relation *history_relation,
+					   TypeCacheEntry *typcache,
+					   Datum period)
+{
+	RangeBound	 lower;
+	RangeBound	 upper;
+	bool		 empty;
+	Relation	 partition;
+
+	range_deserialize(typcache, DatumGetRangeTypeP(period), &lower, &upper,
+					  &empty);
+
+	if (empty || upper.infinite)
+		return NULL;
+
+	/*
+	 * The history rows of a transaction usually have the same upper bound, so
+	 * the partition is looked up only when the upper bound changes.
+	 */
+	if (!hash_entry->partition_cached ||
+		hash_entry->partition_upper != DatumGetTimestampTz(upper.val))
+		find_history_partition(hash_entry, history_relation,
+							   DatumGetTimestampTz(upper.val));
+
+	if (!OidIsValid(hash_entry->partition_relid) ||
+		!hash_entry->partition_direct)
+		return NULL;
+
+	partition = table_open(hash_entry->partition_relid, RowExclusiveLock);
+
+	/*
+	 * Partitions cannot have rules and the row level security of the history
+	 * relation applies to them, but they may have their own triggers.
+	 */
+	if (partition->rd_rel->relkind != RELKIND_RELATION ||
+		partition->trigdesc != NULL)
+	{
+		relation_close(partition, NoLock);
+		return NULL;
+	}
+
+	return partition;
+}
+
+/*
+ * Find the leaf partition of the history rows with the specified upper bound
+ * of the system period and remember it in the cached data.
+ *
+ * If temporal_tables.history_partition_interval is set, the partitions that
+ * cover the upper bound and the following interval are created first.
+ */
+static void
+find_history_partition(VersioningHashEntry *hash_entry,
+					   Relation *history_relation,
+					   TimestampTz upper)
+{
+	PartitionKey		 key;
+	PartitionDesc		 partdesc;
+	PartitionBoundInfo	 boundinfo;
+	Datum				 value;
+	bool				 is_equal;
+	int					 index;
+
+	if (history_partition_interval != NULL &&
+		history_partition_interval[0] != '\0')
+		create_history_partitions(history_relation, upper);
+
+	key = RelationGetPartitionKey(*history_relation);
+	partdesc = RelationGetPartitionDesc(*history_relation, true);
+	boundinfo = partdesc->boundinfo;
+
+	index = -1;
+
+	if (partdesc->nparts > 0)
+	{
+		value = TimestampTzGetDatum(upper);
+
+		/*
+		 * The bound at the found offset is less than or equal to the value, so
+		 * the next bound is the upper bound of the partition if there is one.
+		 */
+		index = boundinfo->indexes[partition_range_datum_bsearch(key->partsupfunc,
+																 key->partcollation,
+																 boundinfo,
+																 1,
+																 &value,
+																 &is_equal) + 1];
+
+		if (index < 0 && partition_bound_has_default(boundinfo))
+			index = boundinfo->default_index;
+	}
+
+	hash_entry->partition_upper = upper;
+	hash_entry->partition_relid = InvalidOid;
+	hash_entry->partition_direct = false;
+
+	/* The partitions that are partitioned further are not supported. */
+	if (index >= 0 && partdesc->is_leaf[index])
+	{
+		Relation	partition;
+		TupleConversionMap *map;
+
+		hash_entry->partition_relid = partdesc->oids[index];
+
+		/*
+		 * The rows are built for the history relation, so the partition must
+		 * have the same physical layout.
+		 */
+		partition = table_open(hash_entry->partition_relid, RowExclusiveLock);
+
+		map = convert_tuples_by_name(RelationGetDescr(*history_relation),
+									 RelationGetDescr(partition));
+
+		if (map == NULL)
+			hash_entry->partition_direct = true;
+		else
+			free_conversion_map(map);
+
+		relation_close(partition, NoLock);
+	}
+
+	hash_entry->partition_cached = true;
+}
+
+/*
+ * Create the partitions of the history relation that follow the last one
+ * until they cover the upper bound of a history row plus
+ * temporal_tables.history_partition_interval. Every new partition covers the
+ * interval.
+ *
+ * Nothing is done if there are no partitions or the last one is unbounded. If
+ * the partitions cannot be created, e.g. the history relation is used by a
+ * query of the current session, a warning is reported instead of an error.
+ *
+ * CREATE TABLE .. PARTITION OF locks the history relation exclusively. The
+ * lock is not waited for unless the history row falls past the last
+ * partition and there is no default one, so that a transaction reading the
+ * history does not stall the modifications of the versioned relation; the
+ * partitions are created by a later history row instead.
+ *
+ * CREATE TABLE .. PARTITION OF fails if the parent is open, so the history
+ * relation is closed while the partitions are created and then reopened. The
+ * lock on it is kept all the time.
+ */
+static void
+create_history_partitions(Relation *history_relation, TimestampTz upper)
+{
+	Interval		   *interval;
+	PartitionDesc		partdesc;
+	PartitionBoundInfo	boundinfo;
+	TimestampTz			end;
+	TimestampTz			last;
+	Oid					history_relid;
+	char			   *options;
+	bool				needed;
+	MemoryContext		oldcontext;
+	ResourceOwner		oldowner;
+
+	interval = DatumGetIntervalP(DirectFunctionCall3(interval_in,
+													 CStringGetDatum(history_partition_interval),
+													 ObjectIdGetDatum(InvalidOid),
+													 Int32GetDatum(-1)));
+
+	last = DatumGetTimestampTz(DirectFunctionCall2(timestamptz_pl_interval,
+												   TimestampTzGetDatum(upper),
+												   PointerGetDatum(interval)));
+
+	partdesc = RelationGetPartitionDesc(*history_relation, true);
+	boundinfo = partdesc->boundinfo;
+
+	if (partdesc->nparts == 0 ||
+		boundinfo->ndatums == 0 ||
+		boundinfo->kind[boundinfo->ndatums - 1][0] != PARTITION_RANGE_DATUM_VALUE)
+		return;
+
+	end = DatumGetTimestampTz(boundinfo->datums[boundinfo->ndatums - 1][0]);
+
+	if (end > last)
+		return;
+
+	needed = end <= upper && !partition_bound_has_default(boundinfo);
+
+	/* The new partitions get the storage parameters of the last one. */
+	options = get_reloptions_clause(partdesc->oids[boundinfo->indexes[boundinfo->ndatums - 1]]);
+
+	history_relid = RelationGetRelid(*history_relation);
+	relation_close(*history_relation, NoLock);
+
+	oldcontext = CurrentMemoryContext;
+	oldowner = CurrentResourceOwner;
+
+	BeginInternalSubTransaction(NULL);
+	MemoryContextSwitchTo(oldcontext);
+
+	PG_TRY();
+	{
+		bool	locked = true;
+
+		if (!ConditionalLockRelationOid(history_relid, AccessExclusiveLock))
+		{
+			if (needed)
+				LockRelationOid(history_relid, AccessExclusiveLock);
+			else
+				locked = false;
+		}
+
+		while (locked && end <= last)
+		{
+			TimestampTz	next;
+
+			next = DatumGetTimestampTz(DirectFunctionCall2(timestamptz_pl_interval,
+														   TimestampTzGetDatum(end),
+														   PointerGetDatum(interval)));
+
+			if (next <= end)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("\"temporal_tables.history_partition_interval\" must be positive")));
+
+			create_history_partition(history_relid, end, next, options);
+
+			end = next;
+		}
+
+		ReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		MemoryContextSwitchTo(oldcontext);
+		edata = CopyErrorData();
+		FlushErrorState();
+
+		RollbackAndReleaseCurrentSubTransaction();
+		MemoryContextSwitchTo(oldcontext);
+		CurrentResourceOwner = oldowner;
+
+		ereport(WARNING,
+				(errmsg("could not create partition of history relation \"%s\": %s",
+						get_rel_name(history_relid),
+						edata->message)));
+
+		FreeErrorData(edata);
+	}
+	PG_END_TRY();
+
+	*history_relation = table_open(history_relid, NoLock);
+}
+
+/*
+ * Create the partition "<history_relation>_<YYYYMMDD>" of the history relation
+ * for the values from "from" to "to". The time of "from" in UTC is added to
+ * the name if it is not midnight. options is the WITH clause of the partition
+ * or NULL.
+ */
+static void
+create_history_partition(Oid history_relid,
+						 TimestampTz from,
+						 TimestampTz to,
+						 const char *options)
+{
+	struct pg_tm	 tm;
+	fsec_t			 fsec;
+	char			 suffix[32];
+	char			*relname;
+	char			*nspname;
+	char			*partname;
+	char			*query;
+	int				 ret;
+
+	if (timestamp2tm(from, NULL, &tm, &fsec, NULL, NULL) != 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+				 errmsg("timestamp out of range")));
+
+	if (tm.tm_hour == 0 && tm.tm_min == 0 && tm.tm_sec == 0 && fsec == 0)
+		snprintf(suffix, sizeof(suffix), "_%04d%02d%02d",
+				 tm.tm_year, tm.tm_mon, tm.tm_mday);
+	else
+		snprintf(suffix, sizeof(suffix), "_%04d%02d%02d_%02d%02d%02d",
+				 tm.tm_year, tm.tm_mon, tm.tm_mday,
+				 tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+	relname = get_rel_name(history_relid);
+	nspname = get_namespace_name(get_rel_namespace(history_relid));
+
+	/* Truncate the relation name so that the suffix fits. */
+	partname = psprintf("%.*s%s",
+						(int) Min(strlen(relname),
+								  NAMEDATALEN - 1 - strlen(suffix)),
+						relname, suffix);
+
+	query = psprintf("CREATE TABLE %s PARTITION OF %s FOR VALUES FROM (%s) TO (%s)%s%s",
+					 quote_qualified_identifier(nspname, partname),
+					 quote_qualified_identifier(nspname, relname),
+					 quote_literal_cstr(DatumGetCString(DirectFunctionCall1(timestamptz_out,
+																			TimestampTzGetDatum(from)))),
+					 quote_literal_cstr(DatumGetCString(DirectFunctionCall1(timestamptz_out,
+																			TimestampTzGetDatum(to)))),
+					 options != NULL ? " " : "",
+					 options != NULL ? options : "");
+
+	if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect returned %d", ret);
+
+	if ((ret = SPI_execute(query, false, 0)) != SPI_OK_UTILITY)
+		elog(ERROR, "SPI_execute returned %d", ret);
+
+	if ((ret = SPI_finish()) != SPI_OK_FINISH)
+		elog(ERROR, "SPI_finish returned %d", ret);
+
+	pfree(query);
+	pfree(partname);
+}
+
+/*
+ * Return the storage parameters of the relation as the WITH clause of CREATE
+ * TABLE or NULL if the relation has none.
+ */
+static char *
+get_reloptions_clause(Oid relid)
+{
+	HeapTuple		 tuple;
+	Datum			 reloptions;
+	bool			 isnull;
+	Datum			*options;
+	int				 noptions;
+	StringInfoData	 clause;
+	int				 i;
+
+	tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relid));
+
+	if (!HeapTupleIsValid(tuple))
+		elog(ERROR, "cache lookup failed for relation %u", relid);
+
+	reloptions = SysCacheGetAttr(RELOID, tuple, Anum_pg_class_reloptions,
+								 &isnull);
+
+	if (isnull)
+	{
+		ReleaseSysCache(tuple);
+		return NULL;
+	}
+
+	deconstruct_array(DatumGetArrayTypeP(reloptions), TEXTOID, -1, false,
+					  'i', &options, NULL, &noptions);
+
+	initStringInfo(&clause);
+	appendStringInfoString(&clause, "WITH (");
+
+	/* The options are stored as "name=value". */
+	for (i = 0; i < noptions; ++i)
+	{
+		char	   *option = TextDatumGetCString(options[i]);
+		char	   *value = strchr(option, '=');
+
+		if (value != NULL)
+			*value++ = '\0';
+
+		appendStringInfo(&clause, "%s%s = %s", i == 0 ? "" : ", ", option,
+						 quote_literal_cstr(value != NULL ? value : ""));
+	}
+
+	appendStringInfoChar(&clause, ')');
+
+	ReleaseSysCache(tuple);
+
+	return clause.data;
+}
+
+/*
+ * Insert a row into the history relation through the table access method
+ * and update its indexes, bypassing the executor.
+ */
+static void
+insert_history_row_directly(HeapTuple tuple,
+							TupleDesc tupdesc,
+							VersioningHashEntry *hash_entry,
+							Datum period,
+							Relation history_relation)
+{
+	TupleDesc		 history_tupdesc;
+	EState			*estate;
+	ResultRelInfo	*result_rel_info;
+	TupleTableSlot	*slot;
+	int				 i;
+
+	history_tupdesc = RelationGetDescr(history_relation);
+
+	estate = CreateExecutorState();
+
+	result_rel_info = makeNode(ResultRelInfo);
+	InitResultRelInfo(result_rel_info, history_relation, 0, NULL, 0);
+
+	ExecOpenIndices(result_rel_info, false);
+
+	slot = MakeSingleTupleTableSlot(history_tupdesc,
+									table_slot_callbacks(history_relation));
+
+	fill_history_slot(slot, tuple, tupdesc, hash_entry, period);
+
+	/* Check NOT NULL and CHECK constraints of the history relation. */
+	if (history_tupdesc->constr != NULL)
+		ExecConstraints(result_rel_info, slot, estate);
+
+	table_tuple_insert(history_relation, slot, GetCurrentCommandId(true), 0,
+					   NULL);
+
+	if (result_rel_info->ri_NumIndices > 0)
+		list_free(ExecInsertIndexTuples(result_rel_info, slot, estate,
+										false, false, NULL, NIL
+#if PG_VERSION_NUM >= 160000
+										, false
+#endif
+										));
+
+	ExecDropSingleTupleTableSlot(slot);
+	ExecCloseIndices(result_rel_info);
+	FreeExecutorState(estate);
+}
+
+/*
+ * Store the attributes of the row mapped to the history relation ones in the
+ * slot as a virtual tuple. The system period attribute is set to the period
+ * value.
+ *
+ * The row is deformed only once. If the relations have the same layout, it
+ * is deformed right into the slot.
+ */
+static void
+fill_history_slot(TupleTableSlot *slot,
+				  HeapTuple tuple,
+				  TupleDesc tupdesc,
+				  VersioningHashEntry *hash_entry,
+				  Datum period)
+{
+	int		i;
+
+	ExecClearTuple(slot);
+
+	if (hash_entry->identical_layout)
+		heap_deform_tuple(tuple, tupdesc, slot->tts_values, slot->tts_isnull);
+	else
+	{
+		Datum	*values;
+		bool	*isnull;
+
+		values = palloc(tupdesc->natts * sizeof(Datum));
+		isnull = palloc(tupdesc->natts * sizeof(bool));
+
+		heap_deform_tuple(tuple, tupdesc, values, isnull);
+
+		for (i = 0; i < slot->tts_tupleDescriptor->natts; ++i)
+		{
+			slot->tts_values[i] = (Datum) 0;
+			slot->tts_isnull[i] = true;
+		}
+
+		for (i = 0; i < hash_entry->natts; ++i)
+		{
+			int		attnum = hash_entry->attnums[i] - 1;
+			int		history_attnum = hash_entry->history_attnums[i] - 1;
+
+			slot->tts_values[history_attnum] = values[attnum];
+			slot->tts_isnull[history_attnum] = isnull[attnum];
+		}
+
+		pfree(values);
+		pfree(isnull);
+	}
+
+	slot->tts_values[hash_entry->history_period_attnum - 1] = period;
+	slot->tts_isnull[hash_entry->history_period_attnum - 1] = false;
+
+	ExecStoreVirtualTuple(slot);
+}
+
+/*
+ * Add a row to the buffer of the history relation for the current
+ * subtransaction. The buffer is flushed when it is full.
+ */
+static void
+buffer_history_row(HeapTuple tuple,
+				   TupleDesc tupdesc,
+				   VersioningHashEntry *hash_entry,
+				   Datum period,
+				   Relation history_relation)
+{
+	SubTransactionId	 subid;
+	HistoryBuffer		*buffer;
+	ListCell			*lc;
+	MemoryContext		 oldcxt;
+
+	subid = GetCurrentSubTransactionId();
+
+	if (history_buffers_context == NULL)
+		history_buffers_context =
+			AllocSetContextCreate(TopTransactionContext,
+								  "temporal_tables history buffers",
+								  ALLOCSET_DEFAULT_SIZES);
+
+	oldcxt = MemoryContextSwitchTo(history_buffers_context);
+
+	buffer = NULL;
+
+	foreach(lc, history_buffers)
+	{
+		HistoryBuffer *b = lfirst(lc);
+
+		if (b->history_relid == RelationGetRelid(history_relation) &&
+			b->subid == subid)
+		{
+			buffer = b;
+			break;
+		}
+	}
+
+	if (buffer == NULL)
+	{
+		buffer = palloc(sizeof(HistoryBuffer));
+		buffer->history_relid = RelationGetRelid(history_relation);
+		buffer->subid = subid;
+		buffer->tupdesc = CreateTupleDescCopy(RelationGetDescr(history_relation));
+		buffer->bulk = history_relation->rd_rel->relam != HEAP_TABLE_AM_OID;
+		buffer->stale = false;
+		buffer->nrows = 0;
+		buffer->nbytes = 0;
+		buffer->maxrows = buffer->bulk ? MAX_BUFFERED_BULK_HISTORY_ROWS :
+			MAX_BUFFERED_HISTORY_ROWS;
+		buffer->maxbytes = buffer->bulk ? MAX_BUFFERED_BULK_HISTORY_BYTES :
+			MAX_BUFFERED_HISTORY_BYTES;
+		buffer->nslots = 0;
+		buffer->slots = palloc(buffer->maxrows * sizeof(TupleTableSlot *));
+
+		history_buffers = lappend(history_buffers, buffer);
+	}
+
+	if (buffer->nrows == buffer->nslots)
+		buffer->slots[buffer->nslots++] =
+			MakeSingleTupleTableSlot(buffer->tupdesc,
+									 table_slot_callbacks(history_relation));
+
+	/*
+	 * Copy the attributes into the slot since the row does not live until the
+	 * buffer is flushed.
+	 */
+	fill_history_slot(buffer->slots[buffer->nrows], tuple, tupdesc,
+					  hash_entry, period);
+	ExecMaterializeSlot(buffer->slots[buffer->nrows]);
+
+	buffer->nrows++;
+	buffer->nbytes += tuple->t_len;
+
+	MemoryContextSwitchTo(oldcxt);
+
+	if (buffer->nrows == buffer->maxrows ||
+		buffer->nbytes >= buffer->maxbytes)
+		flush_history_buffer(buffer);
+}
+
+/*
+ * Insert the rows of the buffer into the history relation and update its
+ * indexes. Return true if the buffer had any rows. The rows of a history
+ * relation that has been dropped are thrown away.
+ *
+ * The rows are inserted with the current command ID, so they are not visible
+ * until the command counter is incremented.
+ */
+static bool
+flush_history_buffer(HistoryBuffer *buffer)
+{
+	Relation		 history_relation;
+	TupleDesc		 history_tupdesc;
+	EState			*estate;
+	ResultRelInfo	*result_rel_info;
+	int				 i;
+
+	if (buffer->nrows == 0)
+		return false;
+
+	Assert(buffer->subid == GetCurrentSubTransactionId());
+
+	if (buffer->stale)
+	{
+		history_relation = try_relation_open(buffer->history_relid,
+											 RowExclusiveLock);
+
+		if (history_relation == NULL)
+		{
+			for (i = 0; i < buffer->nrows; ++i)
+				ExecClearTuple(buffer->slots[i]);
+
+			buffer->nrows = 0;
+			buffer->nbytes = 0;
+
+			return false;
+		}
+
+		buffer->stale = false;
+	}
+	else
+		history_relation = table_open(buffer->history_relid, RowExclusiveLock);
+
+	history_tupdesc = RelationGetDescr(history_relation);
+
+	/* Make sure that the buffered rows conform to the history relation. */
+	if (history_tupdesc->natts != buffer->tupdesc->natts)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("history relation \"%s\" was altered while rows were being archived into it",
+						RelationGetRelationName(history_relation))));
+
+	for (i = 0; i < history_tupdesc->natts; ++i)
+	{
+		Form_pg_attribute	attr = TupleDescAttr(history_tupdesc, i);
+		Form_pg_attribute	buffer_attr = TupleDescAttr(buffer->tupdesc, i);
+
+		if (attr->atttypid != buffer_attr->atttypid ||
+			attr->attisdropped != buffer_attr->attisdropped)
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("history relation \"%s\" was altered while rows were being archived into it",
+							RelationGetRelationName(history_relation))));
+	}
+
+	estate = CreateExecutorState();
+
+	result_rel_info = makeNode(ResultRelInfo);
+	InitResultRelInfo(result_rel_info, history_relation, 0, NULL, 0);
+
+	ExecOpenIndices(result_rel_info, false);
+
+	/* Check NOT NULL and CHECK constraints of the history relation. */
+	if (history_tupdesc->constr != NULL)
+		for (i = 0; i < buffer->nrows; ++i)
+			ExecConstraints(result_rel_info, buffer->slots[i], estate);
+
+	report_wait_start(VERSIONING_WAIT_HISTORY_FLUSH);
+
+	table_multi_insert(history_relation, buffer->slots, buffer->nrows,
+					   GetCurrentCommandId(true), 0, NULL);
+
+	/* Let the access method finish the batch, e.g. write out a stripe. */
+	table_finish_bulk_insert(history_relation, 0);
+
+	report_wait_end();
+
+	for (i = 0; i < buffer->nrows; ++i)
+	{
+		if (result_rel_info->ri_NumIndices > 0)
+		{
+			list_free(ExecInsertIndexTuples(result_rel_info, buffer->slots[i],
+											estate, false, false, NULL, NIL
+#if PG_VERSION_NUM >= 160000
+											, false
+#endif
+											));
+			ResetPerTupleExprContext(estate);
+		}
+
+		ExecClearTuple(buffer->slots[i]);
+	}
+
+	buffer->nrows = 0;
+	buffer->nbytes = 0;
+
+	ExecCloseIndices(result_rel_info);
+	FreeExecutorState(estate);
+
+	relation_close(history_relation, NoLock);
+
+	return true;
+}
+
+/*
+ * Free the buffer and the rows it contains.
+ */
+static void
+discard_history_buffer(HistoryBuffer *buffer)
+{
+	int		i;
+
+	for (i = 0; i < buffer->nslots; ++i)
+		ExecDropSingleTupleTableSlot(buffer->slots[i]);
+
+	FreeTupleDesc(buffer->tupdesc);
+	pfree(buffer->slots);
+	pfree(buffer);
+}
+#endif
+
+bool
+flush_history_buffers(bool bulk)
+{
+	bool		flushed = false;
+#if PG_VERSION_NUM >= 140000
+	SubTransactionId	subid;
+	ListCell		   *lc;
+
+	if (history_buffers == NIL)
+		return false;
+
+	subid = GetCurrentSubTransactionId();
+
+	/*
+	 * The buffers of the parent subtransactions cannot be flushed since the
+	 * rows would be lost if the current subtransaction rolled back.
+	 */
+	foreach(lc, history_buffers)
+	{
+		HistoryBuffer *buffer = lfirst(lc);
+
+		if (buffer->subid == subid && (bulk || !buffer->bulk))
+			flushed |= flush_history_buffer(buffer);
+	}
+#endif
+
+	return flushed;
+}
+
+bool
+flush_history_buffers_used_by(List *relids)
+{
+	bool		flushed = false;
+#if PG_VERSION_NUM >= 140000
+	SubTransactionId	subid;
+	ListCell		   *lc;
+
+	if (history_buffers == NIL || relids == NIL)
+		return false;
+
+	subid = GetCurrentSubTransactionId();
+
+	foreach(lc, history_buffers)
+	{
+		HistoryBuffer *buffer = lfirst(lc);
+
+		if (buffer->subid == subid &&
+			list_member_oid(relids, buffer->history_relid))
+			flushed |= flush_history_buffer(buffer);
+	}
+#endif
+
+	return flushed;
+}
+
+bool
+history_rows_buffered(void)
+{
+#if PG_VERSION_NUM >= 140000
+	ListCell   *lc;
+
+	foreach(lc, history_buffers)
+	{
+		HistoryBuffer *buffer = lfirst(lc);
+
+		if (buffer->nrows > 0)
+			return true;
+	}
+#endif
+
+	return false;
+}
+
+void
+history_buffers_xact_callback(XactEvent event)
+{
+#if PG_VERSION_NUM >= 100000
+	/* The collected rows that were not archived are never archived. */
+	if (event == XACT_EVENT_PRE_COMMIT ||
+		event == XACT_EVENT_PARALLEL_PRE_COMMIT ||
+		event == XACT_EVENT_PRE_PREPARE ||
+		event == XACT_EVENT_ABORT ||
+		event == XACT_EVENT_PARALLEL_ABORT)
+		discard_statement_history_rows(InvalidSubTransactionId);
+#endif
+
+#if PG_VERSION_NUM >= 140000
+	switch (event)
+	{
+		case XACT_EVENT_PRE_COMMIT:
+		case XACT_EVENT_PARALLEL_PRE_COMMIT:
+		case XACT_EVENT_PRE_PREPARE:
+			/*
+			 * All the subtransactions have committed, so the remaining rows
+			 * belong to the top transaction.
+			 */
+			flush_history_buffers(true);
+			break;
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+		case XACT_EVENT_PREPARE:
+			/* The memory is freed along with TopTransactionContext. */
+			history_buffers = NIL;
+			history_buffers_context = NULL;
+			break;
+	}
+#endif
+}
+
+void
+history_buffers_subxact_callback(SubXactEvent event,
+								 SubTransactionId mySubid,
+								 SubTransactionId parentSubid)
+{
+#if PG_VERSION_NUM >= 140000
+	ListCell   *lc;
+#endif
+
+#if PG_VERSION_NUM >= 100000
+	if (event == SUBXACT_EVENT_COMMIT_SUB || event == SUBXACT_EVENT_ABORT_SUB)
+		discard_statement_history_rows(mySubid);
+#endif
+
+#if PG_VERSION_NUM >= 140000
+	if (history_buffers == NIL)
+		return;
+
+	if (event == SUBXACT_EVENT_COMMIT_SUB)
+	{
+		foreach(lc, history_buffers)
+		{
+			HistoryBuffer *buffer = lfirst(lc);
+
+			if (buffer->subid == mySubid)
+				buffer->subid = parentSubid;
+		}
+	}
+	else if (event == SUBXACT_EVENT_ABORT_SUB)
+	{
+		foreach(lc, history_buffers)
+		{
+			HistoryBuffer *buffer = lfirst(lc);
+
+			if (buffer->subid == mySubid)
+			{
+				history_buffers = foreach_delete_current(history_buffers, lc);
+				discard_history_buffer(buffer);
+			}
+		}
+	}
+#endif
+}
+
+/*
+ * Deconstruct a range value of the system period attribute.
+ *
+ * If the value is null or is bounded on it's high side, an error is thrown.
+ */
+static void
+deserialize_system_period(HeapTuple tuple,
+						  Relation relation,
+						  int period_attnum,
+						  const char *period_attname,
+						  TypeCacheEntry *typcache,
+						  RangeBound *lower,
+						  RangeBound *upper)
+{
+	bool		 isnull;
+	Datum		 datum;
+	Pointer		 ptr;
+	bool		 empty;
+
+	datum = heap_getattr(tuple, period_attnum, RelationGetDescr(relation),
+						 &isnull);
+
+	if (isnull)
+		ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				 errmsg("system period column \"%s\" of relation \"%s\" must not be null",
+						period_attname,
+						RelationGetRelationName(relation))));
+
+	ptr = DatumGetPointer(datum);
+
+	if (VARATT_IS_EXTENDED(ptr) && !VARATT_IS_SHORT(ptr))
+	{
+		RangeType	*system_period;
+
+		system_period = DatumGetRangeTypeP(datum);
+
+		range_deserialize(typcache, system_period, lower, upper, &empty);
+	}
+	else
+	{
+		/*
+		 * The value is stored inline, so decode it right in the tuple. The
+		 * data of a range with timestamptz subtype is the range type OID,
+		 * then the lower and upper bounds if any (they need no alignment as
+		 * the OID is preceded by the 4-byte header in the detoasted form),
+		 * and the flags byte.
+		 */
+		char		*data;
+		char		 flags;
+
+		data = VARDATA_ANY(ptr);
+		flags = data[VARSIZE_ANY_EXHDR(ptr) - 1];
+
+		empty = (flags & RANGE_EMPTY) != 0;
+
+		lower->infinite = (flags & RANGE_LB_INF) != 0;
+		lower->inclusive = (flags & RANGE_LB_INC) != 0;
+		lower->lower = true;
+
+		upper->infinite = (flags & RANGE_UB_INF) != 0;
+		upper->inclusive = (flags & RANGE_UB_INC) != 0;
+		upper->lower = false;
+
+		if (!empty &&
+			!(flags & (RANGE_LB_INF | RANGE_LB_NULL)))
+		{
+			TimestampTz	value;
+
+			memcpy(&value, data + sizeof(Oid), sizeof(TimestampTz));
+			lower->val = TimestampTzGetDatum(value);
+		}
+		else
+			lower->val = (Datum) 0;
+
+		/* The upper bound must be infinite, so its value is not needed. */
+		upper->val = (Datum) 0;
+	}
+
+	if (empty || !upper->infinite)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_EXCEPTION),
+				 errmsg("system period column \"%s\" of relation \"%s\" contains invalid value",
+						period_attname,
+						RelationGetRelationName(relation)),
+				 errdetail("valid ranges must be non-empty and unbounded on the high side")));
+}
+
+/*
+ * Get the "[lower, )" range for the current rows. The result is cached and
+ * must not be modified or freed.
+ */
+static RangeType *
+get_current_period(TypeCacheEntry *typcache, TimestampTz lower)
+{
+	if (current_period == NULL ||
+		current_period_typid != typcache->type_id ||
+		current_period_lower != lower)
+	{
+		RangeBound	 lower_bound;
+		RangeBound	 upper_bound;
+		RangeType	*range;
+
+		lower_bound.val = TimestampTzGetDatum(lower);
+		lower_bound.infinite = false;
+		lower_bound.inclusive = true;
+		lower_bound.lower = true;
+
+		upper_bound.val = (Datum) 0;
+		upper_bound.infinite = true;
+		upper_bound.inclusive = false;
+		upper_bound.lower = false;
+
+#if PG_VERSION_NUM >= 160000
+		range = make_range(typcache, &lower_bound, &upper_bound, false, NULL);
+#else
+		range = make_range(typcache, &lower_bound, &upper_bound, false);
+#endif
+
+		if (current_period != NULL)
+			pfree(current_period);
+
+		current_period = MemoryContextAlloc(TopMemoryContext, VARSIZE(range));
+		memcpy(current_period, range, VARSIZE(range));
+
+		current_period_typid = typcache->type_id;
+		current_period_lower = lower;
+
+		pfree(range);
+	}
+
+	return current_period;
+}
+
+/*
+ * Look up "integer_datetimes" configuration option.
+ */
+static void
+lookup_integer_datetimes()
+{
+	const char	*value;
+
+	value = GetConfigOption("integer_datetimes", false, true);
+
+	integer_datetimes = (strcmp(value, "on") == 0);
+
+	integer_datetimes_set = true;
+}
+
+/*
+ * Add a minimal time interval to the specified timestamp. The returned value
+ * is always not equal to this timestamp.
+ */
+static TimestampTz
+next_timestamp(TimestampTz timestamp)
+{
+	if (!integer_datetimes_set)
+		lookup_integer_datetimes();
+
+	/* If Timestamp is int64, add 1 microsecond. */
+	if (integer_datetimes)
+		return (TimestampTz) ((int64) timestamp + 1);
+	else
+	{
+		float8	ts;
+		float8	next;
+
+		/*
+		 * If Timestamp is double, try adding 1 microsecond. If microsecond
+		 * precision is not available for this value, return the next
+		 * representable floating-point number.
+		 */
+		ts = (float8) timestamp;
+		next = ts + 1E-06;
+		if (next != ts)
+			return (TimestampTz) next;
+
+		return (TimestampTz) nextafter(ts, DBL_MAX);
+	}
+}
+
+/*
+ * Check that the upper bound is greater than the lower bound. If it is not
+ * the case and adjust argument of the trigger is set to false, an exception
+ * is thrown. If adjust argument is set to true, then the upper bound is set
+ * to the lower bound plus delta.
+ */
+static void
+adjust_system_period(VersioningTriggerEntry *entry,
+					 RangeBound *lower,
+					 RangeBound *upper,
+					 const char *adjust_argument,
+					 Relation relation)
+{
+	if (range_cmp_bounds(entry->typcache, lower, upper) >= 0)
+	{
+		TimestampTz next_ts;
+
+		if (!entry->adjust_parsed)
+		{
+			entry->adjust = parse_adjust_argument(adjust_argument);
+			entry->adjust_parsed = true;
+		}
+
+		if (!entry->adjust)
+		{
+			entry->stats->counters[VERSIONING_STATS_ADJUST_ERRORS]++;
+
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_EXCEPTION),
+					 errmsg("system period value of relation \"%s\" cannot be set to a valid period because a row that is attempted to modify was also modified by another transaction",
+							RelationGetRelationName(relation)),
+					 errdetail("the start time of system period is %s but the start time of the current transaction is %s",
+							   lower->infinite ? "-infinity" : timestamptz_to_str(DatumGetTimestampTz(lower->val)),
+							   timestamptz_to_str(DatumGetTimestampTz(upper->val))),
+					 errhint("retry the statement or set \"adjust\" parameter of \"versioning\" function to true")));
+		}
+
+		entry->stats->counters[VERSIONING_STATS_ADJUSTMENTS]++;
+
+		ereport(WARNING,
+				(errcode(ERRCODE_WARNING_SYSTEM_PERIOD_ADJUSTED),
+				 errmsg("system period value of relation \"%s\" was adjusted",
+						RelationGetRelationName(relation))));
+
+		next_ts = next_timestamp(DatumGetTimestampTz(lower->val));
+
+		upper->val = TimestampTzGetDatum(next_ts);
+	}
+}
+
+/*
+ * Check if the tuple was inserted or updated in the current transaction.
+ */
+static bool
+modified_in_current_transaction(HeapTuple tuple)
+{
+	TransactionId	 oldxmin;
+
+	oldxmin = HeapTupleHeaderGetXmin(tuple->t_data);
+	return TransactionIdIsCurrentTransactionId(oldxmin);
+}
+
+/*
+ * Add the time elapsed since start_time to the statistics of the versioned
+ * relation if temporal_tables.track_timing is on, and log it if it exceeds
+ * temporal_tables.log_min_duration.
+ */
+static void
+add_trigger_time(TriggerData *trigdata,
+				 VersioningTriggerEntry *entry,
+				 instr_time start_time)
+{
+	instr_time	duration;
+	double		msec;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start_time);
+
+	msec = INSTR_TIME_GET_MILLISEC(duration);
+
+	if (versioning_track_timing)
+		entry->stats->total_time += msec;
+
+	if (log_min_duration >= 0 && msec >= log_min_duration)
+	{
+		const char *operation;
+
+		if (TRIGGER_FIRED_BY_INSERT(trigdata->tg_event))
+			operation = "INSERT";
+		else if (TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event))
+			operation = "UPDATE";
+		else if (TRIGGER_FIRED_BY_DELETE(trigdata->tg_event))
+			operation = "DELETE";
+		else
+			operation = "TRUNCATE";
+
+		ereport(LOG,
+				(errmsg("duration: %.3f ms  trigger \"%s\" on relation \"%s\" for %s",
+						msec, trigdata->tg_trigger->tgname,
+						RelationGetRelationName(trigdata->tg_relation),
+						operation)));
+	}
+}
+
+/*
+ * Report that the trigger waits on the event, i.e. on a query it executes, on
+ * writing the buffered rows or on reading the catalogs to build its cached
+ * data. A lock or an I/O the server waits on inside
+ * reports its own wait event and resets ours when it ends. PostgreSQL 17
+ * allows custom wait events, all of them are allocated on the first report
+ * so that they are listed in pg_wait_events at once. The older versions
+ * report the generic "Extension" one.
+ */
+static void
+report_wait_start(VersioningWaitEvent event)
+{
+#if PG_VERSION_NUM >= 170000
+	int		i;
+
+	if (wait_event_infos[event] == 0)
+		for (i = 0; i < VERSIONING_NUM_WAIT_EVENTS; ++i)
+			wait_event_infos[i] = WaitEventExtensionNew(wait_event_names[i]);
+
+	pgstat_report_wait_start(wait_event_infos[event]);
+#elif PG_VERSION_NUM >= 90600
+	pgstat_report_wait_start(PG_WAIT_EXTENSION);
+#endif
+}
+
+static void
+report_wait_end(void)
+{
+#if PG_VERSION_NUM >= 90600
+	pgstat_report_wait_end();
+#endif
+}
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * Write the upper bound of the system period of the deleted row to the WAL
+ * as a transactional logical message unless it was already written in the
+ * current subtransaction. The decoder applies it to the deleted rows that
+ * follow the message, see capture.c. A message of an aborted subtransaction
+ * is discarded along with its changes, so every subtransaction writes its own
+ * one.
+ */
+static void
+log_captured_delete_time(TimestampTz upper)
+{
+	if (captured_delete_lxid == MyLocalTransactionId &&
+		captured_delete_subid == GetCurrentSubTransactionId() &&
+		captured_delete_time == upper)
+		return;
+
+	LogLogicalMessage(CAPTURE_MESSAGE_PREFIX, (const char *) &upper,
+					  sizeof(upper), true
+#if PG_VERSION_NUM >= 170000
+					  , false
+#endif
+					  );
+
+	captured_delete_time = upper;
+	captured_delete_lxid = MyLocalTransactionId;
+	captured_delete_subid = GetCurrentSubTransactionId();
+}
+#endif
+
+/*
+ * Tuple modification wrapper around SPI_modifytuple for PG<10
+ * and heap_modify_tuple_by_cols for PG 10
+ */
+static HeapTuple
+modify_tuple(Relation rel, HeapTuple tuple, int period_attnum, RangeType *range)
+{
+	int			 colnum[1] = { period_attnum };
+	Datum		 values[1] = { RangeTypePGetDatum(range) };
+#if PG_VERSION_NUM >= 100000
+	bool		 nulls[1] = { false };
+	return heap_modify_tuple_by_cols(tuple, RelationGetDescr(rel), 1, colnum, values, nulls);
+#else
+	char		 nulls[1] = { ' ' };
+	return SPI_modifytuple(rel, tuple, 1, colnum, values, nulls);
+#endif
+}
+
+/*
+ * Check whether two not null values of the attribute are equal. The values
+ * are compared binary first and then by the equality operator of their type.
+ * Values of a type without the equality operator are equal only if they are
+ * binary equal. typcache is the typcache entry of the type or NULL if it is
+ * not looked up yet.
+ */
+static bool
+values_equal(Form_pg_attribute attr,
+			 TypeCacheEntry *typcache,
+			 Datum value1,
+			 Datum value2)
+{
+	if (datumIsEqual(value1, value2, attr->attbyval, attr->attlen))
+		return true;
+
+	/* The typcache entry may have been reset by an invalidation. */
+	if (typcache == NULL || !OidIsValid(typcache->eq_opr_finfo.fn_oid))
+		typcache = lookup_type_cache(attr->atttypid, TYPECACHE_EQ_OPR_FINFO);
+
+	return OidIsValid(typcache->eq_opr_finfo.fn_oid) &&
+		DatumGetBool(FunctionCall2Coll(&typcache->eq_opr_finfo,
+									   attr->attcollation,
+									   value1, value2));
+}
+
+/*
+ * Check whether UPDATE changes none of the compared attributes of the row.
+ */
+static bool
+row_unchanged(VersioningTriggerEntry *entry,
+			  HeapTuple oldtuple,
+			  HeapTuple newtuple,
+			  TupleDesc tupdesc)
+{
+	int		i;
+
+	for (i = 0; i < entry->ncompare_attrs; ++i)
+	{
+		int					attnum = entry->compare_attnums[i];
+		Datum				oldvalue;
+		Datum				newvalue;
+		bool				oldisnull;
+		bool				newisnull;
+
+		oldvalue = heap_getattr(oldtuple, attnum, tupdesc, &oldisnull);
+		newvalue = heap_getattr(newtuple, attnum, tupdesc, &newisnull);
+
+		if (oldisnull || newisnull)
+		{
+			if (oldisnull != newisnull)
+				return false;
+
+			continue;
+		}
+
+		if (!values_equal(TupleDescAttr(tupdesc, attnum - 1),
+						  entry->compare_typcaches[i], oldvalue, newvalue))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Return the new row of UPDATE with the system period of the old row, so
+ * that UPDATE that does not change the row leaves its system period alone.
+ */
+static HeapTuple
+keep_system_period(TriggerData *trigdata, VersioningTriggerEntry *entry)
+{
+	TupleDesc	tupdesc = RelationGetDescr(trigdata->tg_relation);
+	Datum		oldperiod;
+	Datum		newperiod;
+	bool		oldisnull;
+	bool		newisnull;
+
+	oldperiod = heap_getattr(trigdata->tg_trigtuple, entry->period_attnum,
+							 tupdesc, &oldisnull);
+	newperiod = heap_getattr(trigdata->tg_newtuple, entry->period_attnum,
+							 tupdesc, &newisnull);
+
+	if (oldisnull == newisnull &&
+		(oldisnull || datumIsEqual(oldperiod, newperiod, false, -1)))
+		return trigdata->tg_newtuple;
+
+	if (oldisnull)
+	{
+		int			colnum[1] = { entry->period_attnum };
+		Datum		values[1] = { (Datum) 0 };
+#if PG_VERSION_NUM >= 100000
+		bool		nulls[1] = { true };
+
+		return heap_modify_tuple_by_cols(trigdata->tg_newtuple, tupdesc, 1,
+										 colnum, values, nulls);
+#else
+		char		nulls[1] = { 'n' };
+
+		return SPI_modifytuple(trigdata->tg_relation, trigdata->tg_newtuple,
+							   1, colnum, values, nulls);
+#endif
+	}
+
+	return modify_tuple(trigdata->tg_relation, trigdata->tg_newtuple,
+						entry->period_attnum, DatumGetRangeTypeP(oldperiod));
+}
+
+/*
+ * Overwrite the system period attribute value of the new row of UPDATE with
+ * the range in place. Return false if it is not possible.
+ *
+ * The value can be overwritten only if it is stored inline and has the same
+ * size as the range, which is the case when the period of the old row is
+ * "[lower, )". The new row must be the tuple owned by the slot of the trigger
+ * manager, so that the slot sees the change when the same tuple is returned.
+ */
+static bool
+overwrite_system_period(TriggerData *trigdata,
+						int period_attnum,
+						RangeType *range)
+{
+#if PG_VERSION_NUM >= 120000
+	TupleTableSlot	*slot;
+	HeapTuple		 tuple;
+	Datum			 datum;
+	bool			 isnull;
+	Pointer			 ptr;
+	Size			 size;
+
+	slot = trigdata->tg_newslot;
+	tuple = trigdata->tg_newtuple;
+
+	if (slot == NULL ||
+		!(TTS_IS_HEAPTUPLE(slot) || TTS_IS_BUFFERTUPLE(slot)) ||
+		!TTS_SHOULDFREE(slot) ||
+		((HeapTupleTableSlot *) slot)->tuple != tuple)
+		return false;
+
+	/* A missing attribute would point to the default value. */
+	if (period_attnum > HeapTupleHeaderGetNatts(tuple->t_data))
+		return false;
+
+	datum = heap_getattr(tuple, period_attnum,
+						 RelationGetDescr(trigdata->tg_relation), &isnull);
+
+	if (isnull)
+		return false;
+
+	ptr = DatumGetPointer(datum);
+
+	if (VARATT_IS_EXTERNAL(ptr) || VARATT_IS_COMPRESSED(ptr))
+		return false;
+
+	size = VARSIZE(range) - VARHDRSZ;
+
+	if (VARSIZE_ANY_EXHDR(ptr) != size)
+		return false;
+
+	memcpy(VARDATA_ANY(ptr), VARDATA(range), size);
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+/*
+ * Set system period attribute value of the current row to
+ * "[system_time, )".
+ */
+static Datum
+versioning_insert(TriggerData *trigdata,
+				  VersioningTriggerEntry *entry)
+{
+	RangeType	*range;
+
+	entry->stats->counters[VERSIONING_STATS_ROWS_STAMPED]++;
+
+	/* Construct a period for the current row. */
+	range = get_current_period(entry->typcache,
+							   get_system_time(trigger_clock(entry), NULL));
+
+	return PointerGetDatum(modify_tuple(trigdata->tg_relation, trigdata->tg_trigtuple, entry->period_attnum, range));
+}
+
+/*
+ * Set system period attribute value of the current row to
+ * "[system_time, )", insert the original row into the history table
+ * with the system period attribute value "[lower, system_time)".
+ *
+ * If lower is greater than or equals to system_time, adjust argument
+ * determines whether timestamps adjustment are made or transaction should
+ * fail.
+ *
+ * When a transaction makes multiple changes to a row, a history row is
+ * generated only once.
+ */
+static Datum
+versioning_update(TriggerData *trigdata,
+				  VersioningTriggerEntry *entry,
+				  const char *period_attname,
+				  const char *history_relation_argument,
+				  const char *adjust_argument)
+{
+	HeapTuple		 tuple;
+	Relation		 relation;
+	RangeBound		 lower;
+	RangeBound		 upper;
+	RangeType		*range;
+
+	tuple = trigdata->tg_trigtuple;
+
+	/* Ignore tuples modified in this transaction. */
+	if (modified_in_current_transaction(tuple))
+	{
+		entry->stats->counters[VERSIONING_STATS_ROWS_SKIPPED]++;
+
+#if PG_VERSION_NUM >= 100000
+		/* The delta archived in this transaction may miss the changes. */
+		if (entry->delta_attname != NULL &&
+			!statement_trigger_fires(entry->update_statement_tgenabled))
+			update_delta_history_row(tuple, trigdata->tg_newtuple,
+									 trigdata->tg_relation, entry,
+									 history_relation_argument,
+									 period_attname);
+#endif
+
+		return PointerGetDatum(trigdata->tg_newtuple);
+	}
+
+	relation = trigdata->tg_relation;
+
+	/*
+	 * Ignore updates that do not change the row. The statement-level trigger
+	 * would archive the row anyway, so the row-level trigger must not keep
+	 * its system period then.
+	 */
+	if (entry->skip_unchanged &&
+		!statement_trigger_fires(entry->update_statement_tgenabled) &&
+		row_unchanged(entry, tuple, trigdata->tg_newtuple,
+					  RelationGetDescr(relation)))
+	{
+		entry->stats->counters[VERSIONING_STATS_ROWS_SKIPPED]++;
+
+		return PointerGetDatum(keep_system_period(trigdata, entry));
+	}
+
+	deserialize_system_period(tuple, relation, entry->period_attnum,
+							  period_attname, entry->typcache, &lower, &upper);
+
+	/* Construct a period for the history row. */
+	upper.val = TimestampTzGetDatum(get_system_time(trigger_clock(entry),
+													&lower));
+	upper.infinite = false;
+	upper.inclusive = false;
+
+	/* Adjust if needed. */
+	adjust_system_period(entry, &lower, &upper, adjust_argument, relation);
+
+	/*
+	 * The row may be archived by the statement-level trigger or by the
+	 * capture worker instead.
+	 */
+	if (!entry->capture_logical)
+	{
+#if PG_VERSION_NUM >= 160000
+		range = make_range(entry->typcache, &lower, &upper, false, NULL);
+#else
+		range = make_range(entry->typcache, &lower, &upper, false);
+#endif
+
+#if PG_VERSION_NUM >= 100000
+		if (statement_trigger_fires(entry->update_statement_tgenabled))
+			collect_statement_history_row(relation, TRIGGER_EVENT_UPDATE,
+										  tuple, entry->period_attnum, range);
+		else if (entry->delta_attname != NULL)
+			insert_delta_history_row(tuple, trigdata->tg_newtuple,
+									 RangeTypePGetDatum(range), relation,
+									 entry, history_relation_argument,
+									 period_attname);
+		else
+#endif
+			insert_history_row(tuple, RangeTypePGetDatum(range), relation,
+							   entry, history_relation_argument,
+							   period_attname);
+	}
+
+	/* Construct a period for the current row. */
+	range = get_current_period(entry->typcache,
+							   DatumGetTimestampTz(upper.val));
+
+	/* Avoid copying the new row if possible. */
+	if (overwrite_system_period(trigdata, entry->period_attnum, range))
+		return PointerGetDatum(trigdata->tg_newtuple);
+
+	return PointerGetDatum(modify_tuple(relation, trigdata->tg_newtuple, entry->period_attnum, range));
+}
+
+/*
+ * Insert the original row into the history table with the system period
+ * attribute value "[lower, system_time)".
+ *
+ * If lower is greater than or equals to system_time, adjust argument
+ * determines whether timestamps adjustment are made or transaction should
+ * fail.
+ */
+static Datum
+versioning_delete(TriggerData *trigdata,
+				  VersioningTriggerEntry *entry,
+				  const char *period_attname,
+				  const char *history_relation_argument,
+				  const char *adjust_argument)
+{
+	HeapTuple	 tuple;
+	Relation	 relation;
+	RangeBound	 lower;
+	RangeBound	 upper;
+	RangeType	*range;
+
+	tuple = trigdata->tg_trigtuple;
+
+	/* Ignore tuples modified in this transaction. */
+	if (modified_in_current_transaction(tuple))
+	{
+		entry->stats->counters[VERSIONING_STATS_ROWS_SKIPPED]++;
+
+#if PG_VERSION_NUM >= 100000
+		/* The delta archived in this transaction has no newer version now. */
+		if (entry->delta_attname != NULL &&
+			!statement_trigger_fires(entry->delete_statement_tgenabled))
+			update_delta_history_row(tuple, NULL, trigdata->tg_relation,
+									 entry, history_relation_argument,
+									 period_attname);
+#endif
+
+		return PointerGetDatum(tuple);
+	}
+
+	relation = trigdata->tg_relation;
+
+	deserialize_system_period(tuple, relation, entry->period_attnum,
+							  period_attname, entry->typcache, &lower, &upper);
+
+	/* Construct a period for the history row. */
+	upper.val = TimestampTzGetDatum(get_system_time(trigger_clock(entry),
+													&lower));
+	upper.infinite = false;
+	upper.inclusive = false;
+
+	/* Adjust if needed. */
+	adjust_system_period(entry, &lower, &upper, adjust_argument, relation);
+
+#if PG_VERSION_NUM >= 100000
+	/*
+	 * The WAL record of DELETE has no system time, so it is written for the
+	 * capture worker beforehand.
+	 */
+	if (entry->capture_logical)
+	{
+		log_captured_delete_time(DatumGetTimestampTz(upper.val));
+
+		return PointerGetDatum(tuple);
+	}
+#endif
+
+#if PG_VERSION_NUM >= 160000
+	range = make_range(entry->typcache, &lower, &upper, false, NULL);
+#else
+	range = make_range(entry->typcache, &lower, &upper, false);
+#endif
+
+#if PG_VERSION_NUM >= 100000
+	/* The row may be archived by the statement-level trigger instead. */
+	if (statement_trigger_fires(entry->delete_statement_tgenabled))
+	{
+		collect_statement_history_row(relation, TRIGGER_EVENT_DELETE, tuple,
+									  entry->period_attnum, range);
+
+		return PointerGetDatum(tuple);
+	}
+#endif
+
+	insert_history_row(tuple, RangeTypePGetDatum(range), relation, entry,
+					   history_relation_argument, period_attname);
+
+	return PointerGetDatum(tuple);
+}
+
+/*
+ * Return the memory context of the cached data, creating it on the first
+ * use.
+ */
+static MemoryContext
+get_versioning_cache_context(void)
+{
+	if (versioning_cache_context == NULL)
+		versioning_cache_context =
+			AllocSetContextCreate(TopMemoryContext,
+								  "temporal_tables cache",
+								  ALLOCSET_DEFAULT_MINSIZE,
+								  ALLOCSET_DEFAULT_INITSIZE,
+								  ALLOCSET_DEFAULT_MAXSIZE);
+
+	return versioning_cache_context;
+}
+
+static void *
+hash_entry_alloc(Size size)
+{
+	return MemoryContextAllocZero(versioning_cache_context, size);
+}
+
+/*
+ * Initialize the internal hash table for cached data.
+ */
+static void
+init_versioning_hash_table()
+{
+	HASHCTL	ctl;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.alloc = hash_entry_alloc;
+	ctl.hcxt = get_versioning_cache_context();
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(VersioningHashEntry);
+#if PG_VERSION_NUM < 90500
+	ctl.hash = oid_hash;
+#endif
+
+	versioning_cache = hash_create("Versioning Hash",
+								   128,
+								   &ctl,
+#if PG_VERSION_NUM < 90500
+								   HASH_ALLOC | HASH_CONTEXT | HASH_ELEM | HASH_FUNCTION
+#else
+								   HASH_ALLOC | HASH_CONTEXT | HASH_ELEM | HASH_BLOBS
+#endif
+								  );
+}
+
+/*
+ * Initialize the internal hash table for resolved trigger arguments and
+ * register the callbacks that invalidate its entries.
+ */
+static void
+init_versioning_trigger_hash_table()
+{
+	versioning_trigger_cache = create_trigger_hash_table("Versioning Trigger Hash");
+
+	CacheRegisterRelcacheCallback(versioning_relcache_callback, (Datum) 0);
+	CacheRegisterSyscacheCallback(TYPEOID, versioning_syscache_callback,
+								  (Datum) 0);
+	CacheRegisterSyscacheCallback(RELNAMENSP, versioning_syscache_callback,
+								  (Datum) 0);
+	CacheRegisterSyscacheCallback(NAMESPACEOID, versioning_syscache_callback,
+								  (Datum) 0);
+}
+
+/*
+ * Lookup for a versioned relation OID in the internal hash table of cached
+ * data. If not found, return a new entry with all fields zeroed and
+ * natts = -1.
+ */
+static VersioningHashEntry *
+lookup_versioning_hash_entry(Oid relid,
+							 bool *found)
+{
+	VersioningHashEntry	*entry;
+
+	if (!versioning_cache)
+		init_versioning_hash_table();
+
+	entry = (VersioningHashEntry *) hash_search(versioning_cache,
+												(void *) &relid,
+												HASH_ENTER,
+												found);
+
+	if (!*found)
+	{
+		/*
+		 * The storage of the evicted entries is reused, so zero the fields
+		 * explicitly and mark a newly created entry invalid.
+		 */
+		memset((char *) entry + sizeof(Oid), 0,
+			   sizeof(VersioningHashEntry) - sizeof(Oid));
+		entry->natts = -1;
+
+		dlist_push_head(&versioning_cache_lru, &entry->lru_node);
+	}
+
+	return entry;
+}
+
+/*
+ * Create a hash table of resolved trigger arguments.
+ */
+static HTAB *
+create_trigger_hash_table(const char *name)
+{
+	HASHCTL	ctl;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.alloc = hash_entry_alloc;
+	ctl.hcxt = get_versioning_cache_context();
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(VersioningTriggerEntry);
+#if PG_VERSION_NUM < 90500
+	ctl.hash = oid_hash;
+#endif
+
+	return hash_create(name,
+					   128,
+					   &ctl,
+#if PG_VERSION_NUM < 90500
+					   HASH_ALLOC | HASH_CONTEXT | HASH_ELEM | HASH_FUNCTION
+#else
+					   HASH_ALLOC | HASH_CONTEXT | HASH_ELEM | HASH_BLOBS
+#endif
+					  );
+}
+
+/*
+ * Lookup for a trigger OID in the internal hash table of resolved trigger
+ * arguments. If not found, return a new invalid entry.
+ */
+static VersioningTriggerEntry *
+lookup_versioning_trigger_entry(Oid tgoid)
+{
+	if (!versioning_trigger_cache)
+		init_versioning_trigger_hash_table();
+
+	return enter_trigger_entry(versioning_trigger_cache, tgoid);
+}
+
+/*
+ * Return the resolved arguments of the trigger on the relation, filling them
+ * if needed. The implicit trigger of a relation of the versioned_heap access
+ * method has no OID, so its entry is looked up by the relation OID.
+ */
+static VersioningTriggerEntry *
+get_versioning_trigger_entry(Relation relation, Trigger *trigger)
+{
+	VersioningTriggerEntry *entry;
+
+#if PG_VERSION_NUM >= 120000
+	if (!OidIsValid(trigger->tgoid))
+		entry = enter_versioned_heap_entry(relation);
+	else
+#endif
+		entry = lookup_versioning_trigger_entry(trigger->tgoid);
+
+	if (!entry->valid)
+		fill_versioning_trigger_entry(entry, relation, trigger);
+
+	return entry;
+}
+
+/*
+ * Lookup for the key in the hash table of resolved trigger arguments and
+ * record its use. If not found, return a new invalid entry.
+ */
+static VersioningTriggerEntry *
+enter_trigger_entry(HTAB *cache, Oid key)
+{
+	VersioningTriggerEntry	*entry;
+	bool					 found;
+
+	entry = (VersioningTriggerEntry *) hash_search(cache,
+												   (void *) &key,
+												   HASH_ENTER,
+												   &found);
+
+	if (!found)
+	{
+		entry->valid = false;
+		entry->history_relid = InvalidOid;
+		entry->history_search_path = NULL;
+		entry->locked_history_relid = InvalidOid;
+		entry->compare_attnums = NULL;
+		entry->compare_typcaches = NULL;
+		entry->delta_attname = NULL;
+		entry->trigger = NULL;
+		entry->cache = cache;
+		entry->space = 0;
+
+		dlist_push_head(&versioning_trigger_lru, &entry->lru_node);
+		update_trigger_entry_space(entry);
+	}
+
+	touch_trigger_entry(entry);
+
+	return entry;
+}
+
+/*
+ * Relcache invalidation callback. If the versioned relation changes, its
+ * trigger entries are marked invalid. If the history relation changes, its
+ * OID is resolved again on the next use and its buffers are checked for the
+ * relation to still exist when they are flushed. The cached data of both
+ * relations is marked invalid too.
+ *
+ * Note that the callback may be called at any time, so it only resets flags
+ * and never frees anything.
+ */
+static void
+versioning_relcache_callback(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS			 status;
+
+	invalidate_trigger_entries(versioning_trigger_cache, relid);
+#if PG_VERSION_NUM >= 120000
+	if (versioned_heap_cache != NULL)
+		invalidate_trigger_entries(versioned_heap_cache, relid);
+#endif
+
+	if (versioning_cache != NULL)
+	{
+		VersioningHashEntry	*hash_entry;
+
+		hash_seq_init(&status, versioning_cache);
+
+		while ((hash_entry = (VersioningHashEntry *) hash_seq_search(&status)) != NULL)
+		{
+			if (relid == InvalidOid ||
+				hash_entry->relid == relid ||
+				hash_entry->history_relid == relid)
+				hash_entry->valid = false;
+#if PG_VERSION_NUM >= 140000
+			else if (hash_entry->partition_cached &&
+					 hash_entry->partition_relid == relid)
+				hash_entry->partition_cached = false;
+#endif
+		}
+	}
+
+#if PG_VERSION_NUM >= 140000
+	{
+		ListCell   *lc;
+
+		foreach(lc, history_buffers)
+		{
+			HistoryBuffer *buffer = lfirst(lc);
+
+			if (relid == InvalidOid || buffer->history_relid == relid)
+				buffer->stale = true;
+		}
+	}
+#endif
+}
+
+/*
+ * Syscache invalidation callback. A change of any type invalidates all the
+ * trigger entries since they keep typcache entries of system period types,
+ * and so does a change of any schema since the implicit triggers of the
+ * relations of the versioned_heap access method name the schemas of their
+ * history relations. A change of any relation name may shadow a history
+ * relation, so all the resolved history relation OIDs are reset.
+ */
+static void
+versioning_syscache_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	reset_trigger_entries(versioning_trigger_cache, cacheid);
+#if PG_VERSION_NUM >= 120000
+	if (versioned_heap_cache != NULL)
+		reset_trigger_entries(versioned_heap_cache, cacheid);
+#endif
+}
+
+/*
+ * Mark the trigger entries of the relation invalid and reset the history
+ * relation OIDs that are the relation, see versioning_relcache_callback.
+ */
+static void
+invalidate_trigger_entries(HTAB *cache, Oid relid)
+{
+	HASH_SEQ_STATUS			 status;
+	VersioningTriggerEntry	*entry;
+
+	hash_seq_init(&status, cache);
+
+	while ((entry = (VersioningTriggerEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (relid == InvalidOid || entry->relid == relid)
+		{
+			entry->valid = false;
+			entry->history_relid = InvalidOid;
+		}
+		else if (entry->history_relid == relid)
+			entry->history_relid = InvalidOid;
+	}
+}
+
+/*
+ * Reset the history relation OIDs of all the trigger entries, and mark them
+ * invalid if a type or a schema changes, see versioning_syscache_callback.
+ */
+static void
+reset_trigger_entries(HTAB *cache, int cacheid)
+{
+	HASH_SEQ_STATUS			 status;
+	VersioningTriggerEntry	*entry;
+
+	hash_seq_init(&status, cache);
+
+	while ((entry = (VersioningTriggerEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (cacheid == TYPEOID || cacheid == NAMESPACEOID)
+			entry->valid = false;
+
+		entry->history_relid = InvalidOid;
+	}
+}
+
+/*
+ * Check whether the function is one of the versioning trigger functions.
+ */
+static bool
+is_versioning_function(Oid foid)
+{
+	FmgrInfo	flinfo;
+
+	fmgr_info(foid, &flinfo);
+
+	return flinfo.fn_addr == versioning ||
+		   flinfo.fn_addr == versioning_statement;
+}
+
+/*
+ * Return OIDs of all the relations of the current database that have
+ * versioning triggers.
+ */
+static List *
+find_versioned_relations(void)
+{
+	Relation	 trigger_relation;
+	SysScanDesc	 scan;
+	HeapTuple	 tuple;
+	List		*relids = NIL;
+	List		*checked_foids = NIL;
+	List		*versioning_foids = NIL;
+
+	trigger_relation = heap_open(TriggerRelationId, AccessShareLock);
+
+	scan = systable_beginscan(trigger_relation, InvalidOid, false, NULL, 0,
+							  NULL);
+
+	while (HeapTupleIsValid(tuple = systable_getnext(scan)))
+	{
+		Form_pg_trigger trigger = (Form_pg_trigger) GETSTRUCT(tuple);
+
+		/* Look up every trigger function only once. */
+		if (!list_member_oid(checked_foids, trigger->tgfoid))
+		{
+			checked_foids = lappend_oid(checked_foids, trigger->tgfoid);
+
+			if (is_versioning_function(trigger->tgfoid))
+				versioning_foids = lappend_oid(versioning_foids,
+											   trigger->tgfoid);
+		}
+
+		if (list_member_oid(versioning_foids, trigger->tgfoid))
+			relids = list_append_unique_oid(relids, trigger->tgrelid);
+	}
+
+	systable_endscan(scan);
+
+	relation_close(trigger_relation, AccessShareLock);
+
+	list_free(checked_foids);
+	list_free(versioning_foids);
+
+	return relids;
+}
+
+/*
+ * Fill the cached data of a versioning trigger and prepare its INSERT command
+ * into the history relation if the rows cannot be inserted directly.
+ */
+static void
+prewarm_versioning_trigger(Relation relation, Trigger *trigger)
+{
+	VersioningTriggerEntry *entry;
+	Relation			 history_relation;
+	VersioningHashEntry	*hash_entry;
+	int					 ret;
+
+	entry = lookup_versioning_trigger_entry(trigger->tgoid);
+
+	if (!entry->valid)
+		fill_versioning_trigger_entry(entry, relation, trigger);
+
+	history_relation = open_history_relation(entry, trigger->tgargs[1],
+											 AccessShareLock);
+
+	hash_entry = get_versioning_hash_entry(relation, history_relation,
+										   trigger->tgargs[0]);
+
+	if (hash_entry->natts != 0 &&
+		hash_entry->insert_history_plan == NULL
+#if PG_VERSION_NUM >= 140000
+		&& !can_insert_history_row_directly(hash_entry, history_relation)
+#endif
+		)
+	{
+		if ((ret = SPI_connect()) != SPI_OK_CONNECT)
+			elog(ERROR, "SPI_connect returned %d", ret);
+
+		prepare_history_plan(hash_entry);
+
+		if ((ret = SPI_finish()) != SPI_OK_FINISH)
+			elog(ERROR, "SPI_finish returned %d", ret);
+	}
+
+	relation_close(history_relation, NoLock);
+}
+
+/*
+ * Fill the cached data of all the versioning triggers on the relation and
+ * return the number of the warmed triggers. If the relation no longer exists
+ * or the current user is not allowed to read it, nothing is done.
+ *
+ * Every trigger is warmed in its own subtransaction. If a trigger is
+ * misconfigured, a warning is reported instead of an error, so that a single
+ * broken trigger does not fail a connection that calls this function at
+ * start.
+ */
+static int
+prewarm_versioning_triggers(Oid relid)
+{
+	Relation		 relation;
+	TriggerDesc		*trigdesc;
+	int				 entries = 0;
+	int				 i;
+
+	relation = try_relation_open(relid, AccessShareLock);
+
+	if (relation == NULL)
+		return 0;
+
+	if (pg_class_aclcheck(relid, GetUserId(), ACL_SELECT) != ACLCHECK_OK)
+	{
+		relation_close(relation, AccessShareLock);
+		return 0;
+	}
+
+	trigdesc = relation->trigdesc;
+
+	for (i = 0; trigdesc != NULL && i < trigdesc->numtriggers; ++i)
+	{
+		Trigger		   *trigger;
+		MemoryContext	oldcontext;
+		ResourceOwner	oldowner;
+
+		trigger = &trigdesc->triggers[i];
+
+		/* Triggers with a wrong number of arguments fail when fired anyway. */
+		if (trigger->tgnargs < 3 || !is_versioning_function(trigger->tgfoid))
+			continue;
+
+		oldcontext = CurrentMemoryContext;
+		oldowner = CurrentResourceOwner;
+
+		BeginInternalSubTransaction(NULL);
+		MemoryContextSwitchTo(oldcontext);
+
+		PG_TRY();
+		{
+			prewarm_versioning_trigger(relation, trigger);
+
+			ReleaseCurrentSubTransaction();
+			MemoryContextSwitchTo(oldcontext);
+			CurrentResourceOwner = oldowner;
+
+			++entries;
+		}
+		PG_CATCH();
+		{
+			ErrorData  *edata;
+
+			MemoryContextSwitchTo(oldcontext);
+			edata = CopyErrorData();
+			FlushErrorState();
+
+			RollbackAndReleaseCurrentSubTransaction();
+			MemoryContextSwitchTo(oldcontext);
+			CurrentResourceOwner = oldowner;
+
+			ereport(WARNING,
+					(errmsg("could not prewarm trigger \"%s\" on relation \"%s\": %s",
+							trigger->tgname,
+							RelationGetRelationName(relation),
+							edata->message)));
+
+			FreeErrorData(edata);
+		}
+		PG_END_TRY();
+	}
+
+	relation_close(relation, NoLock);
+
+	return entries;
+}
+
+/*
+ * Find the row-level versioning trigger on the relation. An error is thrown
+ * if there is no such trigger.
+ */
+static Trigger *
+find_versioning_trigger(Relation relation)
+{
+	TriggerDesc	   *trigdesc = relation->trigdesc;
+	int				i;
+
+#if PG_VERSION_NUM >= 120000
+	if (is_versioned_heap(relation))
+		return versioned_heap_trigger(relation);
+#endif
+
+	for (i = 0; trigdesc != NULL && i < trigdesc->numtriggers; ++i)
+	{
+		Trigger	   *trigger = &trigdesc->triggers[i];
+
+		if (trigger->tgnargs >= 3 &&
+			TRIGGER_FOR_ROW(trigger->tgtype) &&
+			is_versioning_function(trigger->tgfoid))
+			return trigger;
+	}
+
+	ereport(ERROR,
+			(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+			 errmsg("relation \"%s\" does not have a versioning trigger",
+					RelationGetRelationName(relation))));
+
+	return NULL;				/* keep compiler quiet */
+}
+
+/*
+ * Return the OID of the history relation of the versioned relation and the
+ * name of its system period attribute. The history relation is locked with
+ * AccessShareLock until the end of the transaction.
+ */
+Oid
+get_history_relation(Relation relation, char **period_attname)
+{
+	Trigger				*trigger;
+	VersioningTriggerEntry *entry;
+	Relation			 history_relation;
+	Oid					 history_relid;
+
+	trigger = find_versioning_trigger(relation);
+
+	entry = get_versioning_trigger_entry(relation, trigger);
+
+	history_relation = open_history_relation(entry, trigger->tgargs[1],
+											 AccessShareLock);
+
+	history_relid = RelationGetRelid(history_relation);
+
+	/* Close the history relation but keep the lock. */
+	relation_close(history_relation, NoLock);
+
+	*period_attname = pstrdup(trigger->tgargs[0]);
+
+	return history_relid;
+}
+
+#if PG_VERSION_NUM >= 120000
+/*
+ * Lookup for the relation of the versioned_heap access method in the hash
+ * table of resolved arguments of the implicit triggers. If not found, return
+ * a new invalid entry.
+ */
+static VersioningTriggerEntry *
+enter_versioned_heap_entry(Relation relation)
+{
+	/* The callbacks are registered along with the trigger hash table. */
+	if (!versioning_trigger_cache)
+		init_versioning_trigger_hash_table();
+
+	if (!versioned_heap_cache)
+		versioned_heap_cache = create_trigger_hash_table("Versioned Heap Hash");
+
+	return enter_trigger_entry(versioned_heap_cache,
+							   RelationGetRelid(relation));
+}
+
+/*
+ * Return the implicit versioning trigger of a relation of the versioned_heap
+ * access method. It has no OID and behaves like
+ *
+ * CREATE TRIGGER versioned_heap
+ * BEFORE INSERT OR UPDATE OR DELETE ON <relation>
+ * FOR EACH ROW EXECUTE PROCEDURE
+ *   versioning('sys_period', '<schema>.<relation>_history', true).
+ *
+ * The trigger is kept in the entry of the relation in versioned_heap_cache
+ * and built again once the entry is invalidated, e.g. when the relation or
+ * its schema is renamed.
+ */
+static Trigger *
+versioned_heap_trigger(Relation relation)
+{
+	VersioningTriggerEntry *entry;
+	MemoryContext	oldcontext;
+	Trigger		   *trigger;
+	char		   *history_relname;
+	char		   *qualified_name;
+
+	entry = enter_versioned_heap_entry(relation);
+
+	if (entry->valid && entry->trigger != NULL)
+		return entry->trigger;
+
+	if (entry->trigger != NULL)
+	{
+		free_versioned_heap_trigger(entry->trigger);
+		entry->trigger = NULL;
+	}
+
+	history_relname = psprintf("%s_history", RelationGetRelationName(relation));
+
+	/* The name is resolved the way CREATE TABLE would truncate it. */
+	truncate_identifier(history_relname, strlen(history_relname), false);
+
+	qualified_name =
+		quote_qualified_identifier(get_namespace_name(RelationGetNamespace(relation)),
+								   history_relname);
+
+	oldcontext = MemoryContextSwitchTo(versioning_cache_context);
+
+	trigger = palloc0(sizeof(Trigger));
+	trigger->tgname = "versioned_heap";
+	trigger->tgtype = TRIGGER_TYPE_ROW | TRIGGER_TYPE_BEFORE |
+		TRIGGER_TYPE_INSERT | TRIGGER_TYPE_UPDATE | TRIGGER_TYPE_DELETE;
+	trigger->tgenabled = TRIGGER_FIRES_ON_ORIGIN;
+	trigger->tgnargs = 3;
+	trigger->tgargs = palloc(3 * sizeof(char *));
+	trigger->tgargs[0] = "sys_period";
+	trigger->tgargs[1] = pstrdup(qualified_name);
+	trigger->tgargs[2] = "true";
+
+	MemoryContextSwitchTo(oldcontext);
+
+	pfree(history_relname);
+	pfree(qualified_name);
+
+	entry->trigger = trigger;
+	update_trigger_entry_space(entry);
+
+	return trigger;
+}
+
+/*
+ * Free an implicit trigger built by versioned_heap_trigger.
+ */
+static void
+free_versioned_heap_trigger(Trigger *trigger)
+{
+	pfree(trigger->tgargs[1]);
+	pfree(trigger->tgargs);
+	pfree(trigger);
+}
+
+/*
+ * Return the number of the system period attribute of a relation of the
+ * versioned_heap access method.
+ */
+int
+versioned_heap_period_attnum(Relation relation)
+{
+	return get_versioning_trigger_entry(relation,
+										versioned_heap_trigger(relation))->period_attnum;
+}
+
+/*
+ * Version a row of a relation of the versioned_heap access method the way
+ * the versioning trigger would: return the row to be inserted, which is the
+ * new row with its system period set, for INSERT and UPDATE, and archive the
+ * old row for UPDATE and DELETE. The old row of UPDATE and DELETE must be
+ * locked by the caller. The returned row is allocated in the memory context
+ * of the caller unless it is the new row.
+ */
+HeapTuple
+versioned_heap_row(Relation relation,
+				   TriggerEvent event,
+				   HeapTuple oldtuple,
+				   HeapTuple newtuple)
+{
+	TriggerData			trigdata;
+	Trigger			   *trigger;
+	char			  **args;
+	VersioningTriggerEntry *entry;
+	bool				track_timing;
+	instr_time			start_time;
+	MemoryContext		row_context;
+	MemoryContext		oldcontext;
+	HeapTuple			result;
+
+	track_timing = versioning_track_timing || log_min_duration >= 0;
+
+	if (track_timing)
+		INSTR_TIME_SET_CURRENT(start_time);
+
+	/* The row would be versioned twice. */
+	if (lookup_row_versioning_trigger(relation, &trigger) != NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("relation \"%s\" of the versioned_heap access method must not have a versioning trigger",
+						RelationGetRelationName(relation))));
+
+	trigger = versioned_heap_trigger(relation);
+	args = trigger->tgargs;
+
+	entry = get_versioning_trigger_entry(relation, trigger);
+
+	if (versioned_heap_row_context == NULL)
+		versioned_heap_row_context =
+			AllocSetContextCreate(TopMemoryContext,
+								  "Versioned Heap Row Context",
+								  ALLOCSET_DEFAULT_SIZES);
+
+	if (!versioned_heap_row_context_used)
+	{
+		row_context = versioned_heap_row_context;
+		versioned_heap_row_context_used = true;
+	}
+	else
+		row_context = AllocSetContextCreate(CurrentMemoryContext,
+											"Versioned Heap Row Context",
+											ALLOCSET_DEFAULT_SIZES);
+
+	memset(&trigdata, 0, sizeof(trigdata));
+	trigdata.type = T_TriggerData;
+	trigdata.tg_event = event | TRIGGER_EVENT_ROW | TRIGGER_EVENT_BEFORE;
+	trigdata.tg_relation = relation;
+	trigdata.tg_trigger = trigger;
+
+	if (TRIGGER_FIRED_BY_INSERT(event))
+		trigdata.tg_trigtuple = newtuple;
+	else
+	{
+		trigdata.tg_trigtuple = oldtuple;
+		trigdata.tg_newtuple = newtuple;
+	}
+
+	TEMPORAL_TABLES_TRIGGER_START(RelationGetRelid(relation),
+								  event & TRIGGER_EVENT_OPMASK);
+
+	oldcontext = MemoryContextSwitchTo(row_context);
+
+	PG_TRY();
+	{
+		Datum		datum;
+
+		if (TRIGGER_FIRED_BY_INSERT(event))
+			datum = versioning_insert(&trigdata, entry);
+		else if (TRIGGER_FIRED_BY_UPDATE(event))
+			datum = versioning_update(&trigdata, entry, args[0], args[1],
+									  args[2]);
+		else
+			datum = versioning_delete(&trigdata, entry, args[0], args[1],
+									  args[2]);
+
+		result = (HeapTuple) DatumGetPointer(datum);
+
+		MemoryContextSwitchTo(oldcontext);
+
+		/* The new row of the command belongs to the caller already. */
+		if (result != NULL && result != newtuple && result != oldtuple)
+			result = heap_copytuple(result);
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(oldcontext);
+
+		if (row_context == versioned_heap_row_context)
+		{
+			MemoryContextReset(row_context);
+			versioned_heap_row_context_used = false;
+		}
+		else
+			MemoryContextDelete(row_context);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	if (row_context == versioned_heap_row_context)
+	{
+		MemoryContextReset(row_context);
+		versioned_heap_row_context_used = false;
+	}
+	else
+		MemoryContextDelete(row_context);
+
+	TEMPORAL_TABLES_TRIGGER_DONE(RelationGetRelid(relation),
+								 event & TRIGGER_EVENT_OPMASK);
+
+	if (track_timing)
+		add_trigger_time(&trigdata, entry, start_time);
+
+	return result;
+}
+#endif
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * Return the resolved arguments of the row-level versioning trigger on the
+ * relation or NULL if there is no such trigger. Unlike
+ * find_versioning_trigger, the cached triggers are looked up first, since
+ * the decoder calls it for every change of every relation.
+ */
+static VersioningTriggerEntry *
+lookup_row_versioning_trigger(Relation relation, Trigger **trigger)
+{
+	TriggerDesc	   *trigdesc = relation->trigdesc;
+	int				i;
+
+	for (i = 0; trigdesc != NULL && i < trigdesc->numtriggers; ++i)
+	{
+		VersioningTriggerEntry *entry = NULL;
+
+		*trigger = &trigdesc->triggers[i];
+
+		if ((*trigger)->tgnargs < 3 || !TRIGGER_FOR_ROW((*trigger)->tgtype))
+			continue;
+
+		if (versioning_trigger_cache != NULL)
+			entry = (VersioningTriggerEntry *) hash_search(versioning_trigger_cache,
+														   (void *) &(*trigger)->tgoid,
+														   HASH_FIND,
+														   NULL);
+
+		if (entry == NULL || !entry->valid)
+		{
+			if (!is_versioning_function((*trigger)->tgfoid))
+				continue;
+
+			entry = lookup_versioning_trigger_entry((*trigger)->tgoid);
+
+			if (!entry->valid)
+				fill_versioning_trigger_entry(entry, relation, *trigger);
+		}
+		else
+			touch_trigger_entry(entry);
+
+		return entry;
+	}
+
+	return NULL;
 }
 
 /*
- * Insert the original row into the history table with the system period
- * attribute value "[lower, system_time)".
- *
- * If lower is greater than or equals to system_time, adjust argument
- * determines whether timestamps adjustment are made or transaction should
- * fail.
+ * Check whether the history of the relation is captured by logical decoding.
  */
-static Datum
-versioning_delete(TriggerData *trigdata,
-				  TypeCacheEntry *typcache,
-				  int period_attnum,
-				  const char *period_attname,
-				  const char *history_relation_argument,
-				  const char *adjust_argument)
+bool
+history_captured(Relation relation)
 {
-	HeapTuple	 tuple;
-	Relation	 relation;
-	RangeBound	 lower;
-	RangeBound	 upper;
-	RangeType	*range;
-	HeapTuple	 history_tuple;
+	VersioningTriggerEntry *entry;
+	Trigger				   *trigger;
 
-	tuple = trigdata->tg_trigtuple;
+	entry = lookup_row_versioning_trigger(relation, &trigger);
 
-	/* Ignore tuples modified in this transaction. */
-	if (modified_in_current_transaction(tuple))
-		return PointerGetDatum(tuple);
+	return entry != NULL && entry->capture_logical;
+}
 
-	relation = trigdata->tg_relation;
+/*
+ * Get the lower bound of the system period of a row of the relation whose
+ * history is captured. TIMESTAMP_NOBEGIN is returned for an unbounded lower
+ * bound. Unlike deserialize_system_period, false is returned instead of an
+ * error if the system period is not valid, so that a row written while the
+ * trigger did not fire does not stop the decoding.
+ */
+bool
+get_captured_lower(Relation relation, HeapTuple tuple, TimestampTz *lower)
+{
+	VersioningTriggerEntry *entry;
+	Trigger				   *trigger;
+	Datum					datum;
+	bool					isnull;
+	RangeBound				lower_bound;
+	RangeBound				upper_bound;
+	bool					empty;
 
-	deserialize_system_period(tuple, relation, period_attnum, period_attname,
-							  typcache, &lower, &upper);
+	entry = lookup_row_versioning_trigger(relation, &trigger);
 
-	/* Construct a period for the history row. */
-	upper.val = TimestampTzGetDatum(get_system_time());
-	upper.infinite = false;
-	upper.inclusive = false;
+	if (entry == NULL || !entry->capture_logical)
+		return false;
 
-	/* Adjust if needed. */
-	adjust_system_period(typcache, &lower, &upper, adjust_argument, relation);
+	datum = heap_getattr(tuple, entry->period_attnum,
+						 RelationGetDescr(relation), &isnull);
+
+	if (isnull)
+		return false;
+
+	range_deserialize(entry->typcache, DatumGetRangeTypeP(datum),
+					  &lower_bound, &upper_bound, &empty);
+
+	if (empty || !upper_bound.infinite)
+		return false;
+
+	if (lower_bound.infinite)
+		TIMESTAMP_NOBEGIN(*lower);
+	else
+		*lower = DatumGetTimestampTz(lower_bound.val);
+
+	return true;
+}
+
+/*
+ * Insert a row of the relation captured by logical decoding into its history
+ * relation with the system period "[lower, upper)". The row is archived even
+ * if the trigger no longer captures the history, but not if there is no
+ * versioning trigger any more.
+ */
+void
+archive_captured_row(Relation relation, HeapTuple tuple, TimestampTz upper)
+{
+	VersioningTriggerEntry *entry;
+	Trigger				   *trigger;
+	RangeBound				lower_bound;
+	RangeBound				upper_bound;
+	RangeType			   *range;
+
+	entry = lookup_row_versioning_trigger(relation, &trigger);
+
+	if (entry == NULL)
+	{
+		ereport(WARNING,
+				(errmsg("captured row of relation \"%s\" is not archived",
+						RelationGetRelationName(relation)),
+				 errdetail("The relation no longer has a versioning trigger.")));
+		return;
+	}
+
+	deserialize_system_period(tuple, relation, entry->period_attnum,
+							  trigger->tgargs[0], entry->typcache,
+							  &lower_bound, &upper_bound);
+
+	/*
+	 * The upper bound written by the trigger is already adjusted, but the
+	 * commit time the decoder falls back to may be not.
+	 */
+	if (!lower_bound.infinite &&
+		upper <= DatumGetTimestampTz(lower_bound.val))
+		upper = next_timestamp(DatumGetTimestampTz(lower_bound.val));
+
+	upper_bound.val = TimestampTzGetDatum(upper);
+	upper_bound.infinite = false;
+	upper_bound.inclusive = false;
 
 #if PG_VERSION_NUM >= 160000
-	range = make_range(typcache, &lower, &upper, false, NULL);
+	range = make_range(entry->typcache, &lower_bound, &upper_bound, false,
+					   NULL);
 #else
-	range = make_range(typcache, &lower, &upper, false);
+	range = make_range(entry->typcache, &lower_bound, &upper_bound, false);
 #endif
 
-	history_tuple = modify_tuple(relation, tuple, period_attnum, range);
-
-	insert_history_row(history_tuple, relation, history_relation_argument,
-					   period_attname);
-
-	return PointerGetDatum(tuple);
+	insert_history_row(tuple, RangeTypePGetDatum(range), relation, entry,
+					   trigger->tgargs[1], trigger->tgargs[0]);
 }
+#endif
 
-static void *
-hash_entry_alloc(Size size)
+/*
+ * Execute the query with the system time as its parameter and add the rows it
+ * returns to the tuplestore. The N-th attribute of the query is stored into
+ * the attnums[N] attribute of the returned row, the other attributes are
+ * nulls. The caller must be connected to SPI.
+ */
+static void
+scan_as_of(const char *query,
+		   TimestampTz system_time,
+		   int natts,
+		   int *attnums,
+		   Tuplestorestate *tupstore,
+		   TupleDesc tupdesc)
 {
-	return MemoryContextAllocZero(TopMemoryContext, size);
+	Oid			 argtypes[1] = { TIMESTAMPTZOID };
+	Datum		 args[1];
+	Portal		 portal;
+	Datum		*values;
+	bool		*nulls;
+	uint64		 row;
+	int			 i;
+
+	args[0] = TimestampTzGetDatum(system_time);
+
+	portal = SPI_cursor_open_with_args(NULL, query, 1, argtypes, args, NULL,
+									   true, 0);
+
+	values = palloc(tupdesc->natts * sizeof(Datum));
+	nulls = palloc(tupdesc->natts * sizeof(bool));
+
+	for (;;)
+	{
+		SPI_cursor_fetch(portal, true, 1000);
+
+		if (SPI_processed == 0)
+			break;
+
+		for (row = 0; row < SPI_processed; ++row)
+		{
+			HeapTuple	tuple = SPI_tuptable->vals[row];
+
+			memset(nulls, true, tupdesc->natts * sizeof(bool));
+
+			for (i = 0; i < natts; ++i)
+				values[attnums[i] - 1] = SPI_getbinval(tuple,
+													   SPI_tuptable->tupdesc,
+													   i + 1,
+													   &nulls[attnums[i] - 1]);
+
+			tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+		}
+
+		SPI_freetuptable(SPI_tuptable);
+	}
+
+	SPI_cursor_close(portal);
+
+	pfree(values);
+	pfree(nulls);
 }
 
+#if PG_VERSION_NUM >= 100000
 /*
- * Initialize the internal hash table for cached data.
+ * Add the history rows of the history relation with delta history rows that
+ * are visible at the system time to the tuplestore.
+ *
+ * The history rows are scanned by the primary key and from the newest to the
+ * oldest. A version of the row is reconstructed from the newer one: a full
+ * history row replaces the version, a delta history row replaces the
+ * attributes it has. The newest version is the current row. The first
+ * version whose system period contains the system time is returned and the
+ * older versions are skipped. The caller must be connected to SPI.
  */
 static void
-init_versioning_hash_table()
+scan_delta_as_of(Relation relation,
+				 Relation history_relation,
+				 VersioningHashEntry *hash_entry,
+				 VersioningTriggerEntry *entry,
+				 int natts,
+				 int *attnums,
+				 int *history_attnums,
+				 const char *period_attname,
+				 TimestampTz system_time,
+				 Tuplestorestate *tupstore,
+				 TupleDesc tupdesc)
 {
-	HASHCTL	ctl;
+	Oid				 argtypes[1] = { TIMESTAMPTZOID };
+	Datum			 args[1];
+	int				 nkey_attrs;
+	int				*key_indexes;
+	Oid				*key_argtypes;
+	Datum			*key_values;
+	char			*key_nulls;
+	int				 period_attnum;
+	int				 period_index;
+	TypeCacheEntry	*typcache;
+	StringInfoData	 querybuf;
+	SPIPlanPtr		 current_plan;
+	Portal			 portal;
+	MemoryContext	 group_context;
+	MemoryContext	 oldcontext;
+	Datum			*values;
+	bool			*nulls;
+	bool			 in_group;
+	bool			 group_done;
+	bool			 base_loaded;
+	int				 ret;
+	int				 i;
 
-	memset(&ctl, 0, sizeof(ctl));
-	ctl.alloc = hash_entry_alloc;
-	ctl.keysize = sizeof(Oid);
-	ctl.entrysize = sizeof(VersioningHashEntry);
-#if PG_VERSION_NUM < 90500
-	ctl.hash = oid_hash;
-#endif
+	prepare_delta_plan(hash_entry, relation, history_relation,
+					   entry->delta_attname);
 
-	versioning_cache = hash_create("Versioning Hash",
-								   128,
-								   &ctl,
-#if PG_VERSION_NUM < 90500
-								   HASH_ALLOC | HASH_ELEM | HASH_FUNCTION
-#else
-								   HASH_ALLOC | HASH_ELEM | HASH_BLOBS
-#endif
-								  );
+	/* Map the primary key and the system period to the common attributes. */
+	nkey_attrs = hash_entry->nkey_attrs;
+	key_indexes = palloc(nkey_attrs * sizeof(int));
+	key_argtypes = palloc(nkey_attrs * sizeof(Oid));
+	key_values = palloc(nkey_attrs * sizeof(Datum));
+	key_nulls = palloc(nkey_attrs * sizeof(char));
+
+	for (i = 0; i < nkey_attrs; ++i)
+	{
+		key_indexes[i] = find_common_attr(hash_entry,
+										  hash_entry->key_attnums[i]);
+		key_argtypes[i] = SPI_gettypeid(RelationGetDescr(relation),
+										hash_entry->key_attnums[i]);
+	}
+
+	period_attnum = hash_entry->period_attnum;
+	period_index = find_common_attr(hash_entry, period_attnum);
+
+	typcache = entry->typcache;
+
+	/*
+	 * The query string build is
+	 * 		SELECT <attr1>, <attr2>, ... FROM <relation>
+	 * 		WHERE <key1> = $1 AND ...
+	 */
+	initStringInfo(&querybuf);
+
+	appendStringInfoString(&querybuf, "SELECT ");
+
+	for (i = 0; i < natts; ++i)
+		appendStringInfo(&querybuf, "%s%s", i == 0 ? "" : ", ",
+						 quote_identifier(NameStr(TupleDescAttr(RelationGetDescr(relation),
+																attnums[i] - 1)->attname)));
+
+	appendStringInfo(&querybuf, " FROM %s WHERE ",
+					 quote_qualified_identifier(get_namespace_name(RelationGetNamespace(relation)),
+												RelationGetRelationName(relation)));
+
+	for (i = 0; i < nkey_attrs; ++i)
+		appendStringInfo(&querybuf, "%s%s = $%d", i == 0 ? "" : " AND ",
+						 quote_identifier(NameStr(TupleDescAttr(RelationGetDescr(relation),
+																attnums[key_indexes[i]] - 1)->attname)),
+						 i + 1);
+
+	current_plan = SPI_prepare(querybuf.data, nkey_attrs, key_argtypes);
+
+	if (current_plan == NULL)
+		elog(ERROR, "SPI_prepare returned %d for %s", SPI_result, querybuf.data);
+
+	/*
+	 * Only the versions of the rows that have a history row at the system
+	 * time are reconstructed, and only from the history rows down to the
+	 * oldest full one newer than the system time, which the newer versions
+	 * are not needed for. The query string build is
+	 * 		SELECT <attr1>, <attr2>, ..., <delta> FROM <history_relation> h
+	 * 		WHERE upper(<system_period>) > $1
+	 * 		AND (<key1>, ...) IN (SELECT <key1>, ... FROM <history_relation>
+	 * 							  WHERE <system_period> @> $1)
+	 * 		AND NOT EXISTS (SELECT FROM <history_relation> f
+	 * 						WHERE f.<key1> = h.<key1> AND ...
+	 * 						AND f.<delta> IS NULL
+	 * 						AND upper(f.<system_period>) > $1
+	 * 						AND upper(f.<system_period>) < upper(h.<system_period>))
+	 * 		ORDER BY <key1>, ..., upper(<system_period>) DESC
+	 */
+	resetStringInfo(&querybuf);
+
+	appendStringInfoString(&querybuf, "SELECT ");
+
+	for (i = 0; i < natts; ++i)
+		appendStringInfo(&querybuf, "h.%s, ",
+						 quote_identifier(NameStr(TupleDescAttr(RelationGetDescr(history_relation),
+																history_attnums[i] - 1)->attname)));
+
+	appendStringInfo(&querybuf, "h.%s FROM %s h WHERE pg_catalog.upper(h.%s) > $1 AND (",
+					 quote_identifier(entry->delta_attname),
+					 quote_qualified_identifier(get_namespace_name(RelationGetNamespace(history_relation)),
+												RelationGetRelationName(history_relation)),
+					 period_attname);
+
+	for (i = 0; i < nkey_attrs; ++i)
+		appendStringInfo(&querybuf, "%sh.%s", i == 0 ? "" : ", ",
+						 quote_identifier(NameStr(TupleDescAttr(RelationGetDescr(history_relation),
+																history_attnums[key_indexes[i]] - 1)->attname)));
+
+	appendStringInfoString(&querybuf, ") IN (SELECT ");
+
+	for (i = 0; i < nkey_attrs; ++i)
+		appendStringInfo(&querybuf, "%s%s", i == 0 ? "" : ", ",
+						 quote_identifier(NameStr(TupleDescAttr(RelationGetDescr(history_relation),
+																history_attnums[key_indexes[i]] - 1)->attname)));
+
+	appendStringInfo(&querybuf, " FROM %s WHERE %s OPERATOR(pg_catalog.@>) $1) AND NOT EXISTS (SELECT FROM %s f WHERE ",
+					 quote_qualified_identifier(get_namespace_name(RelationGetNamespace(history_relation)),
+												RelationGetRelationName(history_relation)),
+					 period_attname,
+					 quote_qualified_identifier(get_namespace_name(RelationGetNamespace(history_relation)),
+												RelationGetRelationName(history_relation)));
+
+	for (i = 0; i < nkey_attrs; ++i)
+	{
+		const char *key_attname;
+
+		key_attname = quote_identifier(NameStr(TupleDescAttr(RelationGetDescr(history_relation),
+															 history_attnums[key_indexes[i]] - 1)->attname));
+
+		appendStringInfo(&querybuf, "f.%s = h.%s AND ",
+						 key_attname, key_attname);
+	}
+
+	appendStringInfo(&querybuf,
+					 "f.%s IS NULL AND pg_catalog.upper(f.%s) > $1 "
+					 "AND pg_catalog.upper(f.%s) < pg_catalog.upper(h.%s)) ORDER BY ",
+					 quote_identifier(entry->delta_attname),
+					 period_attname, period_attname, period_attname);
+
+	for (i = 0; i < nkey_attrs; ++i)
+		appendStringInfo(&querybuf, "h.%s, ",
+						 quote_identifier(NameStr(TupleDescAttr(RelationGetDescr(history_relation),
+																history_attnums[key_indexes[i]] - 1)->attname)));
+
+	appendStringInfo(&querybuf, "pg_catalog.upper(h.%s) DESC", period_attname);
+
+	args[0] = TimestampTzGetDatum(system_time);
+
+	portal = SPI_cursor_open_with_args(NULL, querybuf.data, 1, argtypes, args,
+									   NULL, true, 0);
+
+	/* The versions of a row are reconstructed in a per-row memory context. */
+	group_context = AllocSetContextCreate(CurrentMemoryContext,
+										  "versioning_as_of row versions",
+										  ALLOCSET_DEFAULT_MINSIZE,
+										  ALLOCSET_DEFAULT_INITSIZE,
+										  ALLOCSET_DEFAULT_MAXSIZE);
+
+	values = palloc(tupdesc->natts * sizeof(Datum));
+	nulls = palloc(tupdesc->natts * sizeof(bool));
+
+	in_group = false;
+	group_done = false;
+	base_loaded = false;
+
+	for (;;)
+	{
+		SPITupleTable  *tuptable;
+		uint64			nrows;
+		uint64			row;
+
+		SPI_cursor_fetch(portal, true, 1000);
+
+		if (SPI_processed == 0)
+			break;
+
+		/* Looking up the current rows replaces SPI_tuptable. */
+		tuptable = SPI_tuptable;
+		nrows = SPI_processed;
+
+		for (row = 0; row < nrows; ++row)
+		{
+			HeapTuple	tuple = tuptable->vals[row];
+			Datum		period;
+			Datum		delta;
+			bool		isnull;
+			bool		delta_isnull;
+			bool		same_group;
+
+			/* Check whether the row has the same primary key as the previous. */
+			same_group = in_group;
+
+			for (i = 0; i < nkey_attrs; ++i)
+			{
+				Datum	value = SPI_getbinval(tuple, tuptable->tupdesc,
+											  key_indexes[i] + 1, &isnull);
+
+				if (same_group &&
+					(isnull != (key_nulls[i] == 'n') ||
+					 (!isnull &&
+					  !values_equal(TupleDescAttr(tupdesc,
+												  attnums[key_indexes[i]] - 1),
+									NULL, value, key_values[i]))))
+					same_group = false;
+			}
+
+			if (!same_group)
+			{
+				MemoryContextReset(group_context);
+
+				oldcontext = MemoryContextSwitchTo(group_context);
+
+				for (i = 0; i < nkey_attrs; ++i)
+				{
+					Form_pg_attribute	attr;
+					Datum				value;
+
+					attr = TupleDescAttr(tupdesc, attnums[key_indexes[i]] - 1);
+					value = SPI_getbinval(tuple, tuptable->tupdesc,
+										  key_indexes[i] + 1, &isnull);
+
+					key_values[i] = isnull ? (Datum) 0 :
+						datumCopy(value, attr->attbyval, attr->attlen);
+					key_nulls[i] = isnull ? 'n' : ' ';
+				}
+
+				MemoryContextSwitchTo(oldcontext);
+
+				in_group = true;
+				group_done = false;
+				base_loaded = false;
+			}
+
+			if (group_done)
+				continue;
+
+			delta = SPI_getbinval(tuple, tuptable->tupdesc, natts + 1,
+								  &delta_isnull);
+
+			oldcontext = MemoryContextSwitchTo(group_context);
+
+			if (delta_isnull)
+			{
+				/* A full history row replaces the version. */
+				memset(nulls, true, tupdesc->natts * sizeof(bool));
+
+				for (i = 0; i < natts; ++i)
+				{
+					Form_pg_attribute	attr;
+					Datum				value;
+
+					attr = TupleDescAttr(tupdesc, attnums[i] - 1);
+					value = SPI_getbinval(tuple, tuptable->tupdesc, i + 1,
+										  &nulls[attnums[i] - 1]);
+
+					if (!nulls[attnums[i] - 1])
+						values[attnums[i] - 1] = datumCopy(value, attr->attbyval,
+														   attr->attlen);
+				}
+
+				base_loaded = true;
+			}
+			else
+			{
+				/* The newest version of a delta history row is the current one. */
+				if (!base_loaded)
+				{
+					memset(nulls, true, tupdesc->natts * sizeof(bool));
+
+					MemoryContextSwitchTo(oldcontext);
+
+					if ((ret = SPI_execute_plan(current_plan, key_values,
+												key_nulls, true, 1)) != SPI_OK_SELECT)
+						elog(ERROR, "SPI_execute_plan returned %d", ret);
+
+					MemoryContextSwitchTo(group_context);
+
+					if (SPI_processed > 0)
+					{
+						for (i = 0; i < natts; ++i)
+						{
+							Form_pg_attribute	attr;
+							Datum				value;
+
+							attr = TupleDescAttr(tupdesc, attnums[i] - 1);
+							value = SPI_getbinval(SPI_tuptable->vals[0],
+												  SPI_tuptable->tupdesc, i + 1,
+												  &nulls[attnums[i] - 1]);
+
+							if (!nulls[attnums[i] - 1])
+								values[attnums[i] - 1] = datumCopy(value,
+																   attr->attbyval,
+																   attr->attlen);
+						}
+					}
+
+					SPI_freetuptable(SPI_tuptable);
+
+					base_loaded = true;
+				}
+
+				apply_delta(delta, relation, tupdesc, values, nulls);
+			}
+
+			MemoryContextSwitchTo(oldcontext);
+
+			/* The version has the primary key and the period of the row. */
+			for (i = 0; i < nkey_attrs; ++i)
+			{
+				values[attnums[key_indexes[i]] - 1] = key_values[i];
+				nulls[attnums[key_indexes[i]] - 1] = key_nulls[i] == 'n';
+			}
+
+			period = SPI_getbinval(tuple, tuptable->tupdesc, period_index + 1,
+								   &isnull);
+
+			values[period_attnum - 1] = period;
+			nulls[period_attnum - 1] = isnull;
+
+			if (!isnull &&
+				range_contains_elem_internal(typcache,
+											 DatumGetRangeTypeP(period),
+											 TimestampTzGetDatum(system_time)))
+			{
+				tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+
+				group_done = true;
+			}
+		}
+
+		SPI_freetuptable(tuptable);
+	}
+
+	SPI_cursor_close(portal);
+
+	SPI_freeplan(current_plan);
+
+	MemoryContextDelete(group_context);
+
+	pfree(values);
+	pfree(nulls);
+	pfree(key_indexes);
+	pfree(key_argtypes);
+	pfree(key_values);
+	pfree(key_nulls);
+	pfree(querybuf.data);
 }
 
 /*
- * Lookup for a versioned relation OID in the internal hash table of cached
- * data. If not found, return a new entry with all fields zeroed and
- * natts = -1.
+ * Replace the attributes of the version of a row that the delta has with
+ * their old values. The delta must not have attributes that the relation
+ * does not have: a renamed attribute would be silently lost otherwise.
  */
-static VersioningHashEntry *
-lookup_versioning_hash_entry(Oid relid,
-							 bool *found)
+static void
+apply_delta(Datum delta,
+			Relation relation,
+			TupleDesc tupdesc,
+			Datum *values,
+			bool *nulls)
 {
-	VersioningHashEntry	*entry;
+	Jsonb			   *jb = DatumGetJsonbP(delta);
+	JsonbIterator	   *it;
+	JsonbValue			v;
+	JsonbIteratorToken	r;
+	int					attnum = InvalidAttrNumber;
+	int					nestlevel;
 
-	if (!versioning_cache)
-		init_versioning_hash_table();
+	it = JsonbIteratorInit(&jb->root);
 
-	entry = (VersioningHashEntry *) hash_search(versioning_cache,
-												(void *) &relid,
-												HASH_ENTER,
-												found);
+	nestlevel = begin_delta_text_format();
 
-	if (!*found)
+	while ((r = JsonbIteratorNext(&it, &v, true)) != WJB_DONE)
 	{
-		/* Mark a newly created entry invalid. */
-		entry->natts = -1;
+		Form_pg_attribute	attr;
+		Oid					typinput;
+		Oid					typioparam;
+
+		if (r == WJB_KEY)
+		{
+			char   *attname = pnstrdup(v.val.string.val, v.val.string.len);
+
+			attnum = SPI_fnumber(tupdesc, attname);
+
+			if (attnum <= 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_UNDEFINED_COLUMN),
+						 errmsg("delta history row of relation \"%s\" has column \"%s\" that the relation does not have",
+								RelationGetRelationName(relation), attname),
+						 errdetail("The column was renamed or dropped after the row was archived."),
+						 errhint("Rename or remove the key in the delta column of the history rows.")));
+
+			pfree(attname);
+			continue;
+		}
+
+		if (r != WJB_VALUE)
+			continue;
+
+		attr = TupleDescAttr(tupdesc, attnum - 1);
+
+		if (v.type == jbvNull)
+		{
+			nulls[attnum - 1] = true;
+			continue;
+		}
+
+		if (v.type != jbvString)
+			continue;
+
+		getTypeInputInfo(attr->atttypid, &typinput, &typioparam);
+
+		values[attnum - 1] = OidInputFunctionCall(typinput,
+												  pnstrdup(v.val.string.val,
+														   v.val.string.len),
+												  typioparam,
+												  attr->atttypmod);
+		nulls[attnum - 1] = false;
 	}
 
-	return entry;
+	AtEOXact_GUC(true, nestlevel);
 }
+#endif